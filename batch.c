@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "types.h"
+
+/* One manifest line, owned by the queue until a worker takes it */
+typedef struct _BatchJob
+{
+    unsigned long line_no;
+    char line[MAX_MANIFEST_LINE];
+} BatchJob;
+
+/* Bounded job queue shared by the manifest reader and the workers */
+typedef struct _BatchQueue
+{
+    BatchJob **jobs;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    /* Report file and totals, guarded by report_lock */
+    FILE *fptr_report;
+    unsigned long done;
+    unsigned long failed;
+    pthread_mutex_t report_lock;
+} BatchQueue;
+
+/* Function Definitions */
+
+/* Current monotonic time in milliseconds */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Validate the command-line arguments for batch mode: -b manifest|- [report] [-j workers]
+Status read_and_validate_batch_args(char *argv[], char **manifest_fname, char **report_fname, int *workers)
+{
+    char *fname[2] = { NULL, DEFAULT_BATCH_REPORT };
+    int count = 0;
+
+    // Default to one worker per online core
+    *workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (*workers < 1)
+    {
+        *workers = 1;
+    }
+
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            *workers = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (*workers < 1)
+            {
+                printf("Error: -j needs a worker count of at least 1\n");
+                return e_failure;
+            }
+        }
+        else if (count < 2)
+        {
+            fname[count++] = argv[i];
+        }
+        else
+        {
+            printf("Error: unexpected argument %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+
+    if (fname[0] == NULL)
+    {
+        printf("Error: batch mode needs a manifest file (or - for stdin)\n");
+        return e_failure;
+    }
+    *manifest_fname = fname[0];
+    *report_fname = fname[1];
+    return e_success;
+}
+
+int split_job_line(char *line, const char *program, char *argv[])
+{
+    char *save = NULL;
+    int argc = 1;
+
+    argv[0] = (char *)program;
+    for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (argc == MAX_JOB_ARGS + 1)
+        {
+            return -1;
+        }
+        argv[argc++] = token;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+/*
+ * Run one manifest job
+ * The line is split into an argv array and goes through the same
+ * validation and do_encoding()/do_decoding() as a command line job.
+ */
+static Status run_job(char *line, const char **operation)
+{
+    char *argv[MAX_JOB_ARGS + 2];
+    int argc = split_job_line(line, "batch", argv);
+
+    if (argc < 0)
+    {
+        return e_failure;
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "-e") == 0)
+    {
+        EncodeInfo encInfo;
+
+        *operation = "encode";
+        if (read_and_validate_encode_args(argv, &encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        encInfo.quiet = 1;
+        encInfo.stats.mode = e_stats_off;  // The report has the job latency, workers would interleave tables
+        return do_encoding(&encInfo);
+    }
+    else if (argc >= 3 && strcmp(argv[1], "-d") == 0)
+    {
+        DecodeInfo decInfo;
+
+        *operation = "decode";
+        if (read_and_validate_decode_args(argv, &decInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        decInfo.quiet = 1;
+        decInfo.stats.mode = e_stats_off;
+        return do_decoding(&decInfo);
+    }
+
+    *operation = "invalid";
+    return e_failure;
+}
+
+/* Worker thread: take jobs until the queue is closed and drained */
+static void *batch_worker(void *arg)
+{
+    BatchQueue *queue = arg;
+
+    while (1)
+    {
+        // Step 1: Take the next job, or stop once the reader is done
+        pthread_mutex_lock(&queue->lock);
+        while (queue->count == 0 && !queue->closed)
+        {
+            pthread_cond_wait(&queue->not_empty, &queue->lock);
+        }
+        if (queue->count == 0)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        BatchJob *job = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        pthread_mutex_unlock(&queue->lock);
+
+        // Step 2: Run it, keeping the original line for the report
+        char args[MAX_MANIFEST_LINE];
+        const char *operation = "invalid";
+        strcpy(args, job->line);
+        double start = now_ms();
+        Status status = run_job(args, &operation);
+        double elapsed = now_ms() - start;
+
+        // Step 3: Report it
+        job->line[strcspn(job->line, "\r\n")] = '\0';
+        pthread_mutex_lock(&queue->report_lock);
+        fprintf(queue->fptr_report, "%lu\t%s\t%s\t%.3f\t%s\n", job->line_no, operation,
+                (status == e_success) ? "ok" : "FAILED", elapsed, job->line);
+        queue->done++;
+        if (status == e_failure)
+        {
+            queue->failed++;
+        }
+        pthread_mutex_unlock(&queue->report_lock);
+
+        free(job);
+    }
+    return NULL;
+}
+
+/* Queue one job, waiting while the queue is full */
+static void queue_job(BatchQueue *queue, BatchJob *job)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = job;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* Run every job in the manifest on a pool of workers and write the report */
+Status do_batch(const char *manifest_fname, const char *report_fname, int workers)
+{
+    BatchQueue queue;
+    pthread_t *threads;
+    FILE *fptr_manifest;
+    char line[MAX_MANIFEST_LINE];
+    unsigned long line_no = 0;
+    int started = 0;
+
+    // Step 1: Open the manifest (or stdin) and the report
+    fptr_manifest = (strcmp(manifest_fname, "-") == 0) ? stdin : fopen(manifest_fname, "r");
+    if (fptr_manifest == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", manifest_fname);
+        return e_failure;
+    }
+    queue.fptr_report = fopen(report_fname, "w");
+    if (queue.fptr_report == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", report_fname);
+        if (fptr_manifest != stdin)
+        {
+            fclose(fptr_manifest);
+        }
+        return e_failure;
+    }
+    fprintf(queue.fptr_report, "# line\toperation\tstatus\tms\tjob\n");
+
+    // Step 2: Set up the bounded queue and start the workers
+    queue.capacity = workers * BATCH_QUEUE_PER_WORKER;
+    queue.jobs = malloc(queue.capacity * sizeof(BatchJob *));
+    threads = malloc(workers * sizeof(pthread_t));
+    queue.head = queue.count = queue.closed = 0;
+    queue.done = queue.failed = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_mutex_init(&queue.report_lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+
+    double start = now_ms();
+    if (queue.jobs != NULL && threads != NULL)
+    {
+        for (; started < workers; started++)
+        {
+            if (pthread_create(&threads[started], NULL, batch_worker, &queue) != 0)
+            {
+                break;
+            }
+        }
+    }
+
+    if (started == 0)
+    {
+        printf("ERROR : Unable to start any batch worker\n");
+    }
+
+    // Step 3: Feed the manifest to the workers, the queue bound keeps the reader just ahead of them
+    while (started > 0 && fgets(line, sizeof(line), fptr_manifest) != NULL)
+    {
+        line_no++;
+
+        // A line that does not fit is one failed job, not two cut in half
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(fptr_manifest))
+        {
+            int c;
+            while ((c = fgetc(fptr_manifest)) != EOF && c != '\n')
+            {
+            }
+            printf("ERROR : Manifest line %lu is longer than %d bytes, skipped\n", line_no, MAX_MANIFEST_LINE - 2);
+            pthread_mutex_lock(&queue.report_lock);
+            fprintf(queue.fptr_report, "%lu\tinvalid\tFAILED\t0.000\t(line longer than %d bytes)\n", line_no, MAX_MANIFEST_LINE - 2);
+            queue.done++;
+            queue.failed++;
+            pthread_mutex_unlock(&queue.report_lock);
+            continue;
+        }
+        char *first = line + strspn(line, " \t");
+        if (*first == '#' || *first == '\n' || *first == '\r' || *first == '\0')
+        {
+            continue;
+        }
+
+        BatchJob *job = malloc(sizeof(BatchJob));
+        if (job == NULL)
+        {
+            break;
+        }
+        job->line_no = line_no;
+        strcpy(job->line, first);
+        queue_job(&queue, job);
+    }
+
+    // Step 4: Let the workers drain the queue and stop
+    pthread_mutex_lock(&queue.lock);
+    queue.closed = 1;
+    pthread_cond_broadcast(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now_ms() - start;
+
+    printf("Batch: %lu jobs, %lu failed, %d workers, %.3f s, %.1f jobs/s\n", queue.done, queue.failed, started,
+           elapsed / 1e3, (elapsed > 0) ? queue.done / (elapsed / 1e3) : 0.0);
+
+    pthread_mutex_destroy(&queue.lock);
+    pthread_mutex_destroy(&queue.report_lock);
+    pthread_cond_destroy(&queue.not_empty);
+    pthread_cond_destroy(&queue.not_full);
+    free(queue.jobs);
+    free(threads);
+    fclose(queue.fptr_report);
+    if (fptr_manifest != stdin)
+    {
+        fclose(fptr_manifest);
+    }
+
+    return (started > 0 && queue.failed == 0) ? e_success : e_failure;
+}
@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include "types.h" // Contains user defined types
+
+/*
+ * Batch mode
+ * A manifest holds one job per line, written exactly like the command line
+ * arguments after the program name:
+ *     -e carrier.bmp secret.txt [stego.bmp] [-k depth]
+ *     -d stego.bmp [output.txt]
+ * Blank lines and lines starting with '#' are skipped. Jobs run on a fixed
+ * pool of worker threads, one EncodeInfo/DecodeInfo per job, and a failing
+ * job is only reported, never stops the batch.
+ */
+
+#define MAX_MANIFEST_LINE 4096
+#define MAX_JOB_ARGS 16
+
+/* Jobs read ahead of the workers, per worker, bounds memory and open files */
+#define BATCH_QUEUE_PER_WORKER 2
+
+#define DEFAULT_BATCH_REPORT "batch_report.txt"
+
+/* Split a job line in place into argv (argv[0] = program, NULL terminated, room for MAX_JOB_ARGS + 2),
+ * returns argc or -1 for too many arguments */
+int split_job_line(char *line, const char *program, char *argv[]);
+
+/* Read and validate batch args from argv */
+Status read_and_validate_batch_args(char *argv[], char **manifest_fname, char **report_fname, int *workers);
+
+/* Run every job in the manifest and write the status/latency report */
+Status do_batch(const char *manifest_fname, const char *report_fname, int workers);
+
+#endif
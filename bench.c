@@ -0,0 +1,1199 @@
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "encode.h"
+#include "decode.h"
+#include "daemon.h"
+#include "batch.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "chacha20.h"
+#include "steg.h"
+#include "common.h"
+#include "types.h"
+
+/* Carrier resolutions, widths are multiples of 4 so rows carry no padding */
+typedef struct _BenchResolution
+{
+    const char *name;
+    uint width;
+    uint height;
+} BenchResolution;
+
+static const BenchResolution bench_resolutions[] =
+{
+    { "64x64", 64, 64 },
+    { "640x480", 640, 480 },
+    { "1920x1080", 1920, 1080 },
+    { "3840x2160", 3840, 2160 },
+};
+
+static const long bench_secret_sizes[] = { 16, 4 * 1024, 256 * 1024, 4 * 1024 * 1024, BENCH_FULL_CAPACITY };
+
+static const uint bench_depths[] = { 1, 4 };
+
+/* --daemon: carrier and secret of the per-request latency runs, small enough that fixed costs dominate */
+#define BENCH_DAEMON_WIDTH 64
+#define BENCH_DAEMON_HEIGHT 64
+#define BENCH_DAEMON_SECRET 16
+
+/* How long the benchmark waits for its daemon to listen, in 1 ms tries */
+#define BENCH_DAEMON_START_TRIES 5000
+
+/*
+ * Constant memory check: a near capacity secret in a large carrier (384 MiB
+ * of pixels, a 48 MiB secret) has to encode and decode within a fixed peak
+ * RSS, whatever the sizes, since both stream the secret and the carrier in
+ * fixed blocks. Holding either one whole goes over the ceiling many times.
+ */
+#define BENCH_RSS_WIDTH 16384
+#define BENCH_RSS_HEIGHT 8192
+#define BENCH_RSS_CEILING_KIB (32 * 1024)
+
+/* In-memory kernel check and timing: data bytes per run */
+#define BENCH_KERNEL_BYTES (1024 * 1024)
+
+/* Samples of one stage over all timed repetitions, in nanoseconds */
+typedef struct _BenchStat
+{
+    double median;
+    double p99;
+} BenchStat;
+
+/* Function Definitions */
+
+/* Nanoseconds since *mark, moving *mark to now */
+static double lap_ns(struct timespec *mark)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double ns = (now.tv_sec - mark->tv_sec) * 1e9 + (now.tv_nsec - mark->tv_nsec);
+    *mark = now;
+    return ns;
+}
+
+/* Read plus write family syscalls made by the whole process so far, from /proc/self/io */
+static unsigned long long io_syscalls(void)
+{
+    FILE *fptr = fopen("/proc/self/io", "r");
+    unsigned long long value, total = 0;
+    char key[32];
+
+    if (fptr == NULL)
+    {
+        return 0;
+    }
+    while (fscanf(fptr, "%31[^:]: %llu\n", key, &value) == 2)
+    {
+        if (strcmp(key, "syscr") == 0 || strcmp(key, "syscw") == 0)
+        {
+            total += value;
+        }
+    }
+    fclose(fptr);
+    return total;
+}
+
+/* Reset the peak RSS high-water mark, so the next peak_rss_kib() covers one run */
+static void reset_peak_rss(void)
+{
+    FILE *fptr = fopen("/proc/self/clear_refs", "w");
+
+    if (fptr != NULL)
+    {
+        fputs("5", fptr);
+        fclose(fptr);
+    }
+}
+
+/* Peak RSS (VmHWM) in KiB */
+static long peak_rss_kib(void)
+{
+    FILE *fptr = fopen("/proc/self/status", "r");
+    char line[256];
+    long kib = 0;
+
+    if (fptr == NULL)
+    {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fptr) != NULL)
+    {
+        if (sscanf(line, "VmHWM: %ld kB", &kib) == 1)
+        {
+            break;
+        }
+    }
+    fclose(fptr);
+    return kib;
+}
+
+/* Deterministic filler for carriers and secrets (xorshift64) */
+static void fill_random(uchar *buffer, size_t count, unsigned long long *state)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+        buffer[i] = *state >> 56;
+    }
+}
+
+/* Store a little endian field into a BMP header */
+static void put_le(uchar *header, int offset, uint value, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        header[offset + i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+/* Write a 24 bit bottom-up BMP with a BITMAPINFOHEADER and random pixels */
+static Status write_carrier(const char *fname, uint width, uint height)
+{
+    uchar header[BMP_HEADER_SIZE] = { 'B', 'M' };
+    uint image_size = width * height * 3;
+    unsigned long long state = 0x9E3779B97F4A7C15ULL ^ width ^ ((unsigned long long)height << 32);
+    uchar *pixels = malloc(IMAGE_BLOCK_SIZE);
+    FILE *fptr = fopen(fname, "w");
+    Status ret = (pixels != NULL && fptr != NULL) ? e_success : e_failure;
+
+    put_le(header, 2, BMP_HEADER_SIZE + image_size, 4);  // File size
+    put_le(header, 10, BMP_HEADER_SIZE, 4);              // Pixel data offset
+    put_le(header, 14, 40, 4);                           // Info header size
+    put_le(header, 18, width, 4);
+    put_le(header, 22, height, 4);
+    put_le(header, 26, 1, 2);                            // Planes
+    put_le(header, 28, 24, 2);                           // Bits per pixel
+    put_le(header, 34, image_size, 4);
+
+    if (ret == e_success && fwrite(header, 1, BMP_HEADER_SIZE, fptr) != BMP_HEADER_SIZE)
+    {
+        ret = e_failure;
+    }
+    for (uint done = 0; ret == e_success && done < image_size; done += IMAGE_BLOCK_SIZE)
+    {
+        uint count = (image_size - done < IMAGE_BLOCK_SIZE) ? image_size - done : IMAGE_BLOCK_SIZE;
+        fill_random(pixels, count, &state);
+        if (fwrite(pixels, 1, count, fptr) != count)
+        {
+            ret = e_failure;
+        }
+    }
+
+    if (fptr != NULL && fclose(fptr) != 0)
+    {
+        ret = e_failure;
+    }
+    free(pixels);
+    return ret;
+}
+
+/* Write a secret of size random bytes */
+static Status write_secret(const char *fname, long size)
+{
+    unsigned long long state = 0x2545F4914F6CDD1DULL ^ size;
+    uchar *data = malloc(SECRET_CHUNK_SIZE);
+    FILE *fptr = fopen(fname, "w");
+    Status ret = (data != NULL && fptr != NULL) ? e_success : e_failure;
+
+    for (long done = 0; ret == e_success && done < size; done += SECRET_CHUNK_SIZE)
+    {
+        long count = (size - done < SECRET_CHUNK_SIZE) ? size - done : SECRET_CHUNK_SIZE;
+        fill_random(data, count, &state);
+        if (fwrite(data, 1, count, fptr) != (size_t)count)
+        {
+            ret = e_failure;
+        }
+    }
+
+    if (fptr != NULL && fclose(fptr) != 0)
+    {
+        ret = e_failure;
+    }
+    free(data);
+    return ret;
+}
+
+/* Compare two files byte for byte */
+static Status files_equal(const char *fname_a, const char *fname_b)
+{
+    FILE *fptr_a = fopen(fname_a, "r");
+    FILE *fptr_b = fopen(fname_b, "r");
+    Status ret = (fptr_a != NULL && fptr_b != NULL) ? e_success : e_failure;
+    char buf_a[4096], buf_b[4096];
+
+    while (ret == e_success)
+    {
+        size_t len_a = fread(buf_a, 1, sizeof(buf_a), fptr_a);
+        size_t len_b = fread(buf_b, 1, sizeof(buf_b), fptr_b);
+        if (len_a != len_b || memcmp(buf_a, buf_b, len_a) != 0)
+        {
+            ret = e_failure;
+        }
+        if (len_a == 0)
+        {
+            break;
+        }
+    }
+
+    if (fptr_a != NULL)
+    {
+        fclose(fptr_a);
+    }
+    if (fptr_b != NULL)
+    {
+        fclose(fptr_b);
+    }
+    return ret;
+}
+
+/*
+ * Largest secret check_capacity() accepts at depth and with flags, with the ".txt" extension
+ * Bench carriers are 24 bpp with unpadded rows, every pixel byte is a channel byte.
+ */
+static long full_capacity(uint width, uint height, uint depth, uint flags)
+{
+    unsigned long long image_bytes = (unsigned long long)width * height * 3;
+    StegHeader header;
+
+    header.depth = depth;
+    header.flags = flags;
+    strcpy(header.extension, ".txt");
+    header.payload_size = 0;
+    if (steg_encoded_size(&header) > image_bytes)
+    {
+        return 0;
+    }
+
+    // Start from the exact bit count and step down over the last partial group
+    unsigned long long size = (image_bytes - steg_encoded_size(&header)) * depth / 8;
+    for (header.payload_size = size; steg_encoded_size(&header) > image_bytes; header.payload_size--)
+    {
+    }
+    return header.payload_size;
+}
+
+/* Median and p99 (nearest rank) of count samples, sorts them in place */
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static BenchStat bench_stat(double *samples, int count)
+{
+    BenchStat stat;
+
+    qsort(samples, count, sizeof(double), compare_double);
+    stat.median = (count % 2) ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    stat.p99 = samples[(99 * count + 99) / 100 - 1];
+    return stat;
+}
+
+/*
+ * Time one operation over warmup + reps runs of do_encoding() / do_decoding()
+ * The per-stage times come from the job's own telemetry. samples is laid out
+ * [stage][rep] for every stage plus a last row with the total of the run.
+ * syscalls is the median per run, rss_kib the largest peak RSS seen over the
+ * timed runs.
+ */
+static Status bench_runs(const BenchOptions *opts, EncodeInfo *encInfo, DecodeInfo *decInfo, double *samples,
+                         StegStats *layout, unsigned long long *syscalls, long *rss_kib)
+{
+    unsigned long long *calls = malloc(opts->reps * sizeof(unsigned long long));
+    unsigned long long overhead = io_syscalls();
+
+    // Reading /proc/self/io is a couple of read() calls itself, measure that once and take it off
+    overhead = io_syscalls() - overhead;
+    *rss_kib = 0;
+    if (calls == NULL)
+    {
+        return e_failure;
+    }
+
+    for (int rep = -opts->warmup; rep < opts->reps; rep++)
+    {
+        reset_peak_rss();
+        unsigned long long before = io_syscalls();
+        Status ret = (encInfo != NULL) ? do_encoding(encInfo) : do_decoding(decInfo);
+        unsigned long long after = io_syscalls();
+        const StegStats *stats = (encInfo != NULL) ? &encInfo->stats : &decInfo->stats;
+
+        if (ret == e_failure)
+        {
+            free(calls);
+            return e_failure;
+        }
+        if (rep < 0)
+        {
+            continue;  // Warmup run, only settles the page cache and allocator
+        }
+
+        for (uint i = 0; i < stats->count; i++)
+        {
+            samples[i * opts->reps + rep] = stats->stage[i].ms * 1e6;
+        }
+        samples[stats->count * opts->reps + rep] = stats_total_ms(stats) * 1e6;
+        *layout = *stats;
+        calls[rep] = after - before - overhead;
+        long rss = peak_rss_kib();
+        *rss_kib = (rss > *rss_kib) ? rss : *rss_kib;
+    }
+
+    // Syscall counts barely move between runs, the median drops the odd page cache hiccup
+    for (int i = 1; i < opts->reps; i++)
+    {
+        unsigned long long value = calls[i];
+        int j = i;
+        for (; j > 0 && calls[j - 1] > value; j--)
+        {
+            calls[j] = calls[j - 1];
+        }
+        calls[j] = value;
+    }
+    *syscalls = calls[opts->reps / 2];
+    free(calls);
+    return e_success;
+}
+
+/* Print one operation to stdout and the report, stage names come from layout */
+static void report_operation(FILE *fptr_report, const char *operation, const StegStats *layout,
+                             double *samples, int reps, long payload, unsigned long long syscalls, long rss_kib)
+{
+    BenchStat stat[MAX_STATS_STAGES + 1];
+    uint stages = layout->count;
+
+    for (uint i = 0; i <= stages; i++)
+    {
+        stat[i] = bench_stat(samples + i * reps, reps);
+    }
+    BenchStat total = stat[stages];
+    BenchStat data = total;
+    for (uint i = 0; i < stages; i++)
+    {
+        if (strcmp(layout->stage[i].name, "payload") == 0)
+        {
+            data = stat[i];
+        }
+    }
+
+    printf("  %-6s total %9.3f ms (p99 %9.3f)  %8.1f MB/s  %7.2f ns/B  payload %8.1f MB/s  syscalls %6llu  rss %7ld KiB\n",
+           operation, total.median / 1e6, total.p99 / 1e6, payload / (total.median / 1e3),
+           total.median / payload, payload / (data.median / 1e3), syscalls, rss_kib);
+    printf("        ");
+    for (uint i = 0; i < stages; i++)
+    {
+        printf(" %s %.1f", layout->stage[i].name, stat[i].median / 1e3);
+    }
+    printf(" (us)\n");
+
+    fprintf(fptr_report, "      \"%s\": {\n", operation);
+    fprintf(fptr_report, "        \"total_ms\": { \"median\": %.6f, \"p99\": %.6f },\n", total.median / 1e6, total.p99 / 1e6);
+    fprintf(fptr_report, "        \"mb_per_s\": %.3f,\n", payload / (total.median / 1e3));
+    fprintf(fptr_report, "        \"ns_per_byte\": %.4f,\n", total.median / payload);
+    fprintf(fptr_report, "        \"payload_mb_per_s\": %.3f,\n", payload / (data.median / 1e3));
+    fprintf(fptr_report, "        \"io_syscalls\": %llu,\n", syscalls);
+    fprintf(fptr_report, "        \"peak_rss_kib\": %ld,\n", rss_kib);
+    fprintf(fptr_report, "        \"stages_ms\": {");
+    for (uint i = 0; i < stages; i++)
+    {
+        fprintf(fptr_report, "%s \"%s\": { \"median\": %.6f, \"p99\": %.6f }", i ? "," : "", layout->stage[i].name,
+                stat[i].median / 1e6, stat[i].p99 / 1e6);
+    }
+    fprintf(fptr_report, " }\n      }");
+}
+
+/*
+ * Check every kernel against the scalar reference and time it in memory
+ * A mismatch fails the benchmark, a fast wrong kernel is worse than a slow one.
+ */
+static Status bench_kernels(const BenchOptions *opts, FILE *fptr_report)
+{
+    uint count;
+    const LsbKernel *list = lsb_kernel_list(&count);
+    unsigned long long state = 0x853C49E6748FEA9BULL;
+    uchar *data = malloc(BENCH_KERNEL_BYTES);
+    uchar *carrier = malloc(BENCH_KERNEL_BYTES * 8);
+    uchar *reference = malloc(BENCH_KERNEL_BYTES * 8);
+    uchar *image = malloc(BENCH_KERNEL_BYTES * 8);
+    uchar *extracted = malloc(BENCH_KERNEL_BYTES);
+    double *samples = malloc(opts->reps * sizeof(double));
+    Status ret = e_success;
+
+    if (data == NULL || carrier == NULL || reference == NULL || image == NULL || extracted == NULL || samples == NULL)
+    {
+        ret = e_failure;
+        count = 0;
+    }
+    else
+    {
+        fill_random(data, BENCH_KERNEL_BYTES, &state);
+        fill_random(carrier, BENCH_KERNEL_BYTES * 8, &state);
+        memcpy(reference, carrier, BENCH_KERNEL_BYTES * 8);
+        lsb_embed_scalar(data, BENCH_KERNEL_BYTES, reference);
+    }
+
+    printf("Kernels (%d KiB in memory, selected %s):\n", BENCH_KERNEL_BYTES / 1024, lsb_kernel.name);
+    fprintf(fptr_report, "  \"kernels\": [");
+    for (uint k = 0; k < count; k++)
+    {
+        struct timespec mark;
+        BenchStat embed, extract;
+
+        // Step 1: Same output as the scalar reference, both ways
+        memcpy(image, carrier, BENCH_KERNEL_BYTES * 8);
+        list[k].embed(data, BENCH_KERNEL_BYTES, image);
+        list[k].extract(reference, BENCH_KERNEL_BYTES, extracted);
+        int matches = memcmp(image, reference, BENCH_KERNEL_BYTES * 8) == 0 && memcmp(extracted, data, BENCH_KERNEL_BYTES) == 0;
+        if (!matches)
+        {
+            ret = e_failure;
+        }
+
+        // Step 2: Time embed and extract separately
+        for (int rep = -opts->warmup; rep < opts->reps; rep++)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &mark);
+            list[k].embed(data, BENCH_KERNEL_BYTES, image);
+            double ns = lap_ns(&mark);
+            if (rep >= 0)
+            {
+                samples[rep] = ns;
+            }
+        }
+        embed = bench_stat(samples, opts->reps);
+        for (int rep = -opts->warmup; rep < opts->reps; rep++)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &mark);
+            list[k].extract(image, BENCH_KERNEL_BYTES, extracted);
+            double ns = lap_ns(&mark);
+            if (rep >= 0)
+            {
+                samples[rep] = ns;
+            }
+        }
+        extract = bench_stat(samples, opts->reps);
+
+        printf("  %-6s embed %8.1f MB/s  extract %8.1f MB/s  %s\n", list[k].name,
+               BENCH_KERNEL_BYTES / (embed.median / 1e3), BENCH_KERNEL_BYTES / (extract.median / 1e3),
+               matches ? "matches scalar" : "MISMATCH");
+        fprintf(fptr_report, "%s\n    { \"name\": \"%s\", \"embed_mb_per_s\": %.3f, \"extract_mb_per_s\": %.3f, \"matches_scalar\": %s }",
+                k ? "," : "", list[k].name, BENCH_KERNEL_BYTES / (embed.median / 1e3),
+                BENCH_KERNEL_BYTES / (extract.median / 1e3), matches ? "true" : "false");
+    }
+    fprintf(fptr_report, "\n  ],\n");
+
+    free(data);
+    free(carrier);
+    free(reference);
+    free(image);
+    free(extracted);
+    free(samples);
+    return ret;
+}
+
+/* Check the CRC32C implementation in use against the table one and time both in memory */
+static Status bench_crc32c(const BenchOptions *opts, FILE *fptr_report)
+{
+    uint (*const update[2])(uint, const uchar *, size_t) = { crc32c_update_table, crc32c_update };
+    const char *name[2] = { "table", crc32c_kernel_name() };
+    unsigned long long state = 0x2545F4914F6CDD1DULL;
+    uchar *data = malloc(BENCH_KERNEL_BYTES);
+    double *samples = malloc(opts->reps * sizeof(double));
+    Status ret = e_success;
+    uint reference = 0;
+
+    if (data == NULL || samples == NULL)
+    {
+        free(data);
+        free(samples);
+        return e_failure;
+    }
+    fill_random(data, BENCH_KERNEL_BYTES, &state);
+
+    printf("CRC32C (%d KiB in memory, selected %s):\n", BENCH_KERNEL_BYTES / 1024, name[1]);
+    fprintf(fptr_report, "  \"crc32c\": [");
+    for (int k = 0; k < 2; k++)
+    {
+        struct timespec mark;
+        uint crc = update[k](0, data, BENCH_KERNEL_BYTES);
+
+        // Same value as the table, also when split at an odd length
+        reference = (k == 0) ? crc : reference;
+        int matches = crc == reference && update[k](update[k](0, data, 1001), data + 1001, BENCH_KERNEL_BYTES - 1001) == reference;
+        if (!matches)
+        {
+            ret = e_failure;
+        }
+
+        for (int rep = -opts->warmup; rep < opts->reps; rep++)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &mark);
+            crc = update[k](crc, data, BENCH_KERNEL_BYTES);
+            double ns = lap_ns(&mark);
+            if (rep >= 0)
+            {
+                samples[rep] = ns;
+            }
+        }
+        BenchStat stat = bench_stat(samples, opts->reps);
+
+        printf("  %-6s %8.1f MB/s  %s\n", name[k], BENCH_KERNEL_BYTES / (stat.median / 1e3), matches ? "matches table" : "MISMATCH");
+        fprintf(fptr_report, "%s\n    { \"name\": \"%s\", \"mb_per_s\": %.3f, \"matches_table\": %s }",
+                k ? "," : "", name[k], BENCH_KERNEL_BYTES / (stat.median / 1e3), matches ? "true" : "false");
+    }
+    fprintf(fptr_report, "\n  ],\n");
+
+    free(data);
+    free(samples);
+    return ret;
+}
+
+/* Check the vector ChaCha20 kernel against the one block reference and time both in memory */
+static Status bench_chacha20(const BenchOptions *opts, FILE *fptr_report)
+{
+    void (*const xor[2])(const ChaCha20 *, unsigned long long, uchar *, size_t) = { chacha20_xor_scalar, chacha20_xor };
+    const char *name[2] = { "scalar", chacha20_kernel_name() };
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    uchar key[CHACHA20_KEY_SIZE], nonce[CHACHA20_NONCE_SIZE];
+    uchar *data = malloc(BENCH_KERNEL_BYTES);
+    uchar *reference = malloc(BENCH_KERNEL_BYTES);
+    double *samples = malloc(opts->reps * sizeof(double));
+    Status ret = e_success;
+    ChaCha20 cipher;
+
+    if (data == NULL || reference == NULL || samples == NULL)
+    {
+        free(data);
+        free(reference);
+        free(samples);
+        return e_failure;
+    }
+    fill_random(key, sizeof(key), &state);
+    fill_random(nonce, sizeof(nonce), &state);
+    unsigned long long plaintext = state;
+    fill_random(reference, BENCH_KERNEL_BYTES, &state);
+    chacha20_init(&cipher, key, nonce);
+    chacha20_xor_scalar(&cipher, 0, reference, BENCH_KERNEL_BYTES);
+
+    printf("ChaCha20 (%d KiB in memory, selected %s):\n", BENCH_KERNEL_BYTES / 1024, name[1]);
+    fprintf(fptr_report, "  \"chacha20\": [");
+    for (int k = 0; k < 2; k++)
+    {
+        struct timespec mark;
+
+        // Same ciphertext as the reference, also when started inside a block
+        state = plaintext;
+        fill_random(data, BENCH_KERNEL_BYTES, &state);
+        xor[k](&cipher, 0, data, 1001);
+        xor[k](&cipher, 1001, data + 1001, BENCH_KERNEL_BYTES - 1001);
+        int matches = memcmp(data, reference, BENCH_KERNEL_BYTES) == 0;
+        if (!matches)
+        {
+            ret = e_failure;
+        }
+
+        for (int rep = -opts->warmup; rep < opts->reps; rep++)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &mark);
+            xor[k](&cipher, 0, data, BENCH_KERNEL_BYTES);
+            double ns = lap_ns(&mark);
+            if (rep >= 0)
+            {
+                samples[rep] = ns;
+            }
+        }
+        BenchStat stat = bench_stat(samples, opts->reps);
+
+        printf("  %-6s %8.1f MB/s  %s\n", name[k], BENCH_KERNEL_BYTES / (stat.median / 1e3), matches ? "matches scalar" : "MISMATCH");
+        fprintf(fptr_report, "%s\n    { \"name\": \"%s\", \"mb_per_s\": %.3f, \"matches_scalar\": %s }",
+                k ? "," : "", name[k], BENCH_KERNEL_BYTES / (stat.median / 1e3), matches ? "true" : "false");
+    }
+    fprintf(fptr_report, "\n  ],\n");
+
+    free(data);
+    free(reference);
+    free(samples);
+    return ret;
+}
+
+/* Run the CLI as a child the way a shell does, stdout to /dev/null, and wait for it */
+static Status run_cli(char *const argv[])
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd != -1)
+        {
+            dup2(fd, STDOUT_FILENO);
+        }
+        execv("/proc/self/exe", argv);
+        _exit(127);
+    }
+    if (pid == -1 || waitpid(pid, &status, 0) != pid)
+    {
+        return e_failure;
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? e_success : e_failure;
+}
+
+/*
+ * Per-request latency of a tiny encode and decode, fork-exec of the CLI
+ * against the daemon (--serve): once with a connection per request and once
+ * over one kept connection. The daemon is this binary started with one
+ * worker on a socket in the scratch directory. Client side wall time per
+ * request, so process startup, argument parsing and file opens all count.
+ */
+static Status bench_daemon(const BenchOptions *opts, const char *dir, FILE *fptr_report)
+{
+    const char *path_name[3] = { "fork_exec", "daemon_connect", "daemon_kept" };
+    const char *operation[2] = { "encode", "decode" };
+    char socket_fname[4200], carrier[4200], secret[4200], stego[4200], decoded[4200], line[2][MAX_MANIFEST_LINE];
+    double *samples = malloc(opts->reps * sizeof(double));
+    BenchStat stat[3][2];
+    Status ret = e_success;
+    DaemonReply reply;
+    int status, kept = -1;
+
+    snprintf(socket_fname, sizeof(socket_fname), "%s/daemon.sock", dir);
+    snprintf(carrier, sizeof(carrier), "%s/daemon_carrier.bmp", dir);
+    snprintf(secret, sizeof(secret), "%s/daemon_secret.txt", dir);
+    snprintf(stego, sizeof(stego), "%s/daemon_stego.bmp", dir);
+    snprintf(decoded, sizeof(decoded), "%s/daemon_decoded.txt", dir);
+    int too_long = snprintf(line[0], sizeof(line[0]), "-e %s %s %s -q", carrier, secret, stego) >= MAX_MANIFEST_LINE;
+    too_long |= snprintf(line[1], sizeof(line[1]), "-d %s %s -q", stego, decoded) >= MAX_MANIFEST_LINE;
+    char *cli[2][7] = { { "lsb_steg", "-e", carrier, secret, stego, "-q", NULL },
+                        { "lsb_steg", "-d", stego, decoded, "-q", NULL } };
+    char *serve[] = { "lsb_steg", "--serve", socket_fname, "-j", "1", NULL };
+
+    if (too_long || samples == NULL || write_carrier(carrier, BENCH_DAEMON_WIDTH, BENCH_DAEMON_HEIGHT) == e_failure ||
+        write_secret(secret, BENCH_DAEMON_SECRET) == e_failure)
+    {
+        free(samples);
+        return e_failure;
+    }
+
+    // Step 1: Start the daemon and wait until it listens
+    pid_t daemon = fork();
+    if (daemon == 0)
+    {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd != -1)
+        {
+            dup2(fd, STDOUT_FILENO);
+        }
+        execv("/proc/self/exe", serve);
+        _exit(127);
+    }
+    for (int tries = 0; daemon > 0 && kept == -1 && tries < BENCH_DAEMON_START_TRIES; tries++)
+    {
+        struct timespec pause = { 0, 1000000 };
+        if ((kept = daemon_connect(socket_fname)) == -1)
+        {
+            nanosleep(&pause, NULL);
+        }
+    }
+    if (kept == -1)
+    {
+        printf("ERROR : The daemon did not start on %s\n", socket_fname);
+        ret = e_failure;
+    }
+
+    // Step 2: Every operation on every path, encodes first so the decodes have a stego image
+    for (int op = 0; op < 2 && ret == e_success; op++)
+    {
+        for (int path = 0; path < 3 && ret == e_success; path++)
+        {
+            for (int rep = -opts->warmup; rep < opts->reps && ret == e_success; rep++)
+            {
+                struct timespec mark;
+
+                clock_gettime(CLOCK_MONOTONIC, &mark);
+                if (path == 0)
+                {
+                    ret = run_cli(cli[op]);
+                }
+                else
+                {
+                    int fd = (path == 1) ? daemon_connect(socket_fname) : kept;
+                    ret = (fd != -1 && daemon_request(fd, line[op], NULL, 0, &reply, NULL) == e_success) ? reply.status : e_failure;
+                    if (path == 1 && fd != -1)
+                    {
+                        close(fd);
+                    }
+                }
+                double ns = lap_ns(&mark);
+                if (rep >= 0)
+                {
+                    samples[rep] = ns;
+                }
+            }
+            if (ret == e_success)
+            {
+                stat[path][op] = bench_stat(samples, opts->reps);
+            }
+        }
+    }
+    if (ret == e_success && files_equal(secret, decoded) == e_failure)
+    {
+        ret = e_failure;
+    }
+
+    // Step 3: Report
+    if (ret == e_success)
+    {
+        printf("Daemon (%ux%u carrier, %d byte secret, per request):\n", BENCH_DAEMON_WIDTH, BENCH_DAEMON_HEIGHT, BENCH_DAEMON_SECRET);
+        fprintf(fptr_report, "  \"daemon\": [");
+        for (int path = 0; path < 3; path++)
+        {
+            printf("  %-15s encode %9.1f us (p99 %9.1f)  decode %9.1f us (p99 %9.1f)  %5.1fx\n", path_name[path],
+                   stat[path][0].median / 1e3, stat[path][0].p99 / 1e3, stat[path][1].median / 1e3, stat[path][1].p99 / 1e3,
+                   (stat[0][0].median + stat[0][1].median) / (stat[path][0].median + stat[path][1].median));
+            fprintf(fptr_report, "%s\n    { \"path\": \"%s\"", path ? "," : "", path_name[path]);
+            for (int op = 0; op < 2; op++)
+            {
+                fprintf(fptr_report, ", \"%s_median_us\": %.3f, \"%s_p99_us\": %.3f", operation[op], stat[path][op].median / 1e3,
+                        operation[op], stat[path][op].p99 / 1e3);
+            }
+            fprintf(fptr_report, " }");
+        }
+        fprintf(fptr_report, "\n  ],\n");
+    }
+
+    // Step 4: Stop the daemon
+    if (kept != -1)
+    {
+        daemon_request(kept, "shutdown", NULL, 0, &reply, NULL);
+        close(kept);
+    }
+    if (daemon > 0)
+    {
+        if (kept == -1)
+        {
+            kill(daemon, SIGTERM);
+        }
+        waitpid(daemon, &status, 0);
+    }
+    remove(carrier);
+    remove(secret);
+    remove(stego);
+    remove(decoded);
+    free(samples);
+    return ret;
+}
+
+/*
+ * Encode and decode a full capacity secret in a large carrier once each and
+ * fail if either run's peak RSS goes over BENCH_RSS_CEILING_KIB
+ * --scatter and --in-place hold or map the whole carrier by design, so this
+ * case always runs the streaming engine; --crc and --cipher still apply.
+ */
+static Status bench_rss_ceiling(const BenchOptions *opts, const char *dir, const char *key, FILE *fptr_report)
+{
+    char carrier[4200], secret[4200], stego[4200], decoded[4200];
+    uint flags = (opts->checksum ? STEG_EXT_CRC32C : 0) | (opts->encrypt ? STEG_EXT_CHACHA20 : 0);
+    long size = full_capacity(BENCH_RSS_WIDTH, BENCH_RSS_HEIGHT, 1, flags);
+    long enc_rss = 0, dec_rss = 0;
+    EncodeInfo encInfo;
+    DecodeInfo decInfo;
+    Status ret = e_success;
+
+    snprintf(carrier, sizeof(carrier), "%s/rss_carrier.bmp", dir);
+    snprintf(secret, sizeof(secret), "%s/rss_secret.txt", dir);
+    snprintf(stego, sizeof(stego), "%s/rss_stego.bmp", dir);
+    snprintf(decoded, sizeof(decoded), "%s/rss_decoded.txt", dir);
+    if (write_carrier(carrier, BENCH_RSS_WIDTH, BENCH_RSS_HEIGHT) == e_failure || write_secret(secret, size) == e_failure)
+    {
+        printf("ERROR : Unable to write the peak RSS case files in %s\n", dir);
+        ret = e_failure;
+    }
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    encInfo.src_image_fname = carrier;
+    encInfo.secret_fname = secret;
+    encInfo.stego_image_fname = stego;
+    encInfo.depth = 1;
+    encInfo.threads = 1;
+    encInfo.checksum = opts->checksum;
+    encInfo.key_fname = opts->encrypt ? (char *)key : NULL;
+    encInfo.quiet = 1;
+    encInfo.stats.mode = e_stats_off;
+
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.d_src_image_fname = stego;
+    decInfo.d_secret_fname = decoded;
+    decInfo.d_threads = 1;
+    decInfo.d_range_end = -1;  // Whole payload
+    decInfo.d_key_fname = opts->encrypt ? (char *)key : NULL;
+    decInfo.quiet = 1;
+    decInfo.stats.mode = e_stats_off;
+
+    // One run each, the high-water mark is reset right before it
+    if (ret == e_success)
+    {
+        reset_peak_rss();
+        ret = do_encoding(&encInfo);
+        enc_rss = peak_rss_kib();
+    }
+    if (ret == e_success)
+    {
+        reset_peak_rss();
+        ret = do_decoding(&decInfo);
+        dec_rss = peak_rss_kib();
+    }
+    if (ret == e_success && files_equal(secret, decoded) == e_failure)
+    {
+        ret = e_failure;
+    }
+    int within = ret == e_success && enc_rss <= BENCH_RSS_CEILING_KIB && dec_rss <= BENCH_RSS_CEILING_KIB;
+
+    printf("Peak RSS (%ux%u carrier, %ld byte secret, ceiling %d KiB): encode %ld KiB, decode %ld KiB  %s\n",
+           BENCH_RSS_WIDTH, BENCH_RSS_HEIGHT, size, BENCH_RSS_CEILING_KIB, enc_rss, dec_rss,
+           (ret == e_failure) ? "FAILED" : within ? "within ceiling" : "OVER CEILING");
+    fprintf(fptr_report, "  \"rss_ceiling\": { \"width\": %u, \"height\": %u, \"payload_bytes\": %ld, \"ceiling_kib\": %d, "
+            "\"encode_peak_rss_kib\": %ld, \"decode_peak_rss_kib\": %ld, \"ok\": %s },\n",
+            BENCH_RSS_WIDTH, BENCH_RSS_HEIGHT, size, BENCH_RSS_CEILING_KIB, enc_rss, dec_rss, within ? "true" : "false");
+
+    remove(carrier);
+    remove(secret);
+    remove(stego);
+    remove(decoded);
+    return within ? e_success : e_failure;
+}
+
+/* Key file for --cipher runs, any fixed 32 bytes will do */
+static Status write_key(const char *fname)
+{
+    unsigned long long state = 0xD1B54A32D192ED03ULL;
+    uchar key[CHACHA20_KEY_SIZE];
+    FILE *fptr = fopen(fname, "w");
+
+    if (fptr == NULL)
+    {
+        return e_failure;
+    }
+    fill_random(key, sizeof(key), &state);
+    size_t written = fwrite(key, 1, sizeof(key), fptr);
+    return (fclose(fptr) == 0 && written == sizeof(key)) ? e_success : e_failure;
+}
+
+// Validate the command-line arguments for bench mode: --bench [report] [-r reps] [-w warmup] [-k depth] [-t threads] [-d dir] [--crc] [--cipher] [--scatter] [--in-place] [--daemon] [--rss-only]
+Status read_and_validate_bench_args(char *argv[], BenchOptions *opts)
+{
+    int have_report = 0;
+
+    opts->reps = BENCH_DEFAULT_REPS;
+    opts->warmup = BENCH_DEFAULT_WARMUP;
+    opts->depth = 0;
+    opts->threads = 1;
+    opts->checksum = 0;
+    opts->encrypt = 0;
+    opts->scatter = 0;
+    opts->in_place = 0;
+    opts->daemon = 0;
+    opts->rss_only = 0;
+    opts->report_fname = DEFAULT_BENCH_REPORT;
+    opts->dir = NULL;
+
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-t") == 0)
+        {
+            char option = argv[i][1];
+            int value = (argv[i + 1] != NULL) ? atoi(argv[++i]) : -1;
+
+            if ((option == 'r' && value < 1) || (option == 'w' && value < 0) ||
+                (option == 'k' && (value < 1 || value > LSB_MAX_DEPTH)) ||
+                (option == 't' && (value < 1 || value > MAX_EMBED_THREADS || value > MAX_EXTRACT_THREADS)))
+            {
+                printf("Error: invalid value for -%c\n", option);
+                return e_failure;
+            }
+            if (option == 'r')
+            {
+                opts->reps = value;
+            }
+            else if (option == 'w')
+            {
+                opts->warmup = value;
+            }
+            else if (option == 'k')
+            {
+                opts->depth = value;
+            }
+            else
+            {
+                opts->threads = value;
+            }
+        }
+        else if (strcmp(argv[i], "-d") == 0 && argv[i + 1] != NULL)
+        {
+            opts->dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--crc") == 0)
+        {
+            opts->checksum = 1;
+        }
+        else if (strcmp(argv[i], "--cipher") == 0)
+        {
+            opts->encrypt = 1;
+        }
+        else if (strcmp(argv[i], "--scatter") == 0)
+        {
+            // The tile order comes from the key
+            opts->encrypt = 1;
+            opts->scatter = 1;
+        }
+        else if (strcmp(argv[i], "--in-place") == 0)
+        {
+            opts->in_place = 1;
+        }
+        else if (strcmp(argv[i], "--daemon") == 0)
+        {
+            opts->daemon = 1;
+        }
+        else if (strcmp(argv[i], "--rss-only") == 0)
+        {
+            opts->rss_only = 1;
+        }
+        else if (!have_report)
+        {
+            opts->report_fname = argv[i];
+            have_report = 1;
+        }
+        else
+        {
+            printf("Error: unexpected argument %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Run the whole case matrix */
+Status do_bench(const BenchOptions *opts)
+{
+    char dir[4096], carrier[4200], secret[4200], stego[4200], decoded[4200], key[4200];
+    double *samples;
+    FILE *fptr_report;
+    Status ret = e_success;
+    int cases = 0;
+
+    // Step 1: Scratch directory for the generated files and the report
+    if (opts->dir != NULL)
+    {
+        snprintf(dir, sizeof(dir), "%s", opts->dir);
+    }
+    else
+    {
+        strcpy(dir, "/tmp/lsb_bench_XXXXXX");  // No dot, the extension is taken from the first one
+        if (mkdtemp(dir) == NULL)
+        {
+            perror("mkdtemp");
+            return e_failure;
+        }
+    }
+    fptr_report = fopen(opts->report_fname, "w");
+    samples = malloc((MAX_STATS_STAGES + 1) * opts->reps * sizeof(double));
+    if (fptr_report == NULL || samples == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", opts->report_fname);
+        if (fptr_report != NULL)
+        {
+            fclose(fptr_report);
+        }
+        free(samples);
+        return e_failure;
+    }
+    snprintf(stego, sizeof(stego), "%s/stego.bmp", dir);
+    snprintf(decoded, sizeof(decoded), "%s/decoded.txt", dir);
+    snprintf(key, sizeof(key), "%s/bench.key", dir);
+    if (opts->encrypt && write_key(key) == e_failure)
+    {
+        printf("ERROR : Unable to write %s\n", key);
+        fclose(fptr_report);
+        free(samples);
+        return e_failure;
+    }
+
+    printf("Benchmark: %d reps after %d warmup runs, %u thread(s)%s%s%s%s%s, files in %s\n", opts->reps, opts->warmup, opts->threads,
+           opts->checksum ? ", CRC32C checked" : "", opts->encrypt ? ", ChaCha20 encrypted" : "", opts->scatter ? ", scattered" : "",
+           opts->in_place ? ", in place" : "", opts->rss_only ? ", peak RSS check only" : "", dir);
+    fprintf(fptr_report, "{\n  \"reps\": %d,\n  \"warmup\": %d,\n  \"threads\": %u,\n  \"checksum\": %s,\n  \"encrypted\": %s,\n  \"scattered\": %s,\n"
+            "  \"in_place\": %s,\n  \"rss_only\": %s,\n  \"kernel\": \"%s\",\n",
+            opts->reps, opts->warmup, opts->threads, opts->checksum ? "true" : "false", opts->encrypt ? "true" : "false",
+            opts->scatter ? "true" : "false", opts->in_place ? "true" : "false", opts->rss_only ? "true" : "false", lsb_kernel.name);
+
+    // Step 2: Kernels on their own, --rss-only skips straight to the peak RSS check
+    if (!opts->rss_only && bench_kernels(opts, fptr_report) == e_failure)
+    {
+        printf("ERROR : An LSB kernel does not match the scalar reference\n");
+        ret = e_failure;
+    }
+    if (!opts->rss_only && bench_crc32c(opts, fptr_report) == e_failure)
+    {
+        printf("ERROR : CRC32C does not match the table implementation\n");
+        ret = e_failure;
+    }
+    if (!opts->rss_only && bench_chacha20(opts, fptr_report) == e_failure)
+    {
+        printf("ERROR : ChaCha20 does not match the scalar reference\n");
+        ret = e_failure;
+    }
+    if (!opts->rss_only && opts->daemon && bench_daemon(opts, dir, fptr_report) == e_failure)
+    {
+        printf("ERROR : Daemon latency runs failed\n");
+        ret = e_failure;
+    }
+    if (bench_rss_ceiling(opts, dir, key, fptr_report) == e_failure)
+    {
+        printf("ERROR : A large carrier run failed or went over the peak RSS ceiling\n");
+        ret = e_failure;
+    }
+
+    // Step 3: Every resolution / depth / secret size case through the file based stages, none with --rss-only
+    fprintf(fptr_report, "  \"cases\": [");
+    for (uint r = 0; !opts->rss_only && r < sizeof(bench_resolutions) / sizeof(bench_resolutions[0]); r++)
+    {
+        const BenchResolution *res = &bench_resolutions[r];
+
+        snprintf(carrier, sizeof(carrier), "%s/carrier_%s.bmp", dir, res->name);
+        if (write_carrier(carrier, res->width, res->height) == e_failure)
+        {
+            printf("ERROR : Unable to write %s\n", carrier);
+            ret = e_failure;
+            break;
+        }
+
+        for (uint d = 0; d < sizeof(bench_depths) / sizeof(bench_depths[0]); d++)
+        {
+            uint depth = (opts->depth != 0) ? opts->depth : bench_depths[d];
+            long full = full_capacity(res->width, res->height, depth,
+                                      (opts->checksum ? STEG_EXT_CRC32C : 0) | (opts->encrypt ? STEG_EXT_CHACHA20 : 0) |
+                                      (opts->scatter ? STEG_EXT_SCATTER : 0));
+
+            for (uint s = 0; s < sizeof(bench_secret_sizes) / sizeof(bench_secret_sizes[0]); s++)
+            {
+                long size = (bench_secret_sizes[s] == BENCH_FULL_CAPACITY) ? full : bench_secret_sizes[s];
+                unsigned long long enc_calls, dec_calls;
+                StegStats layout;
+                long enc_rss, dec_rss;
+                EncodeInfo encInfo;
+                DecodeInfo decInfo;
+
+                // Fixed sizes past the capacity are covered by the full capacity case
+                if (size > full || size == 0)
+                {
+                    continue;
+                }
+
+                snprintf(secret, sizeof(secret), "%s/secret_%ld.txt", dir, size);
+                if (write_secret(secret, size) == e_failure)
+                {
+                    printf("ERROR : Unable to write %s\n", secret);
+                    ret = e_failure;
+                    continue;
+                }
+
+                // In place every run embeds into the same fresh copy of the carrier
+                if (opts->in_place && write_carrier(stego, res->width, res->height) == e_failure)
+                {
+                    printf("ERROR : Unable to write %s\n", stego);
+                    ret = e_failure;
+                    remove(secret);
+                    continue;
+                }
+
+                memset(&encInfo, 0, sizeof(encInfo));
+                encInfo.src_image_fname = opts->in_place ? stego : carrier;
+                encInfo.secret_fname = secret;
+                encInfo.stego_image_fname = stego;
+                encInfo.depth = depth;
+                encInfo.threads = opts->threads;
+                encInfo.checksum = opts->checksum;
+                encInfo.key_fname = opts->encrypt ? key : NULL;
+                encInfo.scatter = opts->scatter;
+                encInfo.in_place = opts->in_place;
+                encInfo.quiet = 1;
+                encInfo.stats.mode = e_stats_off;
+
+                memset(&decInfo, 0, sizeof(decInfo));
+                decInfo.d_src_image_fname = stego;
+                decInfo.d_secret_fname = decoded;
+                decInfo.d_threads = opts->threads;
+                decInfo.d_range_end = -1;  // Whole payload
+                decInfo.d_key_fname = opts->encrypt ? key : NULL;
+                decInfo.quiet = 1;
+                decInfo.stats.mode = e_stats_off;
+
+                printf("%s depth %u secret %ld bytes%s\n", res->name, depth, size, (size == full) ? " (full)" : "");
+                fprintf(fptr_report, "%s\n    {\n      \"resolution\": \"%s\",\n      \"width\": %u,\n      \"height\": %u,\n"
+                        "      \"depth\": %u,\n      \"payload_bytes\": %ld,\n      \"full_capacity\": %s,\n",
+                        cases++ ? "," : "", res->name, res->width, res->height, depth, size, (size == full) ? "true" : "false");
+
+                // Encode, decode, then make sure the secret survived
+                if (bench_runs(opts, &encInfo, NULL, samples, &layout, &enc_calls, &enc_rss) == e_failure)
+                {
+                    printf("ERROR : Encoding failed\n");
+                    fprintf(fptr_report, "      \"error\": \"encode failed\"\n    }");
+                    ret = e_failure;
+                    remove(secret);
+                    continue;
+                }
+                report_operation(fptr_report, "encode", &layout, samples, opts->reps, size, enc_calls, enc_rss);
+                fprintf(fptr_report, ",\n");
+
+                if (bench_runs(opts, NULL, &decInfo, samples, &layout, &dec_calls, &dec_rss) == e_failure ||
+                    files_equal(secret, decoded) == e_failure)
+                {
+                    printf("ERROR : Decoding failed or decoded secret differs\n");
+                    fprintf(fptr_report, "      \"error\": \"decode failed\"\n    }");
+                    ret = e_failure;
+                    remove(secret);
+                    continue;
+                }
+                report_operation(fptr_report, "decode", &layout, samples, opts->reps, size, dec_calls, dec_rss);
+                fprintf(fptr_report, "\n    }");
+
+                remove(secret);
+            }
+
+            // -k pins a single depth
+            if (opts->depth != 0)
+            {
+                break;
+            }
+        }
+        remove(carrier);
+    }
+    fprintf(fptr_report, "\n  ]\n}\n");
+
+    // Step 4: Clean up the generated files, a directory passed with -d is kept
+    remove(stego);
+    remove(decoded);
+    if (opts->encrypt)
+    {
+        remove(key);
+    }
+    if (opts->dir == NULL)
+    {
+        rmdir(dir);
+    }
+    free(samples);
+    fclose(fptr_report);
+
+    printf("%d cases, report written to %s\n", cases, opts->report_fname);
+    return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include "types.h" // Contains user defined types
+
+/*
+ * Benchmark mode
+ * Generates synthetic 24 bit BMP carriers and secrets in a scratch
+ * directory, then runs every resolution / secret size / depth case through
+ * do_encoding() and do_decoding(), taking the per-stage times from their
+ * own telemetry (stats.h). Every case runs warmup times untimed and
+ * reps times timed; the report gives median and p99 per stage, MB/s and ns
+ * per payload byte, read/write syscalls and peak RSS per run, as text on
+ * stdout and as JSON in the report file. The LSB kernels are also checked
+ * against the scalar reference and timed on their own, and so are CRC32C
+ * and ChaCha20. With --crc every case stores and checks a payload checksum
+ * and with --cipher every payload is encrypted, --scatter also spreads it
+ * over the keyed tile order and --in-place embeds into the carrier itself,
+ * so comparing against a run without them gives the cost (or gain) of each.
+ * --daemon adds the per-request latency of a tiny job sent to a daemon
+ * (daemon.h) next to running the CLI once per job. A full capacity secret
+ * in a large carrier checks that encode and decode stay within a fixed
+ * peak RSS; going over it fails the benchmark like a mismatch does.
+ * --rss-only runs that check on its own.
+ */
+
+#define BENCH_DEFAULT_REPS 15
+#define BENCH_DEFAULT_WARMUP 3
+#define DEFAULT_BENCH_REPORT "bench_report.json"
+
+/* Secret size meaning "as much as the carrier holds at this depth" */
+#define BENCH_FULL_CAPACITY (-1L)
+
+typedef struct _BenchOptions
+{
+    int reps;
+    int warmup;
+    uint depth;        // 0 runs every depth in the case matrix
+    uint threads;      // > 1 uses the parallel payload stages
+    int checksum;      // --crc: every case embeds and checks a CRC32C
+    int encrypt;       // --cipher: every case encrypts its payload with a generated key
+    int scatter;       // --scatter: every case scatters its payload over keyed tiles, implies --cipher
+    int in_place;      // --in-place: every case embeds into a copy of the carrier through its mapping
+    int daemon;        // --daemon: also time tiny requests through --serve against fork-exec of the CLI
+    int rss_only;      // --rss-only: only the peak RSS check, no kernels and no case matrix
+    char *report_fname;
+    char *dir;         // Scratch directory, NULL for a fresh one under /tmp
+} BenchOptions;
+
+/* Read and validate bench args from argv */
+Status read_and_validate_bench_args(char *argv[], BenchOptions *opts);
+
+/* Run the benchmark matrix and write the text and JSON reports */
+Status do_bench(const BenchOptions *opts);
+
+#endif
@@ -0,0 +1,255 @@
+#include <string.h>
+#include "bmp.h"
+#include "common.h"
+#include "types.h"
+
+/* Info header sizes we take: INFO, V2, V3, V4, V5 (all start like BITMAPINFOHEADER) */
+static const uint bmp_info_sizes[] = { 40, 52, 56, 108, 124 };
+
+#define BMP_BI_RGB 0
+#define BMP_BI_BITFIELDS 3
+
+/* Function Definitions */
+
+/* Little endian fields of the header */
+static uint get_le32(const uchar *header, int offset)
+{
+    return header[offset] | (header[offset + 1] << 8) | (header[offset + 2] << 16) | ((uint)header[offset + 3] << 24);
+}
+
+static uint get_le16(const uchar *header, int offset)
+{
+    return header[offset] | (header[offset + 1] << 8);
+}
+
+Status bmp_parse_layout(const uchar *header, size_t size, unsigned long long file_size, BmpLayout *layout)
+{
+    int known = 0;
+
+    // Step 1: File header and a known info header
+    if (size < BMP_MIN_HEADER_SIZE || header[0] != 'B' || header[1] != 'M')
+    {
+        return e_failure;
+    }
+    uint info_size = get_le32(header, 14);
+    for (uint i = 0; i < sizeof(bmp_info_sizes) / sizeof(bmp_info_sizes[0]); i++)
+    {
+        known |= (info_size == bmp_info_sizes[i]);
+    }
+    if (!known)
+    {
+        return e_failure;
+    }
+
+    // Step 2: Uncompressed 24 or 32 bpp only, palettes and 16 bpp pixels have no byte sized channels
+    int width = (int)get_le32(header, 18);
+    int height = (int)get_le32(header, 22);
+    uint bpp = get_le16(header, 28);
+    uint compression = get_le32(header, 30);
+    if (get_le16(header, 26) != 1 || width <= 0 || height == 0 || height == (int)0x80000000 ||
+        (bpp != 24 && bpp != 32) || (compression != BMP_BI_RGB && !(compression == BMP_BI_BITFIELDS && bpp == 32)))
+    {
+        return e_failure;
+    }
+
+    // 32 bpp bit fields must keep B, G and R in the low three bytes, the fourth one is left alone
+    if (compression == BMP_BI_BITFIELDS)
+    {
+        if (size < BMP_MIN_HEADER_SIZE + 12 ||
+            ((get_le32(header, 54) | get_le32(header, 58) | get_le32(header, 62)) & 0xFF000000) != 0)
+        {
+            return e_failure;
+        }
+    }
+
+    // Step 3: Row geometry, the pixel array has to be in the file
+    layout->pixel_offset = get_le32(header, 10);
+    layout->width = width;
+    layout->top_down = (height < 0);
+    layout->height = (height < 0) ? -height : height;
+    layout->bytes_per_pixel = bpp / 8;
+    layout->row_channels = layout->width * 3;
+    layout->stride = ((unsigned long long)layout->width * bpp + 31) / 32 * 4;
+    layout->channels = (unsigned long long)layout->row_channels * layout->height;
+
+    if ((unsigned long long)layout->width * 4 > 0xFFFFFFF0ULL || layout->pixel_offset < 14 + info_size ||
+        layout->pixel_offset + (unsigned long long)layout->stride * layout->height > file_size)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+void bmp_flat_layout(BmpLayout *layout, unsigned long long file_size)
+{
+    unsigned long long bytes = (file_size > BMP_HEADER_SIZE) ? file_size - BMP_HEADER_SIZE : 0;
+
+    layout->pixel_offset = BMP_HEADER_SIZE;
+    layout->width = bytes / 3;
+    layout->height = (bytes > 0);
+    layout->top_down = 0;
+    layout->bytes_per_pixel = 3;
+    layout->row_channels = (bytes > 0) ? bytes : 1;
+    layout->stride = layout->row_channels;
+    layout->channels = bytes;
+}
+
+int bmp_is_contiguous(const BmpLayout *layout)
+{
+    return layout->bytes_per_pixel == 3 && layout->row_channels == layout->stride;
+}
+
+/* File offset of channel c inside its row */
+static uint row_column(const BmpLayout *layout, uint c)
+{
+    return (layout->bytes_per_pixel == 3) ? c : c / 3 * 4 + c % 3;
+}
+
+unsigned long long bmp_channel_offset(const BmpLayout *layout, unsigned long long channel)
+{
+    if (bmp_is_contiguous(layout))
+    {
+        return layout->pixel_offset + channel;
+    }
+    unsigned long long row = channel / layout->row_channels;
+    return layout->pixel_offset + row * layout->stride + row_column(layout, channel % layout->row_channels);
+}
+
+unsigned long long bmp_channels_before(const BmpLayout *layout, unsigned long long offset)
+{
+    if (offset <= layout->pixel_offset)
+    {
+        return 0;
+    }
+    unsigned long long row = (offset - layout->pixel_offset) / layout->stride;
+    uint column = (offset - layout->pixel_offset) % layout->stride;
+    if (row >= layout->height)
+    {
+        return layout->channels;
+    }
+
+    // Bytes of the row before offset, less the padding and alpha bytes among them
+    uint in_row = (layout->bytes_per_pixel == 3) ? column : column / 4 * 3 + ((column % 4 < 3) ? column % 4 : 3);
+    if (in_row > layout->row_channels)
+    {
+        in_row = layout->row_channels;
+    }
+    return row * layout->row_channels + in_row;
+}
+
+void bmp_scan_init(BmpScan *scan, const BmpLayout *layout, unsigned long long first, unsigned long long count)
+{
+    scan->layout = layout;
+    scan->channel = first;
+    scan->left = count;
+}
+
+int bmp_scan_next(BmpScan *scan, unsigned long long *offset, unsigned long long *channel, uint *count)
+{
+    const BmpLayout *layout = scan->layout;
+
+    if (scan->left == 0)
+    {
+        return 0;
+    }
+
+    // The segment runs to the end of the row or of the walk, whichever is first
+    uint in_row = scan->channel % layout->row_channels;
+    unsigned long long run = layout->row_channels - in_row;
+    *count = (run < scan->left) ? run : scan->left;
+    *channel = scan->channel;
+    *offset = bmp_channel_offset(layout, scan->channel);
+
+    scan->channel += *count;
+    scan->left -= *count;
+    return 1;
+}
+
+void bmp_gather(const BmpLayout *layout, const uchar *raw, unsigned long long raw_offset,
+                unsigned long long first, size_t count, uchar *channels)
+{
+    BmpScan scan;
+    unsigned long long offset, channel;
+    uint run;
+
+    if (bmp_is_contiguous(layout))
+    {
+        memcpy(channels, raw + (bmp_channel_offset(layout, first) - raw_offset), count);
+        return;
+    }
+
+    bmp_scan_init(&scan, layout, first, count);
+    while (bmp_scan_next(&scan, &offset, &channel, &run))
+    {
+        const uchar *row = raw + (offset - raw_offset);
+        if (layout->bytes_per_pixel == 3)
+        {
+            memcpy(channels, row, run);
+        }
+        else
+        {
+            // Skip the fourth byte of every pixel, row starts at the pixel of the first channel
+            uint sub = channel % layout->row_channels % 3;
+            row -= sub;
+            for (uint i = 0; i < run; i++)
+            {
+                channels[i] = row[sub];
+                if (++sub == 3)
+                {
+                    sub = 0;
+                    row += 4;
+                }
+            }
+        }
+        channels += run;
+    }
+}
+
+void bmp_scatter(const BmpLayout *layout, const uchar *channels, unsigned long long first, size_t count,
+                 uchar *raw, unsigned long long raw_offset)
+{
+    BmpScan scan;
+    unsigned long long offset, channel;
+    uint run;
+
+    if (bmp_is_contiguous(layout))
+    {
+        memcpy(raw + (bmp_channel_offset(layout, first) - raw_offset), channels, count);
+        return;
+    }
+
+    bmp_scan_init(&scan, layout, first, count);
+    while (bmp_scan_next(&scan, &offset, &channel, &run))
+    {
+        uchar *row = raw + (offset - raw_offset);
+        if (layout->bytes_per_pixel == 3)
+        {
+            memcpy(row, channels, run);
+        }
+        else
+        {
+            uint sub = channel % layout->row_channels % 3;
+            row -= sub;
+            for (uint i = 0; i < run; i++)
+            {
+                row[sub] = channels[i];
+                if (++sub == 3)
+                {
+                    sub = 0;
+                    row += 4;
+                }
+            }
+        }
+        channels += run;
+    }
+}
+
+const uchar *bmp_view(const BmpLayout *layout, const uchar *image, unsigned long long first, size_t count, uchar *scratch)
+{
+    if (bmp_is_contiguous(layout))
+    {
+        return image + bmp_channel_offset(layout, first);
+    }
+    bmp_gather(layout, image, 0, first, count, scratch);
+    return scratch;
+}
@@ -0,0 +1,75 @@
+#ifndef BMP_H
+#define BMP_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * BMP pixel layout
+ * Only the B, G and R byte of every pixel carry payload ("channel bytes");
+ * row padding and the alpha byte of 32 bpp pixels are never touched. The
+ * channel bytes of the image form one stream in file order, channel byte v
+ * lives at bmp_channel_offset(v), and the scanline walk below hands out the
+ * stream one row segment at a time so callers can copy whole runs.
+ *
+ * A flat layout (bmp_flat_layout) treats everything after the 54 byte header
+ * as channel bytes, which is how images without STEG_MODE_SCANLINE were
+ * embedded.
+ */
+
+/* File header plus the smallest info header we take (BITMAPINFOHEADER) */
+#define BMP_MIN_HEADER_SIZE 54
+
+typedef struct _BmpLayout
+{
+    uint pixel_offset;           // File offset of the first stored row
+    uint width;
+    uint height;                 // Rows, whatever the sign in the header
+    int top_down;                // Rows stored top row first (negative height)
+    uint bytes_per_pixel;        // 3 or 4
+    uint row_channels;           // Channel bytes per row
+    uint stride;                 // Bytes per row in the file, padded to 4
+    unsigned long long channels; // Channel bytes in the whole image
+} BmpLayout;
+
+/* One run of channel bytes inside a single row */
+typedef struct _BmpScan
+{
+    const BmpLayout *layout;
+    unsigned long long channel;  // Next channel byte
+    unsigned long long left;     // Channel bytes still to walk
+} BmpScan;
+
+/* Parse the layout of a 24 or 32 bpp uncompressed BMP from its first size bytes */
+Status bmp_parse_layout(const uchar *header, size_t size, unsigned long long file_size, BmpLayout *layout);
+
+/* Layout that takes every byte after the 54 byte header, in one row */
+void bmp_flat_layout(BmpLayout *layout, unsigned long long file_size);
+
+/* Channel bytes sit back to back in the file, so runs need no gathering */
+int bmp_is_contiguous(const BmpLayout *layout);
+
+/* File offset of channel byte channel (one past the pixel array for channels) */
+unsigned long long bmp_channel_offset(const BmpLayout *layout, unsigned long long channel);
+
+/* Number of channel bytes stored before file offset offset */
+unsigned long long bmp_channels_before(const BmpLayout *layout, unsigned long long offset);
+
+/* Start a scanline walk over count channel bytes from channel first */
+void bmp_scan_init(BmpScan *scan, const BmpLayout *layout, unsigned long long first, unsigned long long count);
+
+/* Next row segment of the walk: file offset of its first byte, first channel and channel count; 0 at the end */
+int bmp_scan_next(BmpScan *scan, unsigned long long *offset, unsigned long long *channel, uint *count);
+
+/*
+ * Copy count channel bytes from channel first between the file bytes in raw
+ * (raw[0] is file offset raw_offset) and a packed channel buffer
+ */
+void bmp_gather(const BmpLayout *layout, const uchar *raw, unsigned long long raw_offset,
+                unsigned long long first, size_t count, uchar *channels);
+void bmp_scatter(const BmpLayout *layout, const uchar *channels, unsigned long long first, size_t count,
+                 uchar *raw, unsigned long long raw_offset);
+
+/* count channel bytes from channel first of a whole image in memory: a pointer into it when contiguous, else gathered into scratch */
+const uchar *bmp_view(const BmpLayout *layout, const uchar *image, unsigned long long first, size_t count, uchar *scratch);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "chacha20.h"
+#include "types.h"
+
+/* Most blocks any kernel generates in one call */
+#define CHACHA20_MAX_LANES 8
+
+/* Blocks generated side by side, keystream gets lanes * 64 bytes for counters counter on */
+typedef void (*chacha20_blocks_fn)(const uint *state, uint counter, uchar *keystream);
+
+typedef struct _ChaCha20Kernel
+{
+    const char *name;
+    chacha20_blocks_fn blocks;
+    uint lanes;
+} ChaCha20Kernel;
+
+/* Function Definitions */
+
+static inline uint load_le32(const uchar *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+}
+
+static inline void store_le32(uchar *p, uint value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/* Works on plain words and on vectors of words alike */
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER(a, b, c, d)                   \
+    do                                        \
+    {                                         \
+        a += b; d ^= a; d = ROTL(d, 16);      \
+        c += d; b ^= c; b = ROTL(b, 12);      \
+        a += b; d ^= a; d = ROTL(d, 8);       \
+        c += d; b ^= c; b = ROTL(b, 7);       \
+    } while (0)
+
+/* Column round, then diagonal round */
+#define DOUBLE_ROUND(x)                        \
+    do                                         \
+    {                                          \
+        QUARTER(x[0], x[4], x[8], x[12]);      \
+        QUARTER(x[1], x[5], x[9], x[13]);      \
+        QUARTER(x[2], x[6], x[10], x[14]);     \
+        QUARTER(x[3], x[7], x[11], x[15]);     \
+        QUARTER(x[0], x[5], x[10], x[15]);     \
+        QUARTER(x[1], x[6], x[11], x[12]);     \
+        QUARTER(x[2], x[7], x[8], x[13]);      \
+        QUARTER(x[3], x[4], x[9], x[14]);      \
+    } while (0)
+
+/* Reference: one 64 byte block */
+static void chacha20_block(const uint *state, uint counter, uchar *keystream)
+{
+    uint x[16];
+
+    memcpy(x, state, sizeof(x));
+    x[12] = counter;
+    for (int i = 0; i < 10; i++)
+    {
+        DOUBLE_ROUND(x);
+    }
+    for (int j = 0; j < 16; j++)
+    {
+        store_le32(keystream + 4 * j, x[j] + ((j == 12) ? counter : state[j]));
+    }
+}
+
+/*
+ * lanes blocks at once, lane l of every vector belongs to block counter + l
+ * The rounds only add, xor and rotate, so GCC vector types lower them to
+ * SSE2/NEON or AVX2 instructions without intrinsics.
+ */
+#define CHACHA20_BLOCKS(name, vec, lanes)                                  \
+    static void name(const uint *state, uint counter, uchar *keystream)   \
+    {                                                                      \
+        vec x[16], s[16];                                                  \
+                                                                           \
+        for (int j = 0; j < 16; j++)                                       \
+        {                                                                  \
+            s[j] = (vec){ 0 } + state[j];                                  \
+        }                                                                  \
+        for (int l = 0; l < lanes; l++)                                    \
+        {                                                                  \
+            s[12][l] = counter + l;                                        \
+        }                                                                  \
+        memcpy(x, s, sizeof(x));                                           \
+        for (int i = 0; i < 10; i++)                                       \
+        {                                                                  \
+            DOUBLE_ROUND(x);                                               \
+        }                                                                  \
+        for (int j = 0; j < 16; j++)                                       \
+        {                                                                  \
+            x[j] += s[j];                                                  \
+        }                                                                  \
+        for (int l = 0; l < lanes; l++)                                   \
+        {                                                                  \
+            for (int j = 0; j < 16; j++)                                   \
+            {                                                              \
+                store_le32(keystream + CHACHA20_BLOCK_SIZE * l + 4 * j, x[j][l]); \
+            }                                                              \
+        }                                                                  \
+    }
+
+typedef uint chacha20_v4 __attribute__((vector_size(16)));
+CHACHA20_BLOCKS(chacha20_blocks_x4, chacha20_v4, 4)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHACHA20_X86
+typedef uint chacha20_v8 __attribute__((vector_size(32)));
+__attribute__((target("avx2")))
+CHACHA20_BLOCKS(chacha20_blocks_avx2, chacha20_v8, 8)
+#endif
+
+static const ChaCha20Kernel chacha20_scalar = { "scalar", chacha20_block, 1 };
+static ChaCha20Kernel chacha20_kernel = { "x4", chacha20_blocks_x4, 4 };
+
+/* Pick the widest kernel once at startup, before any thread encrypts */
+__attribute__((constructor))
+static void chacha20_select_kernel(void)
+{
+#ifdef CHACHA20_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        chacha20_kernel = (ChaCha20Kernel) { "avx2", chacha20_blocks_avx2, 8 };
+    }
+#endif
+}
+
+void chacha20_init(ChaCha20 *cipher, const uchar *key, const uchar *nonce)
+{
+    // "expand 32-byte k"
+    cipher->state[0] = 0x61707865;
+    cipher->state[1] = 0x3320646e;
+    cipher->state[2] = 0x79622d32;
+    cipher->state[3] = 0x6b206574;
+    for (int j = 0; j < 8; j++)
+    {
+        cipher->state[4 + j] = load_le32(key + 4 * j);
+    }
+    cipher->state[12] = 0;
+    for (int j = 0; j < 3; j++)
+    {
+        cipher->state[13 + j] = load_le32(nonce + 4 * j);
+    }
+}
+
+/* XOR count bytes of keystream into data, a word at a time */
+static void xor_bytes(uchar *data, const uchar *keystream, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        uint64_t word, key;
+        memcpy(&word, data + i, 8);
+        memcpy(&key, keystream + i, 8);
+        word ^= key;
+        memcpy(data + i, &word, 8);
+    }
+    for (; i < count; i++)
+    {
+        data[i] ^= keystream[i];
+    }
+}
+
+static void xor_with(const ChaCha20Kernel *kernel, const ChaCha20 *cipher, unsigned long long offset, uchar *data, size_t count)
+{
+    uchar keystream[CHACHA20_BLOCK_SIZE * CHACHA20_MAX_LANES];
+    size_t span = CHACHA20_BLOCK_SIZE * kernel->lanes;
+    uint counter = offset / CHACHA20_BLOCK_SIZE;
+    size_t skip = offset % CHACHA20_BLOCK_SIZE;
+
+    // Only the first blocks can start inside a block, every later call is whole
+    while (count > 0)
+    {
+        size_t n = (span - skip < count) ? span - skip : count;
+
+        kernel->blocks(cipher->state, counter, keystream);
+        xor_bytes(data, keystream + skip, n);
+        data += n;
+        count -= n;
+        counter += kernel->lanes;
+        skip = 0;
+    }
+}
+
+void chacha20_xor(const ChaCha20 *cipher, unsigned long long offset, uchar *data, size_t count)
+{
+    xor_with(&chacha20_kernel, cipher, offset, data, count);
+}
+
+void chacha20_xor_scalar(const ChaCha20 *cipher, unsigned long long offset, uchar *data, size_t count)
+{
+    xor_with(&chacha20_scalar, cipher, offset, data, count);
+}
+
+const char *chacha20_kernel_name(void)
+{
+    return chacha20_kernel.name;
+}
+
+Status chacha20_new_nonce(uchar *nonce)
+{
+    return (getrandom(nonce, CHACHA20_NONCE_SIZE, 0) == CHACHA20_NONCE_SIZE) ? e_success : e_failure;
+}
+
+Status chacha20_read_key(const char *fname, uchar *key)
+{
+    uchar extra;
+    int fd = open(fname, O_RDONLY);
+    Status ret = e_failure;
+
+    if (fd == -1)
+    {
+        return e_failure;
+    }
+
+    // Exactly one key, a longer file is more likely the wrong file than a key
+    ssize_t got = 0;
+    while (got < CHACHA20_KEY_SIZE)
+    {
+        ssize_t n = read(fd, key + got, CHACHA20_KEY_SIZE - got);
+        if (n <= 0)
+        {
+            break;
+        }
+        got += n;
+    }
+    if (got == CHACHA20_KEY_SIZE && read(fd, &extra, 1) == 0)
+    {
+        ret = e_success;
+    }
+    close(fd);
+    return ret;
+}
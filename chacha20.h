@@ -0,0 +1,43 @@
+#ifndef CHACHA20_H
+#define CHACHA20_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * ChaCha20 (RFC 8439), the payload cipher behind STEG_EXT_CHACHA20
+ * The keystream is XORed into the payload chunk by chunk in the embed and
+ * extract loops, so encryption adds no pass of its own. Any byte offset of
+ * the keystream can be reached directly (block offset / 64, 32 bit counter),
+ * which lets the parallel ranges and --range start anywhere in the payload.
+ * Several blocks are generated side by side in vector lanes (8 with AVX2,
+ * 4 otherwise) and the scalar block function is the reference.
+ */
+
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 12
+#define CHACHA20_BLOCK_SIZE 64
+
+typedef struct _ChaCha20
+{
+    uint state[16];    // Constants, key, block counter (word 12), nonce
+} ChaCha20;
+
+/* Set up the cipher for one key and nonce */
+void chacha20_init(ChaCha20 *cipher, const uchar *key, const uchar *nonce);
+
+/* XOR the keystream from byte offset on into count bytes of data */
+void chacha20_xor(const ChaCha20 *cipher, unsigned long long offset, uchar *data, size_t count);
+
+/* Same with one block at a time, the reference for the vector one */
+void chacha20_xor_scalar(const ChaCha20 *cipher, unsigned long long offset, uchar *data, size_t count);
+
+/* Name of the implementation chacha20_xor() uses on this CPU */
+const char *chacha20_kernel_name(void);
+
+/* Fresh random nonce from the kernel, fails rather than fall back to anything guessable */
+Status chacha20_new_nonce(uchar *nonce);
+
+/* Read a key file of exactly CHACHA20_KEY_SIZE bytes */
+Status chacha20_read_key(const char *fname, uchar *key);
+
+#endif
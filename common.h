@@ -1,7 +1,50 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+/* Size of the BMP header in front of the pixel data */
+#define BMP_HEADER_SIZE 54
+
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/*
+ * Stego mode byte, embedded 1 bit deep right after the magic string
+ * Bits 0-2: LSBs per image byte used for every field after the mode byte
+ * Bit 3:    scanline layout, see below
+ * Bit 4:    payload is an LZ stream (lz.h), the payload size counts stored bytes
+ * Bit 5:    payload is a multi-file container (container.h)
+ * Bit 6:    payload is one shard of a secret split over several images (shard.h)
+ * Bit 7:    an extension byte follows, also 1 bit deep
+ * Images from before the mode byte existed have 0 here (the high byte of the
+ * extension size), which decodes as the original 1 bit layout.
+ *
+ * Extension byte, kept in bits 8-15 of the flags next to the mode byte flags:
+ * Bit 0:    a CRC32C of the stored payload (crc32c.h) follows the payload,
+ *           32 bits at depth, so corrupt or truncated images are told apart
+ * Bit 1:    the payload is encrypted with ChaCha20 (chacha20.h), its nonce is
+ *           stored between the extension and the payload size
+ * Bit 2:    the payload channels are scattered over keyed tiles (scatter.h),
+ *           only together with bit 1, whose key and nonce order the tiles
+ * Bits 3-7: reserved, must be 0
+ * An extension byte is only written when one of its bits is set.
+ *
+ * Without the scanline bit every byte after the 54 byte header carries data.
+ * With it, magic string and all fields start at the pixel data offset and
+ * only use the B, G and R bytes of each pixel, skipping row padding and the
+ * alpha byte (see bmp.h). It is only set when the two differ, so plain 24 bpp
+ * images with unpadded rows stay readable by older decoders.
+ */
+#define STEG_MODE_DEPTH_MASK 0x07
+#define STEG_MODE_SCANLINE 0x08
+#define STEG_MODE_LZ 0x10
+#define STEG_MODE_CONTAINER 0x20
+#define STEG_MODE_SHARD 0x40
+#define STEG_MODE_FLAGS_MASK (STEG_MODE_SCANLINE | STEG_MODE_LZ | STEG_MODE_CONTAINER | STEG_MODE_SHARD)
+#define STEG_MODE_EXTENDED 0x80
+#define STEG_EXT_CRC32C 0x100
+#define STEG_EXT_CHACHA20 0x200
+#define STEG_EXT_SCATTER 0x400
+#define STEG_EXT_FLAGS_MASK (STEG_EXT_CRC32C | STEG_EXT_CHACHA20 | STEG_EXT_SCATTER)
+#define STEG_MODE_LEGACY 0x00
+
 #endif
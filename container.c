@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "container.h"
+#include "decode.h"
+#include "steg.h"
+#include "lsb.h"
+#include "lz.h"
+#include "common.h"
+#include "types.h"
+
+/* A container stego image, mapped read-only */
+typedef struct _ContainerImage
+{
+    int fd;
+    const uchar *map;
+    size_t size;
+    StegHeader header;
+    ContainerEntry *entries;
+    uint count;
+} ContainerImage;
+
+/* Function Definitions */
+
+// Validate the command-line arguments for pack mode
+Status read_and_validate_pack_args(char *argv[], EncodeInfo *encInfo)
+{
+    char *fname[2] = { NULL, NULL };
+    int count = 0;
+
+    encInfo->depth = 1;
+    encInfo->threads = 1;
+    encInfo->compress = 0;
+    encInfo->checksum = 0;
+    encInfo->key_fname = NULL;
+    encInfo->scatter = 0;
+    encInfo->in_place = 0;
+    encInfo->stream = 0;
+    encInfo->io_mode = e_pipeline_auto;
+    encInfo->container_compress = 0;
+    encInfo->payload_prefix = NULL;
+    encInfo->prefix_size = 0;
+    encInfo->secret_start = 0;
+    encInfo->quiet = 0;
+    encInfo->stats.mode = e_stats_off;
+
+    // Files are collected in place over argv, the options are dropped
+    encInfo->container_files = argv + 2;
+    encInfo->container_count = 0;
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-t") == 0)
+        {
+            char option = argv[i][1];
+            int value = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+
+            if (value < 1 || value > ((option == 'k') ? LSB_MAX_DEPTH : MAX_EMBED_THREADS))
+            {
+                printf("Error: invalid value for -%c\n", option);
+                return e_failure;
+            }
+            if (option == 'k')
+            {
+                encInfo->depth = value;
+            }
+            else
+            {
+                encInfo->threads = value;
+            }
+        }
+        else if (strcmp(argv[i], "-z") == 0)
+        {
+            encInfo->container_compress = 1;  // Per entry, the container itself stays seekable
+        }
+        else if (strcmp(argv[i], "--crc") == 0)
+        {
+            encInfo->checksum = 1;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            encInfo->stats.mode = e_stats_text;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            encInfo->stats.mode = e_stats_json;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            encInfo->quiet = 1;
+        }
+        else if (count < 2)
+        {
+            fname[count++] = argv[i];
+        }
+        else
+        {
+            encInfo->container_files[encInfo->container_count++] = argv[i];
+        }
+    }
+
+    if (fname[0] == NULL || strstr(fname[0], ".bmp") == NULL)
+    {
+        printf("Error: source image file must be .bmp file\n");
+        return e_failure;
+    }
+    if (fname[1] == NULL || strstr(fname[1], ".bmp") == NULL)
+    {
+        printf("Error: stego image file must be .bmp file\n");
+        return e_failure;
+    }
+    if (encInfo->container_count == 0 || encInfo->container_count > MAX_CONTAINER_ENTRIES)
+    {
+        printf("Error: pack needs 1 to %d files\n", MAX_CONTAINER_ENTRIES);
+        return e_failure;
+    }
+    encInfo->src_image_fname = fname[0];
+    encInfo->stego_image_fname = fname[1];
+    encInfo->secret_fname = "container" CONTAINER_EXTN;
+    return e_success;
+}
+
+/* Little endian 32 bit field */
+static void put_le32(uchar *p, uint value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = value >> (8 * i);
+    }
+}
+
+static uint get_le32(const uchar *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+}
+
+/* Copy everything left in fptr_src to fptr_dest, size gets the bytes copied */
+static Status copy_stream(FILE *fptr_src, FILE *fptr_dest, long *size)
+{
+    char buffer[64 * 1024];
+    size_t count;
+
+    *size = 0;
+    while ((count = fread(buffer, 1, sizeof(buffer), fptr_src)) > 0)
+    {
+        if (fwrite(buffer, 1, count, fptr_dest) != count)
+        {
+            return e_failure;
+        }
+        *size += count;
+    }
+    return ferror(fptr_src) ? e_failure : e_success;
+}
+
+/* Entry names are the base names, they have to be unique to be pulled by name */
+static Status name_entries(const EncodeInfo *encInfo, ContainerEntry *entries, unsigned long long *table_size)
+{
+    *table_size = CONTAINER_HEADER_SIZE;
+    for (int i = 0; i < encInfo->container_count; i++)
+    {
+        const char *slash = strrchr(encInfo->container_files[i], '/');
+        const char *name = (slash != NULL) ? slash + 1 : encInfo->container_files[i];
+
+        if (strlen(name) == 0 || strlen(name) > MAX_CONTAINER_NAME)
+        {
+            printf("ERROR : %s: entry names need 1 to %d characters\n", encInfo->container_files[i], MAX_CONTAINER_NAME);
+            return e_failure;
+        }
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(entries[j].name, name) == 0)
+            {
+                printf("ERROR : %s: two entries named %s\n", encInfo->container_files[i], name);
+                return e_failure;
+            }
+        }
+        strcpy(entries[i].name, name);
+        *table_size += CONTAINER_ENTRY_FIXED + strlen(name);
+    }
+    return e_success;
+}
+
+/* Entry data in table order from the current position of fptr on */
+static Status write_entries(const EncodeInfo *encInfo, ContainerEntry *entries, FILE *fptr, unsigned long long *raw_total)
+{
+    *raw_total = 0;
+    for (int i = 0; i < encInfo->container_count; i++)
+    {
+        FILE *fptr_entry = fopen(encInfo->container_files[i], "r");
+        long offset = ftell(fptr), size;
+        Status status;
+
+        if (fptr_entry == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->container_files[i]);
+            return e_failure;
+        }
+        status = encInfo->container_compress ? compress_stream(fptr_entry, fptr, &size) : copy_stream(fptr_entry, fptr, &size);
+        fclose(fptr_entry);
+
+        // Offsets and lengths are 32 bit fields, the whole payload has to fit an int anyway
+        long end = ftell(fptr);
+        if (status == e_failure || end < 0 || end > INT_MAX || (unsigned long)size > UINT_MAX)
+        {
+            return e_failure;
+        }
+        entries[i].flags = encInfo->container_compress ? CONTAINER_ENTRY_LZ : 0;
+        entries[i].offset = offset;
+        entries[i].length = end - offset;
+        entries[i].size = size;
+        *raw_total += size;
+    }
+    return e_success;
+}
+
+/* The table of contents at the start of fptr */
+static Status write_table(const ContainerEntry *entries, int count, size_t table_size, FILE *fptr)
+{
+    uchar *table = malloc(table_size);
+    uchar *p = table;
+    Status ret = e_failure;
+
+    if (table == NULL)
+    {
+        return e_failure;
+    }
+    put_le32(p, count);
+    put_le32(p + 4, table_size);
+    p += CONTAINER_HEADER_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        size_t length = strlen(entries[i].name);
+        *p++ = length;
+        memcpy(p, entries[i].name, length);
+        p += length;
+        *p++ = entries[i].flags;
+        put_le32(p, entries[i].offset);
+        put_le32(p + 4, entries[i].length);
+        put_le32(p + 8, entries[i].size);
+        p += 12;
+    }
+    if (fseek(fptr, 0, SEEK_SET) == 0 && fwrite(table, 1, table_size, fptr) == table_size && fflush(fptr) == 0)
+    {
+        ret = e_success;
+    }
+    free(table);
+    return ret;
+}
+
+/*
+ * Build the container in a temporary file
+ * The table size only depends on the names, so the data goes in right
+ * behind the space left for it and the table is filled in last. The
+ * carrier is then embedded in the usual single pass with this file as the
+ * secret.
+ */
+Status build_container(EncodeInfo *encInfo)
+{
+    ContainerEntry *entries = calloc(encInfo->container_count, sizeof(ContainerEntry));
+    unsigned long long table_size, raw_total;
+    FILE *fptr = tmpfile();
+    Status ret = e_failure;
+
+    if (entries != NULL && fptr != NULL &&
+        name_entries(encInfo, entries, &table_size) == e_success && table_size <= INT_MAX &&
+        fseek(fptr, table_size, SEEK_SET) == 0 &&
+        write_entries(encInfo, entries, fptr, &raw_total) == e_success &&
+        write_table(entries, encInfo->container_count, table_size, fptr) == e_success)
+    {
+        if (!encInfo->quiet)
+        {
+            printf("container = %d entries, %llu bytes of files\n", encInfo->container_count, raw_total);
+        }
+        encInfo->fptr_secret = fptr;
+        ret = e_success;
+    }
+    else if (fptr != NULL)
+    {
+        fclose(fptr);
+    }
+    free(entries);
+    return ret;
+}
+
+/* Payload bytes [offset, offset + count) of the container */
+static Status read_payload(const ContainerImage *image, size_t offset, uchar *data, size_t count)
+{
+    StegHeader header;
+
+    return steg_decode_range(image->map, image->size, offset, data, count, &header);
+}
+
+static void close_container(ContainerImage *image)
+{
+    if (image->map != NULL)
+    {
+        munmap((void *)image->map, image->size);
+    }
+    if (image->fd != -1)
+    {
+        close(image->fd);
+    }
+    free(image->entries);
+}
+
+/* Map the image, check it holds a container and read its table of contents */
+static Status open_container(const char *fname, ContainerImage *image)
+{
+    uchar head[CONTAINER_HEADER_SIZE];
+    struct stat st;
+
+    image->map = NULL;
+    image->entries = NULL;
+    image->count = 0;
+    image->fd = open(fname, O_RDONLY);
+    if (image->fd == -1 || fstat(image->fd, &st) == -1)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", fname);
+        return e_failure;
+    }
+    if (st.st_size < BMP_HEADER_SIZE)
+    {
+        printf("ERROR : %s is not a valid image\n", fname);
+        return e_failure;
+    }
+
+    // Only the pages of the table and of the entry asked for are ever touched
+    image->size = st.st_size;
+    image->map = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, image->fd, 0);
+    if (image->map == MAP_FAILED)
+    {
+        image->map = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+
+    if (steg_read_header(image->map, image->size, &image->header) == e_failure ||
+        !(image->header.flags & STEG_MODE_CONTAINER))
+    {
+        printf("ERROR : %s does not hold a container\n", fname);
+        return e_failure;
+    }
+
+    // Step 1: Entry count and table size
+    uint payload_size = image->header.payload_size;
+    if (read_payload(image, 0, head, CONTAINER_HEADER_SIZE) == e_failure)
+    {
+        return e_failure;
+    }
+    uint count = get_le32(head);
+    uint table_size = get_le32(head + 4);
+    if (count > MAX_CONTAINER_ENTRIES || table_size < CONTAINER_HEADER_SIZE || table_size > payload_size ||
+        (table_size - CONTAINER_HEADER_SIZE) / CONTAINER_ENTRY_FIXED < count)
+    {
+        printf("ERROR : Corrupt container table\n");
+        return e_failure;
+    }
+
+    // Step 2: The entries, each checked to lie inside the payload behind the table
+    uchar *table = malloc(table_size);
+    image->entries = calloc(count ? count : 1, sizeof(ContainerEntry));
+    if (table == NULL || image->entries == NULL || read_payload(image, 0, table, table_size) == e_failure)
+    {
+        free(table);
+        return e_failure;
+    }
+    const uchar *p = table + CONTAINER_HEADER_SIZE;
+    const uchar *end = table + table_size;
+    for (uint i = 0; i < count; i++)
+    {
+        ContainerEntry *entry = &image->entries[i];
+        uint length = (p < end) ? *p : 0;
+
+        if (length == 0 || end - p < (long)(CONTAINER_ENTRY_FIXED + length))
+        {
+            break;
+        }
+        memcpy(entry->name, p + 1, length);
+        entry->name[length] = '\0';
+        p += 1 + length;
+        entry->flags = *p++;
+        entry->offset = get_le32(p);
+        entry->length = get_le32(p + 4);
+        entry->size = get_le32(p + 8);
+        p += 12;
+        if (entry->offset < table_size || entry->offset > payload_size || entry->length > payload_size - entry->offset ||
+            (!(entry->flags & CONTAINER_ENTRY_LZ) && entry->length != entry->size))
+        {
+            break;
+        }
+        image->count++;
+    }
+    free(table);
+
+    if (image->count != count)
+    {
+        printf("ERROR : Corrupt container table\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+Status do_container_list(const char *image_fname)
+{
+    ContainerImage image;
+    unsigned long long total = 0;
+    Status ret = e_failure;
+
+    if (open_container(image_fname, &image) == e_success)
+    {
+        printf("%-40s %12s %12s %s\n", "name", "size", "stored", "flags");
+        for (uint i = 0; i < image.count; i++)
+        {
+            const ContainerEntry *entry = &image.entries[i];
+            printf("%-40s %12u %12u %s\n", entry->name, entry->size, entry->length, (entry->flags & CONTAINER_ENTRY_LZ) ? "lz" : "-");
+            total += entry->size;
+        }
+        printf("%u entries, %llu bytes (depth %u)\n", image.count, total, image.header.depth);
+        ret = e_success;
+    }
+    close_container(&image);
+    return ret;
+}
+
+/* LZ sink for an entry: write every expanded block to the output file */
+static Status write_block(void *arg, const uchar *data, size_t count)
+{
+    return write_all(*(int *)arg, data, count);
+}
+
+Status do_container_extract(const char *image_fname, const char *name, const char *output_fname)
+{
+    ContainerImage image;
+    const ContainerEntry *entry = NULL;
+    uchar *chunk = NULL;
+    LzStream stream;
+    int fd = -1;
+    Status ret = e_failure;
+
+    if (open_container(image_fname, &image) == e_failure)
+    {
+        close_container(&image);
+        return e_failure;
+    }
+    for (uint i = 0; i < image.count && entry == NULL; i++)
+    {
+        if (strcmp(image.entries[i].name, name) == 0)
+        {
+            entry = &image.entries[i];
+        }
+    }
+    if (entry == NULL)
+    {
+        printf("ERROR : No entry named %s in %s\n", name, image_fname);
+        close_container(&image);
+        return e_failure;
+    }
+
+    // The name comes from the image, never let it leave the current directory
+    if (output_fname == NULL)
+    {
+        if (strchr(entry->name, '/') != NULL || strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0)
+        {
+            printf("ERROR : Entry name %s is not a plain file name, give an output file\n", entry->name);
+            close_container(&image);
+            return e_failure;
+        }
+        output_fname = entry->name;
+    }
+
+    fd = open(output_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    chunk = malloc(CONTAINER_CHUNK_SIZE);
+    if (fd == -1 || chunk == NULL)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", output_fname);
+    }
+    else if (!(entry->flags & CONTAINER_ENTRY_LZ) || lz_stream_init(&stream, write_block, &fd) == e_success)
+    {
+        // Only this entry's payload bytes are extracted, straight from their place after the table
+        ret = e_success;
+        for (uint done = 0; done < entry->length && ret == e_success; )
+        {
+            uint count = (entry->length - done < CONTAINER_CHUNK_SIZE) ? entry->length - done : CONTAINER_CHUNK_SIZE;
+
+            ret = read_payload(&image, entry->offset + done, chunk, count);
+            if (ret == e_success)
+            {
+                ret = (entry->flags & CONTAINER_ENTRY_LZ) ? lz_stream_feed(&stream, chunk, count) : write_all(fd, chunk, count);
+            }
+            done += count;
+        }
+        if ((entry->flags & CONTAINER_ENTRY_LZ) && lz_stream_finish(&stream) == e_failure)
+        {
+            ret = e_failure;
+        }
+
+        // An LZ entry has to expand to exactly the recorded size
+        if (ret == e_success && lseek(fd, 0, SEEK_CUR) != (off_t)entry->size)
+        {
+            ret = e_failure;
+        }
+        if (ret == e_success)
+        {
+            printf("Extracted %s (%u bytes) to %s\n", entry->name, entry->size, output_fname);
+        }
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    free(chunk);
+    close_container(&image);
+    return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+#include "types.h" // Contains user defined types
+#include "encode.h"
+
+/*
+ * Multi-file container
+ * With STEG_MODE_CONTAINER in the mode byte the payload is a container
+ * instead of one secret file. It starts with a table of contents, all
+ * numbers 32 bits little endian:
+ *     entry count
+ *     table size    bytes from the start of the payload to the first entry's data
+ *     per entry:    name length (1 byte), name, flags (1 byte),
+ *                   offset (from the start of the payload), stored length, size
+ * followed by the data of every entry in table order. An entry with
+ * CONTAINER_ENTRY_LZ holds an LZ stream (lz.h) of stored length bytes that
+ * expands to size bytes, otherwise stored length and size are equal.
+ *
+ * The payload sits at a fixed place after the stego header and every payload
+ * byte at a fixed channel offset, so listing only reads the table and pulling
+ * an entry only reads that entry's channel bytes.
+ */
+
+#define CONTAINER_HEADER_SIZE 8
+
+/* Name length byte, name, flags byte, offset, stored length and size */
+#define CONTAINER_ENTRY_FIXED (1 + 1 + 4 + 4 + 4)
+#define MAX_CONTAINER_NAME 255
+
+/* Decoders refuse tables with more entries than this */
+#define MAX_CONTAINER_ENTRIES 65536
+
+/* Entry flag: data is an LZ stream */
+#define CONTAINER_ENTRY_LZ 0x01
+
+/* Extension recorded in the stego header for a container */
+#define CONTAINER_EXTN ".toc"
+
+/* Payload bytes extracted per piece when pulling an entry */
+#define CONTAINER_CHUNK_SIZE (1024 * 1024)
+
+typedef struct _ContainerEntry
+{
+    char name[MAX_CONTAINER_NAME + 1];
+    uint flags;
+    uint offset;
+    uint length;       // Stored bytes
+    uint size;         // Bytes once expanded
+} ContainerEntry;
+
+/* Read and validate pack args: -p carrier.bmp stego.bmp file... [-k depth] [-t threads] [-z] [-q] [--stats|--json] */
+Status read_and_validate_pack_args(char *argv[], EncodeInfo *encInfo);
+
+/*
+ * Write the container for encInfo->container_files into a temporary file
+ * that then serves as the secret stream; called by open_files()
+ */
+Status build_container(EncodeInfo *encInfo);
+
+/* List the entries of a container stego image */
+Status do_container_list(const char *image_fname);
+
+/* Extract one entry by name, to output_fname or to its own name */
+Status do_container_extract(const char *image_fname, const char *name, const char *output_fname);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdint.h>
+#include <string.h>
+#include "crc32c.h"
+#include "types.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+/* Castagnoli polynomial, bit reversed */
+#define CRC32C_POLY 0x82F63B78
+
+/* Slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes */
+static uint crc32c_table[8][256];
+
+/* x^(2^n) mod p, for combining */
+static uint x2n_table[32];
+
+/* Function Definitions */
+
+/* a * b mod p, both reflected polynomials */
+static uint multmodp(uint a, uint b)
+{
+    uint m = 1U << 31;
+    uint p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+            {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* Both tables are filled once at startup, before any thread can ask for a CRC */
+__attribute__((constructor))
+static void crc32c_init_tables(void)
+{
+    for (uint b = 0; b < 256; b++)
+    {
+        uint crc = b;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][b] = crc;
+    }
+    for (uint b = 0; b < 256; b++)
+    {
+        for (int k = 1; k < 8; k++)
+        {
+            uint prev = crc32c_table[k - 1][b];
+            crc32c_table[k][b] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+
+    uint p = 1U << 30;  // x^1
+    x2n_table[0] = p;
+    for (int n = 1; n < 32; n++)
+    {
+        x2n_table[n] = p = multmodp(p, p);
+    }
+}
+
+uint crc32c_update_table(uint crc, const uchar *data, size_t count)
+{
+    crc = ~crc;
+
+    // Eight bytes per step, one lookup per byte in its own table
+    while (count >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xFF] ^ crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^ crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^ crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^ crc32c_table[0][word >> 56];
+        data += 8;
+        count -= 8;
+    }
+    while (count-- > 0)
+    {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xFF];
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint crc32c_update_sse42(uint crc, const uchar *data, size_t count)
+{
+    uint64_t crc64 = ~crc;
+
+    while (count >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        count -= 8;
+    }
+    crc = crc64;
+    while (count-- > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return ~crc;
+}
+#endif
+
+#ifdef CRC32C_ARM
+static uint crc32c_update_arm(uint crc, const uchar *data, size_t count)
+{
+    crc = ~crc;
+    while (count >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        count -= 8;
+    }
+    while (count-- > 0)
+    {
+        crc = __crc32cb(crc, *data++);
+    }
+    return ~crc;
+}
+#endif
+
+uint crc32c_update(uint crc, const uchar *data, size_t count)
+{
+#if defined(CRC32C_X86)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return crc32c_update_sse42(crc, data, count);
+    }
+#elif defined(CRC32C_ARM)
+    return crc32c_update_arm(crc, data, count);
+#endif
+    return crc32c_update_table(crc, data, count);
+}
+
+const char *crc32c_kernel_name(void)
+{
+#if defined(CRC32C_X86)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return "sse4.2";
+    }
+#elif defined(CRC32C_ARM)
+    return "armv8-crc";
+#endif
+    return "table";
+}
+
+/*
+ * Appending length_b bytes multiplies the CRC of A by x^(8 * length_b) mod p,
+ * built from the x^(2^n) table one set bit of the length at a time
+ */
+uint crc32c_combine(uint crc_a, uint crc_b, unsigned long long length_b)
+{
+    uint p = 1U << 31;  // x^0
+    uint k = 3;         // Bytes to bits
+
+    for (; length_b > 0; length_b >>= 1, k++)
+    {
+        if (length_b & 1)
+        {
+            p = multmodp(x2n_table[k & 31], p);
+        }
+    }
+    return multmodp(p, crc_a) ^ crc_b;
+}
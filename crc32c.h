@@ -0,0 +1,27 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * CRC32C (Castagnoli), the payload checksum behind STEG_EXT_CRC32C
+ * As with zlib's crc32(), the running value starts at 0 and is passed back in
+ * with the next piece, so the embed and extract loops check a payload chunk
+ * by chunk while it is hot in cache instead of in a pass of its own. The
+ * crc32 instruction is used where the CPU has it (SSE4.2, ARMv8 CRC), a
+ * slicing-by-8 table otherwise; both give the same value.
+ */
+
+/* CRC of count more bytes after the bytes crc covers */
+uint crc32c_update(uint crc, const uchar *data, size_t count);
+
+/* Table version, the reference for the hardware one */
+uint crc32c_update_table(uint crc, const uchar *data, size_t count);
+
+/* CRC of A followed by B, from the CRCs of both and the length of B */
+uint crc32c_combine(uint crc_a, uint crc_b, unsigned long long length_b);
+
+/* Name of the implementation crc32c_update() uses on this CPU */
+const char *crc32c_kernel_name(void);
+
+#endif
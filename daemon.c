@@ -0,0 +1,1000 @@
+#define _GNU_SOURCE // For unshare(), accept4() and pipe2()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "inspect.h"
+#include "stats.h"
+#include "types.h"
+
+typedef struct _DaemonQueue DaemonQueue;
+
+/* One worker and the buffers it keeps from request to request */
+typedef struct _DaemonWorker
+{
+    int id;
+    DaemonQueue *queue;
+    pthread_t thread;
+    int own_cwd;                              // unshare(CLONE_FS) worked, fchdir() stays in this thread
+    char request[MAX_MANIFEST_LINE];
+    char output[DAEMON_OUTPUT_SIZE];
+    char link[MAX_JOB_ARGS][4200];            // Names given to passed descriptors, in link_dir
+} DaemonWorker;
+
+/* Bounded queue of connections with a request waiting, shared by the accept loop and the workers */
+struct _DaemonQueue
+{
+    int *conns;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    DaemonWorker *workers;
+    int started;
+    int epoll_fd;         // Idle connections, one-shot: a connection fires once per request
+    uchar *open;          // open[fd]: fd is a connection of ours, guarded by lock
+    int open_size;
+    int stop_pipe[2];     // A shutdown request wakes the accept loop through it
+    int home_fd;          // Directory relative paths resolve against without a passed one
+    char link_dir[64];
+
+    /* Totals, guarded by lock */
+    unsigned long done;
+    unsigned long failed;
+};
+
+/* Set by SIGINT / SIGTERM, only delivered while the accept loop waits */
+static volatile sig_atomic_t daemon_signalled;
+
+/* Function Definitions */
+
+static void daemon_signal(int signo)
+{
+    (void)signo;
+    daemon_signalled = 1;
+}
+
+/* Current monotonic time in milliseconds */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Validate the command-line arguments for daemon mode: --serve socket [-j workers]
+Status read_and_validate_serve_args(char *argv[], DaemonOptions *opts)
+{
+    // Default to one worker per online core
+    opts->socket_fname = NULL;
+    opts->workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts->workers < 1)
+    {
+        opts->workers = 1;
+    }
+
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            opts->workers = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (opts->workers < 1)
+            {
+                printf("Error: -j needs a worker count of at least 1\n");
+                return e_failure;
+            }
+        }
+        else if (opts->socket_fname == NULL)
+        {
+            opts->socket_fname = argv[i];
+        }
+        else
+        {
+            printf("Error: unexpected argument %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+
+    if (opts->socket_fname == NULL)
+    {
+        printf("Error: daemon mode needs a socket path\n");
+        return e_failure;
+    }
+    if (strlen(opts->socket_fname) >= sizeof(((struct sockaddr_un *)NULL)->sun_path))
+    {
+        printf("Error: socket path %s is too long\n", opts->socket_fname);
+        return e_failure;
+    }
+    return e_success;
+}
+
+// Validate the command-line arguments for client mode: --client socket [--pass-fds] job...
+Status read_and_validate_client_args(char *argv[], ClientOptions *opts)
+{
+    int i = 3;
+
+    opts->socket_fname = argv[2];
+    opts->pass_fds = 0;
+    if (argv[i] != NULL && strcmp(argv[i], "--pass-fds") == 0)
+    {
+        opts->pass_fds = 1;
+        i++;
+    }
+    opts->job = argv + i;
+
+    if (opts->socket_fname == NULL)
+    {
+        printf("Error: client mode needs a socket path\n");
+        return e_failure;
+    }
+    if (strlen(opts->socket_fname) >= sizeof(((struct sockaddr_un *)NULL)->sun_path))
+    {
+        printf("Error: socket path %s is too long\n", opts->socket_fname);
+        return e_failure;
+    }
+    if (opts->job[0] == NULL || (strcmp(opts->job[0], "-e") != 0 && strcmp(opts->job[0], "-d") != 0 &&
+                                 strcmp(opts->job[0], "-i") != 0 && strcmp(opts->job[0], "shutdown") != 0))
+    {
+        printf("Error: the job has to be -e, -d, -i or shutdown\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+int daemon_connect(const char *socket_fname)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+    // A cut short path would reach some other socket
+    if (strlen(socket_fname) >= sizeof(addr.sun_path))
+    {
+        close(fd);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr.sun_path, socket_fname, strlen(socket_fname) + 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Send head and body, the descriptors go with the first message */
+static Status send_all(int fd, const char *head, size_t head_size, const char *body, size_t body_size,
+                       const int *fds, int nfds)
+{
+    union
+    {
+        struct cmsghdr align;
+        char space[CMSG_SPACE(sizeof(int) * DAEMON_MAX_FDS)];
+    } control;
+    struct iovec iov[2] = { { (void *)head, head_size }, { (void *)body, body_size } };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+    if (nfds > 0)
+    {
+        msg.msg_control = control.space;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    // A stream socket may take less, the descriptors went with the first piece
+    while (iov[0].iov_len + iov[1].iov_len > 0)
+    {
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return e_failure;
+        }
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            size_t part = ((size_t)sent < iov[i].iov_len) ? (size_t)sent : iov[i].iov_len;
+            iov[i].iov_base = (char *)iov[i].iov_base + part;
+            iov[i].iov_len -= part;
+            sent -= part;
+        }
+    }
+    return e_success;
+}
+
+Status daemon_request(int fd, const char *line, const int *fds, int nfds, DaemonReply *reply, FILE *fptr_out)
+{
+    char buffer[MAX_MANIFEST_LINE + DAEMON_REPLY_LINE];
+    size_t fill = 0;
+    char *end = NULL;
+
+    // Step 1: The line and its descriptors in one message
+    int len = snprintf(buffer, sizeof(buffer), "%s\n", line);
+    if (len >= MAX_MANIFEST_LINE || nfds > DAEMON_MAX_FDS || send_all(fd, buffer, len, NULL, 0, fds, nfds) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // Step 2: The reply line, the output may already follow it
+    while (end == NULL)
+    {
+        if (fill == sizeof(buffer))
+        {
+            return e_failure;
+        }
+        ssize_t got = recv(fd, buffer + fill, sizeof(buffer) - fill, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return e_failure;
+        }
+        end = memchr(buffer + fill, '\n', got);
+        fill += got;
+    }
+    *end = '\0';
+    char status[8];
+    if (sscanf(buffer, "%7s %15s %lf %zu", status, reply->operation, &reply->ms, &reply->output_size) != 4)
+    {
+        return e_failure;
+    }
+    reply->status = (strcmp(status, "ok") == 0) ? e_success : e_failure;
+
+    // Step 3: Exactly output_size bytes of output
+    size_t have = fill - (end + 1 - buffer);
+    size_t left = reply->output_size;
+    const char *data = end + 1;
+    while (1)
+    {
+        have = (have < left) ? have : left;
+        if (fptr_out != NULL)
+        {
+            fwrite(data, 1, have, fptr_out);
+        }
+        left -= have;
+        if (left == 0)
+        {
+            break;
+        }
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got < 0 && errno == EINTR)
+        {
+            got = 0;
+        }
+        else if (got <= 0)
+        {
+            return e_failure;
+        }
+        data = buffer;
+        have = got;
+    }
+    return e_success;
+}
+
+/* Option arguments that take a value which is not a file */
+static int takes_value(const char *arg)
+{
+    return strcmp(arg, "-k") == 0 || strcmp(arg, "-t") == 0 || strcmp(arg, "--range") == 0 || strcmp(arg, "--io") == 0;
+}
+
+/*
+ * Send one job
+ * The current directory always goes along, so relative paths mean what
+ * they mean here. With --pass-fds every file is opened here and sent as
+ * @k.ext instead: inputs read-only, the output (and an --in-place carrier)
+ * writable, created if missing.
+ */
+Status do_client(const ClientOptions *opts)
+{
+    char line[MAX_MANIFEST_LINE];
+    int fds[DAEMON_MAX_FDS];
+    int nfds = 0, used = 0, position = 0, in_place = 0;
+    Status ret = e_success;
+    DaemonReply reply;
+
+    fds[nfds++] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fds[0] == -1)
+    {
+        perror("open");
+        return e_failure;
+    }
+    for (char **arg = opts->job; *arg != NULL; arg++)
+    {
+        in_place |= (strcmp(*arg, "--in-place") == 0);
+    }
+
+    // Step 1: The job line, files swapped for descriptors with --pass-fds
+    line[0] = '\0';
+    for (char **arg = opts->job; *arg != NULL && ret == e_success; arg++)
+    {
+        const char *token = *arg;
+        char passed[32];
+
+        if (opts->pass_fds && arg != opts->job && (*arg)[0] != '-' && !takes_value(arg[-1]))
+        {
+            int output = (strcmp(opts->job[0], "-e") == 0 && position == 2) || (strcmp(opts->job[0], "-d") == 0 && position == 1);
+            int writable = output || (in_place && position == 0);
+            const char *base = strrchr(*arg, '/');
+            const char *extn = strchr((base != NULL) ? base + 1 : *arg, '.');
+
+            // --key takes a file that is not one of the positional names
+            if (strcmp(arg[-1], "--key") != 0)
+            {
+                position++;
+            }
+            if (nfds == DAEMON_MAX_FDS || extn == NULL || strlen(extn) >= MAX_FILE_SUFFIX)
+            {
+                printf("Error: %s can not be passed as a descriptor\n", *arg);
+                ret = e_failure;
+                break;
+            }
+            fds[nfds] = open(*arg, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+            if (fds[nfds] == -1)
+            {
+                perror("open");
+                fprintf(stderr, "ERROR : Unable to open file %s\n", *arg);
+                ret = e_failure;
+                break;
+            }
+            snprintf(passed, sizeof(passed), "@%d%s", nfds++, extn);
+            token = passed;
+        }
+        else if (arg != opts->job && (*arg)[0] != '-' && !takes_value(arg[-1]) && strcmp(arg[-1], "--key") != 0)
+        {
+            position++;
+        }
+
+        int len = snprintf(line + used, sizeof(line) - used, "%s%s", used ? " " : "", token);
+        if (len < 0 || (size_t)len >= sizeof(line) - used)
+        {
+            printf("Error: the job is longer than %d bytes\n", MAX_MANIFEST_LINE - 1);
+            ret = e_failure;
+            break;
+        }
+        used += len;
+    }
+
+    // Step 2: Ask the daemon and print what it answered
+    if (ret == e_success)
+    {
+        int fd = daemon_connect(opts->socket_fname);
+        if (fd == -1)
+        {
+            perror("connect");
+            fprintf(stderr, "ERROR : No daemon listening on %s\n", opts->socket_fname);
+            ret = e_failure;
+        }
+        else
+        {
+            if (daemon_request(fd, line, fds, nfds, &reply, stdout) == e_failure)
+            {
+                printf("ERROR : The daemon closed the connection\n");
+                ret = e_failure;
+            }
+            else
+            {
+                printf("%s %s in %.3f ms\n", reply.operation, (reply.status == e_success) ? "ok" : "FAILED", reply.ms);
+                ret = reply.status;
+            }
+            close(fd);
+        }
+    }
+
+    for (int i = 0; i < nfds; i++)
+    {
+        close(fds[i]);
+    }
+    return ret;
+}
+
+/*
+ * Read one request line and the descriptors sent with it
+ * Requests come one at a time, anything past the newline is a protocol
+ * error and so is a line that does not fit. Fails at the end of the
+ * connection too, nfds is 0 then.
+ */
+static Status read_request(int conn, char *line, int *fds, int *nfds)
+{
+    size_t fill = 0;
+    int bad = 0;
+
+    *nfds = 0;
+    while (1)
+    {
+        union
+        {
+            struct cmsghdr align;
+            char space[CMSG_SPACE(sizeof(int) * DAEMON_MAX_FDS)];
+        } control;
+        struct iovec iov = { line + fill, MAX_MANIFEST_LINE - 1 - fill };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.space,
+                              .msg_controllen = sizeof(control.space) };
+
+        ssize_t got = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); got >= 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            {
+                continue;
+            }
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < count; i++)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (*nfds < DAEMON_MAX_FDS)
+                {
+                    fds[(*nfds)++] = fd;
+                }
+                else
+                {
+                    close(fd);
+                    bad = 1;
+                }
+            }
+        }
+        if (got <= 0 || (msg.msg_flags & MSG_CTRUNC))
+        {
+            bad = 1;
+            break;
+        }
+
+        char *end = memchr(line + fill, '\n', got);
+        fill += got;
+        if (end != NULL)
+        {
+            bad |= (end != line + fill - 1);
+            *end = '\0';
+            break;
+        }
+        if (fill == MAX_MANIFEST_LINE - 1)
+        {
+            bad = 1;
+            break;
+        }
+    }
+
+    if (bad)
+    {
+        for (int i = 0; i < *nfds; i++)
+        {
+            close(fds[i]);
+        }
+        *nfds = 0;
+        return e_failure;
+    }
+    line[strcspn(line, "\r")] = '\0';
+    return e_success;
+}
+
+/* Run a split job the way main() would, the output and stage timings go to fptr_out */
+static Status run_operation(char *argv[], int argc, FILE *fptr_out, const char **operation)
+{
+    if (argc >= 4 && strcmp(argv[1], "-e") == 0)
+    {
+        EncodeInfo encInfo;
+
+        *operation = "encode";
+        if (read_and_validate_encode_args(argv, &encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        encInfo.quiet = 1;
+        encInfo.stats.mode = e_stats_off;  // The reply carries the timings, the daemon prints nothing
+        Status status = do_encoding(&encInfo);
+        stats_write_json(fptr_out, &encInfo.stats, *operation, status);
+        return status;
+    }
+    else if (argc >= 3 && strcmp(argv[1], "-d") == 0)
+    {
+        DecodeInfo decInfo;
+
+        *operation = "decode";
+        if (read_and_validate_decode_args(argv, &decInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        decInfo.quiet = 1;
+        decInfo.stats.mode = e_stats_off;
+        Status status = do_decoding(&decInfo);
+        stats_write_json(fptr_out, &decInfo.stats, *operation, status);
+        return status;
+    }
+    else if (argc >= 3 && strcmp(argv[1], "-i") == 0)
+    {
+        InspectOptions inspectOpts;
+
+        *operation = "inspect";
+        if (read_and_validate_inspect_args(argv, &inspectOpts) == e_failure)
+        {
+            return e_failure;
+        }
+        return do_inspect(&inspectOpts, fptr_out);
+    }
+
+    *operation = "invalid";
+    return e_failure;
+}
+
+/*
+ * Run one request
+ * fds[0] is the client's directory, @k.ext arguments become links to
+ * /proc/self/fd/N of descriptor k named with the extension, so the engine
+ * opens them like any other path and sees the extension it checks for.
+ */
+static Status run_request(DaemonWorker *worker, const int *fds, int nfds, FILE *fptr_out, const char **operation)
+{
+    char *argv[MAX_JOB_ARGS + 2];
+    int argc = split_job_line(worker->request, "daemon", argv);
+    int links = 0;
+    Status ret = e_success;
+
+    *operation = "invalid";
+    if (argc < 2)
+    {
+        return e_failure;
+    }
+
+    // Step 1: Relative paths resolve against the client's directory, or the daemon's own
+    if (nfds > 0 && !worker->own_cwd)
+    {
+        return e_failure;
+    }
+    if (worker->own_cwd && fchdir((nfds > 0) ? fds[0] : worker->queue->home_fd) == -1)
+    {
+        perror("fchdir");
+        return e_failure;
+    }
+
+    // Step 2: Name the passed descriptors
+    for (int i = 2; i < argc && ret == e_success; i++)
+    {
+        char target[64], *extn;
+
+        if (argv[i][0] != '@')
+        {
+            continue;
+        }
+        long k = strtol(argv[i] + 1, &extn, 10);
+        if (extn == argv[i] + 1 || k < 1 || k >= nfds || *extn != '.' || strchr(extn, '/') != NULL ||
+            strlen(extn) >= MAX_FILE_SUFFIX)
+        {
+            ret = e_failure;
+            break;
+        }
+        snprintf(worker->link[links], sizeof(worker->link[links]), "%s/%d_%d%s", worker->queue->link_dir, worker->id, links, extn);
+        snprintf(target, sizeof(target), "/proc/self/fd/%d", fds[k]);
+        unlink(worker->link[links]);
+        if (symlink(target, worker->link[links]) == -1)
+        {
+            perror("symlink");
+            ret = e_failure;
+            break;
+        }
+        argv[i] = worker->link[links++];
+    }
+
+    // Step 3: The job itself, then drop the names again
+    if (ret == e_success)
+    {
+        ret = run_operation(argv, argc, fptr_out, operation);
+    }
+    for (int i = 0; i < links; i++)
+    {
+        unlink(worker->link[i]);
+    }
+    return ret;
+}
+
+/* Stop taking requests and wake the accept loop, safe to call more than once */
+static void daemon_stop(DaemonQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    if (write(queue->stop_pipe[1], "", 1) < 0)
+    {
+        // The pipe already holds a wake-up
+    }
+}
+
+/* Close a connection, forgetting it first so its number can be reused */
+static void close_connection(DaemonQueue *queue, int conn)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->open[conn] = 0;
+    pthread_mutex_unlock(&queue->lock);
+    close(conn);
+}
+
+/* Run one request and answer it, fails when the connection is done */
+static Status serve_request(DaemonWorker *worker, int conn)
+{
+    DaemonQueue *queue = worker->queue;
+    char reply[DAEMON_REPLY_LINE];
+    int fds[DAEMON_MAX_FDS], nfds;
+    const char *operation = "invalid";
+    size_t output_size = 0;
+    Status status = e_failure;
+
+    // Step 1: The request, into the buffer kept from the last one
+    if (read_request(conn, worker->request, fds, &nfds) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // Step 2: Run it, collecting its output in the kept output buffer
+    double start = now_ms();
+    if (strcmp(worker->request, "shutdown") == 0)
+    {
+        operation = "shutdown";
+        status = e_success;
+        daemon_stop(queue);
+    }
+    else
+    {
+        FILE *fptr_out = fmemopen(worker->output, sizeof(worker->output), "w");
+        if (fptr_out != NULL)
+        {
+            status = run_request(worker, fds, nfds, fptr_out, &operation);
+            fflush(fptr_out);
+            long pos = ftell(fptr_out);
+            output_size = (pos > 0) ? (size_t)pos : 0;
+            fclose(fptr_out);
+        }
+    }
+    double elapsed = now_ms() - start;
+    for (int i = 0; i < nfds; i++)
+    {
+        close(fds[i]);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->done++;
+    if (status == e_failure)
+    {
+        queue->failed++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    // Step 3: Reply line and output in one message
+    int len = snprintf(reply, sizeof(reply), "%s\t%s\t%.3f\t%zu\n", (status == e_success) ? "ok" : "FAILED",
+                       operation, elapsed, output_size);
+    return send_all(conn, reply, len, worker->output, output_size, NULL, 0);
+}
+
+/* Worker thread: one request at a time from whichever connection has one, until the daemon stops */
+static void *daemon_worker(void *arg)
+{
+    DaemonWorker *worker = arg;
+    DaemonQueue *queue = worker->queue;
+
+    // A working directory of its own, so fchdir() for one client leaves the other workers alone
+    worker->own_cwd = (unshare(CLONE_FS) == 0);
+
+    while (1)
+    {
+        // Step 1: Take the next connection with a request, or stop with the daemon
+        pthread_mutex_lock(&queue->lock);
+        while (queue->count == 0 && !queue->closed)
+        {
+            pthread_cond_wait(&queue->not_empty, &queue->lock);
+        }
+        if (queue->closed)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        int conn = queue->conns[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        pthread_mutex_unlock(&queue->lock);
+
+        // Step 2: Serve it, then hand the connection back to the accept loop for its next request
+        struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT, .data.fd = conn };
+        if (serve_request(worker, conn) == e_failure || epoll_ctl(queue->epoll_fd, EPOLL_CTL_MOD, conn, &event) == -1)
+        {
+            close_connection(queue, conn);
+        }
+    }
+    return NULL;
+}
+
+/* Queue a connection with a request waiting, waits while the queue is full, fails once the daemon stops */
+static Status queue_connection(DaemonQueue *queue, int conn)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity && !queue->closed)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    if (queue->closed)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        return e_failure;
+    }
+    queue->conns[(queue->head + queue->count) % queue->capacity] = conn;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return e_success;
+}
+
+/* Bind the socket, taking over the path only from a daemon that is gone */
+static int listen_socket(const char *socket_fname)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+
+    // bind() would take a cut short name while the daemon unlinks the full one on exit
+    if (strlen(socket_fname) >= sizeof(addr.sun_path))
+    {
+        printf("ERROR : Socket path %s is longer than %zu bytes\n", socket_fname, sizeof(addr.sun_path) - 1);
+        return -1;
+    }
+    if (lstat(socket_fname, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int fd = daemon_connect(socket_fname);
+        if (fd != -1)
+        {
+            close(fd);
+            printf("ERROR : A daemon is already listening on %s\n", socket_fname);
+            return -1;
+        }
+        unlink(socket_fname);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memcpy(addr.sun_path, socket_fname, strlen(socket_fname) + 1);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, DAEMON_BACKLOG) == -1)
+    {
+        perror("socket");
+        fprintf(stderr, "ERROR : Unable to listen on %s\n", socket_fname);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+/* Take a new connection and watch it for its first request */
+static void accept_connection(DaemonQueue *queue, int listen_fd)
+{
+    struct timeval timeout = { DAEMON_REQUEST_TIMEOUT, 0 };
+    struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT };
+    int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (conn == -1)
+    {
+        return;
+    }
+
+    // A request that arrives only in part can not hold a worker for longer than the timeout
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    pthread_mutex_lock(&queue->lock);
+    if (conn >= queue->open_size)
+    {
+        int size = 2 * conn + 64;
+        uchar *open = realloc(queue->open, size);
+        if (open == NULL)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            close(conn);
+            return;
+        }
+        memset(open + queue->open_size, 0, size - queue->open_size);
+        queue->open = open;
+        queue->open_size = size;
+    }
+    queue->open[conn] = 1;
+    pthread_mutex_unlock(&queue->lock);
+
+    event.data.fd = conn;
+    if (epoll_ctl(queue->epoll_fd, EPOLL_CTL_ADD, conn, &event) == -1)
+    {
+        close_connection(queue, conn);
+    }
+}
+
+/* Accept connections and pass on the ones with a request until a shutdown request or a signal */
+static void accept_loop(DaemonQueue *queue, int listen_fd, const sigset_t *wait_mask)
+{
+    struct epoll_event events[DAEMON_BACKLOG];
+
+    while (!daemon_signalled)
+    {
+        // SIGINT / SIGTERM are only unblocked inside the wait, no signal slips in between
+        int count = epoll_pwait(queue->epoll_fd, events, DAEMON_BACKLOG, -1, wait_mask);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_pwait");
+            return;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.fd == queue->stop_pipe[0])
+            {
+                return;
+            }
+            else if (events[i].data.fd == listen_fd)
+            {
+                accept_connection(queue, listen_fd);
+            }
+            else if (queue_connection(queue, events[i].data.fd) == e_failure)
+            {
+                return;
+            }
+        }
+    }
+}
+
+Status do_serve(const DaemonOptions *opts)
+{
+    DaemonQueue queue;
+    sigset_t block, wait_mask;
+    struct sigaction action;
+    struct epoll_event event = { .events = EPOLLIN };
+
+    // Step 1: The socket, a directory for names of passed descriptors, the wake-up pipe and the epoll set
+    int listen_fd = listen_socket(opts->socket_fname);
+    if (listen_fd == -1)
+    {
+        return e_failure;
+    }
+    strcpy(queue.link_dir, "/tmp/lsb_daemon_XXXXXX");  // No dot, the extension is taken from the first one
+    queue.home_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    queue.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    queue.stop_pipe[0] = queue.stop_pipe[1] = -1;
+    if (mkdtemp(queue.link_dir) == NULL || queue.home_fd == -1 || queue.epoll_fd == -1 ||
+        pipe2(queue.stop_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+    {
+        perror("daemon");
+        close(listen_fd);
+        unlink(opts->socket_fname);
+        rmdir(queue.link_dir);
+        if (queue.home_fd != -1)
+        {
+            close(queue.home_fd);
+        }
+        if (queue.epoll_fd != -1)
+        {
+            close(queue.epoll_fd);
+        }
+        return e_failure;
+    }
+    event.data.fd = listen_fd;
+    epoll_ctl(queue.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.fd = queue.stop_pipe[0];
+    epoll_ctl(queue.epoll_fd, EPOLL_CTL_ADD, queue.stop_pipe[0], &event);
+
+    // Step 2: Keep the engine's block buffers in the workers' heaps, so a request reuses the pages the last one faulted in
+    mallopt(M_MMAP_THRESHOLD, DAEMON_MMAP_THRESHOLD);
+    mallopt(M_TRIM_THRESHOLD, 4 * DAEMON_MMAP_THRESHOLD);
+
+    // Step 3: Signals stay blocked everywhere but in the accept loop's wait
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = daemon_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    // Step 4: Set up the bounded queue and start the workers
+    queue.capacity = opts->workers * DAEMON_QUEUE_PER_WORKER;
+    queue.conns = malloc(queue.capacity * sizeof(int));
+    queue.workers = malloc(opts->workers * sizeof(DaemonWorker));
+    queue.open = NULL;
+    queue.open_size = 0;
+    queue.head = queue.count = queue.closed = queue.started = 0;
+    queue.done = queue.failed = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+
+    double start = now_ms();
+    if (queue.conns != NULL && queue.workers != NULL)
+    {
+        for (; queue.started < opts->workers; queue.started++)
+        {
+            DaemonWorker *worker = &queue.workers[queue.started];
+            worker->id = queue.started;
+            worker->queue = &queue;
+            if (pthread_create(&worker->thread, NULL, daemon_worker, worker) != 0)
+            {
+                break;
+            }
+        }
+    }
+
+    // Step 5: Hand requests to the workers until told to stop
+    if (queue.started > 0)
+    {
+        printf("Daemon: listening on %s with %d workers\n", opts->socket_fname, queue.started);
+        fflush(stdout);
+        accept_loop(&queue, listen_fd, &wait_mask);
+    }
+
+    // Step 6: Stop, let running requests finish, then drop every connection still open
+    daemon_stop(&queue);
+    for (int i = 0; i < queue.started; i++)
+    {
+        pthread_join(queue.workers[i].thread, NULL);
+    }
+    for (int fd = 0; fd < queue.open_size; fd++)
+    {
+        if (queue.open[fd])
+        {
+            close(fd);
+        }
+    }
+    double elapsed = now_ms() - start;
+
+    printf("Daemon: %lu requests, %lu failed, %d workers, %.3f s\n", queue.done, queue.failed, queue.started, elapsed / 1e3);
+
+    pthread_sigmask(SIG_UNBLOCK, &block, NULL);
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.not_empty);
+    pthread_cond_destroy(&queue.not_full);
+    free(queue.conns);
+    free(queue.workers);
+    free(queue.open);
+    close(listen_fd);
+    unlink(opts->socket_fname);
+    rmdir(queue.link_dir);
+    close(queue.home_fd);
+    close(queue.epoll_fd);
+    close(queue.stop_pipe[0]);
+    close(queue.stop_pipe[1]);
+
+    return (queue.started > 0) ? e_success : e_failure;
+}
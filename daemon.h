@@ -0,0 +1,86 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Daemon mode
+ * --serve keeps one process listening on a Unix stream socket, so a job
+ * pays neither process startup nor argument parsing in main(). A request is
+ * one line written like a batch manifest line (-e ..., -d ..., -i ...) and
+ * "shutdown" stops the daemon. Descriptors can come along with the line
+ * (SCM_RIGHTS): the first one is the directory relative paths resolve
+ * against (every worker has a working directory of its own), and token
+ * @k.ext stands for descriptor k, a file the daemon need not be able to
+ * name. A connection can carry any number of requests, one at a time: the
+ * accept loop watches idle connections with epoll and hands each request to
+ * the next free worker of a fixed pool, so an idle client holds no worker.
+ *
+ * Every request is answered with one line
+ *     ok|FAILED <tab> operation <tab> ms <tab> output bytes
+ * followed by that many bytes of output: the inspect lines, or the stage
+ * timings of an encode or decode as one line of JSON (stats.h).
+ */
+
+/* Descriptors one request can pass, the working directory included */
+#define DAEMON_MAX_FDS 8
+
+/* Output a worker collects per request, kept for the next one */
+#define DAEMON_OUTPUT_SIZE (64 * 1024)
+
+/* Longest reply line in front of the output */
+#define DAEMON_REPLY_LINE 128
+
+#define DAEMON_BACKLOG 64
+
+/* Seconds a worker waits for the rest of a request that arrived in part */
+#define DAEMON_REQUEST_TIMEOUT 5
+
+/* Requests waiting for a worker, per worker */
+#define DAEMON_QUEUE_PER_WORKER 4
+
+/* Engine buffers up to this size stay in the worker's heap between requests instead of a fresh mmap() each */
+#define DAEMON_MMAP_THRESHOLD (8 * 1024 * 1024)
+
+typedef struct _DaemonOptions
+{
+    char *socket_fname;
+    int workers;
+} DaemonOptions;
+
+typedef struct _ClientOptions
+{
+    char *socket_fname;
+    int pass_fds;    // --pass-fds: open the files here and send descriptors instead of names
+    char **job;      // NULL terminated, points into argv
+} ClientOptions;
+
+/* What the daemon answered to one request */
+typedef struct _DaemonReply
+{
+    Status status;
+    char operation[16];
+    double ms;             // Time the worker spent on the request
+    size_t output_size;
+} DaemonReply;
+
+/* Read and validate serve args from argv */
+Status read_and_validate_serve_args(char *argv[], DaemonOptions *opts);
+
+/* Listen on the socket and run requests until "shutdown", SIGINT or SIGTERM */
+Status do_serve(const DaemonOptions *opts);
+
+/* Read and validate client args from argv */
+Status read_and_validate_client_args(char *argv[], ClientOptions *opts);
+
+/* Send one job to a daemon and print its output, fails if the job failed */
+Status do_client(const ClientOptions *opts);
+
+/* Connect to the daemon on socket_fname, returns the socket or -1 */
+int daemon_connect(const char *socket_fname);
+
+/* Send one request with nfds descriptors and wait for its reply, the output goes to fptr_out (NULL drops it) */
+Status daemon_request(int fd, const char *line, const int *fds, int nfds, DaemonReply *reply, FILE *fptr_out);
+
+#endif
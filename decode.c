@@ -3,25 +3,87 @@
 #include "types.h"
 #include <string.h>
 #include "common.h"
+#include "lsb.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "scatter.h"
 #include <stdlib.h>
-#include <unistd.h> // For sleep()
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Function definition for read and validate decode args
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 {
+    char *fname[2] = { NULL, "decode.txt" };  // Secret file defaults to "decode.txt"
+    int count = 0;
+
+    // Defaults for the options
+    decInfo->d_threads = 1;
+    decInfo->d_io_mode = e_pipeline_auto;
+    decInfo->quiet = 0;
+    decInfo->stats.mode = e_stats_off;
+    decInfo->d_range_offset = 0;
+    decInfo->d_range_end = -1;
+    decInfo->d_key_fname = NULL;
+
+    // Separate the options from the file names
+    for (int i = 2; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            int threads = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (threads < 1 || threads > MAX_EXTRACT_THREADS) {
+                printf("Decoding validation failed: -t needs a thread count from 1 to %d.\n", MAX_EXTRACT_THREADS);
+                return e_failure;
+            }
+            decInfo->d_threads = threads;
+        } else if (strcmp(argv[i], "--range") == 0) {
+            // offset:length, or offset: for everything from offset on
+            long long offset = -1, length = -1;
+            int used = 0;
+            if (argv[i + 1] == NULL || sscanf(argv[++i], "%lld:%n", &offset, &used) != 1 || used == 0 || offset < 0 ||
+                (argv[i][used] != '\0' && (sscanf(argv[i] + used, "%lld", &length) != 1 || length < 0))) {
+                printf("Decoding validation failed: --range needs offset:length in bytes.\n");
+                return e_failure;
+            }
+            decInfo->d_range_offset = offset;
+            decInfo->d_range_end = (length < 0) ? LLONG_MAX : offset + length;
+        } else if (strcmp(argv[i], "--key") == 0) {
+            if (argv[i + 1] == NULL) {
+                printf("Decoding validation failed: --key needs a key file.\n");
+                return e_failure;
+            }
+            decInfo->d_key_fname = argv[++i];
+        } else if (strcmp(argv[i], "--io") == 0) {
+            if (argv[i + 1] == NULL || pipeline_parse_mode(argv[i + 1], &decInfo->d_io_mode) == e_failure) {
+                printf("Decoding validation failed: --io needs auto, uring, threads or off.\n");
+                return e_failure;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            decInfo->stats.mode = e_stats_text;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            decInfo->stats.mode = e_stats_json;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            decInfo->quiet = 1;
+        } else if (count < 2) {
+            fname[count++] = argv[i];
+        } else {
+            printf("Decoding validation failed: unexpected argument %s.\n", argv[i]);
+            return e_failure;
+        }
+    }
+
     // Ensure the source image file is a .bmp file
-    if (strstr(argv[2], ".bmp") == NULL) {
+    if (fname[0] == NULL || strstr(fname[0], ".bmp") == NULL) {
         printf("Decoding validation failed: Invalid image file (must be .bmp).\n");
         return e_failure;
     }
-    decInfo->d_src_image_fname = argv[2];  // Assign source image filename
-
-    // Validate secret file: If not provided, default to "decode.txt"
-    if (argv[3] != NULL) {
-        decInfo->d_secret_fname = argv[3];
-    } else {
-        decInfo->d_secret_fname = "decode.txt";  // Default filename
-    }
+    decInfo->d_src_image_fname = fname[0];  // Assign source image filename
+    decInfo->d_secret_fname = fname[1];
 
     return e_success;  // Return success if all validation passed
 }
@@ -29,34 +91,103 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 // Function definition for opening files for decoding
 Status open_files_dec(DecodeInfo *decInfo)
 {
+    struct stat st;
+
+    // Nothing is open yet, so close_files_dec() knows what to release on failure
+    decInfo->d_image_map = NULL;
+    decInfo->fd_d_secret = -1;
+    decInfo->d_secret_buf = NULL;
+    decInfo->d_channel_buf = NULL;
+    decInfo->magic_data = NULL;
+    decInfo->d_extn_secret_file = NULL;
+    decInfo->d_decrypt = 0;
+    decInfo->d_scattered = 0;
+
     // Open the source image file (stego image) in read mode
-    decInfo->fptr_d_src_image = fopen(decInfo->d_src_image_fname, "r");
-    if (decInfo->fptr_d_src_image == NULL) {
-        perror("fopen");
+    decInfo->fd_d_src_image = open(decInfo->d_src_image_fname, O_RDONLY);
+    if (decInfo->fd_d_src_image == -1) {
+        perror("open");
         fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo->d_src_image_fname);
         return e_failure;
     }
 
+    // Map the whole stego image read-only, the extract kernel runs straight over it
+    if (fstat(decInfo->fd_d_src_image, &st) == -1 || st.st_size < 54) {
+        fprintf(stderr, "ERROR: %s is not a valid image\n", decInfo->d_src_image_fname);
+        return e_failure;
+    }
+    decInfo->d_image_size = st.st_size;
+    decInfo->d_image_map = mmap(NULL, decInfo->d_image_size, PROT_READ, MAP_PRIVATE, decInfo->fd_d_src_image, 0);
+    if (decInfo->d_image_map == MAP_FAILED) {
+        decInfo->d_image_map = NULL;
+        perror("mmap");
+        fprintf(stderr, "ERROR: Unable to map file %s\n", decInfo->d_src_image_fname);
+        return e_failure;
+    }
+    // A range only faults in the pages it needs, no read-ahead over the rest of the image
+    madvise((void *)decInfo->d_image_map, decInfo->d_image_size, (decInfo->d_range_end < 0) ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+    // Output buffer the secret data is extracted into before each write, plus a group for unaligned ranges
+    decInfo->d_secret_buf = malloc(DECODE_CHUNK_SIZE + LSB_MAX_DEPTH);
+    if (decInfo->d_secret_buf == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate %d byte output buffer\n", DECODE_CHUNK_SIZE);
+        return e_failure;
+    }
+
+    return e_success;  // Return success if the stego image is mapped
+}
+
+// Function definition for opening the secret file, only once the header has validated so a bad image leaves it untouched
+static Status open_secret_file(DecodeInfo *decInfo)
+{
     // Open the secret file in write mode to store the decoded data
-    decInfo->fptr_d_secret = fopen(decInfo->d_secret_fname, "w");
-    if (decInfo->fptr_d_secret == NULL) {
-        perror("fopen");
+    decInfo->fd_d_secret = open(decInfo->d_secret_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (decInfo->fd_d_secret == -1) {
+        perror("open");
         fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo->d_secret_fname);
         return e_failure;
     }
+    return e_success;
+}
 
-    return e_success;  // Return success if both files are opened
+// Function definition for viewing count payload channels from channel first, through the tile order when scattered
+static const uchar *payload_view(DecodeInfo *decInfo, unsigned long long first, size_t count, uchar *buffer)
+{
+    if (decInfo->d_scattered) {
+        scatter_gather(&decInfo->d_scatter, &decInfo->d_layout, decInfo->d_image_map, first - decInfo->d_scatter.base, count, buffer);
+        return buffer;
+    }
+    return bmp_view(&decInfo->d_layout, decInfo->d_image_map, first, count, buffer);
+}
+
+// Function definition for taking the next count channel bytes of the mapped stego image
+const uchar *take_image_bytes(size_t count, DecodeInfo *decInfo)
+{
+    StegCursor *cursor = &decInfo->d_cursor;
+
+    // The recorded sizes come from the image itself, never go past its last channel byte
+    if (count > decInfo->d_layout.channels - cursor->pos) {
+        return NULL;
+    }
+    const uchar *image_buffer = payload_view(decInfo, cursor->pos, count, decInfo->d_channel_buf);
+    cursor->pos += count;
+    return image_buffer;
 }
 
 // Function definition for decoding magic string from image
 Status decode_magic_string(DecodeInfo *decInfo)
 {
-    fseek(decInfo->fptr_d_src_image, 54, SEEK_SET);  // Skip the first 54 bytes (BMP header)
+    // Pick the layout the image was embedded with, the cursor only covers its channel bytes
+    if (steg_open_image(decInfo->d_image_map, decInfo->d_image_size, &decInfo->d_layout, &decInfo->d_cursor, decInfo->d_head) == e_failure) {
+        return e_failure;
+    }
     int i = strlen(MAGIC_STRING);
     decInfo->magic_data = malloc(strlen(MAGIC_STRING) + 1);  // Allocate memory for magic string
 
     // Decode the magic string from the image
-    decode_data_from_image(strlen(MAGIC_STRING), decInfo->fptr_d_src_image, decInfo);
+    if (decode_data_from_image(strlen(MAGIC_STRING), decInfo) == e_failure) {
+        return e_failure;
+    }
     decInfo->magic_data[i] = '\0';  // Null-terminate the decoded magic string
 
     // Verify if the decoded string matches the expected magic string
@@ -68,44 +199,34 @@ Status decode_magic_string(DecodeInfo *decInfo)
 }
 
 // Function definition for decoding data (characters) from image
-Status decode_data_from_image(int size, FILE *fptr_d_src_image, DecodeInfo *decInfo)
+Status decode_data_from_image(int size, DecodeInfo *decInfo)
 {
-    int i;
-    char str[8];
-
-    // Read 8 bits (1 byte) at a time and decode it from LSB
-    for (i = 0; i < size; i++) {
-        fread(str, 8, sizeof(char), fptr_d_src_image);  // Read 8 bits from the image
-        decode_byte_from_lsb(&decInfo->magic_data[i], str);  // Decode the byte from LSB
-    }
-
-    return e_success;  // Return success after decoding all data
+    // Decode all size bytes from the LSBs of the mapped image at once
+    return steg_get_data(&decInfo->d_cursor, (uchar *)decInfo->magic_data, size);
 }
 
-// Function definition for decoding a single byte from LSB (Least Significant Bit)
-Status decode_byte_from_lsb(char *data, char *image_buffer)
+// Function definition for decoding the stego mode byte (embedding depth) from image
+Status decode_stego_mode(DecodeInfo *decInfo)
 {
-    int bit = 7;  // Start from the most significant bit (MSB)
-    unsigned char ch = 0x00;
-
-    // Extract the LSB from each byte in the image buffer
-    for (int i = 0; i < 8; i++) {
-        ch = ((image_buffer[i] & 0x01) << bit--) | ch;  // Shift the LSB into place
-    }
+    // Images without a mode byte decode as 1 bit deep, see steg_get_mode()
+    return steg_get_mode(&decInfo->d_cursor);
+}
 
-    *data = ch;  // Store the decoded byte
-    return e_success;  // Return success
+// Function definition for decoding a 32 bit size field at the decoded depth
+Status decode_size_from_image(int *size, DecodeInfo *decInfo)
+{
+    return steg_get_size(&decInfo->d_cursor, (uint *)size);
 }
 
 // Function definition for decoding file extension size from the image
-Status decode_file_extn_size(int size, FILE *fptr_d_src_image)
+Status decode_file_extn_size(int size, DecodeInfo *decInfo)
 {
-    char str[32];
     int length;
 
-    // Read the 32 bits representing the extension size from the image
-    fread(str, 32, sizeof(char), fptr_d_src_image);
-    decode_size_from_lsb(str, &length);  // Decode the size value from LSB
+    // Decode the 32 bits representing the extension size from the image
+    if (decode_size_from_image(&length, decInfo) == e_failure) {
+        return e_failure;
+    }
 
     // Verify if the decoded size matches the expected size
     if (length == size) {
@@ -115,21 +236,6 @@ Status decode_file_extn_size(int size, FILE *fptr_d_src_image)
     }
 }
 
-// Function definition for decoding size (32-bit integer) from LSB
-Status decode_size_from_lsb(char *buffer, int *size)
-{
-    int j = 31;
-    int num = 0x00;
-
-    // Decode a 32-bit integer by extracting each LSB from the buffer
-    for (int i = 0; i < 32; i++) {
-        num = ((buffer[i] & 0x01) << j--) | num;
-    }
-
-    *size = num;  // Store the decoded size value
-    return e_success;  // Return success
-}
-
 // Function definition for decoding secret file extension from the image
 Status decode_secret_file_extn(char *file_ext, DecodeInfo *decInfo)
 {
@@ -138,7 +244,9 @@ Status decode_secret_file_extn(char *file_ext, DecodeInfo *decInfo)
     decInfo->d_extn_secret_file = malloc(i + 1);  // Allocate memory for the extension
 
     // Decode the file extension from the image
-    decode_extension_data_from_image(strlen(file_ext), decInfo->fptr_d_src_image, decInfo);
+    if (decode_extension_data_from_image(strlen(file_ext), decInfo) == e_failure) {
+        return e_failure;
+    }
     decInfo->d_extn_secret_file[i] = '\0';  // Null-terminate the decoded extension
 
     // Verify if the decoded extension matches the expected extension
@@ -150,100 +258,706 @@ Status decode_secret_file_extn(char *file_ext, DecodeInfo *decInfo)
 }
 
 // Function definition for decoding extension data (string) from the image
-Status decode_extension_data_from_image(int size, FILE *fptr_d_src_image, DecodeInfo *decInfo)
+Status decode_extension_data_from_image(int size, DecodeInfo *decInfo)
+{
+    return steg_get_data(&decInfo->d_cursor, (uchar *)decInfo->d_extn_secret_file, size);  // Decode bytes from LSB
+}
+
+// Function definition for decoding the nonce of an encrypted payload and keying the cipher with it
+Status decode_secret_file_nonce(DecodeInfo *decInfo)
 {
-    for (int i = 0; i < size; i++) {
-        fread(decInfo->d_src_image_fname, 8, 1, fptr_d_src_image);  // Read 8 bits from image
-        decode_byte_from_lsb(&decInfo->d_extn_secret_file[i], decInfo->d_src_image_fname);  // Decode byte from LSB
+    uchar nonce[CHACHA20_NONCE_SIZE];
+    uchar key[CHACHA20_KEY_SIZE];
+
+    if (!(decInfo->d_cursor.flags & STEG_EXT_CHACHA20)) {
+        return e_success;
+    }
+    if (steg_get_data(&decInfo->d_cursor, nonce, CHACHA20_NONCE_SIZE) == e_failure) {
+        return e_failure;
     }
-    return e_success;  // Return success after decoding all extension data
+    if (chacha20_read_key(decInfo->d_key_fname, key) == e_failure) {
+        fprintf(stderr, "ERROR: %s is not a %d byte key file\n", decInfo->d_key_fname, CHACHA20_KEY_SIZE);
+        return e_failure;
+    }
+    chacha20_init(&decInfo->d_cipher, key, nonce);
+    explicit_bzero(key, sizeof(key));
+    decInfo->d_decrypt = 1;
+    return e_success;
 }
 
 // Function definition for decoding secret file size from the image
 Status decode_secret_file_size(int file_size, DecodeInfo *decInfo)
 {
-    char str[32];
+    // Decode the 32 bits representing the secret file size from the image
+    if (decode_size_from_image(&file_size, decInfo) == e_failure) {
+        return e_failure;
+    }
 
-    // Read the 32 bits representing the secret file size from the image
-    fread(str, 32, sizeof(char), decInfo->fptr_d_src_image);
-    decode_size_from_lsb(str, &file_size);  // Decode the size from LSB
+    // A size the rest of the image cannot hold means this is not a valid stego image
+    if (file_size < 0 ||
+        steg_payload_channels(decInfo->d_cursor.depth, decInfo->d_cursor.flags, file_size) > decInfo->d_layout.channels - decInfo->d_cursor.pos) {
+        return e_failure;
+    }
 
     // Store the decoded size in the DecodeInfo structure
     decInfo->size_secret_file = file_size;
     return e_success;  // Return success
 }
 
+// Function definition for drawing the tile order of a scattered payload
+Status decode_scatter_map(DecodeInfo *decInfo)
+{
+    if (!(decInfo->d_cursor.flags & STEG_EXT_SCATTER)) {
+        return e_success;
+    }
+    if (scatter_map_init(&decInfo->d_scatter, &decInfo->d_cipher, decInfo->d_cursor.pos, decInfo->d_layout.channels) == e_failure) {
+        return e_failure;
+    }
+    decInfo->d_scattered = 1;
+    return e_success;
+}
+
+// Function definition for writing one expanded LZ block to the secret file
+static Status write_expanded(void *arg, const uchar *data, size_t count)
+{
+    DecodeInfo *decInfo = arg;
+
+    decInfo->d_written += count;
+    return write_all(decInfo->fd_d_secret, data, count);
+}
+
+/*
+ * Function definition for decoding secret file data through pipelines
+ * The payload's file bytes are read block by block into the input pipeline's
+ * buffers instead of being faulted in from the map, and the extracted chunks
+ * go out through an output pipeline at their own offsets, so the next block is
+ * read and the last chunk written while this one is extracted. A partial group
+ * at the end of a block moves into the headroom in front of the next block.
+ * An LZ payload is expanded and written in order as before, only its input
+ * comes through the pipeline.
+ */
+static Status decode_secret_file_data_pipelined(DecodeInfo *decInfo, unsigned long long start, unsigned long long end)
+{
+    const BmpLayout *layout = &decInfo->d_layout;
+    size_t left = decInfo->size_secret_file;
+    uint depth = decInfo->d_cursor.depth;
+    unsigned long long channel = decInfo->d_cursor.pos;
+    int expand = (decInfo->d_cursor.flags & STEG_MODE_LZ) != 0;
+    int checksum = (decInfo->d_cursor.flags & STEG_EXT_CRC32C) != 0;
+    Pipeline in, out;
+    PipeStat in_stat, out_stat;
+    PipelineBlock *block = NULL;
+    const uchar *raw = NULL;            // The block's bytes with the carried tail in front, raw[0] at file offset raw_offset
+    unsigned long long raw_offset = start;
+    size_t raw_len = 0;
+    LzStream stream;
+    Status ret = e_success;
+
+    if (!bmp_is_contiguous(layout)) {
+        decInfo->d_channel_buf = malloc(DECODE_CHUNK_SIZE + PIPELINE_HEADROOM);
+        if (decInfo->d_channel_buf == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate the channel buffer\n");
+            return e_failure;
+        }
+    }
+    if (pipeline_open(&in, decInfo->d_io_mode, decInfo->fd_d_src_image, start, end, -1, DECODE_CHUNK_SIZE) == e_failure) {
+        return e_failure;
+    }
+    if (!expand && pipeline_open(&out, decInfo->d_io_mode, -1, 0, 0, decInfo->fd_d_secret, DECODE_CHUNK_SIZE) == e_failure) {
+        pipeline_close(&in, NULL);
+        return e_failure;
+    }
+    decInfo->d_written = 0;
+    decInfo->d_crc = 0;
+    if (expand && lz_stream_init(&stream, write_expanded, decInfo) == e_failure) {
+        ret = e_failure;
+    }
+
+    while (left > 0 && ret == e_success) {
+        // Extract the rest if this block holds it, else as many whole groups as it holds
+        unsigned long long before = bmp_channels_before(layout, raw_offset + raw_len);
+        unsigned long long avail = (before > channel) ? before - channel : 0;
+        size_t count = (avail >= lsb_image_bytes(depth, left)) ? left : avail / 8 * depth;
+        if (count > 0) {
+            size_t length = lsb_image_bytes(depth, count);
+            const uchar *image_buffer = raw + (bmp_channel_offset(layout, channel) - raw_offset);
+            if (!bmp_is_contiguous(layout)) {
+                bmp_gather(layout, raw, raw_offset, channel, length, decInfo->d_channel_buf);
+                image_buffer = decInfo->d_channel_buf;
+            }
+            PipelineBlock *chunk = expand ? NULL : pipeline_get(&out);
+            uchar *data = expand ? decInfo->d_secret_buf : (chunk != NULL) ? chunk->data : NULL;
+            if (data == NULL) {
+                ret = e_failure;
+                break;
+            }
+            lsb_extract_depth(depth, image_buffer, count, data);
+            if (checksum) {
+                decInfo->d_crc = crc32c_update(decInfo->d_crc, data, count);
+            }
+            if (decInfo->d_decrypt) {
+                chacha20_xor(&decInfo->d_cipher, decInfo->size_secret_file - left, data, count);
+            }
+            if (expand) {
+                ret = lz_stream_feed(&stream, data, count);
+            } else if ((ret = pipeline_write(&out, chunk, data, count, decInfo->d_written)) == e_success) {
+                decInfo->d_written += count;
+            }
+            channel += length;
+            left -= count;
+            continue;
+        }
+
+        // Carry the unextracted tail over in front of the next block
+        PipelineBlock *next = pipeline_read(&in);
+        unsigned long long tail = bmp_channel_offset(layout, channel);
+        size_t carry = (tail < raw_offset + raw_len) ? raw_offset + raw_len - tail : 0;
+        if (next == NULL || carry > PIPELINE_HEADROOM) {
+            ret = e_failure;  // Stego image is shorter than the recorded size
+            break;
+        }
+        if (carry > 0) {
+            memcpy(next->data - carry, raw + raw_len - carry, carry);
+        }
+        if (block != NULL) {
+            pipeline_release(&in, block);
+        }
+        block = next;
+        raw = next->data - carry;
+        raw_offset = next->offset - carry;
+        raw_len = carry + next->len;
+    }
+
+    // The output is complete once its pipeline is closed, the input pipeline spans the whole run
+    if (block != NULL) {
+        pipeline_release(&in, block);
+    }
+    if (!expand && pipeline_close(&out, &out_stat) == e_failure) {
+        ret = e_failure;
+    }
+    if (pipeline_close(&in, &in_stat) == e_failure) {
+        ret = e_failure;
+    }
+    if (expand && lz_stream_finish(&stream) == e_failure) {
+        ret = e_failure;
+    }
+    decInfo->d_cursor.pos = channel;
+
+    // Compute is what neither pipeline's calls took
+    decInfo->stats.pipe = in_stat;
+    if (!expand) {
+        decInfo->stats.pipe.write_ms = out_stat.write_ms;
+        decInfo->stats.pipe.compute_ms -= out_stat.wall_ms - out_stat.compute_ms;
+    } else {
+        decInfo->stats.pipe.write_ms = 0;
+    }
+    return ret;
+}
+
 // Function definition for decoding secret file data from the image
 Status decode_secret_file_data(DecodeInfo *decInfo)
 {
-    char ch;
+    size_t left = decInfo->size_secret_file;
+    uint depth = decInfo->d_cursor.depth;
+    int expand = (decInfo->d_cursor.flags & STEG_MODE_LZ) != 0;
+    int checksum = (decInfo->d_cursor.flags & STEG_EXT_CRC32C) != 0;
+    LzStream stream;
+    Status ret = e_success;
+    struct stat st;
+
+    // Pipelines read the payload's file bytes and write the secret at offsets, the scattered tiles are read out of order
+    if (!decInfo->d_scattered && left > 0 && lsb_image_bytes(depth, left) <= decInfo->d_layout.channels - decInfo->d_cursor.pos) {
+        unsigned long long start = bmp_channel_offset(&decInfo->d_layout, decInfo->d_cursor.pos);
+        unsigned long long end = bmp_channel_offset(&decInfo->d_layout, decInfo->d_cursor.pos + lsb_image_bytes(depth, left) - 1) + 1;
+        if (pipeline_wanted(decInfo->d_io_mode, end - start, DECODE_CHUNK_SIZE) &&
+            (expand || (fstat(decInfo->fd_d_secret, &st) == 0 && S_ISREG(st.st_mode)))) {
+            return decode_secret_file_data_pipelined(decInfo, start, end);
+        }
+    }
+
+    // Padded rows, 32 bpp pixels and scattered tiles are gathered per chunk, otherwise the kernel runs on the map itself
+    if ((!bmp_is_contiguous(&decInfo->d_layout) || decInfo->d_scattered) && left > 0) {
+        decInfo->d_channel_buf = malloc(lsb_image_bytes(depth, DECODE_CHUNK_SIZE));
+        if (decInfo->d_channel_buf == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate the channel buffer\n");
+            return e_failure;
+        }
+    }
+
+    // A compressed payload is expanded block by block as the chunks come out
+    decInfo->d_written = 0;
+    decInfo->d_crc = 0;
+    if (expand && lz_stream_init(&stream, write_expanded, decInfo) == e_failure) {
+        return e_failure;
+    }
+
+    // Extract from the mapped image into the output buffer, one write per chunk
+    while (left > 0 && ret == e_success) {
+        size_t count = (left < DECODE_CHUNK_SIZE) ? left : DECODE_CHUNK_SIZE;
+        const uchar *image_buffer = take_image_bytes(lsb_image_bytes(depth, count), decInfo);
+        if (image_buffer == NULL) {
+            ret = e_failure;  // Stego image is shorter than the recorded size
+            break;
+        }
+        lsb_extract_depth(depth, image_buffer, count, decInfo->d_secret_buf);
+        if (checksum) {
+            decInfo->d_crc = crc32c_update(decInfo->d_crc, decInfo->d_secret_buf, count);
+        }
+
+        // The CRC covers the stored bytes, decrypt after it while the chunk is in cache
+        if (decInfo->d_decrypt) {
+            chacha20_xor(&decInfo->d_cipher, decInfo->size_secret_file - left, decInfo->d_secret_buf, count);
+        }
+        if (expand) {
+            ret = lz_stream_feed(&stream, decInfo->d_secret_buf, count);
+        } else if ((ret = write_all(decInfo->fd_d_secret, decInfo->d_secret_buf, count)) == e_success) {
+            decInfo->d_written += count;
+        }
+        left -= count;
+    }
+
+    // A stream cut off inside a block is corrupt
+    if (expand && lz_stream_finish(&stream) == e_failure) {
+        ret = e_failure;
+    }
+    return ret;  // Return success after decoding all secret file data
+}
+
+// Function definition for extracting stored payload bytes [offset, offset + count), count up to DECODE_CHUNK_SIZE
+static const uchar *extract_stored(size_t offset, size_t count, unsigned long long channel, DecodeInfo *decInfo)
+{
+    uint depth = decInfo->d_cursor.depth;
+
+    // Start on the group holding byte offset, its channel byte is exact
+    size_t skip = offset % depth;
+    size_t first = offset - skip;
+    size_t length = lsb_image_bytes(depth, skip + count);
+    const uchar *image_buffer = payload_view(decInfo, channel + lsb_image_bytes(depth, first), length, decInfo->d_channel_buf);
+
+    // Pull the pages of this piece in with one request instead of a fault per page, scattered tiles are read as they come
+    if (!decInfo->d_scattered) {
+        unsigned long long start = bmp_channel_offset(&decInfo->d_layout, channel + lsb_image_bytes(depth, first));
+        unsigned long long end = bmp_channel_offset(&decInfo->d_layout, channel + lsb_image_bytes(depth, first) + length);
+        long page = sysconf(_SC_PAGESIZE);
+        start -= start % page;
+        madvise((void *)(decInfo->d_image_map + start), end - start, MADV_WILLNEED);
+    }
+
+    lsb_extract_depth(depth, image_buffer, skip + count, decInfo->d_secret_buf);
+
+    // The keystream starts anywhere, so a slice decrypts on its own
+    if (decInfo->d_decrypt) {
+        chacha20_xor(&decInfo->d_cipher, offset, decInfo->d_secret_buf + skip, count);
+    }
+    return decInfo->d_secret_buf + skip;
+}
+
+// Function definition for writing the part of an expanded LZ block that falls inside the range
+static Status write_expanded_range(void *arg, const uchar *data, size_t count)
+{
+    DecodeInfo *decInfo = arg;
+    long long first = decInfo->d_expanded;
+    long long last = first + count;
+
+    decInfo->d_expanded = last;
+    if (first < decInfo->d_range_offset) {
+        first = decInfo->d_range_offset;
+    }
+    if (last > decInfo->d_range_end) {
+        last = decInfo->d_range_end;
+    }
+    if (first >= last) {
+        return e_success;
+    }
+    decInfo->d_written += last - first;
+    return write_all(decInfo->fd_d_secret, data + (first - (decInfo->d_expanded - count)), last - first);
+}
+
+// Function definition for decoding only the --range slice of the secret file
+Status decode_secret_file_range(DecodeInfo *decInfo)
+{
+    size_t size = decInfo->size_secret_file;
+    uint depth = decInfo->d_cursor.depth;
+    unsigned long long channel = decInfo->d_cursor.pos;
+    LzStream stream;
+    Status ret = e_success;
+
+    if (!bmp_is_contiguous(&decInfo->d_layout) || decInfo->d_scattered) {
+        decInfo->d_channel_buf = malloc(lsb_image_bytes(depth, DECODE_CHUNK_SIZE + LSB_MAX_DEPTH));
+        if (decInfo->d_channel_buf == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate the channel buffer\n");
+            return e_failure;
+        }
+    }
+    decInfo->d_written = 0;
+
+    // Plain payload: byte i sits at a fixed place after the header, go straight there
+    if (!(decInfo->d_cursor.flags & STEG_MODE_LZ)) {
+        if (decInfo->d_range_offset > (long long)size) {
+            printf("Range starts past the end of the %zu byte secret file.\n", size);
+            return e_failure;
+        }
+        size_t offset = decInfo->d_range_offset;
+        size_t end = (decInfo->d_range_end < (long long)size) ? (size_t)decInfo->d_range_end : size;
+        while (offset < end && ret == e_success) {
+            size_t count = (end - offset < DECODE_CHUNK_SIZE) ? end - offset : DECODE_CHUNK_SIZE;
+            ret = write_all(decInfo->fd_d_secret, extract_stored(offset, count, channel, decInfo), count);
+            decInfo->d_written += count;
+            offset += count;
+        }
+        return ret;
+    }
+
+    // LZ payload: every block but the last expands to LZ_BLOCK_SIZE, so whole blocks
+    // in front of the range are stepped over by their headers alone
+    size_t stored = 0;
+    decInfo->d_expanded = 0;
+    while (decInfo->d_expanded + LZ_BLOCK_SIZE <= decInfo->d_range_offset) {
+        if (size - stored < LZ_HEADER_SIZE) {
+            printf("Range starts past the end of the compressed secret file.\n");
+            return e_failure;
+        }
+        const uchar *header = extract_stored(stored, LZ_HEADER_SIZE, channel, decInfo);
+        uint length = (header[0] | (header[1] << 8) | (header[2] << 16) | ((uint)header[3] << 24)) & ~LZ_BLOCK_STORED;
+        if (length == 0 || length > LZ_BLOCK_SIZE || length > size - stored - LZ_HEADER_SIZE) {
+            return e_failure;  // Corrupt block header
+        }
+        if (stored + LZ_HEADER_SIZE + length == size) {
+            break;  // The last block may be short, only expanding it tells
+        }
+        stored += LZ_HEADER_SIZE + length;
+        decInfo->d_expanded += LZ_BLOCK_SIZE;
+    }
+
+    // Expand block by block from there until the range is written or the stream ends
+    if (lz_stream_init(&stream, write_expanded_range, decInfo) == e_failure) {
+        return e_failure;
+    }
+    while (stored < size && decInfo->d_expanded < decInfo->d_range_end && ret == e_success) {
+        if (size - stored < LZ_HEADER_SIZE) {
+            ret = e_failure;
+            break;
+        }
+        const uchar *header = extract_stored(stored, LZ_HEADER_SIZE, channel, decInfo);
+        size_t block_end = stored + LZ_HEADER_SIZE + ((header[0] | (header[1] << 8) | (header[2] << 16) | ((uint)header[3] << 24)) & ~LZ_BLOCK_STORED);
+        if (block_end > size) {
+            ret = e_failure;
+            break;
+        }
+        while (stored < block_end && ret == e_success) {
+            size_t count = (block_end - stored < DECODE_CHUNK_SIZE) ? block_end - stored : DECODE_CHUNK_SIZE;
+            ret = lz_stream_feed(&stream, extract_stored(stored, count, channel, decInfo), count);
+            stored += count;
+        }
+    }
+    if (lz_stream_finish(&stream) == e_failure || decInfo->d_range_offset > decInfo->d_expanded) {
+        ret = e_failure;
+    }
+    return ret;
+}
+
+// One thread's share of the payload: secret bytes [first, last)
+typedef struct _ExtractRange
+{
+    DecodeInfo *decInfo;
+    unsigned long long channel;  // Channel byte payload byte 0 starts at
+    size_t first;
+    size_t last;
+    uint crc;                    // CRC32C of this range alone, with STEG_EXT_CRC32C
+    Status status;
+} ExtractRange;
+
+// Function definition for extracting one payload range and writing it at its own offset
+static void *extract_range_worker(void *arg)
+{
+    ExtractRange *range = arg;
+    DecodeInfo *decInfo = range->decInfo;
+    uint depth = decInfo->d_cursor.depth;
+    uchar *data = malloc(DECODE_CHUNK_SIZE);
+    uchar *channel_buf = NULL;
+
+    // Each thread gathers into its own buffer when the layout or the scatter needs it
+    int gather = !bmp_is_contiguous(&decInfo->d_layout) || decInfo->d_scattered;
+    if (gather) {
+        channel_buf = malloc(lsb_image_bytes(depth, DECODE_CHUNK_SIZE));
+    }
+    range->status = (data != NULL && (channel_buf != NULL || !gather)) ? e_success : e_failure;
+    for (size_t i = range->first; i < range->last && range->status == e_success; i += DECODE_CHUNK_SIZE) {
+        size_t count = (range->last - i < DECODE_CHUNK_SIZE) ? range->last - i : DECODE_CHUNK_SIZE;
+
+        // Payload byte i starts a group, so its channel byte is exact
+        size_t length = lsb_image_bytes(depth, count);
+        lsb_extract_depth(depth, payload_view(decInfo, range->channel + lsb_image_bytes(depth, i), length, channel_buf),
+                          count, data);
+        if (decInfo->d_cursor.flags & STEG_EXT_CRC32C) {
+            range->crc = crc32c_update(range->crc, data, count);
+        }
+        if (decInfo->d_decrypt) {
+            chacha20_xor(&decInfo->d_cipher, i, data, count);
+        }
+        off_t offset = i;
+        for (size_t done = 0; done < count; ) {
+            ssize_t written = pwrite(decInfo->fd_d_secret, data + done, count - done, offset + done);
+            if (written <= 0) {
+                perror("pwrite");
+                range->status = e_failure;
+                break;
+            }
+            done += written;
+        }
+    }
 
-    // Read and decode the secret file data from the image, then write to the secret file
-    for (int i = 0; i < decInfo->size_secret_file; i++) {
-        fread(decInfo->d_src_image_fname, 8, sizeof(char), decInfo->fptr_d_src_image);  // Read 8 bits
-        decode_byte_from_lsb(&ch, decInfo->d_src_image_fname);  // Decode the byte
-        fputc(ch, decInfo->fptr_d_secret);  // Write the decoded byte to the secret file
+    free(data);
+    free(channel_buf);
+    return NULL;
+}
+
+// Function definition for decoding secret file data with one range per thread
+Status decode_secret_file_data_parallel(DecodeInfo *decInfo)
+{
+    ExtractRange range[MAX_EXTRACT_THREADS];
+    pthread_t thread[MAX_EXTRACT_THREADS];
+    size_t size = decInfo->size_secret_file;
+    size_t chunks = (size + DECODE_CHUNK_SIZE - 1) / DECODE_CHUNK_SIZE;
+    uint threads = decInfo->d_threads;
+    uint started = 0;
+    Status ret = e_success;
+
+    // LZ blocks have no fixed place in the stored stream, a compressed payload is expanded in one pass
+    if (decInfo->d_cursor.flags & STEG_MODE_LZ) {
+        return decode_secret_file_data(decInfo);
     }
+    decInfo->d_written = size;
 
-    return e_success;  // Return success after decoding all secret file data
+    unsigned long long channel = decInfo->d_cursor.pos;
+    if (lsb_image_bytes(decInfo->d_cursor.depth, size) > decInfo->d_layout.channels - channel) {
+        return e_failure;  // Stego image is shorter than the recorded size
+    }
+
+    // Split the payload into whole chunks per thread, each writes its slice with pwrite
+    for (uint t = 0; t < threads; t++) {
+        range[t].decInfo = decInfo;
+        range[t].channel = channel;
+        range[t].first = (chunks * t / threads) * DECODE_CHUNK_SIZE;
+        range[t].last = (chunks * (t + 1) / threads) * DECODE_CHUNK_SIZE;
+        if (range[t].last > size) {
+            range[t].last = size;
+        }
+        range[t].crc = 0;
+        if (pthread_create(&thread[t], NULL, extract_range_worker, &range[t]) != 0) {
+            ret = e_failure;
+            break;
+        }
+        started++;
+    }
+    decInfo->d_crc = 0;
+    for (uint t = 0; t < started; t++) {
+        pthread_join(thread[t], NULL);
+        if (range[t].status == e_failure) {
+            ret = e_failure;
+        }
+
+        // The ranges follow each other, so their CRCs chain up in order
+        if (range[t].first < range[t].last) {
+            decInfo->d_crc = crc32c_combine(decInfo->d_crc, range[t].crc, range[t].last - range[t].first);
+        }
+    }
+
+    // Leave the cursor after the payload, as decode_secret_file_data() does
+    decInfo->d_cursor.pos = channel + lsb_image_bytes(decInfo->d_cursor.depth, size);
+    return ret;
+}
+
+// Function definition for checking the payload against the CRC32C stored after it
+Status decode_secret_file_checksum(DecodeInfo *decInfo)
+{
+    uchar channels[32];
+    uint depth = decInfo->d_cursor.depth;
+    size_t length = lsb_image_bytes(depth, 4);
+
+    if (!(decInfo->d_cursor.flags & STEG_EXT_CRC32C)) {
+        return e_success;
+    }
+
+    // The size check made sure the field is inside the image
+    const uchar *image_buffer = payload_view(decInfo, decInfo->d_cursor.pos, length, channels);
+    decInfo->d_cursor.pos += length;
+    return (lsb_extract_size(image_buffer, depth) == decInfo->d_crc) ? e_success : e_failure;
+}
+
+// Function definition for writing a whole buffer, retrying short writes
+Status write_all(int fd, const uchar *buffer, size_t count)
+{
+    while (count > 0) {
+        ssize_t written = write(fd, buffer, count);
+        if (written <= 0) {
+            perror("write");
+            return e_failure;
+        }
+        buffer += written;
+        count -= written;
+    }
+    return e_success;
+}
+
+// Function definition for dropping a secret file that failed to decode or failed its checksum
+static void discard_secret_file(DecodeInfo *decInfo)
+{
+    struct stat st;
+
+    // Through the descriptor, a path handed over by the daemon is only a link to it
+    if (fstat(decInfo->fd_d_secret, &st) == 0 && S_ISREG(st.st_mode)) {
+        ftruncate(decInfo->fd_d_secret, 0);
+    }
+    if (lstat(decInfo->d_secret_fname, &st) == 0 && S_ISREG(st.st_mode)) {
+        unlink(decInfo->d_secret_fname);
+    }
+}
+
+// Function definition for unmapping the stego image and closing the decode files
+void close_files_dec(DecodeInfo *decInfo)
+{
+    if (decInfo->d_image_map != NULL) {
+        munmap((void *)decInfo->d_image_map, decInfo->d_image_size);
+        decInfo->d_image_map = NULL;
+    }
+    if (decInfo->fd_d_src_image != -1) {
+        close(decInfo->fd_d_src_image);
+        decInfo->fd_d_src_image = -1;
+    }
+    if (decInfo->fd_d_secret != -1) {
+        close(decInfo->fd_d_secret);
+        decInfo->fd_d_secret = -1;
+    }
+    explicit_bzero(&decInfo->d_cipher, sizeof(decInfo->d_cipher));
+    if (decInfo->d_scattered) {
+        scatter_map_free(&decInfo->d_scatter);
+        decInfo->d_scattered = 0;
+    }
+    free(decInfo->d_secret_buf);
+    free(decInfo->d_channel_buf);
+    free(decInfo->magic_data);
+    free(decInfo->d_extn_secret_file);
+    decInfo->d_secret_buf = NULL;
+    decInfo->d_channel_buf = NULL;
+    decInfo->magic_data = NULL;
+    decInfo->d_extn_secret_file = NULL;
+}
+
+// Function definition for printing a finished stage, unless running quiet
+static void print_stage(const DecodeInfo *decInfo, const char *format, ...)
+{
+    va_list args;
+
+    if (decInfo->quiet) {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
 }
 
 // Function definition for performing the entire decoding process
 Status do_decoding(DecodeInfo *decInfo)
 {
+    Status ret = e_failure;
+
+    // Time every stage from here on
+    stats_start(&decInfo->stats);
+
     // Open the necessary files (stego image and secret file) for decoding
     if (open_files_dec(decInfo) == e_success) {
-        printf("Open files successfully.\n");
-        sleep(1); // Delay for better visibility
+        stats_stage(&decInfo->stats, "open", 0);
+        print_stage(decInfo, "Open files successfully.\n");
 
-        // Decode the magic string from the image
-        if (decode_magic_string(decInfo) == e_success) {
-            printf("Decoded magic string successfully.\n");
-             sleep(1); // Delay for better visibility
+        // Decode the magic string and the embedding depth from the image
+        if (decode_magic_string(decInfo) == e_success && decode_stego_mode(decInfo) == e_success &&
+            !(decInfo->d_cursor.flags & (STEG_MODE_CONTAINER | STEG_MODE_SHARD)) &&
+            (!(decInfo->d_cursor.flags & STEG_EXT_CHACHA20) || decInfo->d_key_fname != NULL)) {
+            stats_stage(&decInfo->stats, "magic", strlen(MAGIC_STRING) + steg_mode_size(decInfo->d_cursor.flags));
+            print_stage(decInfo, "Decoded magic string successfully (depth %u).\n", decInfo->d_cursor.depth);
 
             // Decode the file extension size from the image
-            if (decode_file_extn_size(strlen(".txt"), decInfo->fptr_d_src_image) == e_success) {
-                printf("Decoded file extension size successfully.\n");
-                 sleep(1); // Delay for better visibility
+            if (decode_file_extn_size(strlen(".txt"), decInfo) == e_success) {
+                print_stage(decInfo, "Decoded file extension size successfully.\n");
 
                 // Decode the secret file extension from the image
                 if (decode_secret_file_extn(decInfo->d_extn_secret_file, decInfo) == e_success) {
-                    printf("Decoded secret file extension successfully.\n");
-                     sleep(1); // Delay for better visibility
+                    stats_stage(&decInfo->stats, "extn", 4 + strlen(decInfo->d_extn_secret_file));
+                    print_stage(decInfo, "Decoded secret file extension successfully.\n");
 
-                    // Decode the secret file size from the image
-                    if (decode_secret_file_size(decInfo->size_secret_file, decInfo) == e_success) {
-                        printf("Decoded secret file size successfully.\n");
-                        sleep(1); // Delay for better visibility
+                    // Decode the nonce of an encrypted payload and the secret file size from the image
+                    if (decode_secret_file_nonce(decInfo) == e_success && decode_secret_file_size(decInfo->size_secret_file, decInfo) == e_success &&
+                        decode_scatter_map(decInfo) == e_success) {
+                        stats_stage(&decInfo->stats, "size", 4 + (decInfo->d_decrypt ? CHACHA20_NONCE_SIZE : 0));
+                        print_stage(decInfo, "Decoded secret file size successfully.\n");
 
                         // Decode the secret file data from the image and write it to the secret file
-                        if (decode_secret_file_data(decInfo) == e_success) 
+                        if (open_secret_file(decInfo) == e_failure) {
+                            printf("Opening the secret file failed.\n");
+                        } else if (decInfo->d_range_end >= 0) {
+                            // Only the slice asked for, nothing in front of it is extracted
+                            if (decode_secret_file_range(decInfo) == e_success) {
+                                stats_stage(&decInfo->stats, "range", decInfo->d_written);
+                                print_stage(decInfo, "Decoded secret file bytes %lld to %lld successfully.\n",
+                                            decInfo->d_range_offset, decInfo->d_range_offset + decInfo->d_written);
+                                ret = e_success;
+                            } else {
+                                printf("Decoding of secret file range failed.\n");
+                            }
+                        } else if (((decInfo->d_threads > 1) ? decode_secret_file_data_parallel(decInfo) : decode_secret_file_data(decInfo)) == e_success)
                         {
-                            printf("Decoded secret file data successfully.\n");
-                            sleep(1); // Delay for better visibility
+                            stats_stage(&decInfo->stats, "payload", decInfo->size_secret_file);
+                            const StageStat *payload = &decInfo->stats.stage[decInfo->stats.count - 1];
+                            print_stage(decInfo, "Decoded secret file data successfully (%d bytes, %.1f MB/s).\n",
+                                        decInfo->size_secret_file, payload->ms > 0 ? payload->bytes / payload->ms / 1e3 : 0.0);
+                            if (decInfo->d_cursor.flags & STEG_MODE_LZ) {
+                                print_stage(decInfo, "Expanded compressed secret file to %lld bytes.\n", decInfo->d_written);
+                            }
+                            if (decInfo->d_decrypt) {
+                                print_stage(decInfo, "Decrypted secret file data (ChaCha20, %s).\n", chacha20_kernel_name());
+                            }
+
+                            // The CRC was taken as the payload came out, only the stored value is left to read
+                            if (decode_secret_file_checksum(decInfo) == e_success) {
+                                if (decInfo->d_cursor.flags & STEG_EXT_CRC32C) {
+                                    print_stage(decInfo, "Payload checksum verified (CRC32C %08x).\n", decInfo->d_crc);
+                                }
+                                ret = e_success;
+                            } else {
+                                printf("Payload checksum mismatch, %s is corrupted or truncated.\n", decInfo->d_src_image_fname);
+                            }
                         } else {
                             printf("Decoding of secret file data failed.\n");
                         }
                     } else {
                         printf("Decoding of secret file size failed.\n");
-                        return e_failure;
                     }
                 } else {
                     printf("Decoding of secret file extension failed.\n");
-                    return e_failure;
                 }
             } else {
                 printf("Decoding of file extension size failed.\n");
-                return e_failure;
             }
+        } else if (decInfo->d_cursor.flags & STEG_MODE_CONTAINER) {
+            printf("%s holds a container of several files, list it with -l and extract with -x.\n", decInfo->d_src_image_fname);
+        } else if (decInfo->d_cursor.flags & STEG_MODE_SHARD) {
+            printf("%s holds one shard of a split secret, join the whole set with --join.\n", decInfo->d_src_image_fname);
+        } else if (decInfo->d_cursor.flags & STEG_EXT_CHACHA20) {
+            printf("%s holds an encrypted secret, pass its key file with --key.\n", decInfo->d_src_image_fname);
         } else {
             printf("Decoding of magic string failed.\n");
-            return e_failure;
         }
     } else {
         printf("Opening files failed.\n");
-        return e_failure;
     }
 
-    return e_success;  // Return success if everything decoded successfully
+    // Whatever failed once the secret file was opened, no partial or corrupted copy is left behind
+    if (ret == e_failure && decInfo->fd_d_secret != -1) {
+        discard_secret_file(decInfo);
+    }
+    close_files_dec(decInfo);
+    stats_stage(&decInfo->stats, "close", 0);
+    stats_report(&decInfo->stats, "decode", ret);
+    return ret;  // Return success if everything decoded successfully
 }
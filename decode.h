@@ -2,6 +2,11 @@
 #define DECODE_H
 #include <stdio.h>
 #include "types.h" // Contains user defined types
+#include "steg.h"
+#include "stats.h"
+#include "chacha20.h"
+#include "scatter.h"
+#include "pipeline.h"
 
 /*
  * Structure to store information required for
@@ -13,21 +18,56 @@
 #define MAX_SECRET_BUF_SIZE 1
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
 
+/* Secret bytes extracted per write by decode_secret_file_data(),
+ * a multiple of every embedding depth (1-4) so chunks split on whole groups */
+#define DECODE_CHUNK_SIZE (960 * 1024)
+
+/* Upper limit for -t, threads extracting one image in parallel */
+#define MAX_EXTRACT_THREADS 64
+
 typedef struct _DecodeInfo
 {
-    /* Stego image Info */
+    /* Stego image Info, mapped read-only */
     char *d_src_image_fname;
-    FILE *fptr_d_src_image;
+    int fd_d_src_image;
+    const uchar *d_image_map;
+    size_t d_image_size;
+    StegCursor d_cursor;  // Position (in channel bytes) and depth inside the pixel data
+    BmpLayout d_layout;   // Which image bytes carry the payload
+    uchar d_head[STEG_HEAD_MAX];  // Header channels, gathered when the layout is not contiguous
+    uchar *d_channel_buf; // Payload channels gathered per chunk, likewise
+    uint d_threads;
+    PipelineMode d_io_mode;       // --io: read the payload channels and write the secret through pipelines (pipeline.h)
 
     char d_image_data[MAX_IMAGE_BUF_SIZE];
     char *magic_data;
     char *d_extn_secret_file;
 
-    int size_secret_file;
+    int size_secret_file;         // Stored payload bytes, the LZ stream when compressed
+    long long d_written;          // Bytes written to the secret file
+    long long d_expanded;         // Expanded bytes the LZ stream has produced so far
+    uint d_crc;                   // CRC32C of the payload extracted so far, with STEG_EXT_CRC32C
+    char *d_key_fname;            // --key: key file for a payload encrypted with STEG_EXT_CHACHA20
+    ChaCha20 d_cipher;            // Keyed with the nonce from the image once it is read
+    int d_decrypt;                // The payload is encrypted and d_cipher is keyed
+    int d_scattered;              // The payload channels follow d_scatter, with STEG_EXT_SCATTER
+    ScatterMap d_scatter;
+
+    /* Only secret bytes [d_range_offset, d_range_end) with --range, d_range_end -1 without */
+    long long d_range_offset;
+    long long d_range_end;
     FILE *fptr_d_dest_image;
 
+    /* Decoded secret file Info */
     char *d_secret_fname;
-    FILE *fptr_d_secret;
+    int fd_d_secret;
+    uchar *d_secret_buf;
+
+    /* Skip progress messages (-q, batch jobs) */
+    int quiet;
+
+    /* Per-stage timings, printed with --stats / --json */
+    StegStats stats;
 } DecodeInfo;
 // ANSI escape codes for colors
 #define RESET   "\033[0m"
@@ -50,31 +90,55 @@ Status do_decoding(DecodeInfo *decInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files_dec(DecodeInfo *decInfo);
 
+/* Take the next count channel bytes of the mapped stego image */
+const uchar *take_image_bytes(size_t count, DecodeInfo *decInfo);
+
 /* Decode Magic String */
 Status decode_magic_string(DecodeInfo *decInfo);
 
-/* Decode data from image */
-Status decode_data_from_image(int size, FILE *fptr_d_src_image, DecodeInfo *decInfo);
+/* Decode stego mode byte (embedding depth) */
+Status decode_stego_mode(DecodeInfo *decInfo);
 
-/* Decode byte from lsb */
-Status decode_byte_from_lsb(char *data, char *image_buffer);
+/* Decode a 32 bit size field at the decoded depth */
+Status decode_size_from_image(int *size, DecodeInfo *decInfo);
 
-/* Decode file extn size */
-Status decode_file_extn_size(int size, FILE *fptr_d_src_image);
+/* Decode data from image */
+Status decode_data_from_image(int size, DecodeInfo *decInfo);
 
-/* Decode size from lsb */
-Status decode_size_from_lsb(char *buffer, int *size);
+/* Decode file extn size */
+Status decode_file_extn_size(int size, DecodeInfo *decInfo);
 
 /* Decode secret file extn */
 Status decode_secret_file_extn(char *file_ext, DecodeInfo *decInfo);
 
 /* Decode extension data from image */
-Status decode_extension_data_from_image(int size, FILE *fptr_d_src_image, DecodeInfo *decInfo);
+Status decode_extension_data_from_image(int size, DecodeInfo *decInfo);
+
+/* Decode the ChaCha20 nonce of an encrypted payload and key the cipher with it */
+Status decode_secret_file_nonce(DecodeInfo *decInfo);
 
 /* Decode secret file size */
 Status decode_secret_file_size(int file_size, DecodeInfo *decInfo);
 
+/* Draw the tile order of a scattered payload, which starts at the cursor */
+Status decode_scatter_map(DecodeInfo *decInfo);
+
 /* Decode secret file data */
 Status decode_secret_file_data(DecodeInfo *decInfo);
 
+/* Decode secret file data with one range per thread */
+Status decode_secret_file_data_parallel(DecodeInfo *decInfo);
+
+/* Decode only the --range slice of the secret file */
+Status decode_secret_file_range(DecodeInfo *decInfo);
+
+/* Check the payload against the CRC32C after it, if the image has one */
+Status decode_secret_file_checksum(DecodeInfo *decInfo);
+
+/* Write a whole buffer to fd */
+Status write_all(int fd, const uchar *buffer, size_t count);
+
+/* Unmap the stego image and close the decode files */
+void close_files_dec(DecodeInfo *decInfo);
+
 #endif
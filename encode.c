@@ -1,325 +1,1664 @@
+#define _GNU_SOURCE // For copy_file_range() and splice()
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "encode.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "steg.h"
+#include "scatter.h"
+#include "lz.h"
+#include "container.h"
+#include "shard.h"
 #include "common.h"
 #include "types.h"
-#include <unistd.h> // For sleep()
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 
 /* Function Definitions */
 
-/* Get image size
+/* Get image layout
  * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * Output: pixel data offset, row stride and channel bytes (see bmp.h)
+ * Description: The file header gives the pixel data offset at byte 10,
+ * the info header width, height, bits per pixel and compression from
+ * byte 14 on; 32 bpp bit fields follow at byte 54.
  */
-uint get_image_size_for_bmp(FILE *fptr_image)
+Status get_image_layout_for_bmp(FILE *fptr_image, BmpLayout *layout)
 {
-    uint width, height;
+    uchar header[BMP_MIN_HEADER_SIZE + 12];
+    struct stat st;
 
-    // Seek to the 18th byte where width is stored in BMP header
-    fseek(fptr_image, 18, SEEK_SET);
+    // Read the file and info headers, plus the bit fields masks if there are any
+    fseek(fptr_image, 0, SEEK_SET);
+    size_t size = fread(header, 1, sizeof(header), fptr_image);
+    if (fstat(fileno(fptr_image), &st) == -1)
+    {
+        return e_failure;
+    }
+    return bmp_parse_layout(header, size, st.st_size, layout);
+}
+
+/* Map the whole carrier read-write and shared, so stores land in its page cache */
+static Status map_carrier(EncodeInfo *encInfo)
+{
+    struct stat st;
+
+    if (fstat(fileno(encInfo->fptr_src_image), &st) == -1 || st.st_size == 0)
+    {
+        return e_failure;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(encInfo->fptr_src_image), 0);
+    if (map == MAP_FAILED)
+    {
+        return e_failure;
+    }
+    encInfo->image_map = map;
+    encInfo->image_map_size = st.st_size;
+    return e_success;
+}
+
+/*
+ * Open the source image, secret file, and destination (stego) image files
+ * Inputs: Src Image file, Secret file, and Stego Image file
+ * Output: FILE pointers for the above files
+ * Return Value: e_success or e_failure, based on file open errors
+ */
+Status open_files(EncodeInfo *encInfo)
+{
+    // Nothing is open yet, so close_files() knows what to release on failure
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->image_block = NULL;
+    encInfo->channel_block = NULL;
+    encInfo->image_map = NULL;
+    encInfo->stream_header = NULL;
+    encInfo->pipeline = NULL;
+    encInfo->pipe_block = NULL;
+
+    // Open the source image file in read mode, read-write when it is also the stego image
+    encInfo->fptr_src_image = encInfo->stream ? fdopen(encInfo->stream_src_fd, "r") :
+                              fopen(encInfo->src_image_fname, encInfo->in_place ? "r+" : "r");
+    if (encInfo->fptr_src_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    // Unbuffered, so the tail copy can go on from the descriptor where the engine's block reads stopped
+    if (encInfo->stream)
+    {
+        setvbuf(encInfo->fptr_src_image, NULL, _IONBF, 0);
+    }
+
+    // Open the secret file (text file to hide in the image), or pack the container files into one
+    if (encInfo->container_count > 0)
+    {
+        if (build_container(encInfo) == e_failure)
+        {
+            fprintf(stderr, "ERROR : Unable to build the container\n");
+            return e_failure;
+        }
+    }
+    else if ((encInfo->fptr_secret = encInfo->stream ? fdopen(encInfo->stream_secret_fd, "r") : fopen(encInfo->secret_fname, "r")) == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->secret_fname);
+        return e_failure;
+    }
+
+    // Open the stego image file for writing (destination image), in place the carrier is written through its mapping
+    if (!encInfo->in_place)
+    {
+        encInfo->fptr_stego_image = encInfo->stream ? fdopen(encInfo->stream_stego_fd, "w") : fopen(encInfo->stego_image_fname, "w");
+    }
+    else if (map_carrier(encInfo) == e_failure)
+    {
+        perror("mmap");
+        fprintf(stderr, "ERROR : Unable to map file %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    if (encInfo->fptr_stego_image == NULL && !encInfo->in_place)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->stego_image_fname);
+        return e_failure;
+    }
+
+    // Key the cipher with a nonce of its own, a key is never used twice with one nonce
+    if (encInfo->key_fname != NULL)
+    {
+        uchar key[CHACHA20_KEY_SIZE];
+        if (chacha20_read_key(encInfo->key_fname, key) == e_failure)
+        {
+            fprintf(stderr, "ERROR : %s is not a %d byte key file\n", encInfo->key_fname, CHACHA20_KEY_SIZE);
+            return e_failure;
+        }
+        if (chacha20_new_nonce(encInfo->nonce) == e_failure)
+        {
+            explicit_bzero(key, sizeof(key));
+            fprintf(stderr, "ERROR : Unable to get a random nonce\n");
+            return e_failure;
+        }
+        chacha20_init(&encInfo->cipher, key, encInfo->nonce);
+        explicit_bzero(key, sizeof(key));
+    }
+
+    // Allocate the carrier block used by the embedding engine, in place the mapping is the block
+    encInfo->image_block = encInfo->in_place ? (char *)encInfo->image_map : malloc(IMAGE_BLOCK_SIZE);
+    if (encInfo->image_block == NULL)
+    {
+        fprintf(stderr, "ERROR : Unable to allocate %d byte image block\n", IMAGE_BLOCK_SIZE);
+        return e_failure;
+    }
+    encInfo->block_len = 0;
+    encInfo->block_start = 0;
+    encInfo->channel_pos = 0;
+
+    // No failure, return e_success
+    return e_success;
+}
+
+
+
+// Validate the command-line arguments for encoding
+Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
+{
+    char *fname[3] = { NULL, NULL, "steged_img.bmp" };
+    int count = 0;
+
+    // Defaults for the options
+    encInfo->depth = 1;
+    encInfo->threads = 1;
+    encInfo->compress = 0;
+    encInfo->checksum = 0;
+    encInfo->key_fname = NULL;
+    encInfo->scatter = 0;
+    encInfo->in_place = 0;
+    encInfo->stream = 0;
+    encInfo->io_mode = e_pipeline_auto;
+    encInfo->container_count = 0;
+    encInfo->payload_prefix = NULL;
+    encInfo->prefix_size = 0;
+    encInfo->secret_start = 0;
+    encInfo->quiet = 0;
+    encInfo->stats.mode = e_stats_off;
+
+    // Step 0: Separate the options from the file names
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-k") == 0)
+        {
+            int depth = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (depth < 1 || depth > LSB_MAX_DEPTH)
+            {
+                printf("Error: -k needs an embedding depth from 1 to %d\n", LSB_MAX_DEPTH);
+                return e_failure;
+            }
+            encInfo->depth = depth;
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            int threads = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (threads < 1 || threads > MAX_EMBED_THREADS)
+            {
+                printf("Error: -t needs a thread count from 1 to %d\n", MAX_EMBED_THREADS);
+                return e_failure;
+            }
+            encInfo->threads = threads;
+        }
+        else if (strcmp(argv[i], "-z") == 0)
+        {
+            encInfo->compress = 1;
+        }
+        else if (strcmp(argv[i], "--crc") == 0)
+        {
+            encInfo->checksum = 1;
+        }
+        else if (strcmp(argv[i], "--key") == 0)
+        {
+            if (argv[i + 1] == NULL)
+            {
+                printf("Error: --key needs a key file\n");
+                return e_failure;
+            }
+            encInfo->key_fname = argv[++i];
+        }
+        else if (strcmp(argv[i], "--scatter") == 0)
+        {
+            encInfo->scatter = 1;
+        }
+        else if (strcmp(argv[i], "--in-place") == 0)
+        {
+            encInfo->in_place = 1;
+        }
+        else if (strcmp(argv[i], "--io") == 0)
+        {
+            if (argv[i + 1] == NULL || pipeline_parse_mode(argv[i + 1], &encInfo->io_mode) == e_failure)
+            {
+                printf("Error: --io needs auto, uring, threads or off\n");
+                return e_failure;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            encInfo->stats.mode = e_stats_text;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            encInfo->stats.mode = e_stats_json;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            encInfo->quiet = 1;
+        }
+        else if (count < 3)
+        {
+            fname[count++] = argv[i];
+        }
+        else
+        {
+            printf("Error: unexpected argument %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+
+    // The key orders the tiles, so scattering needs one
+    if (encInfo->scatter && encInfo->key_fname == NULL)
+    {
+        printf("Error: --scatter needs --key, the key orders the tiles\n");
+        return e_failure;
+    }
+
+    // Step 1: Check if the source image file is a BMP file
+    if (fname[0] == NULL || strstr(fname[0], ".bmp") == NULL)
+    {
+        printf("Error: source image file must be .bmp file\n");
+        return e_failure;
+    }
+    encInfo->src_image_fname = fname[0];  // Store the source file name
+
+    // In place the carrier itself becomes the stego image
+    if (encInfo->in_place)
+    {
+        if (count == 3)
+        {
+            printf("Error: --in-place writes into the source image, drop the output file\n");
+            return e_failure;
+        }
+        fname[2] = fname[0];
+    }
+
+    // Step 2: Check if the secret file is a text file
+    if (fname[1] == NULL || strstr(fname[1], ".txt") == NULL)
+    {
+        printf("Error: secret file must be .txt file\n");
+        return e_failure;
+    }
+    encInfo->secret_fname = fname[1];  // Store the secret file name
+
+    // Step 3: Check if the stego output image file is a BMP file
+    if (strstr(fname[2], ".bmp") == NULL)
+    {
+        printf("Error: stego image file must be .bmp file\n");
+        return e_failure;
+    }
+    encInfo->stego_image_fname = fname[2];  // Store the output file name
+
+    return e_success;
+}
+
+// Get the size of the secret file, 64 bits wide so a secret of 4 GiB or more does not wrap
+off_t get_file_size(FILE *fptr)
+{
+    struct stat st;
+
+    // A regular file knows its size, anything else is seeked to the end
+    if (fstat(fileno(fptr), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        return st.st_size;
+    }
+    if (fseeko(fptr, 0, SEEK_END) == -1)
+    {
+        return -1;
+    }
+    return ftello(fptr);  // Return the size of the file
+}
+
+/* Extension recorded in the stego header, shards record SHARD_EXTN instead of the secret's own */
+static const char *secret_file_extn(const EncodeInfo *encInfo)
+{
+    return (encInfo->payload_prefix != NULL) ? SHARD_EXTN : strstr(encInfo->secret_fname, ".");
+}
+
+/*
+ * Read everything in front of the pixel data off a carrier stream
+ * A stream cannot be rewound for copy_bmp_header(), so the header is kept
+ * until the stego image is written. There is no file size to check against
+ * either: the pixel array size comes from the header alone and a carrier
+ * that ends early fails when its blocks are read.
+ */
+static Status read_stream_header(EncodeInfo *encInfo)
+{
+    uchar fixed[BMP_MIN_HEADER_SIZE];
+
+    if (fread(fixed, 1, sizeof(fixed), encInfo->fptr_src_image) != sizeof(fixed))
+    {
+        return e_failure;
+    }
+    uint size = fixed[10] | (fixed[11] << 8) | (fixed[12] << 16) | ((uint)fixed[13] << 24);
+    if (size < BMP_MIN_HEADER_SIZE || size > STREAM_HEADER_MAX || (encInfo->stream_header = malloc(size)) == NULL)
+    {
+        return e_failure;
+    }
+    memcpy(encInfo->stream_header, fixed, sizeof(fixed));
+    if (fread(encInfo->stream_header + sizeof(fixed), 1, size - sizeof(fixed), encInfo->fptr_src_image) != size - sizeof(fixed))
+    {
+        return e_failure;
+    }
+    return bmp_parse_layout(encInfo->stream_header, size, ULLONG_MAX, &encInfo->layout);
+}
+
+/*
+ * Size of a secret stream, -1 if it has none
+ * A regular file gives what is left of it; a pipe or socket starts with a
+ * decimal length prefix line ("<bytes>\n") in front of the secret bytes.
+ */
+static long stream_secret_size(FILE *fptr)
+{
+    struct stat st;
+    long size = 0;
+    int digits = 0;
+    int ch;
+
+    if (fstat(fileno(fptr), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        long pos = ftell(fptr);
+        return (pos >= 0 && st.st_size >= pos) ? st.st_size - pos : -1;
+    }
+    while ((ch = getc(fptr)) != '\n')
+    {
+        if (ch < '0' || ch > '9' || ++digits > 10)
+        {
+            return -1;
+        }
+        size = size * 10 + (ch - '0');
+    }
+    return (digits > 0) ? size : -1;
+}
+
+// Check the capacity of the source image to hold the secret file
+Status check_capacity(EncodeInfo *encInfo)
+{
+    // Get the image capacity, the B, G and R bytes of every pixel
+    if ((encInfo->stream ? read_stream_header(encInfo) : get_image_layout_for_bmp(encInfo->fptr_src_image, &encInfo->layout)) == e_failure)
+    {
+        printf("ERROR : %s is not an uncompressed 24 or 32 bpp BMP\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    encInfo->image_capacity = encInfo->layout.channels;
+    encInfo->mode_flags = steg_layout_flags(&encInfo->layout) | (encInfo->compress ? STEG_MODE_LZ : 0) |
+                          ((encInfo->container_count > 0) ? STEG_MODE_CONTAINER : 0) |
+                          ((encInfo->payload_prefix != NULL) ? STEG_MODE_SHARD : 0) |
+                          (encInfo->checksum ? STEG_EXT_CRC32C : 0) |
+                          ((encInfo->key_fname != NULL) ? STEG_EXT_CHACHA20 : 0) |
+                          (encInfo->scatter ? STEG_EXT_SCATTER : 0);
+    encInfo->crc = 0;
+    if (!encInfo->quiet)
+    {
+        printf("image capacity = %llu bytes\n", encInfo->image_capacity);
+    }
+
+    // The engine starts at the first pixel, padded rows and 32 bpp pixels are gathered per block
+    encInfo->block_start = encInfo->layout.pixel_offset;
+    encInfo->channel_pos = 0;
+    if (encInfo->in_place)
+    {
+        // The whole image is one block that never needs a refill or a write
+        encInfo->image_block = (char *)encInfo->image_map + encInfo->layout.pixel_offset;
+        encInfo->block_len = encInfo->image_map_size - encInfo->layout.pixel_offset;
+    }
+    if (!bmp_is_contiguous(&encInfo->layout))
+    {
+        encInfo->channel_block = malloc(IMAGE_BLOCK_SIZE);
+        if (encInfo->channel_block == NULL)
+        {
+            return e_failure;
+        }
+    }
+
+    // Compress the secret first when asked to, from here on only the compressed size counts
+    if (encInfo->compress)
+    {
+        if (compress_secret_file(encInfo) == e_failure)
+        {
+            printf("ERROR : Compressing the secret file failed\n");
+            return e_failure;
+        }
+        stats_stage(&encInfo->stats, "compress", encInfo->raw_secret_size);
+    }
+
+    // Get the size of the secret file, or of its LZ stream once compressed
+    encInfo->size_secret_file = encInfo->stream ? stream_secret_size(encInfo->fptr_secret) : get_file_size(encInfo->fptr_secret);
+    if (!encInfo->compress)
+    {
+        encInfo->raw_secret_size = encInfo->size_secret_file;
+    }
+    else if (!encInfo->quiet)
+    {
+        printf("compressed secret = %ld bytes (from %ld bytes)\n", encInfo->size_secret_file, encInfo->raw_secret_size);
+    }
+
+    // A shard only carries its own slice of the secret file
+    if (encInfo->payload_prefix != NULL)
+    {
+        if (encInfo->secret_start < 0 || encInfo->secret_length < 0 ||
+            encInfo->secret_start + encInfo->secret_length > encInfo->size_secret_file)
+        {
+            return e_failure;
+        }
+        encInfo->size_secret_file = encInfo->secret_length;
+        encInfo->raw_secret_size = encInfo->secret_length;
+    }
+
+    // The size field is 32 bits wide and decoded as an int
+    if (encInfo->size_secret_file < 0)
+    {
+        printf("ERROR : Unable to get the size of %s\n", encInfo->secret_fname);
+        return e_failure;
+    }
+    if (encInfo->size_secret_file > INT_MAX - (long)encInfo->prefix_size)
+    {
+        printf("ERROR : Secret of %ld bytes is larger than the %ld bytes the stego header can record\n",
+               encInfo->size_secret_file, INT_MAX - (long)encInfo->prefix_size);
+        return e_failure;
+    }
+
+    // The decoder only takes extensions that fit the stego header
+    const char *file_extn = secret_file_extn(encInfo);
+    if (file_extn == NULL || strlen(file_extn) > MAX_STEG_EXTN)
+    {
+        return e_failure;
+    }
+
+    // Calculate the total number of channel bytes required to store the stego header
+    // (magic string, mode byte, extension size, extension, size) and the secret file data itself
+    StegHeader header;
+    header.depth = encInfo->depth;
+    header.flags = encInfo->mode_flags;
+    strcpy(header.extension, file_extn);
+    header.payload_size = encInfo->size_secret_file + encInfo->prefix_size;
+    unsigned long long total_bytes = steg_encoded_size(&header);
+    if (total_bytes > 0 && total_bytes <= encInfo->image_capacity)
+    {
+        encInfo->embed_end = bmp_channel_offset(&encInfo->layout, total_bytes - 1) + 1;
+    }
+
+    // Check if the image capacity is enough to store the secret file and metadata
+    if (total_bytes <= encInfo->image_capacity)
+    {
+        return e_success;  // Enough space in the image
+    }
+    else
+    {
+        return e_failure;  // Not enough space in the image
+    }
+}
+
+/* Copy the first size bytes (BMP headers, masks, palette and profile) from the source image to the destination (stego) image */
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, uint size)
+{
+    char str[4096];
+
+    // Seek to the beginning of the image file (0th byte)
+    fseek(fptr_src_image, 0, SEEK_SET);
+
+    // Copy everything up to the pixel data unchanged, in large pieces
+    while (size > 0)
+    {
+        size_t count = (size < sizeof(str)) ? size : sizeof(str);
+        if (fread(str, 1, count, fptr_src_image) != count || fwrite(str, 1, count, fptr_dest_image) != count)
+        {
+            return e_failure;
+        }
+        size -= count;
+    }
+    return e_success;
+}
+
+/* Write the header kept by read_stream_header() to the stego image, in place of copy_bmp_header() */
+static Status copy_stream_header(EncodeInfo *encInfo)
+{
+    uint size = encInfo->layout.pixel_offset;
+
+    return (fwrite(encInfo->stream_header, 1, size, encInfo->fptr_stego_image) == size) ? e_success : e_failure;
+}
+
+/* Bytes of the block in front of the next channel byte, all of them once it lies past the block */
+static uint block_embedded(EncodeInfo *encInfo)
+{
+    unsigned long long offset = bmp_channel_offset(&encInfo->layout, encInfo->channel_pos) - encInfo->block_start;
+    return (offset < encInfo->block_len) ? offset : encInfo->block_len;
+}
+
+/*
+ * Run the block engine on a pipeline when it pays: a plain serial encode
+ * (no -t, --scatter, --in-place or --stream, which do their own I/O) between
+ * two regular files, with enough carrier to embed into for --io. The header
+ * is already in the stego image, the pipeline writes the pixel array behind it.
+ */
+static Status start_pipeline(EncodeInfo *encInfo)
+{
+    struct stat st_src, st_stego;
+    unsigned long long start = encInfo->layout.pixel_offset;
+
+    if (encInfo->threads > 1 || encInfo->scatter || encInfo->in_place || encInfo->stream ||
+        !pipeline_wanted(encInfo->io_mode, encInfo->embed_end - start, IMAGE_BLOCK_SIZE) ||
+        fstat(fileno(encInfo->fptr_src_image), &st_src) == -1 || !S_ISREG(st_src.st_mode) ||
+        fstat(fileno(encInfo->fptr_stego_image), &st_stego) == -1 || !S_ISREG(st_stego.st_mode))
+    {
+        return e_success;
+    }
+    if (fflush(encInfo->fptr_stego_image) != 0 || (encInfo->pipeline = malloc(sizeof(Pipeline))) == NULL)
+    {
+        return e_failure;
+    }
+    if (pipeline_open(encInfo->pipeline, encInfo->io_mode, fileno(encInfo->fptr_src_image), start, encInfo->embed_end,
+                      fileno(encInfo->fptr_stego_image), IMAGE_BLOCK_SIZE) == e_failure)
+    {
+        free(encInfo->pipeline);
+        encInfo->pipeline = NULL;
+        return e_failure;
+    }
+
+    // From here on the block is always one of the pipeline's buffers
+    free(encInfo->image_block);
+    encInfo->image_block = NULL;
+    return e_success;
+}
+
+/*
+ * Move the engine on to the pipeline's next block
+ * The unembedded tail of the current block goes into the headroom in front
+ * of the next one, which makes it the new block, and the embedded part is
+ * queued for writing; the buffer it sits in is prefetched into once written.
+ */
+static Status next_pipeline_block(EncodeInfo *encInfo)
+{
+    PipelineBlock *next = pipeline_read(encInfo->pipeline);
+    uint done = block_embedded(encInfo);
+    uint left = encInfo->block_len - done;
+
+    if (next == NULL || left > PIPELINE_HEADROOM)
+    {
+        return e_failure;
+    }
+    if (left > 0)
+    {
+        memcpy(next->data - left, encInfo->image_block + done, left);
+    }
+    if (encInfo->pipe_block != NULL &&
+        pipeline_write(encInfo->pipeline, encInfo->pipe_block, (uchar *)encInfo->image_block, done, encInfo->block_start) == e_failure)
+    {
+        return e_failure;
+    }
+    encInfo->pipe_block = next;
+    encInfo->image_block = (char *)next->data - left;
+    encInfo->block_start += done;
+    encInfo->block_len = left + next->len;
+    return e_success;
+}
+
+/*
+ * Make sure the carrier block holds the file bytes of the next count channel bytes
+ * The already embedded part of the block is written to the stego image, the rest
+ * is moved to the front and the block is topped up from the source image, so row
+ * padding and alpha bytes pass through in the same bulk reads and writes.
+ * Returns e_failure if the image has fewer channel bytes left.
+ */
+Status reserve_image_block(uint count, EncodeInfo *encInfo)
+{
+    if (count == 0)
+    {
+        return e_success;
+    }
+    if (count > encInfo->layout.channels - encInfo->channel_pos)
+    {
+        return e_failure;
+    }
+    unsigned long long end = bmp_channel_offset(&encInfo->layout, encInfo->channel_pos + count - 1) + 1;
+    if (end <= encInfo->block_start + encInfo->block_len)
+    {
+        return e_success;
+    }
+
+    // The first refill decides whether the blocks come through a pipeline
+    if (encInfo->pipeline == NULL && encInfo->channel_pos == 0 && encInfo->block_len == 0 && start_pipeline(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    if (encInfo->pipeline != NULL)
+    {
+        return (next_pipeline_block(encInfo) == e_success && end <= encInfo->block_start + encInfo->block_len) ? e_success : e_failure;
+    }
+
+    // Write out everything up to the embed position
+    uint done = block_embedded(encInfo);
+    if (fwrite(encInfo->image_block, 1, done, encInfo->fptr_stego_image) != done)
+    {
+        return e_failure;
+    }
+
+    // Keep the unembedded tail and refill the rest of the block
+    uint left = encInfo->block_len - done;
+    memmove(encInfo->image_block, encInfo->image_block + done, left);
+    encInfo->block_len = left + fread(encInfo->image_block + left, 1, IMAGE_BLOCK_SIZE - left, encInfo->fptr_src_image);
+    encInfo->block_start += done;
+
+    return (end <= encInfo->block_start + encInfo->block_len) ? e_success : e_failure;
+}
+
+/*
+ * Write the embedded part of the carrier block to the stego image
+ * The untouched bytes after the embed position are dropped from the block and
+ * the source image is rewound to them, so both streams end at the same offset
+ * and copy_remaining_img_data() can take over from there. A stream cannot be
+ * rewound, there the whole block is written and both still end level.
+ */
+Status flush_image_block(EncodeInfo *encInfo)
+{
+    uint done = encInfo->stream ? encInfo->block_len : block_embedded(encInfo);
+
+    // A pipeline writes the last block itself and is done, the tail copy goes on from the descriptors
+    if (encInfo->pipeline != NULL)
+    {
+        Status ret = pipeline_write(encInfo->pipeline, encInfo->pipe_block, (uchar *)encInfo->image_block, done, encInfo->block_start);
+        if (pipeline_close(encInfo->pipeline, &encInfo->stats.pipe) == e_failure)
+        {
+            ret = e_failure;
+        }
+        free(encInfo->pipeline);
+        encInfo->pipeline = NULL;
+        encInfo->pipe_block = NULL;
+        encInfo->image_block = NULL;
+        encInfo->block_start += done;
+        encInfo->block_len = 0;
+        if (ret == e_failure || fseeko(encInfo->fptr_src_image, encInfo->block_start, SEEK_SET) != 0 ||
+            fseeko(encInfo->fptr_stego_image, encInfo->block_start, SEEK_SET) != 0)
+        {
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    if (fwrite(encInfo->image_block, 1, done, encInfo->fptr_stego_image) != done)
+    {
+        return e_failure;
+    }
+    if (!encInfo->stream && fseek(encInfo->fptr_src_image, -(long)(encInfo->block_len - done), SEEK_CUR) != 0)
+    {
+        return e_failure;
+    }
+    encInfo->block_start += done;
+    encInfo->block_len = 0;
+    return e_success;
+}
+
+/*
+ * Get a libsteg cursor over the unembedded channel bytes of the carrier block
+ * At least count channel bytes are reserved first. Contiguous layouts embed
+ * straight into the block; otherwise up to want channel bytes are gathered
+ * into channel_block a row segment at a time and block_advance() scatters
+ * back what the field codecs used.
+ */
+static Status block_cursor(uint count, uint want, uint depth, StegCursor *cursor, EncodeInfo *encInfo)
+{
+    const BmpLayout *layout = &encInfo->layout;
+
+    if (reserve_image_block(count, encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    unsigned long long avail = bmp_channels_before(layout, encInfo->block_start + encInfo->block_len) - encInfo->channel_pos;
+    if (bmp_is_contiguous(layout))
+    {
+        uint offset = bmp_channel_offset(layout, encInfo->channel_pos) - encInfo->block_start;
+        steg_cursor_init(cursor, (uchar *)encInfo->image_block + offset, avail);
+    }
+    else
+    {
+        // In place the block is the whole image, channel_block still holds only IMAGE_BLOCK_SIZE
+        size_t size = (avail < want) ? avail : want;
+        size = (size < IMAGE_BLOCK_SIZE) ? size : IMAGE_BLOCK_SIZE;
+        bmp_gather(layout, (uchar *)encInfo->image_block, encInfo->block_start, encInfo->channel_pos, size, encInfo->channel_block);
+        steg_cursor_init(cursor, encInfo->channel_block, size);
+    }
+    cursor->depth = depth;
+    return e_success;
+}
+
+static void block_advance(const StegCursor *cursor, EncodeInfo *encInfo)
+{
+    if (!bmp_is_contiguous(&encInfo->layout))
+    {
+        bmp_scatter(&encInfo->layout, encInfo->channel_block, encInfo->channel_pos, cursor->pos,
+                    (uchar *)encInfo->image_block, encInfo->block_start);
+    }
+    encInfo->channel_pos += cursor->pos;
+}
+
+/*
+ * Encode data into the carrier block at the given depth
+ * Every depth data bytes fill 8 channel bytes, so the block is consumed in
+ * groups of 8 channel bytes and a run is only split on whole groups; embedding
+ * a field in several calls gives the same layout as one call as long as every
+ * call but the last passes a multiple of depth bytes.
+ */
+Status encode_data_at_depth(const char *data, int size, uint depth, EncodeInfo *encInfo)
+{
+    StegCursor cursor;
+    int i = 0;
+    while (i < size)
+    {
+        // Get at least one group (or the final partial group) of carrier into the block
+        uint need = lsb_image_bytes(depth, size - i);
+        if (block_cursor((need < 8) ? need : 8, need, depth, &cursor, encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+
+        // Embed the rest if the cursor covers it, else as many whole groups as it holds
+        int count = (cursor.size >= need) ? size - i : (int)(cursor.size / 8 * depth);
+        if (steg_put_data(&cursor, (const uchar *)data + i, count) == e_failure)
+        {
+            return e_failure;
+        }
+        block_advance(&cursor, encInfo);
+        i += count;
+    }
+    return e_success;
+}
+
+/* Encode the secret data into the carrier block at the chosen depth */
+Status encode_data_to_image(char *data, int size, EncodeInfo *encInfo)
+{
+    return encode_data_at_depth(data, size, encInfo->depth, encInfo);
+}
+
+/* Encode the magic string into the stego image, always 1 bit deep so decode can find it */
+Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+{
+    return encode_data_at_depth(magic_string, strlen(magic_string), 1, encInfo);
+}
+
+/* Encode the mode byte (embedding depth) into the stego image, 1 bit deep */
+Status encode_stego_mode(EncodeInfo *encInfo)
+{
+    StegCursor cursor;
+    uint count = lsb_image_bytes(1, steg_mode_size(encInfo->mode_flags));
+    if (block_cursor(count, count, 1, &cursor, encInfo) == e_failure ||
+        steg_put_mode(&cursor, encInfo->depth, encInfo->mode_flags) == e_failure)
+    {
+        return e_failure;
+    }
+    block_advance(&cursor, encInfo);
+    return e_success;
+}
+
+/* Encode a 32 bit size field into the stego image at the chosen depth */
+Status encode_size_to_image(uint size, EncodeInfo *encInfo)
+{
+    StegCursor cursor;
+    uint count = lsb_image_bytes(encInfo->depth, 4);
+    if (block_cursor(count, count, encInfo->depth, &cursor, encInfo) == e_failure ||
+        steg_put_size(&cursor, size) == e_failure)  // Encode the size into the LSB
+    {
+        return e_failure;
+    }
+    block_advance(&cursor, encInfo);
+    return e_success;
+}
+
+/* Encode the secret file extension size into the stego image */
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
+{
+    return encode_size_to_image(size, encInfo);
+}
+
+/* Encode the secret file extension into the stego image */
+Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+{
+    return encode_data_to_image((char *)file_extn, strlen(file_extn), encInfo);
+}
+
+/* Encode the secret file size into the stego image */
+Status encode_secret_file_size(long int size, EncodeInfo *encInfo)
+{
+    return encode_size_to_image(size, encInfo);
+}
+
+/* Write the LZ stream (see lz.h) of everything left in fptr_src to fptr_dest */
+Status compress_stream(FILE *fptr_src, FILE *fptr_dest, long *raw_size)
+{
+    uchar *block = malloc(LZ_BLOCK_SIZE);
+    uchar *packed = malloc(LZ_HEADER_SIZE + LZ_BLOCK_SIZE);
+    Status ret = (block != NULL && packed != NULL) ? e_success : e_failure;
+    size_t count;
+
+    *raw_size = 0;
+    while (ret == e_success && (count = fread(block, 1, LZ_BLOCK_SIZE, fptr_src)) > 0)
+    {
+        // Keep the block as is unless it gets at least one byte smaller
+        size_t length = lz_compress_block(block, count, packed + LZ_HEADER_SIZE, count - 1);
+        uint word = length;
+        if (length == 0)
+        {
+            memcpy(packed + LZ_HEADER_SIZE, block, count);
+            length = count;
+            word = count | LZ_BLOCK_STORED;
+        }
+        for (int i = 0; i < LZ_HEADER_SIZE; i++)
+        {
+            packed[i] = word >> (8 * i);
+        }
+
+        if (fwrite(packed, 1, LZ_HEADER_SIZE + length, fptr_dest) != LZ_HEADER_SIZE + length)
+        {
+            ret = e_failure;
+        }
+        *raw_size += count;
+    }
+    if (ferror(fptr_src) || fflush(fptr_dest) != 0)
+    {
+        ret = e_failure;
+    }
+    free(block);
+    free(packed);
+    return ret;
+}
+
+/*
+ * Compress the secret file into an LZ stream in a temporary file
+ * The temporary file then takes the place of the secret, so the capacity check
+ * and both payload stages only ever see the compressed bytes.
+ */
+Status compress_secret_file(EncodeInfo *encInfo)
+{
+    FILE *fptr_lz = tmpfile();
+
+    fseek(encInfo->fptr_secret, 0, SEEK_SET);
+    if (fptr_lz == NULL || compress_stream(encInfo->fptr_secret, fptr_lz, &encInfo->raw_secret_size) == e_failure)
+    {
+        if (fptr_lz != NULL)
+        {
+            fclose(fptr_lz);
+        }
+        return e_failure;
+    }
+
+    // The payload stages read the compressed stream from here on
+    fclose(encInfo->fptr_secret);
+    encInfo->fptr_secret = fptr_lz;
+    return e_success;
+}
+
+/* Encode payload bytes, adding them to the running CRC while they are still in cache */
+Status encode_payload_data(const char *data, int size, EncodeInfo *encInfo)
+{
+    if (encInfo->checksum)
+    {
+        encInfo->crc = crc32c_update(encInfo->crc, (const uchar *)data, size);
+    }
+    return encode_data_to_image((char *)data, size, encInfo);
+}
+
+/* Encode the nonce the payload is encrypted with, between the extension and the payload size */
+Status encode_secret_file_nonce(EncodeInfo *encInfo)
+{
+    return encode_data_to_image((char *)encInfo->nonce, CHACHA20_NONCE_SIZE, encInfo);
+}
+
+/* Encode the CRC32C of the payload right after it, as a 32 bit field at the chosen depth */
+Status encode_secret_file_checksum(EncodeInfo *encInfo)
+{
+    return encode_size_to_image(encInfo->crc, encInfo);
+}
+
+/* Encode the secret file data into the stego image */
+/*
+ * The secret is streamed in SECRET_CHUNK_SIZE pieces, each embedded as soon as
+ * it is read, so memory use does not depend on the secret size and binary data
+ * (including NUL bytes) is embedded exactly as stored.
+ */
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    char *chunk = malloc(SECRET_CHUNK_SIZE);
+    long left = encInfo->size_secret_file;
+    Status ret = e_success;
+
+    if (chunk == NULL)
+    {
+        return e_failure;
+    }
+
+    // A stream is read from where it stands, past its length prefix
+    if (!encInfo->stream)
+    {
+        fseek(encInfo->fptr_secret, encInfo->secret_start, SEEK_SET);
+    }
+    while (left > 0 && ret == e_success)
+    {
+        size_t count = (left < SECRET_CHUNK_SIZE) ? left : SECRET_CHUNK_SIZE;
 
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("width = %u\n", width);
+        // A short read means the secret changed size after check_capacity()
+        if (fread(chunk, 1, count, encInfo->fptr_secret) != count)
+        {
+            ret = e_failure;
+            break;
+        }
 
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("height = %u\n", height);
+        // Encrypted while the chunk is in cache, the CRC then covers the stored bytes
+        if (encInfo->key_fname != NULL)
+        {
+            chacha20_xor(&encInfo->cipher, encInfo->prefix_size + (encInfo->size_secret_file - left), (uchar *)chunk, count);
+        }
+        ret = encode_payload_data(chunk, count, encInfo);
+        left -= count;
+    }
 
-    // Return image capacity: width * height * bytes per pixel (3 for RGB)
-    return width * height * 3;
+    free(chunk);
+    return ret;
 }
 
-/*
- * Open the source image, secret file, and destination (stego) image files
- * Inputs: Src Image file, Secret file, and Stego Image file
- * Output: FILE pointers for the above files
- * Return Value: e_success or e_failure, based on file open errors
- */
-Status open_files(EncodeInfo *encInfo)
+/* Read exactly count bytes at offset, retrying short reads */
+static Status pread_full(int fd, char *buffer, size_t count, off_t offset)
 {
-    // Open the source image file in read mode
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
-    if (encInfo->fptr_src_image == NULL)
+    while (count > 0)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->src_image_fname);
-        return e_failure;
+        ssize_t done = pread(fd, buffer, count, offset);
+        if (done <= 0)
+        {
+            return e_failure;
+        }
+        buffer += done;
+        offset += done;
+        count -= done;
     }
+    return e_success;
+}
 
-    // Open the secret file (text file to hide in the image)
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
-    if (encInfo->fptr_secret == NULL)
+/* Write exactly count bytes at offset, retrying short writes */
+static Status pwrite_full(int fd, const char *buffer, size_t count, off_t offset)
+{
+    while (count > 0)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->secret_fname);
-        return e_failure;
+        ssize_t done = pwrite(fd, buffer, count, offset);
+        if (done <= 0)
+        {
+            return e_failure;
+        }
+        buffer += done;
+        offset += done;
+        count -= done;
     }
+    return e_success;
+}
 
-    // Open the stego image file for writing (destination image)
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
-    if (encInfo->fptr_stego_image == NULL)
+/* One thread's share of the payload: secret bytes [first, last) */
+typedef struct _EmbedRange
+{
+    EncodeInfo *encInfo;
+    off_t data_offset;              // Where the stego file stops after the metadata
+    unsigned long long channel;     // Channel byte payload byte 0 starts at
+    long first;
+    long last;
+    uint crc;                       // CRC32C of this range alone, with --crc
+    Status status;
+} EmbedRange;
+
+/* File offset of the carrier bytes for payload byte i on, padding in front of its first channel included */
+static off_t payload_offset(const EmbedRange *range, long i)
+{
+    if (i == 0)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR : Unable to open file %s\n", encInfo->stego_image_fname);
-        return e_failure;
+        return range->data_offset;
     }
-
-    // No failure, return e_success
-    return e_success;
+    return bmp_channel_offset(&range->encInfo->layout, range->channel + lsb_image_bytes(range->encInfo->depth, i));
 }
 
+/* Embed one payload range: pread the secret and carrier, embed, pwrite the stego image */
+static void *embed_range_worker(void *arg)
+{
+    EmbedRange *range = arg;
+    EncodeInfo *encInfo = range->encInfo;
+    const BmpLayout *layout = &encInfo->layout;
+    uint depth = encInfo->depth;
+    size_t raw_size = 0;
+    char *chunk = malloc(SECRET_CHUNK_SIZE);
+    char *image_buffer = NULL;
+    uchar *channels = NULL;
 
+    // Padded rows and 32 bpp pixels are gathered into their own buffer, whole rows at a time
+    if (!bmp_is_contiguous(layout))
+    {
+        channels = malloc(lsb_image_bytes(depth, SECRET_CHUNK_SIZE));
+    }
+    range->status = (chunk != NULL && (channels != NULL || bmp_is_contiguous(layout))) ? e_success : e_failure;
+    for (long i = range->first; i < range->last && range->status == e_success; i += SECRET_CHUNK_SIZE)
+    {
+        long count = (range->last - i < SECRET_CHUNK_SIZE) ? range->last - i : SECRET_CHUNK_SIZE;
 
-// Validate the command-line arguments for encoding
-Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
+        // Payload byte i starts a group, so its channel byte is exact; the file
+        // ranges of consecutive chunks meet, so padding between them is copied too
+        unsigned long long first = range->channel + lsb_image_bytes(depth, i);
+        size_t length = lsb_image_bytes(depth, count);
+        off_t offset = payload_offset(range, i);
+        size_t raw_length = payload_offset(range, i + count) - offset;
+        if (raw_length > raw_size)
+        {
+            free(image_buffer);
+            raw_size = raw_length;
+            image_buffer = malloc(raw_size);
+        }
+        if (image_buffer == NULL ||
+            pread_full(fileno(encInfo->fptr_secret), chunk, count, encInfo->secret_start + i) == e_failure ||
+            pread_full(fileno(encInfo->fptr_src_image), image_buffer, raw_length, offset) == e_failure)
+        {
+            range->status = e_failure;
+            break;
+        }
+        if (encInfo->key_fname != NULL)
+        {
+            chacha20_xor(&encInfo->cipher, encInfo->prefix_size + i, (uchar *)chunk, count);
+        }
+        if (encInfo->checksum)
+        {
+            range->crc = crc32c_update(range->crc, (uchar *)chunk, count);
+        }
+        if (channels == NULL)
+        {
+            lsb_embed_depth(depth, (uchar *)chunk, count, (uchar *)image_buffer + (bmp_channel_offset(layout, first) - offset));
+        }
+        else
+        {
+            bmp_gather(layout, (uchar *)image_buffer, offset, first, length, channels);
+            lsb_embed_depth(depth, (uchar *)chunk, count, channels);
+            bmp_scatter(layout, channels, first, length, (uchar *)image_buffer, offset);
+        }
+        range->status = pwrite_full(fileno(encInfo->fptr_stego_image), image_buffer, raw_length, offset);
+    }
+
+    free(chunk);
+    free(image_buffer);
+    free(channels);
+    return NULL;
+}
+
+/*
+ * Encode the secret file data with encInfo->threads threads
+ * Payload byte i always lands in channel bytes [v + 8i/depth, ...), so the
+ * payload is cut into one range per thread, on SECRET_CHUNK_SIZE boundaries,
+ * and every thread reads, embeds and writes its range with pread/pwrite.
+ * The result is byte-identical to encode_secret_file_data(); both streams are
+ * left at the end of the embedded region for copy_remaining_img_data().
+ */
+Status encode_secret_file_data_parallel(EncodeInfo *encInfo)
 {
-    // Step 1: Check if the source image file is a BMP file
-    if (strstr(argv[2], ".bmp") == NULL)
+    EmbedRange range[MAX_EMBED_THREADS];
+    pthread_t thread[MAX_EMBED_THREADS];
+    long size = encInfo->size_secret_file;
+    long chunks = (size + SECRET_CHUNK_SIZE - 1) / SECRET_CHUNK_SIZE;
+    uint threads = encInfo->threads;
+    Status ret = e_success;
+
+    // Hand the embedded metadata over to the file so pwrite can take over after it
+    if (flush_image_block(encInfo) == e_failure || fflush(encInfo->fptr_stego_image) != 0)
     {
-        printf("Error: source image file must be .bmp file\n");
         return e_failure;
     }
-    encInfo->src_image_fname = argv[2];  // Store the source file name
-
-    // Step 2: Check if the secret file is a text file
-    if (strstr(argv[3], ".txt") == NULL)
+    off_t data_offset = ftello(encInfo->fptr_src_image);
+    if (data_offset == -1 || data_offset != ftello(encInfo->fptr_stego_image) ||
+        lsb_image_bytes(encInfo->depth, size) > encInfo->layout.channels - encInfo->channel_pos)
     {
-        printf("Error: secret file must be .txt file\n");
         return e_failure;
     }
-    encInfo->secret_fname = argv[3];  // Store the secret file name
 
-    // Step 3: Check if the stego output image file is a BMP file
-    if (strstr(argv[4], ".bmp") == NULL)
+    // Split the payload into whole chunks per thread and start the threads
+    uint started = 0;
+    for (uint t = 0; t < threads; t++)
     {
-        printf("Error: stego image file must be .bmp file\n");
-        return e_failure;
+        range[t].encInfo = encInfo;
+        range[t].data_offset = data_offset;
+        range[t].channel = encInfo->channel_pos;
+        range[t].first = (chunks * t / threads) * SECRET_CHUNK_SIZE;
+        range[t].last = (chunks * (t + 1) / threads) * SECRET_CHUNK_SIZE;
+        if (range[t].last > size)
+        {
+            range[t].last = size;
+        }
+        range[t].crc = 0;
+        if (pthread_create(&thread[t], NULL, embed_range_worker, &range[t]) != 0)
+        {
+            ret = e_failure;
+            break;
+        }
+        started++;
     }
-    encInfo->stego_image_fname = argv[4];  // Store the output file name
+    for (uint t = 0; t < started; t++)
+    {
+        pthread_join(thread[t], NULL);
+        if (range[t].status == e_failure)
+        {
+            ret = e_failure;
+        }
 
-    return e_success;
+        // The ranges follow each other, so their CRCs chain up in order
+        if (range[t].first < range[t].last)
+        {
+            encInfo->crc = crc32c_combine(encInfo->crc, range[t].crc, range[t].last - range[t].first);
+        }
+    }
+
+    // Continue both streams right after the embedded payload
+    encInfo->channel_pos += lsb_image_bytes(encInfo->depth, size);
+    off_t end = (size > 0) ? (off_t)bmp_channel_offset(&encInfo->layout, encInfo->channel_pos) : data_offset;
+    encInfo->block_start = end;
+    if (fseeko(encInfo->fptr_src_image, end, SEEK_SET) != 0 || fseeko(encInfo->fptr_stego_image, end, SEEK_SET) != 0)
+    {
+        return e_failure;
+    }
+    return ret;
 }
 
-// Get the size of the secret file
-uint get_file_size(FILE *fptr)
+/*
+ * Move the logical tiles [first, last) of the payload between image, the
+ * whole carrier in memory, and logical. Contiguous tiles are used in place,
+ * the others go through channels.
+ */
+static void scatter_tiles(const BmpLayout *layout, const ScatterMap *map, uint first, uint last, uchar *image,
+                          uchar *logical, int store, uchar *channels)
 {
-    // Seek to the end of the file to get the size
-    fseek(fptr, 0, SEEK_END);
-    return ftell(fptr);  // Return the size of the file
+    int contiguous = bmp_is_contiguous(layout);
+
+    for (uint j = first; j < last; j++)
+    {
+        unsigned long long channel = map->base + (unsigned long long)map->tile[j] * SCATTER_TILE_CHANNELS;
+        uchar *physical = contiguous ? image + bmp_channel_offset(layout, channel) : channels;
+        uchar *tile_logical = logical + (size_t)(j - first) * SCATTER_TILE_CHANNELS;
+
+        if (!store)
+        {
+            if (!contiguous)
+            {
+                bmp_gather(layout, image, 0, channel, SCATTER_TILE_CHANNELS, channels);
+            }
+            scatter_tile_load(map, j, physical, tile_logical);
+            continue;
+        }
+        scatter_tile_store(map, j, tile_logical, physical);
+        if (!contiguous)
+        {
+            bmp_scatter(layout, channels, channel, SCATTER_TILE_CHANNELS, image, 0);
+        }
+    }
 }
 
-// Check the capacity of the source image to hold the secret file
-Status check_capacity(EncodeInfo *encInfo)
+/*
+ * Encode the secret file data scattered over keyed tiles
+ * The tiles sit anywhere in the carrier, so instead of a pread and a pwrite
+ * per tile the pixel data after the header is read into memory with one
+ * pread. Then, one secret chunk at a time (a whole number of tiles at every
+ * depth), the chunk's tiles are loaded into logical order, embedded like
+ * the sequential layout and stored back, and the image goes out with one
+ * pwrite. In place the carrier mapping is used instead and neither happens.
+ * The CRC goes in with the last chunk, so no tile is stored twice. The tile
+ * order is drawn once, -t does not apply.
+ */
+Status encode_secret_file_data_scatter(EncodeInfo *encInfo)
 {
-    // Get the image capacity (width * height * 3 for RGB)
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
+    uint depth = encInfo->depth;
+    long size = encInfo->size_secret_file;
+    size_t chunk_channels = lsb_image_bytes(depth, SECRET_CHUNK_SIZE);
+    int fd_src = fileno(encInfo->fptr_src_image);
+    uchar *chunk = malloc(SECRET_CHUNK_SIZE);
+    uchar *logical = malloc(chunk_channels + SCATTER_TILE_CHANNELS);
+    uchar *channels = malloc(SCATTER_TILE_CHANNELS);
+    uchar *image = NULL;
+    Status ret = e_success;
+    struct stat st;
+    ScatterMap map;
+
+    // In place the tiles are moved in the mapping itself, nothing to read or write
+    if (encInfo->in_place)
+    {
+        image = encInfo->image_map;
+        st.st_size = encInfo->image_map_size;
+    }
+    // Hand the embedded header over to the file, the buffer takes over after it
+    else if (chunk != NULL && logical != NULL && channels != NULL && flush_image_block(encInfo) == e_success &&
+             fflush(encInfo->fptr_stego_image) == 0 && fstat(fd_src, &st) == 0)
+    {
+        // Huge pages where the kernel has them, the tiles are read in random order and every 4 KiB page is a TLB miss
+        if (posix_memalign((void **)&image, SCATTER_IMAGE_ALIGN, st.st_size) != 0)
+        {
+            image = NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        else
+        {
+            madvise(image, st.st_size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    off_t data_offset = ftello(encInfo->fptr_src_image);
+    if (chunk == NULL || logical == NULL || channels == NULL || image == NULL || data_offset == -1 ||
+        (!encInfo->in_place && pread_full(fd_src, (char *)image + data_offset, st.st_size - data_offset, data_offset) == e_failure) ||
+        scatter_map_init(&map, &encInfo->cipher, encInfo->channel_pos, encInfo->layout.channels) == e_failure)
+    {
+        if (!encInfo->in_place)
+        {
+            free(image);
+        }
+        free(chunk);
+        free(logical);
+        free(channels);
+        return e_failure;
+    }
 
-    // Get the size of the secret file
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    for (long i = 0; ret == e_success && (i < size || (i == 0 && encInfo->checksum)); i += SECRET_CHUNK_SIZE)
+    {
+        long count = (size - i < SECRET_CHUNK_SIZE) ? size - i : SECRET_CHUNK_SIZE;
+        unsigned long long first = lsb_image_bytes(depth, i);
+        unsigned long long end = lsb_image_bytes(depth, i + count);
+        int last = (i + count == size);
 
-    // Calculate the total number of bytes required to store the image header, magic string, secret file metadata (extension, size), and the secret file data itself
-    int total_bytes = 54 + strlen(MAGIC_STRING) * 8 + 32 + 32 + 32 + encInfo->size_secret_file * 8;
+        if (pread_full(fileno(encInfo->fptr_secret), (char *)chunk, count, encInfo->secret_start + i) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+        if (encInfo->key_fname != NULL)
+        {
+            chacha20_xor(&encInfo->cipher, encInfo->prefix_size + i, chunk, count);
+        }
+        if (encInfo->checksum)
+        {
+            encInfo->crc = crc32c_update(encInfo->crc, chunk, count);
+            end += last ? lsb_image_bytes(depth, 4) : 0;
+        }
 
-    // Check if the image capacity is enough to store the secret file and metadata
-    if (total_bytes <= encInfo->image_capacity)
+        // Chunks start on a tile, only the last one ends inside one
+        uint tile_first = first / SCATTER_TILE_CHANNELS;
+        uint tile_last = (end + SCATTER_TILE_CHANNELS - 1) / SCATTER_TILE_CHANNELS;
+        if (tile_last > map.tiles)
+        {
+            ret = e_failure;
+            break;
+        }
+        scatter_tiles(&encInfo->layout, &map, tile_first, tile_last, image, logical, 0, channels);
+        lsb_embed_depth(depth, chunk, count, logical);
+        if (last && encInfo->checksum)
+        {
+            lsb_embed_size(encInfo->crc, depth, logical + (lsb_image_bytes(depth, size) - first));
+        }
+        scatter_tiles(&encInfo->layout, &map, tile_first, tile_last, image, logical, 1, channels);
+    }
+
+    // Everything after the header in one go, both streams continue at the end
+    if (ret == e_success && !encInfo->in_place &&
+        (pwrite_full(fileno(encInfo->fptr_stego_image), (char *)image + data_offset, st.st_size - data_offset, data_offset) == e_failure ||
+         fseeko(encInfo->fptr_src_image, st.st_size, SEEK_SET) != 0 || fseeko(encInfo->fptr_stego_image, st.st_size, SEEK_SET) != 0))
     {
-        return e_success;  // Enough space in the image
+        ret = e_failure;
     }
-    else
+    if (!encInfo->in_place)
     {
-        return e_failure;  // Not enough space in the image
+        encInfo->block_start = st.st_size;
+        free(image);
     }
+    scatter_map_free(&map);
+    free(chunk);
+    free(logical);
+    free(channels);
+    return ret;
 }
 
-/* Copy the first 54 bytes (BMP header) from the source image to the destination (stego) image */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+/*
+ * Write the pages an in-place encode touched back to the carrier
+ * The span runs from the first pixel byte to the last embedded channel byte,
+ * over the whole pixel data with --scatter, whose tiles lie anywhere. msync
+ * only writes the dirty pages in it, so the write volume follows the payload
+ * and the untouched rest of the image is never read or written.
+ */
+Status sync_in_place(EncodeInfo *encInfo, size_t *synced)
 {
-    char str[54];
-
-    // Seek to the beginning of the image file (0th byte)
-    fseek(fptr_src_image, 0, SEEK_SET);
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = encInfo->layout.pixel_offset / page * page;
+    size_t end = encInfo->scatter ? encInfo->image_map_size : bmp_channel_offset(&encInfo->layout, encInfo->channel_pos - 1) + 1;
 
-    // Read the 54-byte BMP header from the source image
-    fread(str, 54, 1, fptr_src_image);
-
-    // Write the 54-byte BMP header to the destination (stego image)
-    fwrite(str, 54, 1, fptr_dest_image);
-    return e_success;
+    *synced = end - start;
+    return (msync(encInfo->image_map + start, end - start, MS_SYNC) == 0) ? e_success : e_failure;
 }
 
-/* Encode the secret file data into the image */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image)
+/*
+ * Copy the remaining data from the source image to the destination image
+ * The copy starts at the current position of both streams and is done by the
+ * kernel with copy_file_range(), then sendfile(), and only falls back to
+ * pread/pwrite through a large buffer when neither works for these files.
+ * Both streams are left positioned at the end of the copied data.
+ */
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
-    char str[8];
-    for (int i = 0; i < size; i++)
+    int fd_src = fileno(fptr_src);
+    int fd_dest = fileno(fptr_dest);
+    struct stat st;
+
+    // Hand the stream positions over to the file descriptors
+    if (fflush(fptr_dest) != 0 || fstat(fd_src, &st) == -1)
+    {
+        return e_failure;
+    }
+    off_t off_src = ftello(fptr_src);
+    off_t off_dest = ftello(fptr_dest);
+    if (off_src == -1 || off_dest == -1)
     {
-        // Read 8 bytes from the source image (or the image buffer)
-        fread(str, 8, 1, fptr_src_image);
+        return e_failure;
+    }
+    size_t left = (st.st_size > off_src) ? st.st_size - off_src : 0;
 
-        // Encode each byte of data into the least significant bits (LSB) of the image buffer
-        encode_byte_to_lsb(data[i], str);
+    // Step 1: copy_file_range, which can share extents or stay in the page cache
+    while (left > 0)
+    {
+        ssize_t copied = copy_file_range(fd_src, &off_src, fd_dest, &off_dest, left, 0);
+        if (copied <= 0)
+        {
+            break;
+        }
+        left -= copied;
+    }
 
-        // Write the modified image buffer to the stego image
-        fwrite(str, 8, 1, fptr_stego_image);
+    // Step 2: sendfile, which writes at the destination descriptor's own offset
+    if (left > 0 && lseek(fd_dest, off_dest, SEEK_SET) != -1)
+    {
+        while (left > 0)
+        {
+            ssize_t copied = sendfile(fd_dest, fd_src, &off_src, left);
+            if (copied <= 0)
+            {
+                break;
+            }
+            off_dest += copied;
+            left -= copied;
+        }
     }
-    return e_success;
-}
 
-/* Encode the magic string into the stego image */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
-{
-    encode_data_to_image((char*) magic_string, strlen(magic_string), encInfo->fptr_src_image, encInfo->fptr_stego_image);
-    return e_success;
-}
+    // Step 3: plain copy through a large buffer
+    if (left > 0)
+    {
+        char *buffer = malloc(IMAGE_BLOCK_SIZE);
+        if (buffer == NULL)
+        {
+            return e_failure;
+        }
+        while (left > 0)
+        {
+            ssize_t count = pread(fd_src, buffer, (left < IMAGE_BLOCK_SIZE) ? left : IMAGE_BLOCK_SIZE, off_src);
+            if (count <= 0 || pwrite(fd_dest, buffer, count, off_dest) != count)
+            {
+                break;
+            }
+            off_src += count;
+            off_dest += count;
+            left -= count;
+        }
+        free(buffer);
+    }
 
-/* Encode the secret file extension size into the stego image */
-Status encode_secret_file_extn_size(int size, FILE *fptr_src_image, FILE *fptr_stego_image)
-{
-    char str[32];
-    fread(str, 32, 1, fptr_src_image);
-    encode_size_to_lsb(size, str);  // Encode the size into the LSB
-    fwrite(str, 32, 1, fptr_stego_image);
-    return e_success;
+    // Leave both streams where the descriptors stopped
+    if (fseeko(fptr_src, off_src, SEEK_SET) != 0 || fseeko(fptr_dest, off_dest, SEEK_SET) != 0)
+    {
+        return e_failure;
+    }
+    return (left == 0) ? e_success : e_failure;
 }
 
-/* Encode the secret file extension into the stego image */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+/*
+ * Copy everything left on fd_src to fd_dest, up to end of file
+ * For streams, which have no size or offsets: splice() moves the pages
+ * through the pipe on either side without a copy to user space, a plain
+ * read/write loop takes over when neither descriptor is a pipe.
+ */
+static Status copy_stream_data(int fd_src, int fd_dest, unsigned long long *copied)
 {
-    encode_data_to_image((char *)file_extn, strlen(file_extn), encInfo->fptr_src_image, encInfo->fptr_stego_image);
-    return e_success;
-}
+    ssize_t count;
 
-/* Encode the secret file size into the stego image */
-Status encode_secret_file_size(long int size, EncodeInfo *encInfo)
-{
-    char str[32];
-    fread(str, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(size, str);  // Encode the size into the LSB
-    fwrite(str, 32, 1, encInfo->fptr_stego_image);
-    return e_success;
-}
+    *copied = 0;
+    while ((count = splice(fd_src, NULL, fd_dest, NULL, IMAGE_BLOCK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+    {
+        *copied += count;
+    }
+    if (count == 0)
+    {
+        return e_success;
+    }
+    if (*copied > 0 || errno != EINVAL)
+    {
+        return e_failure;
+    }
 
-/* Encode the secret file data into the stego image */
-Status encode_secret_file_data(EncodeInfo *encInfo)
-{
-    fseek(encInfo->fptr_secret, 0, SEEK_SET);
-    char str[encInfo->size_secret_file];
-    fread(str, encInfo->size_secret_file, 1, encInfo->fptr_secret);
-    encode_data_to_image(str, strlen(str), encInfo->fptr_src_image, encInfo->fptr_stego_image);
-    return e_success;
+    char *buffer = malloc(IMAGE_BLOCK_SIZE);
+    if (buffer == NULL)
+    {
+        return e_failure;
+    }
+    while ((count = read(fd_src, buffer, IMAGE_BLOCK_SIZE)) > 0)
+    {
+        for (ssize_t done = 0, written; done < count; done += written)
+        {
+            if ((written = write(fd_dest, buffer + done, count - done)) <= 0)
+            {
+                free(buffer);
+                return e_failure;
+            }
+        }
+        *copied += count;
+    }
+    free(buffer);
+    return (count == 0) ? e_success : e_failure;
 }
 
-/* Encode a single byte of data into the LSB of the image buffer */
-Status encode_byte_to_lsb(char data, char *image_buffer)
+/* Write out the last carrier block and the rest of the image after it, tail gets the bytes written */
+static Status write_image_tail(EncodeInfo *encInfo, unsigned long long *tail)
 {
-    int count = 0;
-    for (int i = 7; i >= 0; i--)
+    if (encInfo->stream)
     {
-        if ((data >> i) & 1)
-        {
-            image_buffer[count] |= 1;  // Set LSB to 1
-        }
-        else
+        unsigned long long start = encInfo->block_start;
+        unsigned long long copied;
+
+        if (flush_image_block(encInfo) == e_failure || fflush(encInfo->fptr_stego_image) != 0 ||
+            copy_stream_data(fileno(encInfo->fptr_src_image), fileno(encInfo->fptr_stego_image), &copied) == e_failure)
         {
-            image_buffer[count] &= ~1;  // Set LSB to 0
+            return e_failure;
         }
-        count++;
+        *tail = encInfo->block_start - start + copied;
+        return e_success;
+    }
+
+    // The block's file offset, not the FILE's: a pipeline wrote everything in front of it through the descriptor
+    unsigned long long start = encInfo->block_start;
+    if (flush_image_block(encInfo) == e_failure ||
+        copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    {
+        return e_failure;
     }
+    *tail = ftello(encInfo->fptr_stego_image) - start;
     return e_success;
 }
 
-/* Encode the size value into the LSB of the image buffer */
-Status encode_size_to_lsb(int size, char *image_buffer)
+/* Release the carrier block and close the files opened by open_files() */
+void close_files(EncodeInfo *encInfo)
 {
-    int count = 0;
-    for (int i = 31; i >= 0; i--)
+    // A failed encode still waits for the pipeline's I/O, the block is one of its buffers
+    if (encInfo->pipeline != NULL)
     {
-        if ((size >> i) & 1)
-        {
-            image_buffer[count] |= 1;  // Set LSB to 1
-        }
-        else
-        {
-            image_buffer[count] &= ~1;  // Set LSB to 0
-        }
-        count++;
+        pipeline_close(encInfo->pipeline, &encInfo->stats.pipe);
+        free(encInfo->pipeline);
+        encInfo->pipeline = NULL;
+        encInfo->image_block = NULL;
+    }
+    if (encInfo->image_map != NULL)
+    {
+        munmap(encInfo->image_map, encInfo->image_map_size);
+        encInfo->image_map = NULL;
+    }
+    else
+    {
+        free(encInfo->image_block);
+    }
+    free(encInfo->channel_block);
+    free(encInfo->stream_header);
+    encInfo->image_block = NULL;
+    encInfo->channel_block = NULL;
+    encInfo->stream_header = NULL;
+    explicit_bzero(&encInfo->cipher, sizeof(encInfo->cipher));
+
+    if (encInfo->fptr_src_image != NULL)
+    {
+        fclose(encInfo->fptr_src_image);
+        encInfo->fptr_src_image = NULL;
+    }
+    if (encInfo->fptr_secret != NULL)
+    {
+        fclose(encInfo->fptr_secret);
+        encInfo->fptr_secret = NULL;
+    }
+    if (encInfo->fptr_stego_image != NULL)
+    {
+        fclose(encInfo->fptr_stego_image);
+        encInfo->fptr_stego_image = NULL;
     }
-    return e_success;
 }
 
-/* Copy the remaining data from the source image to the destination image */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+/* Remove the stego image a failed encode created, so no empty or half written copy is left behind */
+static void discard_stego_image(EncodeInfo *encInfo)
 {
-    char ch;
-    while ((fread(&ch, 1, 1, fptr_src)) > 0)
+    struct stat st;
+
+    // Only a regular file, a path handed over by the daemon may be a link to someone else's
+    if (lstat(encInfo->stego_image_fname, &st) == 0 && S_ISREG(st.st_mode))
     {
-        fwrite(&ch, 1, 1, fptr_dest);
+        unlink(encInfo->stego_image_fname);
     }
-    return e_success;
+}
+
+/* Print a progress message for a finished stage, unless running quiet */
+static void print_stage(const EncodeInfo *encInfo, const char *format, ...)
+{
+    va_list args;
+
+    if (encInfo->quiet)
+    {
+        return;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
 }
 
 /* Perform the entire encoding process: embedding the secret file into the image */
 Status do_encoding(EncodeInfo *encInfo)
 {
+    Status ret = e_failure;
+    unsigned long long tail = 0;
+
+    // Time every stage from here on
+    stats_start(&encInfo->stats);
+
     // Open necessary files (source image, secret file, stego image)
     if (open_files(encInfo) == e_success)
     {
-        printf("Open files is Success\n");
-        sleep(1); // Delay for better visibility
+        stats_stage(&encInfo->stats, "open", 0);
+        print_stage(encInfo, "Open files is Success\n");
 
         // Check if the image has enough capacity for the secret file
         if (check_capacity(encInfo) == e_success)
         {
-            printf("Check Capacity is Success\n");
-            sleep(1); // Delay for better visibility
+            stats_stage(&encInfo->stats, "capacity", 0);
+            print_stage(encInfo, "Check Capacity is Success\n");
 
-            // Copy the BMP header (54 bytes) from source to stego image
-            if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+            // Copy the BMP header (everything up to the pixel data) from source to stego image
+            if (encInfo->in_place ||
+                (encInfo->stream ? copy_stream_header(encInfo) : copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->layout.pixel_offset)) == e_success)
             {
-                printf("Copying bmp header is Success\n");
-                  sleep(1); // Delay for better visibility
+                stats_stage(&encInfo->stats, "header", encInfo->in_place ? 0 : encInfo->layout.pixel_offset);
+                print_stage(encInfo, "Copying bmp header is Success\n");
 
-                // Encode the magic string into the stego image
-                if (encode_magic_string(MAGIC_STRING, encInfo) == e_success)
+                // Encode the magic string and the embedding depth used for the rest of the image
+                if (encode_magic_string(MAGIC_STRING, encInfo) == e_success && encode_stego_mode(encInfo) == e_success)
                 {
-                    printf("Encoded Magic string is Successful\n");
-                     sleep(1); // Delay for better visibility
+                    stats_stage(&encInfo->stats, "magic", strlen(MAGIC_STRING) + steg_mode_size(encInfo->mode_flags));
+                    print_stage(encInfo, "Encoded Magic string is Successful (depth %u)\n", encInfo->depth);
 
                     // Get and encode the secret file extension
-                    strcpy(encInfo->extn_secret_file, strstr(encInfo->secret_fname, "."));
-                    printf("Got secret file extension\n");
-                     sleep(1); // Delay for better visibility
+                    strcpy(encInfo->extn_secret_file, secret_file_extn(encInfo));
+                    print_stage(encInfo, "Got secret file extension\n");
 
                     // Encode the secret file extension size and extension into the image
-                    if (encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+                    if (encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo) == e_success)
                     {
-                        printf("Encoding Secret file extension size is successful\n");
-                         sleep(1); // Delay for better visibility
+                        print_stage(encInfo, "Encoding Secret file extension size is successful\n");
 
                         // Encode the secret file data size and data itself into the image
                         if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
                         {
-                            printf("Secret file extension is encoded succesfully\n");
-                             sleep(1); // Delay for better visibility
+                            stats_stage(&encInfo->stats, "extn", 4 + strlen(encInfo->extn_secret_file));
+                            print_stage(encInfo, "Secret file extension is encoded succesfully\n");
 
-                            if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success)
+                            if ((encInfo->key_fname == NULL || encode_secret_file_nonce(encInfo) == e_success) &&
+                                encode_secret_file_size(encInfo->size_secret_file + encInfo->prefix_size, encInfo) == e_success)
                             {
-                                printf("Secret file size is encoded successfully\n");
-                                sleep(1); // Delay for better visibility
+                                stats_stage(&encInfo->stats, "size", 4 + ((encInfo->key_fname != NULL) ? CHACHA20_NONCE_SIZE : 0));
+                                print_stage(encInfo, "Secret file size is encoded successfully\n");
 
-                                if (encode_secret_file_data(encInfo) == e_success)
+                                // A shard header goes in front of the data, the CRC behind it
+                                if ((encInfo->prefix_size == 0 || encode_payload_data((const char *)encInfo->payload_prefix, encInfo->prefix_size, encInfo) == e_success) &&
+                                    (encInfo->scatter ? encode_secret_file_data_scatter(encInfo) :
+                                     ((encInfo->threads > 1 && !encInfo->in_place) ? encode_secret_file_data_parallel(encInfo) : encode_secret_file_data(encInfo))) == e_success &&
+                                    (!encInfo->checksum || encInfo->scatter || encode_secret_file_checksum(encInfo) == e_success))
                                 {
-                                    printf("Secret file data is encoded successfully\n");
-                                     sleep(1); // Delay for better visibility
+                                    stats_stage(&encInfo->stats, "payload", encInfo->size_secret_file);
+                                    print_stage(encInfo, "Secret file data is encoded successfully\n");
 
-                                    // Copy the remaining image data from source to destination (stego image)
-                                    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+                                    // In place only the touched pages go back to the carrier
+                                    if (encInfo->in_place)
+                                    {
+                                        size_t synced = 0;
+                                        if (sync_in_place(encInfo, &synced) == e_success)
+                                        {
+                                            stats_stage(&encInfo->stats, "tail", synced);
+                                            print_stage(encInfo, "Touched pages are synced to the carrier successfully\n");
+                                            ret = e_success;
+                                        }
+                                        else
+                                        {
+                                            printf("ERROR : Syncing %s failed\n", encInfo->src_image_fname);
+                                        }
+                                    }
+                                    // Write out the embedded part of the last carrier block, then copy the remaining image data from source to destination (stego image)
+                                    else if (write_image_tail(encInfo, &tail) == e_success)
                                     {
-                                        printf("Remaining image data is copied successfully\n");
-                                        return e_success;
+                                        stats_stage(&encInfo->stats, "tail", tail);
+                                        print_stage(encInfo, "Remaining image data is copied successfully\n");
+                                        ret = e_success;
                                     }
                                     else
                                     {
@@ -364,6 +1703,15 @@ Status do_encoding(EncodeInfo *encInfo)
     else
     {
         printf("ERROR : File opening failed\n");
-        return e_failure;
     }
+    // Only a file open_files() created, the carrier edited in place and a stream are not ours to remove
+    int created = !encInfo->in_place && !encInfo->stream && encInfo->fptr_stego_image != NULL;
+    close_files(encInfo);
+    if (ret == e_failure && created)
+    {
+        discard_stego_image(encInfo);
+    }
+    stats_stage(&encInfo->stats, "close", 0);
+    stats_report(&encInfo->stats, "encode", ret);
+    return ret;
 }
@@ -1,6 +1,12 @@
 #ifndef ENCODE_H
 #define ENCODE_H
+#include <stdio.h>
+#include <sys/types.h>
 #include "types.h" // Contains user defined types
+#include "bmp.h"
+#include "stats.h"
+#include "chacha20.h"
+#include "pipeline.h"
 
 /* 
  * Structure to store information required for
@@ -11,28 +17,100 @@
 
 #define MAX_SECRET_BUF_SIZE 1
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 4
+/* Extension with its terminator, as long as the stego header allows (MAX_STEG_EXTN) */
+#define MAX_FILE_SUFFIX 16
+
+/* Carrier file bytes read, embedded and written per block by the encode engine */
+#define IMAGE_BLOCK_SIZE (256 * 1024)
+
+/* Secret bytes read and embedded at a time by encode_secret_file_data(),
+ * a multiple of every embedding depth (1-4) so chunks split on whole groups */
+#define SECRET_CHUNK_SIZE (60 * 1024)
+
+/* Alignment of the carrier a scattered encode holds in memory, one huge page */
+#define SCATTER_IMAGE_ALIGN (2 * 1024 * 1024)
+
+/* Longest header (everything in front of the pixel data) a --stream encode keeps for the stego image */
+#define STREAM_HEADER_MAX (1024 * 1024)
+
+/* Upper limit for -t, threads embedding one image in parallel */
+#define MAX_EMBED_THREADS 64
 
 typedef struct _EncodeInfo
 {
     /* Source Image info */
     char *src_image_fname;
     FILE *fptr_src_image;
-    uint image_capacity;
+    BmpLayout layout;                    // Which carrier bytes are channel bytes
+    uint mode_flags;                     // STEG_MODE_* flags for this layout
+    unsigned long long image_capacity;   // Channel bytes in the carrier
     uint bits_per_pixel;
+    uint depth;
+    uint threads;
     char image_data[MAX_IMAGE_BUF_SIZE];
 
+    /* Carrier block currently being embedded: file bytes from block_start on */
+    char *image_block;
+    uint block_len;
+    unsigned long long block_start;
+    unsigned long long channel_pos;      // Next channel byte to embed into
+    uchar *channel_block;                // Channels gathered from the block when not contiguous
+
+    /* --io: the block is one of the pipeline's buffers, read ahead and written back behind the engine (pipeline.h) */
+    PipelineMode io_mode;
+    Pipeline *pipeline;
+    PipelineBlock *pipe_block;
+    unsigned long long embed_end;        // File offset past the last channel byte embedded into
+
+    /* --in-place: the carrier is the stego image, mapped shared and used as one block */
+    int in_place;
+    uchar *image_map;
+    size_t image_map_size;
+
     /* Secret File Info */
     char *secret_fname;
     FILE *fptr_secret;
     char extn_secret_file[MAX_FILE_SUFFIX];
     char secret_data[MAX_SECRET_BUF_SIZE];
-    long size_secret_file;
+    long size_secret_file;               // Bytes embedded, the LZ stream when compressing
+    long raw_secret_size;                // Bytes of the secret file itself
+    int compress;                        // -z: LZ compress the secret before embedding
+    int checksum;                        // --crc: store a CRC32C of the payload after it
+    uint crc;                            // CRC32C of the payload embedded so far
+    char *key_fname;                     // --key: encrypt the payload with ChaCha20 under this key file
+    ChaCha20 cipher;                     // Keyed by open_files() with a fresh nonce for every image
+    uchar nonce[CHACHA20_NONCE_SIZE];
+    int scatter;                         // --scatter: spread the payload over tiles in a keyed order
+
+    /* Files packed into a container instead of one secret (-p), see container.h */
+    char **container_files;
+    int container_count;
+    int container_compress;              // -z with -p: LZ compress every entry on its own
+
+    /* One shard of a secret split over several carriers (--shard), see shard.h:
+     * prefix_size bytes of payload_prefix, then secret bytes [secret_start, secret_start + secret_length) */
+    const uchar *payload_prefix;
+    uint prefix_size;
+    long secret_start;
+    long secret_length;
 
     /* Stego Image Info */
     char *stego_image_fname;
     FILE *fptr_stego_image;
 
+    /* --stream: all three files are descriptors read and written front to back, nothing is seeked (stream.h) */
+    int stream;
+    int stream_src_fd;
+    int stream_secret_fd;
+    int stream_stego_fd;
+    uchar *stream_header;                // Everything in front of the pixel data, kept from the carrier stream
+
+    /* Skip progress messages (-q, batch jobs) */
+    int quiet;
+
+    /* Per-stage timings, printed with --stats / --json */
+    StegStats stats;
+
 } EncodeInfo;
 
 /* Encoding function prototype */
@@ -52,37 +130,76 @@ Status open_files(EncodeInfo *encInfo);
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Get image pixel layout */
+Status get_image_layout_for_bmp(FILE *fptr_image, BmpLayout *layout);
 
 /* Get file size */
-uint get_file_size(FILE *fptr);
+off_t get_file_size(FILE *fptr);
 
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+/* Copy bmp image header, everything in front of the pixel data */
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, uint size);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
+/* Store the stego mode byte (embedding depth) */
+Status encode_stego_mode(EncodeInfo *encInfo);
+
 /* Encode secret file extenstion */
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
 Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
 
+/* Replace the secret stream by its LZ compressed form */
+Status compress_secret_file(EncodeInfo *encInfo);
+
+/* Write the LZ stream of everything left in fptr_src to fptr_dest, raw_size gets the bytes read */
+Status compress_stream(FILE *fptr_src, FILE *fptr_dest, long *raw_size);
+
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
+/* Encode secret file data with one pread/pwrite range per thread */
+Status encode_secret_file_data_parallel(EncodeInfo *encInfo);
+
+/* Encode secret file data (and CRC) scattered over keyed tiles */
+Status encode_secret_file_data_scatter(EncodeInfo *encInfo);
+
+/* Encode payload bytes, adding them to the running CRC with --crc */
+Status encode_payload_data(const char *data, int size, EncodeInfo *encInfo);
+
+/* Encode the ChaCha20 nonce of an encrypted payload */
+Status encode_secret_file_nonce(EncodeInfo *encInfo);
+
+/* Encode the CRC32C of the payload after it */
+Status encode_secret_file_checksum(EncodeInfo *encInfo);
+
+/* Encode secret file extension size */
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
+
 /* Encode function, which does the real encoding */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image);
+Status encode_data_to_image(char *data, int size, EncodeInfo *encInfo);
+
+/* Encode data at an explicit embedding depth */
+Status encode_data_at_depth(const char *data, int size, uint depth, EncodeInfo *encInfo);
 
-/* Encode a byte into LSB of image data array */
-Status encode_byte_to_lsb(char data, char *image_buffer);
+/* Encode a 32 bit size field at the chosen depth */
+Status encode_size_to_image(uint size, EncodeInfo *encInfo);
+
+/* Make sure the carrier block holds the next count channel bytes */
+Status reserve_image_block(uint count, EncodeInfo *encInfo);
+
+/* Write the carrier block out to the stego image */
+Status flush_image_block(EncodeInfo *encInfo);
 
 /* Copy remaining image bytes from src to stego image after encoding */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
 
-/* Encode size to lsb */
-Status encode_size_to_lsb(int size,char *arr);
+/* Write the pages an in-place encode touched back to the carrier, synced bytes in *synced */
+Status sync_in_place(EncodeInfo *encInfo, size_t *synced);
+
+/* Release the carrier block and close all files */
+void close_files(EncodeInfo *encInfo);
 
 #endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "inspect.h"
+#include "steg.h"
+#include "common.h"
+#include "types.h"
+
+/* Function Definitions */
+
+// Validate the command-line arguments for inspect mode: -i image.bmp [image.bmp ...] [--json]
+Status read_and_validate_inspect_args(char *argv[], InspectOptions *opts)
+{
+    int count = 0;
+
+    // Images are collected in place over argv, dropping the options
+    opts->json = 0;
+    opts->images = argv + 2;
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            opts->json = 1;
+        }
+        else if (strstr(argv[i], ".bmp") != NULL)
+        {
+            opts->images[count++] = argv[i];
+        }
+        else
+        {
+            printf("Error: %s is not a .bmp file\n", argv[i]);
+            return e_failure;
+        }
+    }
+    opts->images[count] = NULL;
+
+    if (count == 0)
+    {
+        printf("Error: no image to inspect\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Read up to count bytes at offset, short only at the end of the file */
+static ssize_t read_at(int fd, uchar *buf, size_t count, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < count)
+    {
+        ssize_t got = pread(fd, buf + done, count - done, offset + done);
+        if (got < 0)
+        {
+            return -1;
+        }
+        if (got == 0)
+        {
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+Status inspect_image(const char *fname, InspectResult *result)
+{
+    uchar head[INSPECT_READ_SIZE];
+    uchar *image = head;
+    struct stat st;
+    struct timespec start, end;
+    BmpLayout layout;
+    Status ret = e_success;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", fname);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return e_failure;
+    }
+    result->file_size = st.st_size;
+
+    // Step 1: BMP header and, for any usual pixel offset, the stego header channels in one read
+    ssize_t got = read_at(fd, head, sizeof(head), 0);
+    if (got < 0)
+    {
+        perror("pread");
+        close(fd);
+        return e_failure;
+    }
+    result->bytes_read = got;
+
+    // Step 2: Pixel data starting past the first read, fetch up to the end of the header channels
+    if (bmp_parse_layout(head, got, result->file_size, &layout) == e_success)
+    {
+        unsigned long long channels = (layout.channels < STEG_HEAD_MAX) ? layout.channels : STEG_HEAD_MAX;
+        unsigned long long need = bmp_channel_offset(&layout, channels);
+
+        if (need > (unsigned long long)got && (image = malloc(need)) != NULL)
+        {
+            memcpy(image, head, got);
+            ssize_t more = read_at(fd, image + got, need - got, got);
+            if (more < 0)
+            {
+                perror("pread");
+                ret = e_failure;
+            }
+            else
+            {
+                result->bytes_read += more;
+            }
+        }
+        else if (image == NULL)
+        {
+            fprintf(stderr, "ERROR : Unable to allocate %llu bytes\n", need);
+            image = head;
+            ret = e_failure;
+        }
+    }
+    close(fd);
+
+    // Step 3: Magic, mode, extension and payload size, never the payload
+    if (ret == e_success)
+    {
+        result->found = (steg_probe(image, result->bytes_read, result->file_size, &result->header, &result->layout) == e_success);
+    }
+    if (image != head)
+    {
+        free(image);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    return ret;
+}
+
+/* JSON string with quotes, backslashes and control bytes escaped */
+static void print_json_string(FILE *fptr, const char *str)
+{
+    fputc('"', fptr);
+    for (const uchar *p = (const uchar *)str; *p != '\0'; p++)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            fprintf(fptr, "\\%c", *p);
+        }
+        else if (*p < 0x20 || *p >= 0x7F)
+        {
+            fprintf(fptr, "\\u%04x", *p);
+        }
+        else
+        {
+            fputc(*p, fptr);
+        }
+    }
+    fputc('"', fptr);
+}
+
+static void print_result(FILE *fptr, const char *fname, const InspectResult *result, int json)
+{
+    const StegHeader *header = &result->header;
+    const char *layout = (header->flags & STEG_MODE_SCANLINE) ? "scanline" : "flat";
+
+    if (json)
+    {
+        fprintf(fptr, "{\"image\": ");
+        print_json_string(fptr, fname);
+        fprintf(fptr, ", \"stego\": %s", result->found ? "true" : "false");
+        if (result->found)
+        {
+            fprintf(fptr, ", \"extension\": ");
+            print_json_string(fptr, header->extension);
+            fprintf(fptr, ", \"payload_bytes\": %u, \"depth\": %u, \"layout\": \"%s\", \"compressed\": %s, \"container\": %s, "
+                    "\"shard\": %s, \"checksum\": %s, \"encrypted\": %s, \"scattered\": %s, \"channels_used\": %llu, \"channels\": %llu",
+                    header->payload_size, header->depth, layout, (header->flags & STEG_MODE_LZ) ? "true" : "false",
+                    (header->flags & STEG_MODE_CONTAINER) ? "true" : "false", (header->flags & STEG_MODE_SHARD) ? "true" : "false",
+                    (header->flags & STEG_EXT_CRC32C) ? "true" : "false", (header->flags & STEG_EXT_CHACHA20) ? "true" : "false",
+                    (header->flags & STEG_EXT_SCATTER) ? "true" : "false",
+                    steg_encoded_size(header), result->layout.channels);
+        }
+        fprintf(fptr, ", \"bytes_read\": %zu, \"us\": %.1f}\n", result->bytes_read, result->us);
+    }
+    else if (result->found)
+    {
+        fprintf(fptr, "%s: extension \"%s\", payload %u bytes%s%s%s%s%s%s, depth %u, %s layout, %llu of %llu channel bytes used (%zu bytes read, %.1f us)\n",
+                fname, header->extension, header->payload_size, (header->flags & STEG_MODE_LZ) ? " (LZ compressed)" : "",
+                (header->flags & STEG_MODE_CONTAINER) ? " (container, list with -l)" : "",
+                (header->flags & STEG_MODE_SHARD) ? " (shard, join with --join)" : "",
+                (header->flags & STEG_EXT_CRC32C) ? " (CRC32C stored, not verified)" : "",
+                (header->flags & STEG_EXT_CHACHA20) ? " (ChaCha20 encrypted, decode with --key)" : "",
+                (header->flags & STEG_EXT_SCATTER) ? " (scattered over keyed tiles)" : "",
+                header->depth, layout, steg_encoded_size(header), result->layout.channels, result->bytes_read, result->us);
+    }
+    else
+    {
+        fprintf(fptr, "%s: no payload (%zu bytes read, %.1f us)\n", fname, result->bytes_read, result->us);
+    }
+}
+
+Status do_inspect(const InspectOptions *opts, FILE *fptr_out)
+{
+    Status ret = e_success;
+
+    for (char **fname = opts->images; *fname != NULL; fname++)
+    {
+        InspectResult result = { 0 };
+
+        if (inspect_image(*fname, &result) == e_failure)
+        {
+            ret = e_failure;
+            continue;
+        }
+        print_result(fptr_out, *fname, &result, opts->json);
+    }
+    return ret;
+}
@@ -0,0 +1,46 @@
+#ifndef INSPECT_H
+#define INSPECT_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "steg.h"
+
+/*
+ * Inspect mode
+ * Reports what a stego image carries without extracting it: only the BMP
+ * header and the channel bytes of the stego header are read (one pread of
+ * INSPECT_READ_SIZE bytes covers both for any usual image), the payload is
+ * never touched and no output file is created. One line per image, as text
+ * or as one JSON object per line.
+ */
+
+/* Bytes read from the start of every image, a second read only fetches what a far pixel offset leaves out */
+#define INSPECT_READ_SIZE 4096
+
+typedef struct _InspectOptions
+{
+    char **images;    // NULL terminated, points into argv
+    int json;
+} InspectOptions;
+
+/* What a single probe found */
+typedef struct _InspectResult
+{
+    int found;                    // Image carries a stego header
+    StegHeader header;
+    BmpLayout layout;
+    unsigned long long file_size;
+    size_t bytes_read;            // Bytes the probe read from the file
+    double us;
+} InspectResult;
+
+/* Read and validate inspect args from argv */
+Status read_and_validate_inspect_args(char *argv[], InspectOptions *opts);
+
+/* Probe one image, fails only if it could not be read */
+Status inspect_image(const char *fname, InspectResult *result);
+
+/* Probe every image and write one line per image to fptr_out, fails if any of them could not be read */
+Status do_inspect(const InspectOptions *opts, FILE *fptr_out);
+
+#endif
@@ -0,0 +1,372 @@
+#include <stdint.h>
+#include <string.h>
+#include "lsb.h"
+#include "types.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LSB_X86
+#endif
+
+/* One bit set in every byte of a 64 bit word */
+#define LSB_MASK 0x0101010101010101ULL
+
+/* Function Definitions */
+
+/* Load / store 8 image bytes as a word with image byte 0 in the low byte */
+static inline uint64_t load_word(const uchar *image_buffer)
+{
+    uint64_t word;
+    memcpy(&word, image_buffer, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+static inline void store_word(uchar *image_buffer, uint64_t word)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(image_buffer, &word, 8);
+}
+
+/*
+ * Spread the 8 bits of a data byte into the LSB of 8 image bytes
+ * Broadcast the byte, keep bit (7 - j) in byte j, then turn every non-zero
+ * byte into 0x01 by carrying it into bit 7 and shifting it down.
+ */
+static inline uint64_t spread_byte(uchar data)
+{
+    uint64_t word = (data * LSB_MASK) & 0x0102040810204080ULL;
+    return ((word + 0x7F7F7F7F7F7F7F7FULL) >> 7) & LSB_MASK;
+}
+
+/*
+ * Gather the LSB of 8 image bytes into one data byte
+ * Multiplying by 0x8040201008040201 moves the LSB of byte j to bit 63 - j
+ * without any carries, so the top byte is the data byte, MSB first.
+ */
+static inline uchar gather_byte(uint64_t word)
+{
+    return (uchar)(((word & LSB_MASK) * 0x8040201008040201ULL) >> 56);
+}
+
+/* Reverse the bit order inside every byte of a 64 bit movemask */
+static inline uint64_t reverse_bits_in_bytes(uint64_t mask)
+{
+    mask = ((mask & 0xF0F0F0F0F0F0F0F0ULL) >> 4) | ((mask & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    mask = ((mask & 0xCCCCCCCCCCCCCCCCULL) >> 2) | ((mask & 0x3333333333333333ULL) << 2);
+    mask = ((mask & 0xAAAAAAAAAAAAAAAAULL) >> 1) | ((mask & 0x5555555555555555ULL) << 1);
+    return mask;
+}
+
+/* Scalar reference: one bit per iteration */
+void lsb_embed_scalar(const uchar *data, uint count, uchar *image_buffer)
+{
+    for (uint i = 0; i < count; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            *image_buffer = (*image_buffer & ~1) | ((data[i] >> bit) & 1);
+            image_buffer++;
+        }
+    }
+}
+
+void lsb_extract_scalar(const uchar *image_buffer, uint count, uchar *data)
+{
+    for (uint i = 0; i < count; i++)
+    {
+        uchar ch = 0;
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            ch |= (*image_buffer++ & 1) << bit;
+        }
+        data[i] = ch;
+    }
+}
+
+/* Portable SWAR: one data byte per 64 bit word */
+static void lsb_embed_swar(const uchar *data, uint count, uchar *image_buffer)
+{
+    for (uint i = 0; i < count; i++)
+    {
+        uint64_t word = load_word(image_buffer + i * 8);
+        store_word(image_buffer + i * 8, (word & ~LSB_MASK) | spread_byte(data[i]));
+    }
+}
+
+static void lsb_extract_swar(const uchar *image_buffer, uint count, uchar *data)
+{
+    for (uint i = 0; i < count; i++)
+    {
+        data[i] = gather_byte(load_word(image_buffer + i * 8));
+    }
+}
+
+#ifdef LSB_X86
+/* SSE2: 2 data bytes per 16 image bytes on embed, 8 per 64 on extract */
+__attribute__((target("sse2")))
+static void lsb_embed_sse2(const uchar *data, uint count, uchar *image_buffer)
+{
+    const __m128i bit_select = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                            0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+    const __m128i one = _mm_set1_epi8(1);
+    uint i = 0;
+
+    for (; i + 2 <= count; i += 2)
+    {
+        // Broadcast data[i] into bytes 0-7 and data[i + 1] into bytes 8-15
+        __m128i bits = _mm_cvtsi32_si128(data[i] | (data[i + 1] << 8));
+        bits = _mm_unpacklo_epi8(bits, bits);
+        bits = _mm_unpacklo_epi16(bits, bits);
+        bits = _mm_unpacklo_epi32(bits, bits);
+        bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(bits, bit_select), bit_select), one);
+
+        __m128i *image = (__m128i *)(image_buffer + i * 8);
+        _mm_storeu_si128(image, _mm_or_si128(_mm_andnot_si128(one, _mm_loadu_si128(image)), bits));
+    }
+    lsb_embed_swar(data + i, count - i, image_buffer + i * 8);
+}
+
+__attribute__((target("sse2")))
+static void lsb_extract_sse2(const uchar *image_buffer, uint count, uchar *data)
+{
+    uint i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        // Move every LSB up to bit 7 and collect 64 of them, image byte 0 in mask bit 0
+        uint64_t mask = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            __m128i image = _mm_loadu_si128((const __m128i *)(image_buffer + i * 8 + j * 16));
+            mask |= (uint64_t)_mm_movemask_epi8(_mm_slli_epi16(image, 7)) << (j * 16);
+        }
+        mask = reverse_bits_in_bytes(mask);
+        memcpy(data + i, &mask, 8);
+    }
+    lsb_extract_swar(image_buffer + i * 8, count - i, data + i);
+}
+
+/* AVX2: 4 data bytes per 32 image bytes */
+__attribute__((target("avx2")))
+static void lsb_embed_avx2(const uchar *data, uint count, uchar *image_buffer)
+{
+    const __m256i broadcast = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                               2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit_select = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    uint i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        int word;
+        memcpy(&word, data + i, 4);
+
+        // Byte j of the 4 byte group fills image bytes [8j, 8j + 8)
+        __m256i bits = _mm256_shuffle_epi8(_mm256_set1_epi32(word), broadcast);
+        bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(bits, bit_select), bit_select), one);
+
+        __m256i *image = (__m256i *)(image_buffer + i * 8);
+        _mm256_storeu_si256(image, _mm256_or_si256(_mm256_andnot_si256(one, _mm256_loadu_si256(image)), bits));
+    }
+
+    // GCC drops the vzeroupper on the tail call, and dirty upper halves slow down all later SSE code
+    _mm256_zeroupper();
+    lsb_embed_sse2(data + i, count - i, image_buffer + i * 8);
+}
+
+__attribute__((target("avx2")))
+static void lsb_extract_avx2(const uchar *image_buffer, uint count, uchar *data)
+{
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    uint i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        // Reverse each 8 byte group so the movemask comes out MSB first
+        __m256i image = _mm256_loadu_si256((const __m256i *)(image_buffer + i * 8));
+        int mask = _mm256_movemask_epi8(_mm256_slli_epi16(_mm256_shuffle_epi8(image, reverse), 7));
+        memcpy(data + i, &mask, 4);
+    }
+    _mm256_zeroupper();
+    lsb_extract_sse2(image_buffer + i * 8, count - i, data + i);
+}
+#endif
+
+LsbKernel lsb_kernel = { "swar", lsb_embed_swar, lsb_extract_swar };
+
+/* Get all kernels this CPU supports, ordered from scalar reference to fastest */
+const LsbKernel *lsb_kernel_list(uint *count)
+{
+    static LsbKernel list[4];
+    uint n = 0;
+
+    list[n++] = (LsbKernel) { "scalar", lsb_embed_scalar, lsb_extract_scalar };
+    list[n++] = (LsbKernel) { "swar", lsb_embed_swar, lsb_extract_swar };
+#ifdef LSB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        list[n++] = (LsbKernel) { "sse2", lsb_embed_sse2, lsb_extract_sse2 };
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        list[n++] = (LsbKernel) { "avx2", lsb_embed_avx2, lsb_extract_avx2 };
+    }
+#endif
+
+    *count = n;
+    return list;
+}
+
+/* Pick the fastest kernel this CPU supports, called once at startup */
+Status lsb_select_kernel(void)
+{
+    uint count;
+    const LsbKernel *list = lsb_kernel_list(&count);
+
+    lsb_kernel = list[count - 1];
+    return e_success;
+}
+
+/*
+ * Generic k-LSB kernels
+ * depth is a compile time constant in every caller below, so each depth gets
+ * its own fully unrolled loop and no per-byte depth checks.
+ */
+static inline void embed_group(uint32_t bits, uint used, uchar *image_buffer, const uint depth)
+{
+    const uchar mask = (1 << depth) - 1;
+    for (uint j = 0; j < used; j++)
+    {
+        image_buffer[j] = (image_buffer[j] & ~mask) | ((bits >> (depth * (7 - j))) & mask);
+    }
+}
+
+static inline uint32_t extract_group(const uchar *image_buffer, uint used, const uint depth)
+{
+    const uchar mask = (1 << depth) - 1;
+    uint32_t bits = 0;
+    for (uint j = 0; j < used; j++)
+    {
+        bits |= (uint32_t)(image_buffer[j] & mask) << (depth * (7 - j));
+    }
+    return bits;
+}
+
+static inline void embed_depth(const uchar *data, uint count, uchar *image_buffer, const uint depth)
+{
+    uint i = 0;
+
+    // Whole groups: depth data bytes fill exactly 8 image bytes
+    for (; i + depth <= count; i += depth)
+    {
+        uint32_t bits = 0;
+        for (uint j = 0; j < depth; j++)
+        {
+            bits = (bits << 8) | data[i + j];
+        }
+        embed_group(bits, 8, image_buffer, depth);
+        image_buffer += 8;
+    }
+
+    // Partial group: pad with zero bits, only touch the image bytes that carry data
+    if (i < count)
+    {
+        uint32_t bits = 0;
+        for (uint j = 0; j < depth; j++)
+        {
+            bits = (bits << 8) | ((i + j < count) ? data[i + j] : 0);
+        }
+        embed_group(bits, ((count - i) * 8 + depth - 1) / depth, image_buffer, depth);
+    }
+}
+
+static inline void extract_depth(const uchar *image_buffer, uint count, uchar *data, const uint depth)
+{
+    uint i = 0;
+
+    for (; i + depth <= count; i += depth)
+    {
+        uint32_t bits = extract_group(image_buffer, 8, depth);
+        for (uint j = 0; j < depth; j++)
+        {
+            data[i + j] = bits >> (8 * (depth - 1 - j));
+        }
+        image_buffer += 8;
+    }
+
+    if (i < count)
+    {
+        uint32_t bits = extract_group(image_buffer, ((count - i) * 8 + depth - 1) / depth, depth);
+        for (uint j = 0; i + j < count; j++)
+        {
+            data[i + j] = bits >> (8 * (depth - 1 - j));
+        }
+    }
+}
+
+static void lsb_embed_depth2(const uchar *data, uint count, uchar *image_buffer) { embed_depth(data, count, image_buffer, 2); }
+static void lsb_embed_depth3(const uchar *data, uint count, uchar *image_buffer) { embed_depth(data, count, image_buffer, 3); }
+static void lsb_embed_depth4(const uchar *data, uint count, uchar *image_buffer) { embed_depth(data, count, image_buffer, 4); }
+static void lsb_extract_depth2(const uchar *image_buffer, uint count, uchar *data) { extract_depth(image_buffer, count, data, 2); }
+static void lsb_extract_depth3(const uchar *image_buffer, uint count, uchar *data) { extract_depth(image_buffer, count, data, 3); }
+static void lsb_extract_depth4(const uchar *image_buffer, uint count, uchar *data) { extract_depth(image_buffer, count, data, 4); }
+
+/* Kernels for depth 2 and up, depth 1 always goes through lsb_kernel */
+static const LsbKernel lsb_depth_kernel[LSB_MAX_DEPTH + 1] =
+{
+    [2] = { "depth2", lsb_embed_depth2, lsb_extract_depth2 },
+    [3] = { "depth3", lsb_embed_depth3, lsb_extract_depth3 },
+    [4] = { "depth4", lsb_embed_depth4, lsb_extract_depth4 },
+};
+
+/* Image bytes needed for count data bytes at the given depth */
+unsigned long long lsb_image_bytes(uint depth, unsigned long long count)
+{
+    return (count * 8 + depth - 1) / depth;
+}
+
+void lsb_embed_depth(uint depth, const uchar *data, uint count, uchar *image_buffer)
+{
+    if (depth == 1)
+    {
+        lsb_kernel.embed(data, count, image_buffer);
+    }
+    else
+    {
+        lsb_depth_kernel[depth].embed(data, count, image_buffer);
+    }
+}
+
+void lsb_extract_depth(uint depth, const uchar *image_buffer, uint count, uchar *data)
+{
+    if (depth == 1)
+    {
+        lsb_kernel.extract(image_buffer, count, data);
+    }
+    else
+    {
+        lsb_depth_kernel[depth].extract(image_buffer, count, data);
+    }
+}
+
+/* Embed a 32 bit size field, MSB first, at the given depth */
+void lsb_embed_size(uint size, uint depth, uchar *image_buffer)
+{
+    uchar bytes[4] = { size >> 24, size >> 16, size >> 8, size };
+    lsb_embed_depth(depth, bytes, 4, image_buffer);
+}
+
+/* Extract a 32 bit size field at the given depth */
+uint lsb_extract_size(const uchar *image_buffer, uint depth)
+{
+    uchar bytes[4];
+    lsb_extract_depth(depth, image_buffer, 4, bytes);
+    return ((uint)bytes[0] << 24) | ((uint)bytes[1] << 16) | ((uint)bytes[2] << 8) | bytes[3];
+}
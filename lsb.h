@@ -0,0 +1,57 @@
+#ifndef LSB_H
+#define LSB_H
+#include "types.h" // Contains user defined types
+
+/*
+ * Bulk LSB kernels
+ * Every kernel embeds or extracts whole data bytes: data byte i lives in
+ * the LSBs of image bytes [8i, 8i + 8), most significant bit first.
+ *
+ * At an embedding depth of k bits per image byte, every k data bytes fill
+ * exactly 8 image bytes (k LSBs each, most significant bits first). A run of
+ * count data bytes takes lsb_image_bytes(depth, count) image bytes; a last
+ * partial group is padded with zero bits and only touches the image bytes
+ * that carry data.
+ */
+
+/* Deepest supported embedding, in LSBs per image byte */
+#define LSB_MAX_DEPTH 4
+
+/* Embed count data bytes into the LSBs of count * 8 image bytes */
+typedef void (*lsb_embed_fn)(const uchar *data, uint count, uchar *image_buffer);
+
+/* Extract count data bytes from the LSBs of count * 8 image bytes */
+typedef void (*lsb_extract_fn)(const uchar *image_buffer, uint count, uchar *data);
+
+typedef struct _LsbKernel
+{
+    const char *name;
+    lsb_embed_fn embed;
+    lsb_extract_fn extract;
+} LsbKernel;
+
+/* Kernel used by the encode and decode engines (portable SWAR until selected) */
+extern LsbKernel lsb_kernel;
+
+/* Pick the fastest kernel this CPU supports */
+Status lsb_select_kernel(void);
+
+/* Get all kernels this CPU supports, scalar reference first */
+const LsbKernel *lsb_kernel_list(uint *count);
+
+/* Scalar reference kernels, one bit per iteration */
+void lsb_embed_scalar(const uchar *data, uint count, uchar *image_buffer);
+void lsb_extract_scalar(const uchar *image_buffer, uint count, uchar *data);
+
+/* Image bytes needed for count data bytes at the given depth */
+unsigned long long lsb_image_bytes(uint depth, unsigned long long count);
+
+/* Embed / extract count data bytes at the given depth (1 uses lsb_kernel) */
+void lsb_embed_depth(uint depth, const uchar *data, uint count, uchar *image_buffer);
+void lsb_extract_depth(uint depth, const uchar *image_buffer, uint count, uchar *data);
+
+/* Embed / extract a 32 bit size field, MSB first, at the given depth */
+void lsb_embed_size(uint size, uint depth, uchar *image_buffer);
+uint lsb_extract_size(const uchar *image_buffer, uint depth);
+
+#endif
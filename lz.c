@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+#include "types.h"
+
+/* Match finder: one candidate position per hash of the next 4 bytes */
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+/* Function Definitions */
+
+static uint read32(const uchar *p)
+{
+    uint v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned long long read64(const uchar *p)
+{
+    unsigned long long v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Length of the common run of p and ref, p stops at end */
+static size_t match_length(const uchar *p, const uchar *ref, const uchar *end)
+{
+    const uchar *start = p;
+
+    // Eight bytes at a time, the first differing bit gives the byte
+    while (end - p >= 8)
+    {
+        unsigned long long diff = read64(p) ^ read64(ref);
+        if (diff != 0)
+        {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return p - start + (__builtin_ctzll(diff) >> 3);
+#else
+            break;
+#endif
+        }
+        p += 8;
+        ref += 8;
+    }
+    while (p < end && *p == *ref)
+    {
+        p++;
+        ref++;
+    }
+    return p - start;
+}
+
+static uint lz_hash(uint v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Length beyond a full nibble: 255 while it keeps going, then the rest */
+static uchar *put_length(uchar *op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/* Emit literals plus an optional match (match 0 ends the block), NULL if dest is full */
+static uchar *put_sequence(uchar *op, const uchar *oend, const uchar *literals, size_t literal_count, uint offset, size_t match)
+{
+    size_t match_code = (match > 0) ? match - LZ_MIN_MATCH : 0;
+
+    // Worst case: token, literal count bytes, literals, offset, match count bytes
+    if ((size_t)(oend - op) < 1 + literal_count / 255 + 1 + literal_count + 2 + match_code / 255 + 1)
+    {
+        return NULL;
+    }
+
+    uchar *token = op++;
+    *token = ((literal_count < 15) ? literal_count : 15) << 4;
+    if (literal_count >= 15)
+    {
+        op = put_length(op, literal_count - 15);
+    }
+    memcpy(op, literals, literal_count);
+    op += literal_count;
+
+    if (match > 0)
+    {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        *token |= (match_code < 15) ? match_code : 15;
+        if (match_code >= 15)
+        {
+            op = put_length(op, match_code - 15);
+        }
+    }
+    return op;
+}
+
+size_t lz_compress_block(const uchar *src, size_t count, uchar *dest, size_t capacity)
+{
+    uint table[1 << LZ_HASH_BITS];
+    const uchar *ip = src;
+    const uchar *anchor = src;
+    const uchar *end = src + count;
+    uchar *op = dest;
+    const uchar *oend = dest + capacity;
+    uint misses = 0;
+
+    memset(table, 0, sizeof(table));
+    while (count >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH)
+    {
+        uint sequence = read32(ip);
+        uint h = lz_hash(sequence);
+        const uchar *ref = src + table[h];
+        table[h] = ip - src;
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence)
+        {
+            // Step faster through data that keeps missing, incompressible blocks end up stored anyway
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+
+        // Extend the match as far as the block goes
+        size_t match = LZ_MIN_MATCH + match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, end);
+        op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, match);
+        if (op == NULL)
+        {
+            return 0;
+        }
+        ip = anchor = ip + match;
+        misses = 0;
+
+        // Remember a position inside the match too, repeats often start there
+        if (ip <= end - LZ_MIN_MATCH)
+        {
+            table[lz_hash(read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    // The rest goes out as literals
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return (op != NULL) ? (size_t)(op - dest) : 0;
+}
+
+/* Read a length continued past a full nibble, -1 if the input ends first */
+static long get_length(const uchar **ip, const uchar *iend, long length)
+{
+    uchar byte;
+    do
+    {
+        if (*ip >= iend)
+        {
+            return -1;
+        }
+        byte = *(*ip)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+long lz_expand_block(const uchar *src, size_t count, uchar *dest, size_t capacity)
+{
+    const uchar *ip = src;
+    const uchar *iend = src + count;
+    uchar *op = dest;
+    uchar *oend = dest + capacity;
+
+    while (ip < iend)
+    {
+        uint token = *ip++;
+
+        // Step 1: Literals
+        long literals = token >> 4;
+        if (literals == 15 && (literals = get_length(&ip, iend, literals)) < 0)
+        {
+            return -1;
+        }
+        if (literals > iend - ip || literals > oend - op)
+        {
+            return -1;
+        }
+
+        // Short runs go as one fixed 16 byte copy when both buffers have room past them
+        if (literals <= 16 && iend - ip >= 16 && oend - op >= 16)
+        {
+            memcpy(op, ip, 16);
+        }
+        else
+        {
+            memcpy(op, ip, literals);
+        }
+        op += literals;
+        ip += literals;
+
+        // The last sequence has no match
+        if (ip == iend)
+        {
+            break;
+        }
+
+        // Step 2: Match, which may overlap the bytes it produces
+        if (iend - ip < 2)
+        {
+            return -1;
+        }
+        long offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        long match = token & 0x0F;
+        if (match == 15 && (match = get_length(&ip, iend, match)) < 0)
+        {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - dest || match > oend - op)
+        {
+            return -1;
+        }
+        if (offset >= 16 && match <= 16 && oend - op >= 16)
+        {
+            memcpy(op, op - offset, 16);
+            op += match;
+        }
+        else if (offset >= match)
+        {
+            memcpy(op, op - offset, match);
+            op += match;
+        }
+        else
+        {
+            // Overlapping match: the pattern repeats every offset bytes, so copy
+            // from ever further back as more of it has been written
+            for (long distance = offset; match > 0; distance *= 2)
+            {
+                long run = (distance < match) ? distance : match;
+                memcpy(op, op - distance, run);
+                op += run;
+                match -= run;
+            }
+        }
+    }
+    return op - dest;
+}
+
+Status lz_stream_init(LzStream *stream, lz_sink_fn sink, void *arg)
+{
+    stream->block = malloc(LZ_BLOCK_SIZE);
+    stream->out = malloc(LZ_BLOCK_SIZE);
+    stream->have = 0;
+    stream->length = 0;
+    stream->stored = 0;
+    stream->last = 0;
+    stream->sink = sink;
+    stream->arg = arg;
+    if (stream->block == NULL || stream->out == NULL)
+    {
+        lz_stream_finish(stream);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Expand the collected block and hand it to the sink */
+static Status flush_block(LzStream *stream)
+{
+    const uchar *data = stream->block;
+    long count = stream->length;
+
+    if (!stream->stored)
+    {
+        count = lz_expand_block(stream->block, stream->length, stream->out, LZ_BLOCK_SIZE);
+        data = stream->out;
+    }
+    if (count < 0)
+    {
+        return e_failure;
+    }
+
+    // Only the last block may come up short
+    stream->last = (count < LZ_BLOCK_SIZE);
+    stream->length = 0;
+    stream->have = 0;
+    return stream->sink(stream->arg, data, count);
+}
+
+Status lz_stream_feed(LzStream *stream, const uchar *data, size_t count)
+{
+    while (count > 0)
+    {
+        // Step 1: Block header
+        if (stream->length == 0)
+        {
+            size_t take = (LZ_HEADER_SIZE - stream->have < count) ? LZ_HEADER_SIZE - stream->have : count;
+            memcpy(stream->header + stream->have, data, take);
+            stream->have += take;
+            data += take;
+            count -= take;
+            if (stream->have < LZ_HEADER_SIZE)
+            {
+                break;
+            }
+
+            uint word = stream->header[0] | (stream->header[1] << 8) | (stream->header[2] << 16) | ((uint)stream->header[3] << 24);
+            stream->stored = (word & LZ_BLOCK_STORED) != 0;
+            stream->length = word & ~LZ_BLOCK_STORED;
+            stream->have = 0;
+            if (stream->last || stream->length == 0 || stream->length > LZ_BLOCK_SIZE)
+            {
+                return e_failure;
+            }
+            continue;
+        }
+
+        // Step 2: Block body, expanded as soon as it is complete
+        size_t take = (stream->length - stream->have < count) ? stream->length - stream->have : count;
+        memcpy(stream->block + stream->have, data, take);
+        stream->have += take;
+        data += take;
+        count -= take;
+        if (stream->have == stream->length && flush_block(stream) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+Status lz_stream_finish(LzStream *stream)
+{
+    Status ret = (stream->length == 0 && stream->have == 0) ? e_success : e_failure;
+
+    free(stream->block);
+    free(stream->out);
+    stream->block = NULL;
+    stream->out = NULL;
+    return ret;
+}
@@ -0,0 +1,71 @@
+#ifndef LZ_H
+#define LZ_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * In-tree LZ77 codec for payload compression
+ * The stream is a run of blocks, each holding up to LZ_BLOCK_SIZE payload
+ * bytes behind a 32 bit little endian header: the stored length, with
+ * LZ_BLOCK_STORED set when the block did not compress and is kept as is.
+ * Every block but the last holds exactly LZ_BLOCK_SIZE bytes once expanded.
+ *
+ * Inside a compressed block, sequences of
+ *     token         literal count (high nibble), match length - 4 (low nibble)
+ *     [count bytes] 255 while the nibble and extra bytes keep adding up
+ *     literals
+ *     offset        16 bits little endian, 1 to 65535 bytes back
+ *     [count bytes] for the match length
+ * where the last sequence of a block has literals only. Matches never reach
+ * into the previous block, so every block expands on its own.
+ */
+
+/* Payload bytes per block, also the longest match offset + 1 */
+#define LZ_BLOCK_SIZE (64 * 1024)
+
+/* Block header flag: block is stored uncompressed */
+#define LZ_BLOCK_STORED 0x80000000U
+
+/* Size of the block header in front of every block */
+#define LZ_HEADER_SIZE 4
+
+/* Shortest match worth a sequence */
+#define LZ_MIN_MATCH 4
+
+/*
+ * Compress one block of count bytes (at most LZ_BLOCK_SIZE) into dest
+ * Returns the compressed length, or 0 if it would not fit in capacity bytes;
+ * pass capacity = count - 1 to give up as soon as compression does not pay.
+ */
+size_t lz_compress_block(const uchar *src, size_t count, uchar *dest, size_t capacity);
+
+/* Expand a compressed block into dest, returns the expanded length or -1 on corrupt input */
+long lz_expand_block(const uchar *src, size_t count, uchar *dest, size_t capacity);
+
+/* Receives every expanded block of the stream in order */
+typedef Status (*lz_sink_fn)(void *arg, const uchar *data, size_t count);
+
+/* Stream expander fed with stored bytes in pieces of any size */
+typedef struct _LzStream
+{
+    uchar *block;        // Stored bytes of the current block, LZ_BLOCK_SIZE
+    uchar *out;          // Expanded block, LZ_BLOCK_SIZE
+    uchar header[LZ_HEADER_SIZE];
+    uint have;           // Bytes of the current header or block collected
+    uint length;         // Stored length of the current block, 0 while reading a header
+    int stored;          // Current block is kept as is
+    int last;            // A short block was seen, it has to be the last one
+    lz_sink_fn sink;
+    void *arg;
+} LzStream;
+
+/* Allocate the stream buffers; sink gets every expanded block */
+Status lz_stream_init(LzStream *stream, lz_sink_fn sink, void *arg);
+
+/* Feed the next count stored bytes, expanding every block as soon as it is complete */
+Status lz_stream_feed(LzStream *stream, const uchar *data, size_t count);
+
+/* Check the stream ended on a block boundary and release the buffers */
+Status lz_stream_finish(LzStream *stream);
+
+#endif
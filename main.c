@@ -13,6 +13,15 @@ DESCRIPTION: LSB (Least Significant Bit) steganography is a technique for hiding
 #include "encode.h"
 #include "decode.h"
 #include "types.h"
+#include "lsb.h"
+#include "batch.h"
+#include "bench.h"
+#include "inspect.h"
+#include "scan.h"
+#include "container.h"
+#include "shard.h"
+#include "daemon.h"
+#include "stream.h"
 #include <string.h>
 
 
@@ -25,14 +34,28 @@ int main( int argc, char *argv[] )
         printf("INFO: Please pass valid arguments.");
 		printf("\nINFO:Encodeing - Minimum 4 arguments.\n Usage:- ./a.out -e source_image_file secret_data_file [Destination_image_file]\n");
 		printf("\nINFO:Decodeing - Minimum 3 arguments.\n Usage:- ./a.out -d source_image_file  [Destination_image_file]\n");
+		printf("\nINFO:Batch - Minimum 3 arguments.\n Usage:- ./a.out -b manifest_file|- [report_file] [-j workers]\n");
+		printf("\nINFO:Benchmark -\n Usage:- ./a.out --bench [report.json] [-r reps] [-w warmup] [-k depth] [-t threads] [-d dir] [--crc] [--cipher] [--scatter] [--in-place] [--daemon] [--rss-only]\n");
+		printf("\nINFO:Inspect - Minimum 3 arguments.\n Usage:- ./a.out -i image_file [more_image_files...] [--json]\n");
+		printf("\nINFO:Scan - Minimum 3 arguments.\n Usage:- ./a.out -s directory [index_file] [-j workers] [-q]\n");
+		printf("\nINFO:Container - Minimum 5 / 3 / 4 arguments.\n Usage:- ./a.out -p source_image_file destination_image_file file1 [file2...] [-k depth] [-z] [--crc]\n         ./a.out -l stego_image_file\n         ./a.out -x stego_image_file entry_name [output_file]\n");
+		printf("\nINFO:Shard - Minimum 5 / 4 arguments.\n Usage:- ./a.out --shard secret_file output_prefix carrier1 [carrier2...] [-k depth] [--crc] [-j workers] [-q]\n         ./a.out --join output_file stego_image1 [stego_image2...] [-j workers] [-q]\n");
+		printf("\nINFO:Daemon - Minimum 3 / 4 arguments.\n Usage:- ./a.out --serve socket_file [-j workers]\n         ./a.out --client socket_file [--pass-fds] -e|-d|-i ...|shutdown\n");
+		printf("\nINFO:Stream - Minimum 3 arguments.\n Usage:- ./a.out --stream -e [-k depth] [--crc] [--key key_file] [--secret-fd fd] < source_image_file > destination_image_file\n         ./a.out --stream -d [--key key_file] < stego_image_file > secret_file\n");
         return e_failure;
     }
+    // Pick the LSB kernels for this CPU
+    lsb_select_kernel();
+
     //Decalring encoding structure variable
     EncodeInfo encInfo;
 
     //Declaring decoding structure variable
     DecodeInfo decInfo;
 
+    // Exit status, non-zero when a failure has to reach the calling shell
+    int status = 0;
+
 
 OperationType check_operation_type(char *argv[])
 {
@@ -58,6 +81,109 @@ OperationType check_operation_type(char *argv[])
 		return e_unsupported;
 	    }
     return e_decode;
+}
+    else if(!strcmp(argv[1],"-b"))
+	{
+		if(argc < 3)
+		{
+		printf("INFO: for Batch - Minimum 3 arguments need to pass like ./a.out -b manifest_file|- [report_file] [-j workers]\n");
+		return e_unsupported;
+	    }
+    return e_batch;
+}
+    else if(!strcmp(argv[1],"-i"))
+	{
+		if(argc < 3)
+		{
+		printf("INFO: for Inspect - Minimum 3 arguments need to pass like ./a.out -i image_file [more_image_files...] [--json]\n");
+		return e_unsupported;
+	    }
+    return e_inspect;
+}
+    else if(!strcmp(argv[1],"-s"))
+	{
+		if(argc < 3)
+		{
+		printf("INFO: for Scan - Minimum 3 arguments need to pass like ./a.out -s directory [index_file] [-j workers] [-q]\n");
+		return e_unsupported;
+	    }
+    return e_scan;
+}
+    else if(!strcmp(argv[1],"-p"))
+	{
+		if(argc < 5)
+		{
+		printf("INFO: for Pack - Minimum 5 arguments need to pass like ./a.out -p source_image_file destination_image_file file1 [file2...]\n");
+		return e_unsupported;
+	    }
+    return e_pack;
+}
+    else if(!strcmp(argv[1],"-l"))
+	{
+		if(argc != 3)
+		{
+		printf("INFO: for List - 3 arguments need to pass like ./a.out -l stego_image_file\n");
+		return e_unsupported;
+	    }
+    return e_list;
+}
+    else if(!strcmp(argv[1],"-x"))
+	{
+		if(argc < 4 || argc > 5)
+		{
+		printf("INFO: for Extract - Minimum 4 arguments need to pass like ./a.out -x stego_image_file entry_name [output_file]\n");
+		return e_unsupported;
+	    }
+    return e_extract;
+}
+    else if(!strcmp(argv[1],"--shard"))
+	{
+		if(argc < 5)
+		{
+		printf("INFO: for Shard - Minimum 5 arguments need to pass like ./a.out --shard secret_file output_prefix carrier1 [carrier2...]\n");
+		return e_unsupported;
+	    }
+    return e_shard;
+}
+    else if(!strcmp(argv[1],"--join"))
+	{
+		if(argc < 4)
+		{
+		printf("INFO: for Join - Minimum 4 arguments need to pass like ./a.out --join output_file stego_image1 [stego_image2...]\n");
+		return e_unsupported;
+	    }
+    return e_join;
+}
+    else if(!strcmp(argv[1],"--serve"))
+	{
+		if(argc < 3)
+		{
+		printf("INFO: for Daemon - Minimum 3 arguments need to pass like ./a.out --serve socket_file [-j workers]\n");
+		return e_unsupported;
+	    }
+    return e_serve;
+}
+    else if(!strcmp(argv[1],"--client"))
+	{
+		if(argc < 4)
+		{
+		printf("INFO: for Client - Minimum 4 arguments need to pass like ./a.out --client socket_file [--pass-fds] -e|-d|-i ...|shutdown\n");
+		return e_unsupported;
+	    }
+    return e_client;
+}
+    else if(!strcmp(argv[1],"--stream"))
+	{
+		if(argc < 3)
+		{
+		printf("INFO: for Stream - Minimum 3 arguments need to pass like ./a.out --stream -e|-d [options] < input > output\n");
+		return e_unsupported;
+	    }
+    return e_stream;
+}
+    else if(!strcmp(argv[1],"--bench"))
+	{
+    return e_bench;
 }
     else
 	{
@@ -86,11 +212,13 @@ OperationType check_operation_type(char *argv[])
 		    else
 		    {
 			printf("ERROR : Failed to encode.\n");
+			status = 1;
 		    }
 		}
 		else
 		{
 		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
 		}
 		break;
 
@@ -107,18 +235,307 @@ OperationType check_operation_type(char *argv[])
 		    else
 		    {
 			printf("ERROR : Failed to decode.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+
+	    case e_batch :
+	    {
+		char *manifest_fname, *report_fname;
+		int workers;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_batch_args(argv, &manifest_fname, &report_fname, &workers) == e_success )
+		{
+		    // Batch process begin, failed jobs are listed in the report
+		    if ( do_batch(manifest_fname, report_fname, workers) == e_success )
+		    {
+			printf("<---- Batch successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Some batch jobs failed, see %s.\n", report_fname);
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
+
+	    case e_bench :
+	    {
+		BenchOptions benchOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_bench_args(argv, &benchOpts) == e_success )
+		{
+		    // Benchmark begin, every case is checked by decoding it again
+		    if ( do_bench(&benchOpts) == e_success )
+		    {
+			printf("<---- Benchmark successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Benchmark failed, see %s.\n", benchOpts.report_fname);
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
+
+	    case e_inspect :
+	    {
+		InspectOptions inspectOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_inspect_args(argv, &inspectOpts) == e_success )
+		{
+		    // Header probe only, nothing is extracted or written
+		    if ( do_inspect(&inspectOpts, stdout) == e_success )
+		    {
+			printf("<---- Inspect successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Failed to read some images.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
+
+	    case e_scan :
+	    {
+		ScanOptions scanOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_scan_args(argv, &scanOpts) == e_success )
+		{
+		    // Scan begin, only headers are read and unchanged files are skipped
+		    if ( do_scan(&scanOpts) == e_success )
+		    {
+			printf("<---- Scan successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Some files could not be scanned.\n");
+			status = 1;
 		    }
 		}
 		else
 		{
 		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
 		}
 		break;
+	    }
+
+	    case e_pack :
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_pack_args(argv, &encInfo) == e_success )
+		{
+		    // Same encoding process, with the container as the secret file
+		    if ( do_encoding(&encInfo) == e_success )
+		    {
+			printf("<---- Packing successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Failed to pack.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+
+	    case e_list :
+
+		// Only the table of contents is read
+		if ( do_container_list(argv[2]) == e_success )
+		{
+		    printf("<---- Listing successfully done ---->\n");
+		}
+		else
+		{
+		    printf("ERROR : Failed to list.\n");
+		    status = 1;
+		}
+		break;
+
+	    case e_extract :
+
+		// Only the table and the one entry are read
+		if ( do_container_extract(argv[2], argv[3], argv[4]) == e_success )
+		{
+		    printf("<---- Extraction successfully done ---->\n");
+		}
+		else
+		{
+		    printf("ERROR : Failed to extract.\n");
+		    status = 1;
+		}
+		break;
+
+	    case e_shard :
+	    {
+		ShardOptions shardOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_shard_args(argv, &shardOpts) == e_success )
+		{
+		    // One carrier per worker, each gets a slice of the secret
+		    if ( do_shard(&shardOpts) == e_success )
+		    {
+			printf("<---- Sharding successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Failed to shard.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
+
+	    case e_join :
+	    {
+		JoinOptions joinOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_join_args(argv, &joinOpts) == e_success )
+		{
+		    // The set is checked first, then every shard is written to its offset
+		    if ( do_join(&joinOpts) == e_success )
+		    {
+			printf("<---- Joining successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Failed to join.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
+
+	    case e_serve :
+	    {
+		DaemonOptions daemonOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_serve_args(argv, &daemonOpts) == e_success )
+		{
+		    // Runs until a shutdown request, SIGINT or SIGTERM
+		    if ( do_serve(&daemonOpts) == e_success )
+		    {
+			printf("<---- Daemon successfully stopped ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Failed to start the daemon.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
+
+	    case e_client :
+	    {
+		ClientOptions clientOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_client_args(argv, &clientOpts) == e_success )
+		{
+		    // One request, the daemon's output is printed as it comes
+		    if ( do_client(&clientOpts) == e_success )
+		    {
+			printf("<---- Request successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Request failed.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
+
+	    case e_stream :
+	    {
+		StreamOptions streamOpts;
+
+		// To read and validate the arguments we passed
+		if ( read_and_validate_stream_args(argv, &streamOpts) == e_success )
+		{
+		    // stdout carries the data, this and every other message goes to stderr
+		    if ( do_stream(&streamOpts) == e_success )
+		    {
+			printf("<---- Streaming successfully done ---->\n");
+		    }
+		    else
+		    {
+			printf("ERROR : Failed to stream.\n");
+			status = 1;
+		    }
+		}
+		else
+		{
+		    printf("ERROR : Read and validation failed.\n");
+		    status = 1;
+		}
+		break;
+	    }
 
 	    case e_unsupported :
 
 		// Error handling
 		printf("ERROR : Invalid option.\n");
+		status = 1;
 		break;
 	}
     }
@@ -126,6 +543,7 @@ OperationType check_operation_type(char *argv[])
     {
 	// Error handling
 	printf("ERROR : Please pass sufficient number of arguments.\n");
+	status = 1;
     }
-    return 0;
+    return status;
 }
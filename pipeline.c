@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "pipeline.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Current monotonic time in milliseconds */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+Status pipeline_parse_mode(const char *name, PipelineMode *mode)
+{
+    static const char *names[] = { "auto", "uring", "threads", "off" };
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *mode = (PipelineMode)i;
+            return e_success;
+        }
+    }
+    return e_failure;
+}
+
+int pipeline_wanted(PipelineMode mode, unsigned long long size, size_t block_size)
+{
+    if (mode == e_pipeline_off || size == 0)
+    {
+        return 0;
+    }
+    return mode != e_pipeline_auto || size >= (unsigned long long)PIPELINE_MIN_BLOCKS * block_size;
+}
+
+/* Read or write all of count bytes at offset, for the threads and for short io_uring results */
+static Status transfer_full(int fd, uchar *buffer, size_t count, unsigned long long offset, int write)
+{
+    while (count > 0)
+    {
+        ssize_t done = write ? pwrite(fd, buffer, count, offset) : pread(fd, buffer, count, offset);
+        if (done < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (done <= 0)
+        {
+            return e_failure;
+        }
+        buffer += done;
+        count -= done;
+        offset += done;
+    }
+    return e_success;
+}
+
+/* Set up an io_uring with room for every block, fails where the kernel has none or forbids it */
+static Status ring_open(PipelineRing *ring)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, 2 * PIPELINE_BLOCKS, &params);
+    if (ring->fd < 0)
+    {
+        return e_failure;
+    }
+
+    // The submission and completion rings share one mapping on kernels that can
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_map_size = (ring->cq_map_size > ring->sq_map_size) ? ring->cq_map_size : ring->sq_map_size;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = ring->sq_map;
+    if (ring->sq_map != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        if (ring->sqes != MAP_FAILED)
+        {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+        {
+            munmap(ring->cq_map, ring->cq_map_size);
+        }
+        if (ring->sq_map != MAP_FAILED)
+        {
+            munmap(ring->sq_map, ring->sq_map_size);
+        }
+        close(ring->fd);
+        return e_failure;
+    }
+
+    uchar *sq = ring->sq_map;
+    uchar *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = cq + params.cq_off.cqes;
+    return e_success;
+}
+
+static void ring_close(PipelineRing *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+}
+
+/* Hand the queued entries to the kernel and, with wait, block until at least one completion is there */
+static Status ring_enter(PipelineRing *ring, int wait)
+{
+    for (;;)
+    {
+        unsigned pending = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, ring->fd, pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) >= 0)
+        {
+            return e_success;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            return e_failure;
+        }
+    }
+}
+
+/* Start the read or write of a block, iov and io_offset say what */
+static void submit(Pipeline *pipeline, int index, int write)
+{
+    PipelineBlock *block = &pipeline->block[index];
+
+    if (write)
+    {
+        pipeline->writes++;
+    }
+    else
+    {
+        pipeline->reads++;
+    }
+
+    // Threads: the reader or writer picks it up
+    if (pipeline->engine == e_pipeline_threads)
+    {
+        block->state = write ? e_block_write_queued : e_block_read_queued;
+        pthread_cond_broadcast(&pipeline->work);
+        return;
+    }
+
+    // io_uring: the busy time runs from the first request in flight to the last completion
+    PipelineRing *ring = &pipeline->ring;
+    if (write && pipeline->writes == 1)
+    {
+        pipeline->write_since = now_ms();
+    }
+    if (!write && pipeline->reads == 1)
+    {
+        pipeline->read_since = now_ms();
+    }
+    block->state = write ? e_block_writing : e_block_reading;
+    unsigned tail = *ring->sq_tail;
+    unsigned slot = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring->sqes + slot;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = write ? pipeline->fd_out : pipeline->fd_in;
+    sqe->addr = (unsigned long)&block->iov;
+    sqe->len = 1;
+    sqe->off = block->io_offset;
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (ring_enter(ring, 0) == e_failure)
+    {
+        pipeline->failed = 1;
+    }
+}
+
+/* An io_uring request finished with result, a short transfer is completed in place */
+static void complete(Pipeline *pipeline, int index, int result)
+{
+    PipelineBlock *block = &pipeline->block[index];
+    int write = (block->state == e_block_writing);
+
+    if (result < 0 || (result < (int)block->iov.iov_len &&
+                       transfer_full(write ? pipeline->fd_out : pipeline->fd_in, (uchar *)block->iov.iov_base + result,
+                                     block->iov.iov_len - result, block->io_offset + result, write) == e_failure))
+    {
+        pipeline->failed = 1;
+    }
+    if (write)
+    {
+        block->state = e_block_free;
+        if (--pipeline->writes == 0)
+        {
+            pipeline->write_ms += now_ms() - pipeline->write_since;
+        }
+    }
+    else
+    {
+        block->state = e_block_ready;
+        if (--pipeline->reads == 0)
+        {
+            pipeline->read_ms += now_ms() - pipeline->read_since;
+        }
+    }
+}
+
+/* Take every completion the kernel has posted */
+static void ring_reap(Pipeline *pipeline)
+{
+    PipelineRing *ring = &pipeline->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = (struct io_uring_cqe *)ring->cqes + (head & *ring->cq_mask);
+        complete(pipeline, cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reader or writer thread: takes queued blocks in file order and does the
+ * transfer without the lock; being one thread per direction, the time it
+ * spends transferring is the time that direction is busy
+ */
+static void io_thread(Pipeline *pipeline, int write)
+{
+    BlockState queued = write ? e_block_write_queued : e_block_read_queued;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->stop)
+    {
+        PipelineBlock *block = NULL;
+        for (int i = 0; i < PIPELINE_BLOCKS; i++)
+        {
+            if (pipeline->block[i].state == queued && (block == NULL || pipeline->block[i].io_offset < block->io_offset))
+            {
+                block = &pipeline->block[i];
+            }
+        }
+        if (block == NULL)
+        {
+            pthread_cond_wait(&pipeline->work, &pipeline->lock);
+            continue;
+        }
+        block->state = write ? e_block_writing : e_block_reading;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        double start = now_ms();
+        Status ret = transfer_full(write ? pipeline->fd_out : pipeline->fd_in, block->iov.iov_base, block->iov.iov_len, block->io_offset, write);
+        double busy = now_ms() - start;
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->failed |= (ret == e_failure);
+        if (write)
+        {
+            pipeline->write_ms += busy;
+            pipeline->writes--;
+            block->state = e_block_free;
+        }
+        else
+        {
+            pipeline->read_ms += busy;
+            pipeline->reads--;
+            block->state = e_block_ready;
+        }
+        pthread_cond_broadcast(&pipeline->done);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void *reader_main(void *arg)
+{
+    io_thread(arg, 0);
+    return NULL;
+}
+
+static void *writer_main(void *arg)
+{
+    io_thread(arg, 1);
+    return NULL;
+}
+
+/* Prefetch the next blocks of the range into every free buffer, lock held */
+static void refill(Pipeline *pipeline)
+{
+    for (int i = 0; i < PIPELINE_BLOCKS && pipeline->fd_in != -1 && pipeline->read_offset < pipeline->end && !pipeline->failed; i++)
+    {
+        PipelineBlock *block = &pipeline->block[i];
+        if (block->state == e_block_free)
+        {
+            unsigned long long left = pipeline->end - pipeline->read_offset;
+            block->offset = pipeline->read_offset;
+            block->len = (left < pipeline->block_size) ? left : pipeline->block_size;
+            block->iov.iov_base = block->data;
+            block->iov.iov_len = block->len;
+            block->io_offset = block->offset;
+            pipeline->read_offset += block->len;
+            submit(pipeline, i, 0);
+        }
+    }
+}
+
+/* Wait for the next read or write to finish, lock held; fails when nothing is in flight */
+static Status wait_io(Pipeline *pipeline)
+{
+    if (pipeline->reads + pipeline->writes == 0)
+    {
+        return e_failure;
+    }
+    if (pipeline->engine == e_pipeline_threads)
+    {
+        pthread_cond_wait(&pipeline->done, &pipeline->lock);
+        return e_success;
+    }
+    if (ring_enter(&pipeline->ring, 1) == e_failure)
+    {
+        return e_failure;
+    }
+    ring_reap(pipeline);
+    return e_success;
+}
+
+/* Every call runs under the lock, and its time does not count as compute */
+static double enter_call(Pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    if (pipeline->engine == e_pipeline_uring)
+    {
+        ring_reap(pipeline);
+    }
+    return now_ms();
+}
+
+static void leave_call(Pipeline *pipeline, double entered)
+{
+    pipeline->in_calls += now_ms() - entered;
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+Status pipeline_open(Pipeline *pipeline, PipelineMode mode, int fd_in, unsigned long long start, unsigned long long end,
+                     int fd_out, size_t block_size)
+{
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->opened = now_ms();
+    pipeline->fd_in = fd_in;
+    pipeline->fd_out = fd_out;
+    pipeline->block_size = block_size;
+    pipeline->read_offset = start;
+    pipeline->next_offset = start;
+    pipeline->end = end;
+
+    // Page aligned data, the headroom is one page in front of it
+    for (int i = 0; i < PIPELINE_BLOCKS; i++)
+    {
+        void *buffer;
+        if (posix_memalign(&buffer, PIPELINE_HEADROOM, PIPELINE_HEADROOM + block_size) != 0)
+        {
+            while (i-- > 0)
+            {
+                free(pipeline->block[i].buffer);
+            }
+            return e_failure;
+        }
+        pipeline->block[i].buffer = buffer;
+        pipeline->block[i].data = pipeline->block[i].buffer + PIPELINE_HEADROOM;
+        pipeline->block[i].state = e_block_free;
+    }
+
+    // io_uring where the kernel allows it, else a reader and a writer thread
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->work, NULL);
+    pthread_cond_init(&pipeline->done, NULL);
+    pipeline->engine = e_pipeline_threads;
+    if (mode != e_pipeline_threads && ring_open(&pipeline->ring) == e_success)
+    {
+        pipeline->engine = e_pipeline_uring;
+    }
+    else if (pthread_create(&pipeline->reader, NULL, reader_main, pipeline) != 0)
+    {
+        pipeline->engine = e_pipeline_off;
+    }
+    else if (pthread_create(&pipeline->writer, NULL, writer_main, pipeline) != 0)
+    {
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->stop = 1;
+        pthread_cond_broadcast(&pipeline->work);
+        pthread_mutex_unlock(&pipeline->lock);
+        pthread_join(pipeline->reader, NULL);
+        pipeline->engine = e_pipeline_off;
+    }
+    if (pipeline->engine == e_pipeline_off)
+    {
+        for (int i = 0; i < PIPELINE_BLOCKS; i++)
+        {
+            free(pipeline->block[i].buffer);
+        }
+        pthread_mutex_destroy(&pipeline->lock);
+        pthread_cond_destroy(&pipeline->work);
+        pthread_cond_destroy(&pipeline->done);
+        return e_failure;
+    }
+
+    // The first reads go out right away
+    pthread_mutex_lock(&pipeline->lock);
+    refill(pipeline);
+    pthread_mutex_unlock(&pipeline->lock);
+    return e_success;
+}
+
+PipelineBlock *pipeline_read(Pipeline *pipeline)
+{
+    double entered = enter_call(pipeline);
+    PipelineBlock *found = NULL;
+
+    while (!pipeline->failed && pipeline->next_offset < pipeline->end)
+    {
+        refill(pipeline);
+        for (int i = 0; i < PIPELINE_BLOCKS; i++)
+        {
+            if (pipeline->block[i].state == e_block_ready && pipeline->block[i].offset == pipeline->next_offset)
+            {
+                found = &pipeline->block[i];
+            }
+        }
+        if (found != NULL)
+        {
+            found->state = e_block_busy;
+            pipeline->next_offset += found->len;
+            break;
+        }
+        if (wait_io(pipeline) == e_failure)
+        {
+            pipeline->failed = 1;
+        }
+    }
+    leave_call(pipeline, entered);
+    return found;
+}
+
+PipelineBlock *pipeline_get(Pipeline *pipeline)
+{
+    double entered = enter_call(pipeline);
+    PipelineBlock *found = NULL;
+
+    while (!pipeline->failed && found == NULL)
+    {
+        for (int i = 0; i < PIPELINE_BLOCKS && found == NULL; i++)
+        {
+            if (pipeline->block[i].state == e_block_free)
+            {
+                found = &pipeline->block[i];
+                found->state = e_block_busy;
+            }
+        }
+        if (found == NULL && wait_io(pipeline) == e_failure)
+        {
+            pipeline->failed = 1;
+        }
+    }
+    leave_call(pipeline, entered);
+    return found;
+}
+
+void pipeline_release(Pipeline *pipeline, PipelineBlock *block)
+{
+    double entered = enter_call(pipeline);
+
+    block->state = e_block_free;
+    refill(pipeline);
+    leave_call(pipeline, entered);
+}
+
+Status pipeline_write(Pipeline *pipeline, PipelineBlock *block, const uchar *data, size_t len, unsigned long long offset)
+{
+    double entered = enter_call(pipeline);
+
+    if (len == 0)
+    {
+        block->state = e_block_free;
+        refill(pipeline);
+    }
+    else
+    {
+        block->iov.iov_base = (void *)data;
+        block->iov.iov_len = len;
+        block->io_offset = offset;
+        submit(pipeline, block - pipeline->block, 1);
+    }
+    Status ret = pipeline->failed ? e_failure : e_success;
+    leave_call(pipeline, entered);
+    return ret;
+}
+
+Status pipeline_close(Pipeline *pipeline, PipeStat *stat)
+{
+    double entered = enter_call(pipeline);
+
+    // Nothing more is prefetched, the reads and writes in flight finish first
+    pipeline->end = pipeline->read_offset;
+    while (pipeline->reads + pipeline->writes > 0)
+    {
+        if (wait_io(pipeline) == e_failure)
+        {
+            pipeline->failed = 1;
+            break;
+        }
+    }
+    pipeline->stop = 1;
+    pthread_cond_broadcast(&pipeline->work);
+    leave_call(pipeline, entered);
+
+    if (pipeline->engine == e_pipeline_threads)
+    {
+        pthread_join(pipeline->reader, NULL);
+        pthread_join(pipeline->writer, NULL);
+    }
+    else
+    {
+        ring_close(&pipeline->ring);
+    }
+    for (int i = 0; i < PIPELINE_BLOCKS; i++)
+    {
+        free(pipeline->block[i].buffer);
+    }
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->work);
+    pthread_cond_destroy(&pipeline->done);
+
+    if (stat != NULL)
+    {
+        stat->engine = (pipeline->engine == e_pipeline_uring) ? "io_uring" : "threads";
+        stat->wall_ms = now_ms() - pipeline->opened;
+        stat->read_ms = pipeline->read_ms;
+        stat->write_ms = pipeline->write_ms;
+        stat->compute_ms = stat->wall_ms - pipeline->in_calls;
+    }
+    return pipeline->failed ? e_failure : e_success;
+}
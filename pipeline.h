@@ -0,0 +1,146 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "types.h" // Contains user defined types
+#include "stats.h"
+
+/*
+ * Double-buffered I/O for the serial encode and decode loops
+ * A pipeline reads the file range [start, end) of fd_in in blocks of
+ * block_size bytes and hands them out in file order, while it keeps
+ * prefetching the next ones into the rest of its PIPELINE_BLOCKS buffers;
+ * blocks given back with pipeline_write() go to fd_out at any offset and
+ * their buffer is refilled as soon as the write is done. So while the engine
+ * embeds into block N, block N+1 is being read and block N-1 written back.
+ * A pipeline with only fd_out (fd_in -1) hands out empty buffers instead.
+ *
+ * The I/O runs on io_uring where the kernel has it (raw system calls, no
+ * liburing) and on a reader and a writer thread otherwise. Every buffer has
+ * PIPELINE_HEADROOM bytes in front of its data, where the caller can copy the
+ * unused end of the block before it, so a field that straddles two blocks
+ * is still contiguous.
+ *
+ * The instrumentation counts the time a read is in flight, the time a write
+ * is in flight and the time the engine spends outside pipeline calls
+ * (compute); stats_overlap() makes an overlap ratio of them (stats.h).
+ */
+
+/* Buffers in flight: the one being embedded, plus prefetched and written back ones */
+#define PIPELINE_BLOCKS 4
+
+/* Bytes in front of every buffer for the tail of the block before */
+#define PIPELINE_HEADROOM 4096
+
+/* With --io auto, ranges shorter than this many blocks run serially, the ring or threads would cost more than they hide */
+#define PIPELINE_MIN_BLOCKS 3
+
+typedef enum
+{
+    e_pipeline_auto,     // io_uring, else threads, for ranges of PIPELINE_MIN_BLOCKS or more
+    e_pipeline_uring,
+    e_pipeline_threads,
+    e_pipeline_off       // The serial read, embed, write loop
+} PipelineMode;
+
+typedef enum
+{
+    e_block_free,
+    e_block_read_queued,   // Waiting for the reader thread
+    e_block_reading,
+    e_block_ready,         // Read, not handed out yet
+    e_block_busy,          // Handed out to the caller
+    e_block_write_queued,  // Waiting for the writer thread
+    e_block_writing
+} BlockState;
+
+typedef struct _PipelineBlock
+{
+    uchar *buffer;                 // PIPELINE_HEADROOM + block_size bytes
+    uchar *data;                   // Where reads land, buffer + PIPELINE_HEADROOM
+    unsigned long long offset;     // File offset of data[0]
+    size_t len;                    // Bytes read into data
+    struct iovec iov;              // The read or write in flight
+    unsigned long long io_offset;
+    BlockState state;
+} PipelineBlock;
+
+/* io_uring rings, mapped from the kernel */
+typedef struct _PipelineRing
+{
+    int fd;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    void *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+} PipelineRing;
+
+typedef struct _Pipeline
+{
+    PipelineMode engine;           // e_pipeline_uring or e_pipeline_threads once open
+    int fd_in;
+    int fd_out;
+    size_t block_size;
+    unsigned long long read_offset;   // Next file offset to prefetch
+    unsigned long long next_offset;   // File offset of the block handed out next
+    unsigned long long end;
+    PipelineBlock block[PIPELINE_BLOCKS];
+    int reads;                     // Reads and writes in flight
+    int writes;
+    int failed;
+
+    PipelineRing ring;
+
+    pthread_mutex_t lock;          // Guards the block states, taken around every call
+    pthread_cond_t work;           // Threads: a read or write was queued
+    pthread_cond_t done;           // Threads: a read or write finished
+    pthread_t reader;
+    pthread_t writer;
+    int stop;
+
+    /* Instrumentation, in ms on the monotonic clock */
+    double opened;
+    double in_calls;               // Time spent inside pipeline calls
+    double read_ms;
+    double write_ms;
+    double read_since;             // io_uring: first read of the current busy span went out
+    double write_since;
+} Pipeline;
+
+/* Parse --io auto|uring|threads|off */
+Status pipeline_parse_mode(const char *name, PipelineMode *mode);
+
+/* Use a pipeline for a range of size bytes in this mode, see PIPELINE_MIN_BLOCKS */
+int pipeline_wanted(PipelineMode mode, unsigned long long size, size_t block_size);
+
+/* Start the engine and the first reads of [start, end) from fd_in (-1 for write only) */
+Status pipeline_open(Pipeline *pipeline, PipelineMode mode, int fd_in, unsigned long long start, unsigned long long end,
+                     int fd_out, size_t block_size);
+
+/* Next block of the range in file order, NULL past its end or after an I/O error */
+PipelineBlock *pipeline_read(Pipeline *pipeline);
+
+/* A free buffer for output, for pipelines without fd_in */
+PipelineBlock *pipeline_get(Pipeline *pipeline);
+
+/* Give a block back without writing it */
+void pipeline_release(Pipeline *pipeline, PipelineBlock *block);
+
+/* Write len bytes from data (inside block's buffer) to fd_out at offset, the block is free again once written */
+Status pipeline_write(Pipeline *pipeline, PipelineBlock *block, const uchar *data, size_t len, unsigned long long offset);
+
+/* Wait for every read and write, stop the engine and free the buffers; stat (may be NULL) gets the instrumentation */
+Status pipeline_close(Pipeline *pipeline, PipeStat *stat);
+
+#endif
@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "scan.h"
+#include "inspect.h"
+#include "common.h"
+#include "types.h"
+
+/* One line of the previous index, keyed by its path */
+typedef struct _IndexEntry
+{
+    char *line;                  // Whole line without its newline
+    const char *path;            // Points into line
+    long long mtime_ns;
+    unsigned long long size;
+} IndexEntry;
+
+/* Open addressing table over the previous index */
+typedef struct _IndexTable
+{
+    IndexEntry *entries;
+    size_t count;
+    size_t capacity;             // Power of two, 0 without a previous index
+} IndexTable;
+
+/* Directory stack shared by the workers, plus the new index */
+typedef struct _ScanState
+{
+    const ScanOptions *opts;
+    IndexTable old;
+
+    /* Directories still to read, guarded by lock */
+    char **dirs;
+    size_t dir_count;
+    size_t dir_capacity;
+    int busy;                    // Workers reading a directory, more may come from them
+    int alloc_failed;
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+
+    /* Index file and totals, guarded by index_lock */
+    FILE *fptr_index;
+    unsigned long images;
+    unsigned long stego;
+    unsigned long reused;
+    unsigned long failed;
+    unsigned long long bytes_read;
+    unsigned long long bytes_total;
+    pthread_mutex_t index_lock;
+} ScanState;
+
+/* Function Definitions */
+
+/* Current monotonic time in milliseconds */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Validate the command-line arguments for scan mode: -s dir [index_file] [-j workers] [-q]
+Status read_and_validate_scan_args(char *argv[], ScanOptions *opts)
+{
+    char *fname[2] = { NULL, DEFAULT_SCAN_INDEX };
+    int count = 0;
+
+    // Default to one worker per online core
+    opts->workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts->workers < 1)
+    {
+        opts->workers = 1;
+    }
+    opts->quiet = 0;
+
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            opts->workers = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (opts->workers < 1)
+            {
+                printf("Error: -j needs a worker count of at least 1\n");
+                return e_failure;
+            }
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            opts->quiet = 1;
+        }
+        else if (count < 2)
+        {
+            fname[count++] = argv[i];
+        }
+        else
+        {
+            printf("Error: unexpected argument %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+
+    if (fname[0] == NULL)
+    {
+        printf("Error: scan mode needs a directory\n");
+        return e_failure;
+    }
+    opts->dir = fname[0];
+    opts->index_fname = fname[1];
+    return e_success;
+}
+
+/* FNV-1a over the path */
+static size_t path_hash(const char *path)
+{
+    size_t h = 14695981039346656037ULL;
+
+    for (const uchar *p = (const uchar *)path; *p != '\0'; p++)
+    {
+        h = (h ^ *p) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static void index_insert(IndexTable *table, IndexEntry *entry)
+{
+    size_t slot = path_hash(entry->path) & (table->capacity - 1);
+
+    while (table->entries[slot].line != NULL)
+    {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    table->entries[slot] = *entry;
+}
+
+static const IndexEntry *index_find(const IndexTable *table, const char *path)
+{
+    if (table->capacity == 0)
+    {
+        return NULL;
+    }
+    for (size_t slot = path_hash(path) & (table->capacity - 1); table->entries[slot].line != NULL;
+         slot = (slot + 1) & (table->capacity - 1))
+    {
+        if (strcmp(table->entries[slot].path, path) == 0)
+        {
+            return &table->entries[slot];
+        }
+    }
+    return NULL;
+}
+
+static void index_free(IndexTable *table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        free(table->entries[i].line);
+    }
+    free(table->entries);
+    table->entries = NULL;
+    table->count = table->capacity = 0;
+}
+
+/*
+ * Load a previous index into the table
+ * A missing index is a first scan and not an error; lines that do not
+ * parse are dropped, so their files are simply probed again.
+ */
+static Status index_load(IndexTable *table, const char *fname)
+{
+    char line[MAX_SCAN_PATH + 128];
+    IndexEntry *list = NULL;
+    size_t count = 0, list_capacity = 0;
+
+    table->entries = NULL;
+    table->count = table->capacity = 0;
+
+    FILE *fptr = fopen(fname, "r");
+    if (fptr == NULL)
+    {
+        return e_success;
+    }
+    if (fgets(line, sizeof(line), fptr) == NULL || strncmp(line, SCAN_INDEX_MAGIC, strlen(SCAN_INDEX_MAGIC)) != 0)
+    {
+        printf("INFO: %s is not a scan index, probing every file\n", fname);
+        fclose(fptr);
+        return e_success;
+    }
+
+    // Step 1: Parse every line: mtime, size, payload, extension, path
+    while (fgets(line, sizeof(line), fptr) != NULL)
+    {
+        IndexEntry entry;
+        char *path = line;
+        int tabs = 0;
+
+        while (tabs < 4 && (path = strchr(path, '\t')) != NULL)
+        {
+            path++;
+            tabs++;
+        }
+        size_t length = strlen(line);
+        if (path == NULL || length == 0 || line[length - 1] != '\n' ||
+            sscanf(line, "%lld\t%llu\t", &entry.mtime_ns, &entry.size) != 2)
+        {
+            continue;
+        }
+
+        if (count == list_capacity)
+        {
+            list_capacity = list_capacity ? list_capacity * 2 : 1024;
+            IndexEntry *grown = realloc(list, list_capacity * sizeof(IndexEntry));
+            if (grown == NULL)
+            {
+                break;
+            }
+            list = grown;
+        }
+        if ((entry.line = strdup(line)) == NULL)
+        {
+            break;
+        }
+        entry.path = entry.line + (path - line);
+        entry.line[length - 1] = '\0';
+        list[count++] = entry;
+    }
+    fclose(fptr);
+
+    // Step 2: Hash them by path, at most half full
+    table->capacity = 16;
+    while (table->capacity < count * 2)
+    {
+        table->capacity *= 2;
+    }
+    table->entries = calloc(table->capacity, sizeof(IndexEntry));
+    if (table->entries == NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            free(list[i].line);
+        }
+        free(list);
+        table->capacity = 0;
+        return e_failure;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        index_insert(table, &list[i]);
+    }
+    table->count = count;
+    free(list);
+    return e_success;
+}
+
+/* Queue a directory for the workers, takes ownership of path */
+static void push_dir(ScanState *state, char *path)
+{
+    pthread_mutex_lock(&state->lock);
+    if (path == NULL)
+    {
+        state->alloc_failed = 1;
+        pthread_mutex_unlock(&state->lock);
+        return;
+    }
+    if (state->dir_count == state->dir_capacity)
+    {
+        size_t capacity = state->dir_capacity ? state->dir_capacity * 2 : 256;
+        char **grown = realloc(state->dirs, capacity * sizeof(char *));
+        if (grown == NULL)
+        {
+            state->alloc_failed = 1;
+            pthread_mutex_unlock(&state->lock);
+            free(path);
+            return;
+        }
+        state->dirs = grown;
+        state->dir_capacity = capacity;
+    }
+    state->dirs[state->dir_count++] = path;
+    pthread_cond_signal(&state->more);
+    pthread_mutex_unlock(&state->lock);
+}
+
+/* Image files go by their extension, checking the content is the probe's job */
+static int is_bmp_name(const char *name)
+{
+    size_t length = strlen(name);
+
+    return length > 4 && strcasecmp(name + length - 4, ".bmp") == 0;
+}
+
+/* Index line for one file: reused if mtime and size match the previous index, probed otherwise */
+static void scan_file(ScanState *state, const char *path, const struct stat *st)
+{
+    long long mtime_ns = st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    const IndexEntry *old = index_find(&state->old, path);
+    InspectResult result = { 0 };
+    char line[MAX_SCAN_PATH + 128];
+    int reused = (old != NULL && old->mtime_ns == mtime_ns && old->size == (unsigned long long)st->st_size);
+    Status status = e_success;
+
+    if (reused)
+    {
+        snprintf(line, sizeof(line), "%s\n", old->line);
+        result.found = (strncmp(strchr(strchr(old->line, '\t') + 1, '\t') + 1, "-\t", 2) != 0);
+    }
+    else if ((status = inspect_image(path, &result)) == e_success)
+    {
+        if (result.found)
+        {
+            // Fields are tab separated, keep the extension from breaking the line
+            char extension[MAX_STEG_EXTN + 1];
+            strcpy(extension, result.header.extension);
+            for (char *p = extension; *p != '\0'; p++)
+            {
+                if ((uchar)*p < 0x20 || (uchar)*p == 0x7F)
+                {
+                    *p = '?';
+                }
+            }
+            snprintf(line, sizeof(line), "%lld\t%llu\t%u\t%s\t%s\n", mtime_ns, (unsigned long long)st->st_size,
+                     result.header.payload_size, extension, path);
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "%lld\t%llu\t-\t-\t%s\n", mtime_ns, (unsigned long long)st->st_size, path);
+        }
+    }
+
+    pthread_mutex_lock(&state->index_lock);
+    state->images++;
+    state->bytes_total += st->st_size;
+    if (status == e_failure)
+    {
+        state->failed++;
+    }
+    else
+    {
+        // A newline in the path would split its line, such a file is not indexed and is probed on every scan
+        char shown[MAX_SCAN_PATH];
+        snprintf(shown, sizeof(shown), "%s", path);
+        for (char *p = shown; (p = strchr(p, '\n')) != NULL; p++)
+        {
+            *p = '?';
+        }
+        if (strchr(path, '\n') == NULL)
+        {
+            fputs(line, state->fptr_index);
+        }
+        else
+        {
+            printf("INFO: %s has a newline in its name, not indexed\n", shown);
+        }
+        state->reused += reused;
+        state->stego += result.found;
+        state->bytes_read += result.bytes_read;
+        if (result.found && !reused && !state->opts->quiet)
+        {
+            printf("%s: extension \"%s\", payload %u bytes\n", shown, result.header.extension, result.header.payload_size);
+        }
+    }
+    pthread_mutex_unlock(&state->index_lock);
+}
+
+/* Probe the images of one directory and queue its subdirectories */
+static void scan_dir(ScanState *state, const char *path)
+{
+    char child[MAX_SCAN_PATH];
+    struct dirent *entry;
+    struct stat st;
+    const char *separator = (path[0] != '\0' && path[strlen(path) - 1] == '/') ? "" : "/";
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        perror("opendir");
+        fprintf(stderr, "ERROR : Unable to open directory %s\n", path);
+        pthread_mutex_lock(&state->index_lock);
+        state->failed++;
+        pthread_mutex_unlock(&state->index_lock);
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            continue;
+        }
+        if (snprintf(child, sizeof(child), "%s%s%s", path, separator, name) >= (int)sizeof(child))
+        {
+            fprintf(stderr, "ERROR : Path too long in %s\n", path);
+            continue;
+        }
+
+        // Symbolic links are not followed, a link loop must not keep the walk going
+        if (entry->d_type == DT_DIR)
+        {
+            push_dir(state, strdup(child));
+        }
+        else if ((entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN) &&
+                 fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                push_dir(state, strdup(child));
+            }
+            else if (S_ISREG(st.st_mode) && is_bmp_name(name))
+            {
+                scan_file(state, child, &st);
+            }
+        }
+    }
+    closedir(dir);
+}
+
+/* Take directories off the stack until it is empty and no worker can add more */
+static void *scan_worker(void *arg)
+{
+    ScanState *state = arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&state->lock);
+        while (state->dir_count == 0 && state->busy > 0)
+        {
+            pthread_cond_wait(&state->more, &state->lock);
+        }
+        if (state->dir_count == 0)
+        {
+            pthread_cond_broadcast(&state->more);
+            pthread_mutex_unlock(&state->lock);
+            break;
+        }
+        char *path = state->dirs[--state->dir_count];
+        state->busy++;
+        pthread_mutex_unlock(&state->lock);
+
+        scan_dir(state, path);
+        free(path);
+
+        pthread_mutex_lock(&state->lock);
+        if (--state->busy == 0 && state->dir_count == 0)
+        {
+            pthread_cond_broadcast(&state->more);
+        }
+        pthread_mutex_unlock(&state->lock);
+    }
+    return NULL;
+}
+
+Status do_scan(const ScanOptions *opts)
+{
+    ScanState state;
+    char tmp_fname[MAX_SCAN_PATH];
+    pthread_t *threads;
+    int started = 0;
+    Status ret = e_success;
+
+    memset(&state, 0, sizeof(state));
+    state.opts = opts;
+
+    // Step 1: Previous index, then the new one next to it so an interrupted scan keeps the old
+    if (index_load(&state.old, opts->index_fname) == e_failure)
+    {
+        printf("INFO: previous index %s too large to load, probing every file\n", opts->index_fname);
+    }
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", opts->index_fname);
+    state.fptr_index = fopen(tmp_fname, "w");
+    if (state.fptr_index == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", tmp_fname);
+        index_free(&state.old);
+        return e_failure;
+    }
+    fprintf(state.fptr_index, "%s\n", SCAN_INDEX_MAGIC);
+
+    // Step 2: Workers share one stack of directories, starting with the root
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_mutex_init(&state.index_lock, NULL);
+    pthread_cond_init(&state.more, NULL);
+    push_dir(&state, strdup(opts->dir));
+
+    double start = now_ms();
+    threads = malloc(opts->workers * sizeof(pthread_t));
+    if (threads != NULL && state.dir_count == 1)
+    {
+        for (; started < opts->workers; started++)
+        {
+            if (pthread_create(&threads[started], NULL, scan_worker, &state) != 0)
+            {
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now_ms() - start;
+
+    // Step 3: Replace the old index only with a complete new one
+    if (started == 0 || state.alloc_failed || fclose(state.fptr_index) != 0 || rename(tmp_fname, opts->index_fname) != 0)
+    {
+        fprintf(stderr, "ERROR : Unable to write index %s\n", opts->index_fname);
+        if (started == 0 || state.alloc_failed)
+        {
+            fclose(state.fptr_index);
+        }
+        remove(tmp_fname);
+        ret = e_failure;
+    }
+
+    printf("Scan: %lu images, %lu with a payload, %lu unchanged since the last scan, %lu unreadable, %d workers, %.3f s, %.1f files/s\n",
+           state.images, state.stego, state.reused, state.failed, started, elapsed / 1e3,
+           (elapsed > 0) ? state.images / (elapsed / 1e3) : 0.0);
+    printf("Read %llu bytes of %llu in the images (%.4f%%)\n", state.bytes_read, state.bytes_total,
+           (state.bytes_total > 0) ? 100.0 * state.bytes_read / state.bytes_total : 0.0);
+
+    for (size_t i = 0; i < state.dir_count; i++)
+    {
+        free(state.dirs[i]);
+    }
+    free(state.dirs);
+    free(threads);
+    index_free(&state.old);
+    pthread_mutex_destroy(&state.lock);
+    pthread_mutex_destroy(&state.index_lock);
+    pthread_cond_destroy(&state.more);
+    return (ret == e_success && state.failed == 0) ? e_success : e_failure;
+}
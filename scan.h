@@ -0,0 +1,38 @@
+#ifndef SCAN_H
+#define SCAN_H
+#include "types.h" // Contains user defined types
+
+/*
+ * Scan mode
+ * Walks a directory tree on a pool of worker threads and probes every .bmp
+ * file with inspect_image() (inspect.h), so only the BMP header and the
+ * stego header channels are read, never the pixel bulk. The result goes to
+ * an index file, one line per image:
+ *     mtime_ns <TAB> size <TAB> payload_bytes <TAB> extension <TAB> path
+ * where payload_bytes and extension are "-" for images without a payload.
+ * A later scan with the same index reuses the line of every file whose mtime
+ * and size are unchanged instead of opening it again.
+ */
+
+#define DEFAULT_SCAN_INDEX "steg_index.tsv"
+
+/* First line of an index file */
+#define SCAN_INDEX_MAGIC "# lsb_steg index v1"
+
+#define MAX_SCAN_PATH 4096
+
+typedef struct _ScanOptions
+{
+    char *dir;
+    char *index_fname;
+    int workers;
+    int quiet;          // Only the summary, not every image with a payload
+} ScanOptions;
+
+/* Read and validate scan args from argv */
+Status read_and_validate_scan_args(char *argv[], ScanOptions *opts);
+
+/* Scan the tree, write the index and report files/s and bytes read */
+Status do_scan(const ScanOptions *opts);
+
+#endif
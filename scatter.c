@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include "scatter.h"
+#include "types.h"
+
+/* Function Definitions */
+
+Status scatter_map_init(ScatterMap *map, const ChaCha20 *cipher, unsigned long long base, unsigned long long channels)
+{
+    map->base = base;
+    map->tiles = (channels > base) ? (channels - base) / SCATTER_TILE_CHANNELS : 0;
+    map->tile = malloc((map->tiles + 1) * sizeof(uint));
+    map->step = malloc((map->tiles + 1) * sizeof(unsigned short));
+    map->shift = malloc((map->tiles + 1) * sizeof(unsigned short));
+    uchar *random = calloc(map->tiles + 1, 8);
+    if (map->tile == NULL || map->step == NULL || map->shift == NULL || random == NULL)
+    {
+        free(random);
+        scatter_map_free(map);
+        return e_failure;
+    }
+
+    // 8 keystream bytes per tile: 4 for the shuffle, 2 for the step and 2 for the shift
+    chacha20_xor(cipher, SCATTER_KEYSTREAM_OFFSET, random, (size_t)map->tiles * 8);
+    for (uint j = 0; j < map->tiles; j++)
+    {
+        const uchar *r = random + 8 * (size_t)j;
+        map->tile[j] = j;
+        map->step[j] = ((r[4] | (r[5] << 8)) | 1) & (SCATTER_TILE_GROUPS - 1);
+        map->shift[j] = (r[6] | (r[7] << 8)) & (SCATTER_TILE_GROUPS - 1);
+    }
+
+    // Fisher-Yates, the multiply takes a random index below i + 1 without a division
+    for (uint i = map->tiles; i-- > 1; )
+    {
+        const uchar *r = random + 8 * (size_t)i;
+        uint value = r[0] | (r[1] << 8) | (r[2] << 16) | ((uint)r[3] << 24);
+        uint k = ((unsigned long long)value * (i + 1)) >> 32;
+        uint swap = map->tile[i];
+        map->tile[i] = map->tile[k];
+        map->tile[k] = swap;
+    }
+    free(random);
+    return e_success;
+}
+
+void scatter_map_free(ScatterMap *map)
+{
+    free(map->tile);
+    free(map->step);
+    free(map->shift);
+    map->tile = NULL;
+    map->step = NULL;
+    map->shift = NULL;
+}
+
+/* Physical group of logical group g in logical tile j */
+static inline uint tile_group(const ScatterMap *map, uint j, uint g)
+{
+    return (map->step[j] * g + map->shift[j]) & (SCATTER_TILE_GROUPS - 1);
+}
+
+unsigned long long scatter_channel(const ScatterMap *map, unsigned long long x)
+{
+    uint j = x / SCATTER_TILE_CHANNELS;
+    uint g = (x % SCATTER_TILE_CHANNELS) / 8;
+
+    return map->base + (unsigned long long)map->tile[j] * SCATTER_TILE_CHANNELS + tile_group(map, j, g) * 8 + x % 8;
+}
+
+/*
+ * The group walks by step from shift, kept in locals: the byte stores may
+ * alias the map as far as the compiler knows, and would reload it per group
+ */
+void scatter_tile_load(const ScatterMap *map, uint j, const uchar *physical, uchar *logical)
+{
+    uint step = map->step[j], group = map->shift[j];
+
+    for (uint g = 0; g < SCATTER_TILE_GROUPS; g++)
+    {
+        memcpy(logical + 8 * g, physical + 8 * group, 8);
+        group = (group + step) & (SCATTER_TILE_GROUPS - 1);
+    }
+}
+
+void scatter_tile_store(const ScatterMap *map, uint j, const uchar *logical, uchar *physical)
+{
+    uint step = map->step[j], group = map->shift[j];
+
+    for (uint g = 0; g < SCATTER_TILE_GROUPS; g++)
+    {
+        memcpy(physical + 8 * group, logical + 8 * g, 8);
+        group = (group + step) & (SCATTER_TILE_GROUPS - 1);
+    }
+}
+
+/*
+ * Gather logical channels a tile at a time
+ * Every tile comes out of the image as one piece (in place for contiguous
+ * layouts, through bmp_view() otherwise); whole tiles are loaded group by
+ * group, only the partial tiles at either end go one group run at a time.
+ */
+void scatter_gather(const ScatterMap *map, const BmpLayout *layout, const uchar *image,
+                    unsigned long long first, size_t count, uchar *channels)
+{
+    uchar buffer[SCATTER_TILE_CHANNELS];
+    int contiguous = bmp_is_contiguous(layout);
+    size_t done = 0;
+
+    while (done < count)
+    {
+        unsigned long long x = first + done;
+        uint j = x / SCATTER_TILE_CHANNELS;
+        const uchar *tile = bmp_view(layout, image, map->base + (unsigned long long)map->tile[j] * SCATTER_TILE_CHANNELS,
+                                     SCATTER_TILE_CHANNELS, buffer);
+        size_t tile_end = (j + 1ULL) * SCATTER_TILE_CHANNELS - first;
+        size_t end = (tile_end < count) ? tile_end : count;
+
+        if (x % SCATTER_TILE_CHANNELS == 0 && end - done == SCATTER_TILE_CHANNELS)
+        {
+            // The next tile is somewhere else in the image, no hardware prefetcher finds it
+            if (contiguous && j + 1 < map->tiles && count - end >= SCATTER_TILE_CHANNELS)
+            {
+                const uchar *next = image + bmp_channel_offset(layout, map->base + (unsigned long long)map->tile[j + 1] * SCATTER_TILE_CHANNELS);
+                for (uint line = 0; line < SCATTER_TILE_CHANNELS; line += 64)
+                {
+                    __builtin_prefetch(next + line);
+                }
+            }
+            scatter_tile_load(map, j, tile, channels + done);
+            done = end;
+            continue;
+        }
+
+        // Every run stays inside one group of the tile
+        while (done < end)
+        {
+            x = first + done;
+            uint offset = tile_group(map, j, (x % SCATTER_TILE_CHANNELS) / 8) * 8 + x % 8;
+            size_t run = 8 - x % 8;
+            run = (run < end - done) ? run : end - done;
+            memcpy(channels + done, tile + offset, run);
+            done += run;
+        }
+    }
+}
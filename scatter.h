@@ -0,0 +1,63 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+#include "types.h" // Contains user defined types
+#include "bmp.h"
+#include "chacha20.h"
+
+/*
+ * Keyed scatter layout (STEG_EXT_SCATTER)
+ * The payload channels after the header are cut into tiles of
+ * SCATTER_TILE_CHANNELS channel bytes (a 4 KiB page of a plain 24 bpp image).
+ * The key puts the tiles in a random order, and within every tile the 8
+ * channel byte groups (depth payload bytes each) are visited in a keyed
+ * affine order, so nothing marks where the payload sits, yet every tile is
+ * read and written as one block-local piece. The header stays in front,
+ * the scatter needs the nonce to be read first.
+ *
+ * Logical channel x (counted from the first payload channel, the way the
+ * sequential layout counts them) lives at physical channel
+ *     base + tile[j] * T + ((step[j] * g + shift[j]) mod G) * 8 + x mod 8
+ * with j = x / T, g = (x mod T) / 8, G = T / 8 groups per tile and step[j]
+ * odd. The order comes from the payload keystream far past any payload
+ * (block 2^31), so no other key material is needed.
+ */
+
+#define SCATTER_TILE_CHANNELS 4096
+#define SCATTER_TILE_GROUPS (SCATTER_TILE_CHANNELS / 8)
+
+/* Offset of the keystream the tile order is drawn from */
+#define SCATTER_KEYSTREAM_OFFSET (1ULL << 37)
+
+typedef struct _ScatterMap
+{
+    unsigned long long base;    // Channel byte tile 0 starts at, the first payload channel
+    uint tiles;                 // Whole tiles from base to the last channel byte
+    uint *tile;                 // Physical tile of logical tile j
+    unsigned short *step;       // Group order inside logical tile j
+    unsigned short *shift;
+} ScatterMap;
+
+/* Channel bytes count payload channels take, whole tiles; inline, so libsteg sizes scattered payloads without scatter.c */
+static inline unsigned long long scatter_channels(unsigned long long count)
+{
+    return (count + SCATTER_TILE_CHANNELS - 1) / SCATTER_TILE_CHANNELS * SCATTER_TILE_CHANNELS;
+}
+
+/* Draw the tile order for an image of channels channel bytes, payload from channel base on */
+Status scatter_map_init(ScatterMap *map, const ChaCha20 *cipher, unsigned long long base, unsigned long long channels);
+
+/* Release the tile order */
+void scatter_map_free(ScatterMap *map);
+
+/* Physical channel byte of logical channel x */
+unsigned long long scatter_channel(const ScatterMap *map, unsigned long long x);
+
+/* Physical channel bytes of logical tile j, in logical order and back */
+void scatter_tile_load(const ScatterMap *map, uint j, const uchar *physical, uchar *logical);
+void scatter_tile_store(const ScatterMap *map, uint j, const uchar *logical, uchar *physical);
+
+/* Copy count logical channel bytes from logical channel first out of a whole image in memory */
+void scatter_gather(const ScatterMap *map, const BmpLayout *layout, const uchar *image,
+                    unsigned long long first, size_t count, uchar *channels);
+
+#endif
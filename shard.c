@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "shard.h"
+#include "encode.h"
+#include "steg.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "common.h"
+#include "types.h"
+
+/* Shared by the workers of one --shard or --join run */
+typedef struct _ShardJobs
+{
+    pthread_mutex_t lock;
+    int next;                    // Next job to hand out
+    int count;
+    EncodeInfo *encInfo;         // Shard mode, one per shard
+    struct _ShardImage *images;  // Join mode, one per image
+    int fd_output;
+    Status *status;
+} ShardJobs;
+
+/* A shard stego image, mapped read-only */
+typedef struct _ShardImage
+{
+    const char *fname;
+    int fd;
+    const uchar *map;
+    size_t size;
+    ShardHeader shard;
+    unsigned long long length;   // Secret bytes in this shard
+    uint flags;                  // STEG_* flags of its stego header
+} ShardImage;
+
+/* Function Definitions */
+
+/* Current monotonic time in milliseconds */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Worker count from a -j value, one per online core by default */
+static int default_workers(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cores < 1) ? 1 : cores;
+}
+
+// Validate the command-line arguments for shard mode: --shard secret_file output_prefix carrier.bmp... [-k depth] [--crc] [-j workers] [-q]
+Status read_and_validate_shard_args(char *argv[], ShardOptions *opts)
+{
+    char *fname[2] = { NULL, NULL };
+    int count = 0;
+
+    opts->depth = 1;
+    opts->checksum = 0;
+    opts->workers = default_workers();
+    opts->quiet = 0;
+
+    // Carriers are collected in place over argv, the options are dropped
+    opts->carriers = argv + 2;
+    opts->carrier_count = 0;
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-k") == 0)
+        {
+            int value = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (value < 1 || value > LSB_MAX_DEPTH)
+            {
+                printf("Error: invalid value for -k\n");
+                return e_failure;
+            }
+            opts->depth = value;
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            opts->workers = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (opts->workers < 1)
+            {
+                printf("Error: -j needs a worker count of at least 1\n");
+                return e_failure;
+            }
+        }
+        else if (strcmp(argv[i], "--crc") == 0)
+        {
+            opts->checksum = 1;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            opts->quiet = 1;
+        }
+        else if (count < 2)
+        {
+            fname[count++] = argv[i];
+        }
+        else
+        {
+            opts->carriers[opts->carrier_count++] = argv[i];
+        }
+    }
+
+    if (fname[0] == NULL || fname[1] == NULL)
+    {
+        printf("Error: shard mode needs a secret file and an output prefix\n");
+        return e_failure;
+    }
+    if (opts->carrier_count == 0 || opts->carrier_count > MAX_SHARDS)
+    {
+        printf("Error: shard mode needs 1 to %d carrier images\n", MAX_SHARDS);
+        return e_failure;
+    }
+    for (int i = 0; i < opts->carrier_count; i++)
+    {
+        if (strstr(opts->carriers[i], ".bmp") == NULL)
+        {
+            printf("Error: carrier image %s must be .bmp file\n", opts->carriers[i]);
+            return e_failure;
+        }
+    }
+    opts->secret_fname = fname[0];
+    opts->output_prefix = fname[1];
+    return e_success;
+}
+
+// Validate the command-line arguments for join mode: --join output_file stego.bmp... [-j workers] [-q]
+Status read_and_validate_join_args(char *argv[], JoinOptions *opts)
+{
+    opts->output_fname = NULL;
+    opts->workers = default_workers();
+    opts->quiet = 0;
+
+    // Images are collected in place over argv, the options are dropped
+    opts->images = argv + 2;
+    opts->image_count = 0;
+    for (int i = 2; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            opts->workers = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (opts->workers < 1)
+            {
+                printf("Error: -j needs a worker count of at least 1\n");
+                return e_failure;
+            }
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            opts->quiet = 1;
+        }
+        else if (opts->output_fname == NULL)
+        {
+            opts->output_fname = argv[i];
+        }
+        else
+        {
+            opts->images[opts->image_count++] = argv[i];
+        }
+    }
+
+    if (opts->output_fname == NULL || opts->image_count == 0)
+    {
+        printf("Error: join mode needs an output file and the shard images\n");
+        return e_failure;
+    }
+    if (opts->image_count > MAX_SHARDS)
+    {
+        printf("Error: join mode takes at most %d shard images\n", MAX_SHARDS);
+        return e_failure;
+    }
+    return e_success;
+}
+
+static void put_le(uchar *p, unsigned long long value, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static unsigned long long get_le(const uchar *p, int size)
+{
+    unsigned long long value = 0;
+    for (int i = size - 1; i >= 0; i--)
+    {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static void pack_shard_header(const ShardHeader *shard, uchar *p)
+{
+    put_le(p, shard->set_id, 8);
+    put_le(p + 8, shard->index, 4);
+    put_le(p + 12, shard->count, 4);
+    put_le(p + 16, shard->offset, 8);
+    put_le(p + 24, shard->total, 8);
+    put_le(p + 32, 0, 4);
+}
+
+/* Secret bytes a carrier takes as a shard, 0 if it cannot hold one */
+static Status shard_capacity(const char *fname, uint depth, uint flags, unsigned long long *capacity)
+{
+    FILE *fptr = fopen(fname, "rb");
+    BmpLayout layout;
+    StegHeader header;
+
+    if (fptr == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", fname);
+        return e_failure;
+    }
+    Status ret = get_image_layout_for_bmp(fptr, &layout);
+    fclose(fptr);
+    if (ret == e_failure)
+    {
+        printf("ERROR : %s is not an uncompressed 24 or 32 bpp BMP\n", fname);
+        return e_failure;
+    }
+
+    // Channels left after the stego header, at depth bits each, less the shard header
+    header.depth = depth;
+    header.flags = steg_layout_flags(&layout) | STEG_MODE_SHARD | flags;
+    strcpy(header.extension, SHARD_EXTN);
+    header.payload_size = 0;
+    unsigned long long head = steg_encoded_size(&header);
+    unsigned long long payload = (layout.channels > head) ? (layout.channels - head) * depth / 8 : 0;
+
+    // The size field is a 32 bit int
+    if (payload > INT_MAX)
+    {
+        payload = INT_MAX;
+    }
+    *capacity = (payload > SHARD_HEADER_SIZE) ? payload - SHARD_HEADER_SIZE : 0;
+    return e_success;
+}
+
+/* Random set id, so shards of different runs never mix */
+static unsigned long long new_set_id(void)
+{
+    unsigned long long id;
+
+    if (getrandom(&id, sizeof(id), 0) != sizeof(id))
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        id = ((unsigned long long)ts.tv_sec << 32) ^ ts.tv_nsec ^ ((unsigned long long)getpid() << 16);
+    }
+    return id;
+}
+
+/* Take the next job, -1 once all are handed out */
+static int next_job(ShardJobs *jobs)
+{
+    pthread_mutex_lock(&jobs->lock);
+    int job = (jobs->next < jobs->count) ? jobs->next++ : -1;
+    pthread_mutex_unlock(&jobs->lock);
+    return job;
+}
+
+/* Encode shards until none are left */
+static void *shard_worker(void *arg)
+{
+    ShardJobs *jobs = arg;
+
+    for (int job = next_job(jobs); job != -1; job = next_job(jobs))
+    {
+        jobs->status[job] = do_encoding(&jobs->encInfo[job]);
+    }
+    return NULL;
+}
+
+/* Run worker over at most workers threads for jobs->count jobs, the number started */
+static int run_workers(ShardJobs *jobs, int workers, void *(*worker)(void *))
+{
+    pthread_t *threads;
+    int started = 0;
+
+    if (workers > jobs->count)
+    {
+        workers = jobs->count;
+    }
+    threads = malloc(workers * sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        return 0;
+    }
+    pthread_mutex_init(&jobs->lock, NULL);
+    jobs->next = 0;
+    for (; started < workers; started++)
+    {
+        if (pthread_create(&threads[started], NULL, worker, jobs) != 0)
+        {
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&jobs->lock);
+    free(threads);
+    return started;
+}
+
+/*
+ * Split the secret over the carriers in the order given
+ * Every carrier is filled before the next one is taken, so the set is as
+ * small as the carriers allow; carriers left over are not written.
+ */
+Status do_shard(const ShardOptions *opts)
+{
+    struct stat st;
+    ShardJobs jobs;
+    int count = 0;
+    Status ret = e_success;
+
+    if (stat(opts->secret_fname, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        perror("stat");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", opts->secret_fname);
+        return e_failure;
+    }
+    unsigned long long total = st.st_size;
+
+    // Step 1: Slice the secret by the capacity of each carrier
+    memset(&jobs, 0, sizeof(jobs));
+    jobs.encInfo = calloc(opts->carrier_count, sizeof(EncodeInfo));
+    jobs.status = calloc(opts->carrier_count, sizeof(Status));
+    uchar (*headers)[SHARD_HEADER_SIZE] = calloc(opts->carrier_count, SHARD_HEADER_SIZE);
+    char (*names)[PATH_MAX] = calloc(opts->carrier_count, PATH_MAX);
+    if (jobs.encInfo == NULL || jobs.status == NULL || headers == NULL || names == NULL)
+    {
+        ret = e_failure;
+    }
+    unsigned long long offset = 0;
+    for (int i = 0; i < opts->carrier_count && ret == e_success && (offset < total || count == 0); i++)
+    {
+        unsigned long long capacity;
+
+        ret = shard_capacity(opts->carriers[i], opts->depth, opts->checksum ? STEG_EXT_CRC32C : 0, &capacity);
+        if (ret == e_success && capacity > 0)
+        {
+            EncodeInfo *encInfo = &jobs.encInfo[count];
+            encInfo->src_image_fname = opts->carriers[i];
+            encInfo->secret_fname = opts->secret_fname;
+            encInfo->stego_image_fname = names[count];
+            encInfo->depth = opts->depth;
+            encInfo->checksum = opts->checksum;
+            encInfo->threads = 1;
+            encInfo->quiet = 1;
+            encInfo->stats.mode = e_stats_off;
+            encInfo->secret_start = offset;
+            encInfo->secret_length = (total - offset < capacity) ? total - offset : capacity;
+            encInfo->payload_prefix = headers[count];
+            encInfo->prefix_size = SHARD_HEADER_SIZE;
+            snprintf(names[count], PATH_MAX, "%s_%d.bmp", opts->output_prefix, count);
+            offset += encInfo->secret_length;
+            count++;
+        }
+    }
+    if (ret == e_success && (offset < total || count == 0))
+    {
+        printf("ERROR : The carriers hold %llu of the %llu secret bytes at depth %u\n", offset, total, opts->depth);
+        ret = e_failure;
+    }
+
+    // Step 2: Every shard header names the whole set
+    if (ret == e_success)
+    {
+        ShardHeader shard;
+        shard.set_id = new_set_id();
+        shard.count = count;
+        shard.total = total;
+        for (int i = 0; i < count; i++)
+        {
+            shard.index = i;
+            shard.offset = jobs.encInfo[i].secret_start;
+            pack_shard_header(&shard, headers[i]);
+        }
+
+        // Step 3: One carrier per worker
+        jobs.count = count;
+        double start = now_ms();
+        int started = run_workers(&jobs, opts->workers, shard_worker);
+        double elapsed = now_ms() - start;
+
+        ret = (started > 0) ? e_success : e_failure;
+        for (int i = 0; i < count; i++)
+        {
+            if (started == 0 || jobs.status[i] == e_failure)
+            {
+                printf("ERROR : Shard %d (%s) failed\n", i, jobs.encInfo[i].src_image_fname);
+                ret = e_failure;
+            }
+            else if (!opts->quiet)
+            {
+                printf("Shard %d: %s bytes %ld-%ld -> %s\n", i, jobs.encInfo[i].src_image_fname, jobs.encInfo[i].secret_start,
+                       jobs.encInfo[i].secret_start + jobs.encInfo[i].secret_length, names[i]);
+            }
+        }
+        if (!opts->quiet)
+        {
+            printf("Sharded %llu bytes into %d images (set %016llx), %d workers, %.3f s, %.1f MB/s\n", total, count,
+                   shard.set_id, started, elapsed / 1e3, (elapsed > 0) ? total / (elapsed * 1e3) : 0.0);
+        }
+    }
+
+    free(jobs.encInfo);
+    free(jobs.status);
+    free(headers);
+    free(names);
+    return ret;
+}
+
+static void close_shard(ShardImage *image)
+{
+    if (image->map != NULL)
+    {
+        munmap((void *)image->map, image->size);
+    }
+    if (image->fd != -1)
+    {
+        close(image->fd);
+    }
+}
+
+/* Map a shard image and read its stego and shard headers */
+static Status open_shard(const char *fname, ShardImage *image)
+{
+    uchar head[SHARD_HEADER_SIZE];
+    StegHeader header;
+    struct stat st;
+
+    image->fname = fname;
+    image->map = NULL;
+    image->fd = open(fname, O_RDONLY);
+    if (image->fd == -1 || fstat(image->fd, &st) == -1)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR : Unable to open file %s\n", fname);
+        return e_failure;
+    }
+    if (st.st_size < BMP_HEADER_SIZE)
+    {
+        printf("ERROR : %s is not a valid image\n", fname);
+        return e_failure;
+    }
+
+    // Only the pages of the headers are touched until the shard is written out
+    image->size = st.st_size;
+    image->map = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, image->fd, 0);
+    if (image->map == MAP_FAILED)
+    {
+        image->map = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+
+    if (steg_read_header(image->map, image->size, &header) == e_failure || !(header.flags & STEG_MODE_SHARD) ||
+        header.payload_size < SHARD_HEADER_SIZE ||
+        steg_decode_range(image->map, image->size, 0, head, SHARD_HEADER_SIZE, &header) == e_failure ||
+        get_le(head + 32, 4) != 0)
+    {
+        printf("ERROR : %s does not hold a shard\n", fname);
+        return e_failure;
+    }
+    image->shard.set_id = get_le(head, 8);
+    image->shard.index = get_le(head + 8, 4);
+    image->shard.count = get_le(head + 12, 4);
+    image->shard.offset = get_le(head + 16, 8);
+    image->shard.total = get_le(head + 24, 8);
+    image->length = header.payload_size - SHARD_HEADER_SIZE;
+    image->flags = header.flags;
+    if (image->shard.count == 0 || image->shard.count > MAX_SHARDS || image->shard.index >= image->shard.count ||
+        image->shard.offset > image->shard.total || image->length > image->shard.total - image->shard.offset)
+    {
+        printf("ERROR : Corrupt shard header in %s\n", fname);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * Check the images form one complete set
+ * Every index appears once, and in index order the slices follow each other
+ * from 0 to the total size with no gap or overlap.
+ */
+static Status check_set(ShardImage *images, int count)
+{
+    const ShardHeader *first = &images[0].shard;
+    ShardImage **slot = calloc(first->count, sizeof(ShardImage *));
+    Status ret = (slot != NULL) ? e_success : e_failure;
+
+    for (int i = 0; i < count && ret == e_success; i++)
+    {
+        const ShardHeader *shard = &images[i].shard;
+
+        if (shard->set_id != first->set_id || shard->count != first->count || shard->total != first->total)
+        {
+            printf("ERROR : %s belongs to another set than %s\n", images[i].fname, images[0].fname);
+            ret = e_failure;
+        }
+        else if (slot[shard->index] != NULL)
+        {
+            printf("ERROR : Shard %u is given twice (%s and %s)\n", shard->index, slot[shard->index]->fname, images[i].fname);
+            ret = e_failure;
+        }
+        else
+        {
+            slot[shard->index] = &images[i];
+        }
+    }
+
+    unsigned long long offset = 0;
+    for (uint i = 0; i < first->count && ret == e_success; i++)
+    {
+        if (slot[i] == NULL)
+        {
+            printf("ERROR : Shard %u of %u is missing\n", i, first->count);
+            ret = e_failure;
+        }
+        else if (slot[i]->shard.offset != offset)
+        {
+            printf("ERROR : Shard %u starts at byte %llu, expected %llu\n", i, slot[i]->shard.offset, offset);
+            ret = e_failure;
+        }
+        else
+        {
+            offset += slot[i]->length;
+        }
+    }
+    if (ret == e_success && offset != first->total)
+    {
+        printf("ERROR : The shards cover %llu of %llu bytes\n", offset, first->total);
+        ret = e_failure;
+    }
+
+    free(slot);
+    return ret;
+}
+
+/* Write shards out until none are left, each slice straight to its offset */
+static void *join_worker(void *arg)
+{
+    ShardJobs *jobs = arg;
+    uchar *chunk = malloc(SHARD_CHUNK_SIZE);
+
+    for (int job = next_job(jobs); job != -1; job = next_job(jobs))
+    {
+        const ShardImage *image = &jobs->images[job];
+        StegHeader header;
+        Status ret = (chunk != NULL) ? e_success : e_failure;
+        uint crc = 0;
+
+        // The whole payload goes through here, so a CRC covers it: the shard header first
+        if (image->flags & STEG_EXT_CRC32C)
+        {
+            uchar head[SHARD_HEADER_SIZE];
+            pack_shard_header(&image->shard, head);
+            crc = crc32c_update(crc, head, SHARD_HEADER_SIZE);
+        }
+        for (unsigned long long done = 0; done < image->length && ret == e_success; )
+        {
+            size_t count = (image->length - done < SHARD_CHUNK_SIZE) ? image->length - done : SHARD_CHUNK_SIZE;
+
+            ret = steg_decode_range(image->map, image->size, SHARD_HEADER_SIZE + done, chunk, count, &header);
+            if (ret == e_success && (image->flags & STEG_EXT_CRC32C))
+            {
+                crc = crc32c_update(crc, chunk, count);
+            }
+            for (size_t written = 0; ret == e_success && written < count; )
+            {
+                ssize_t n = pwrite(jobs->fd_output, chunk + written, count - written, image->shard.offset + done + written);
+                if (n <= 0)
+                {
+                    perror("pwrite");
+                    ret = e_failure;
+                }
+                else
+                {
+                    written += n;
+                }
+            }
+            done += count;
+        }
+        if (ret == e_success && (image->flags & STEG_EXT_CRC32C))
+        {
+            uint checksum;
+            if (steg_read_checksum(image->map, image->size, &checksum) == e_failure || checksum != crc)
+            {
+                printf("ERROR : Payload checksum mismatch, %s is corrupted or truncated\n", image->fname);
+                ret = e_failure;
+            }
+        }
+        jobs->status[job] = ret;
+    }
+    free(chunk);
+    return NULL;
+}
+
+Status do_join(const JoinOptions *opts)
+{
+    ShardJobs jobs;
+    int opened = 0;
+    Status ret = e_success;
+
+    // Step 1: Map every image and read its shard header
+    memset(&jobs, 0, sizeof(jobs));
+    jobs.fd_output = -1;
+    jobs.images = calloc(opts->image_count, sizeof(ShardImage));
+    jobs.status = calloc(opts->image_count, sizeof(Status));
+    if (jobs.images == NULL || jobs.status == NULL)
+    {
+        ret = e_failure;
+    }
+    for (; opened < opts->image_count && ret == e_success; opened++)
+    {
+        ret = open_shard(opts->images[opened], &jobs.images[opened]);
+    }
+
+    // Step 2: The set has to be complete before the output is touched
+    if (ret == e_success)
+    {
+        ret = check_set(jobs.images, opts->image_count);
+    }
+
+    // Step 3: Size the output once, then every worker writes its slices in place
+    if (ret == e_success)
+    {
+        unsigned long long total = jobs.images[0].shard.total;
+
+        jobs.fd_output = open(opts->output_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (jobs.fd_output == -1 || ftruncate(jobs.fd_output, total) == -1)
+        {
+            perror("open");
+            fprintf(stderr, "ERROR : Unable to open file %s\n", opts->output_fname);
+            ret = e_failure;
+        }
+        else
+        {
+            jobs.count = opts->image_count;
+            double start = now_ms();
+            int started = run_workers(&jobs, opts->workers, join_worker);
+            double elapsed = now_ms() - start;
+
+            ret = (started > 0) ? e_success : e_failure;
+            for (int i = 0; i < jobs.count; i++)
+            {
+                if (started == 0 || jobs.status[i] == e_failure)
+                {
+                    printf("ERROR : Extracting shard %u from %s failed\n", jobs.images[i].shard.index, jobs.images[i].fname);
+                    ret = e_failure;
+                }
+            }
+            if (ret == e_success && !opts->quiet)
+            {
+                printf("Joined %d shards (%llu bytes, set %016llx) into %s, %d workers, %.3f s, %.1f MB/s\n", jobs.count,
+                       total, jobs.images[0].shard.set_id, opts->output_fname, started, elapsed / 1e3,
+                       (elapsed > 0) ? total / (elapsed * 1e3) : 0.0);
+            }
+        }
+    }
+
+    // A failed join leaves no partial output behind
+    if (jobs.fd_output != -1)
+    {
+        close(jobs.fd_output);
+        if (ret == e_failure)
+        {
+            unlink(opts->output_fname);
+        }
+    }
+    for (int i = 0; i < opened; i++)
+    {
+        close_shard(&jobs.images[i]);
+    }
+    free(jobs.images);
+    free(jobs.status);
+    return ret;
+}
@@ -0,0 +1,80 @@
+#ifndef SHARD_H
+#define SHARD_H
+#include "types.h" // Contains user defined types
+
+/*
+ * Sharded secrets
+ * A secret too large for one carrier is split over a set of carriers, one
+ * shard per carrier, each encoded on its own worker thread. The payload of a
+ * shard (STEG_MODE_SHARD in the mode byte) starts with a shard header, all
+ * numbers little endian:
+ *     set id        64 bits, random, the same in every shard of a set
+ *     shard index   32 bits, 0 to shard count - 1
+ *     shard count   32 bits
+ *     offset        64 bits, where the shard's bytes go in the secret
+ *     total size    64 bits, size of the whole secret
+ *     reserved      32 bits, 0
+ * followed by the shard's slice of the secret; its length is the rest of the
+ * payload. The header is a multiple of every depth's group size, so the slice
+ * starts on a whole group and its channel bytes are exact.
+ *
+ * Joining takes the shards in any order, checks that they come from one set
+ * and cover the secret exactly once, then pwrites each shard's slice straight
+ * to its offset in the output file, one shard per worker. Shards written
+ * with --crc are checked against their CRC32C on the way.
+ */
+
+#define SHARD_HEADER_SIZE 36
+
+/* Extension recorded in the stego header of a shard */
+#define SHARD_EXTN ".shd"
+
+/* Carriers per set, joins refuse headers with a larger shard count */
+#define MAX_SHARDS 4096
+
+/* Payload bytes extracted and written at a time when joining */
+#define SHARD_CHUNK_SIZE (1024 * 1024)
+
+typedef struct _ShardHeader
+{
+    unsigned long long set_id;
+    uint index;
+    uint count;
+    unsigned long long offset;
+    unsigned long long total;
+} ShardHeader;
+
+typedef struct _ShardOptions
+{
+    char *secret_fname;
+    char *output_prefix;     // Shard i goes to <output_prefix>_<i>.bmp
+    char **carriers;
+    int carrier_count;
+    uint depth;
+    int checksum;            // --crc: every shard carries a CRC32C of its payload
+    int workers;
+    int quiet;
+} ShardOptions;
+
+typedef struct _JoinOptions
+{
+    char *output_fname;
+    char **images;
+    int image_count;
+    int workers;
+    int quiet;
+} JoinOptions;
+
+/* Read and validate shard args: --shard secret_file output_prefix carrier.bmp... [-k depth] [--crc] [-j workers] [-q] */
+Status read_and_validate_shard_args(char *argv[], ShardOptions *opts);
+
+/* Split the secret over as many carriers as it needs and encode the shards in parallel */
+Status do_shard(const ShardOptions *opts);
+
+/* Read and validate join args: --join output_file stego.bmp... [-j workers] [-q] */
+Status read_and_validate_join_args(char *argv[], JoinOptions *opts);
+
+/* Check the set is complete and write every shard to its place in the output file */
+Status do_join(const JoinOptions *opts);
+
+#endif
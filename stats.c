@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include "stats.h"
+#include "types.h"
+
+/* Function Definitions */
+
+void stats_start(StegStats *stats)
+{
+    stats->count = 0;
+    stats->pipe.engine = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &stats->mark);
+}
+
+void stats_stage(StegStats *stats, const char *name, unsigned long long bytes)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (stats->count < MAX_STATS_STAGES)
+    {
+        StageStat *stage = &stats->stage[stats->count++];
+        stage->name = name;
+        stage->ms = (now.tv_sec - stats->mark.tv_sec) * 1e3 + (now.tv_nsec - stats->mark.tv_nsec) / 1e6;
+        stage->bytes = bytes;
+    }
+    stats->mark = now;
+}
+
+double stats_total_ms(const StegStats *stats)
+{
+    double total = 0;
+
+    for (uint i = 0; i < stats->count; i++)
+    {
+        total += stats->stage[i].ms;
+    }
+    return total;
+}
+
+double stats_overlap(const PipeStat *pipe)
+{
+    double sum = pipe->read_ms + pipe->compute_ms + pipe->write_ms;
+    double longest = pipe->read_ms;
+
+    longest = (pipe->compute_ms > longest) ? pipe->compute_ms : longest;
+    longest = (pipe->write_ms > longest) ? pipe->write_ms : longest;
+    if (sum - longest <= 0)
+    {
+        return 0;
+    }
+    double overlap = (sum - pipe->wall_ms) / (sum - longest);
+    return (overlap < 0) ? 0 : (overlap > 1) ? 1 : overlap;
+}
+
+void stats_write_json(FILE *fptr, const StegStats *stats, const char *operation, Status status)
+{
+    // One line, so job logs can be grepped and parsed line by line
+    fprintf(fptr, "{\"operation\": \"%s\", \"status\": \"%s\", \"total_ms\": %.3f, \"stages\": [",
+            operation, (status == e_success) ? "ok" : "failed", stats_total_ms(stats));
+    for (uint i = 0; i < stats->count; i++)
+    {
+        fprintf(fptr, "%s{\"stage\": \"%s\", \"ms\": %.3f, \"bytes\": %llu}", i ? ", " : "",
+                stats->stage[i].name, stats->stage[i].ms, stats->stage[i].bytes);
+    }
+    fprintf(fptr, "]");
+    if (stats->pipe.engine != NULL)
+    {
+        fprintf(fptr, ", \"pipeline\": {\"engine\": \"%s\", \"read_ms\": %.3f, \"compute_ms\": %.3f, \"write_ms\": %.3f, "
+                "\"wall_ms\": %.3f, \"overlap\": %.3f}", stats->pipe.engine, stats->pipe.read_ms, stats->pipe.compute_ms,
+                stats->pipe.write_ms, stats->pipe.wall_ms, stats_overlap(&stats->pipe));
+    }
+    fprintf(fptr, "}\n");
+}
+
+void stats_report(const StegStats *stats, const char *operation, Status status)
+{
+    const char *result = (status == e_success) ? "ok" : "failed";
+
+    if (stats->mode == e_stats_json)
+    {
+        stats_write_json(stdout, stats, operation, status);
+    }
+    else if (stats->mode == e_stats_text)
+    {
+        printf("%-10s %10s %12s %10s\n", "stage", "ms", "bytes", "MB/s");
+        for (uint i = 0; i < stats->count; i++)
+        {
+            const StageStat *stage = &stats->stage[i];
+            if (stage->bytes > 0 && stage->ms > 0)
+            {
+                printf("%-10s %10.3f %12llu %10.1f\n", stage->name, stage->ms, stage->bytes, stage->bytes / stage->ms / 1e3);
+            }
+            else
+            {
+                printf("%-10s %10.3f %12llu %10s\n", stage->name, stage->ms, stage->bytes, "-");
+            }
+        }
+        printf("%-10s %10.3f  (%s %s)\n", "total", stats_total_ms(stats), operation, result);
+        if (stats->pipe.engine != NULL)
+        {
+            printf("%-10s %10.3f  (%s: read %.3f, compute %.3f, write %.3f ms, overlap %.2f)\n", "pipeline", stats->pipe.wall_ms,
+                   stats->pipe.engine, stats->pipe.read_ms, stats->pipe.compute_ms, stats->pipe.write_ms, stats_overlap(&stats->pipe));
+        }
+    }
+}
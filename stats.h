@@ -0,0 +1,76 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdio.h>
+#include <time.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Per-stage telemetry for do_encoding() and do_decoding()
+ * Every stage is timed on the monotonic clock from the end of the previous
+ * one and counts the bytes it processed. Collecting is always on (one
+ * clock_gettime() per stage); the mode only decides whether the breakdown is
+ * printed at the end of the job, as a table or as one line of JSON.
+ */
+
+#define MAX_STATS_STAGES 12
+
+typedef enum
+{
+    e_stats_off,
+    e_stats_text,
+    e_stats_json
+} StatsMode;
+
+typedef struct _StageStat
+{
+    const char *name;
+    double ms;
+    unsigned long long bytes;
+} StageStat;
+
+/*
+ * How the payload stage overlapped its I/O when it ran on a pipeline
+ * (pipeline.h): time with a read in flight, in the embed or extract loop,
+ * with a write in flight, and the wall time of the whole stage
+ */
+typedef struct _PipeStat
+{
+    const char *engine;    // "io_uring" or "threads", NULL when the stage ran serially
+    double read_ms;
+    double compute_ms;
+    double write_ms;
+    double wall_ms;
+} PipeStat;
+
+typedef struct _StegStats
+{
+    StatsMode mode;
+    uint count;
+    StageStat stage[MAX_STATS_STAGES];
+    struct timespec mark;
+    PipeStat pipe;
+} StegStats;
+
+/* Start timing the first stage, keeps the mode */
+void stats_start(StegStats *stats);
+
+/* Close the current stage: time since the previous one plus the bytes it processed */
+void stats_stage(StegStats *stats, const char *name, unsigned long long bytes);
+
+/*
+ * Overlap ratio of a pipelined stage: 0 when read, compute and write took
+ * turns (wall = their sum), 1 when all of it hid behind the longest of the
+ * three (wall = that one)
+ */
+double stats_overlap(const PipeStat *pipe);
+
+/* Sum of all recorded stages */
+double stats_total_ms(const StegStats *stats);
+
+/* Write the breakdown as one line of JSON to fptr */
+void stats_write_json(FILE *fptr, const StegStats *stats, const char *operation, Status status);
+
+/* Print the breakdown in the chosen mode (nothing when off) */
+void stats_report(const StegStats *stats, const char *operation, Status status);
+
+#endif
@@ -0,0 +1,549 @@
+#include <stdint.h>
+#include <string.h>
+#include "steg.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "scatter.h"
+#include "common.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/* Start a cursor over size image bytes, 1 bit deep until a mode byte says otherwise */
+void steg_cursor_init(StegCursor *cursor, uchar *image, size_t size)
+{
+    cursor->image = image;
+    cursor->size = size;
+    cursor->pos = 0;
+    cursor->depth = 1;
+    cursor->flags = 0;
+}
+
+/* Take the next count image bytes, NULL if fewer are left */
+uchar *steg_take(StegCursor *cursor, size_t count)
+{
+    // Sizes decoded from an image are untrusted, so never go past the end
+    if (count > cursor->size - cursor->pos)
+    {
+        return NULL;
+    }
+
+    uchar *image_buffer = cursor->image + cursor->pos;
+    cursor->pos += count;
+    return image_buffer;
+}
+
+/* Embed the magic string, always 1 bit deep so it can be found before the depth is known */
+Status steg_put_magic(StegCursor *cursor)
+{
+    uint length = strlen(MAGIC_STRING);
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(1, length));
+
+    if (image_buffer == NULL)
+    {
+        return e_failure;
+    }
+    lsb_embed_depth(1, (const uchar *)MAGIC_STRING, length, image_buffer);
+    return e_success;
+}
+
+/* Check for the magic string */
+Status steg_check_magic(StegCursor *cursor)
+{
+    char magic[sizeof(MAGIC_STRING)];
+    uint length = strlen(MAGIC_STRING);
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(1, length));
+
+    if (image_buffer == NULL)
+    {
+        return e_failure;
+    }
+    lsb_extract_depth(1, image_buffer, length, (uchar *)magic);
+    return (memcmp(magic, MAGIC_STRING, length) == 0) ? e_success : e_failure;
+}
+
+/* Bytes of the mode field for these flags: the mode byte, plus the extension byte if any */
+uint steg_mode_size(uint flags)
+{
+    return (flags & STEG_EXT_FLAGS_MASK) ? 2 : 1;
+}
+
+/* Embed the mode byte (and extension byte) 1 bit deep, then switch the cursor to the chosen depth */
+Status steg_put_mode(StegCursor *cursor, uint depth, uint flags)
+{
+    uint size = steg_mode_size(flags);
+    uchar mode[2] = { (depth & STEG_MODE_DEPTH_MASK) | (flags & STEG_MODE_FLAGS_MASK) | ((size > 1) ? STEG_MODE_EXTENDED : 0),
+                      (flags & STEG_EXT_FLAGS_MASK) >> 8 };
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(1, size));
+
+    if (image_buffer == NULL || depth < 1 || depth > LSB_MAX_DEPTH || (flags & ~(STEG_MODE_FLAGS_MASK | STEG_EXT_FLAGS_MASK)) != 0)
+    {
+        return e_failure;
+    }
+    lsb_embed_depth(1, mode, size, image_buffer);
+    cursor->depth = depth;
+    cursor->flags = flags;
+    return e_success;
+}
+
+/*
+ * Read the mode byte and switch the cursor to its depth
+ * Images without a mode byte use 1 bit throughout and this byte was the high
+ * byte of the extension size, so the cursor steps back over it.
+ */
+Status steg_get_mode(StegCursor *cursor)
+{
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(1, 1));
+    uchar mode;
+
+    if (image_buffer == NULL)
+    {
+        return e_failure;
+    }
+    lsb_extract_depth(1, image_buffer, 1, &mode);
+
+    if (mode == STEG_MODE_LEGACY)
+    {
+        cursor->depth = 1;
+        cursor->flags = 0;
+        cursor->pos -= lsb_image_bytes(1, 1);
+        return e_success;
+    }
+
+    // Reserved bits set or a depth this decoder does not know
+    uint depth = mode & STEG_MODE_DEPTH_MASK;
+    if ((mode & ~(STEG_MODE_DEPTH_MASK | STEG_MODE_FLAGS_MASK | STEG_MODE_EXTENDED)) != 0 || depth < 1 || depth > LSB_MAX_DEPTH)
+    {
+        return e_failure;
+    }
+    uint flags = mode & STEG_MODE_FLAGS_MASK;
+
+    // The extension byte has to set at least one bit this decoder knows, and no other
+    if (mode & STEG_MODE_EXTENDED)
+    {
+        uchar extension;
+        image_buffer = steg_take(cursor, lsb_image_bytes(1, 1));
+        if (image_buffer == NULL)
+        {
+            return e_failure;
+        }
+        lsb_extract_depth(1, image_buffer, 1, &extension);
+        if (extension == 0 || ((uint)extension << 8 & ~STEG_EXT_FLAGS_MASK) != 0)
+        {
+            return e_failure;
+        }
+        flags |= (uint)extension << 8;
+
+        // The tile order comes from the cipher, a scatter without it cannot be read
+        if ((flags & STEG_EXT_SCATTER) && !(flags & STEG_EXT_CHACHA20))
+        {
+            return e_failure;
+        }
+    }
+    cursor->depth = depth;
+    cursor->flags = flags;
+    return e_success;
+}
+
+/* Embed / extract a 32 bit size field at the cursor depth */
+Status steg_put_size(StegCursor *cursor, uint size)
+{
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(cursor->depth, 4));
+
+    if (image_buffer == NULL)
+    {
+        return e_failure;
+    }
+    lsb_embed_size(size, cursor->depth, image_buffer);
+    return e_success;
+}
+
+Status steg_get_size(StegCursor *cursor, uint *size)
+{
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(cursor->depth, 4));
+
+    if (image_buffer == NULL)
+    {
+        return e_failure;
+    }
+    *size = lsb_extract_size(image_buffer, cursor->depth);
+    return e_success;
+}
+
+/* Embed / extract count data bytes at the cursor depth */
+Status steg_put_data(StegCursor *cursor, const uchar *data, size_t count)
+{
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(cursor->depth, count));
+
+    if (image_buffer == NULL)
+    {
+        return e_failure;
+    }
+    lsb_embed_depth(cursor->depth, data, count, image_buffer);
+    return e_success;
+}
+
+Status steg_get_data(StegCursor *cursor, uchar *data, size_t count)
+{
+    uchar *image_buffer = steg_take(cursor, lsb_image_bytes(cursor->depth, count));
+
+    if (image_buffer == NULL)
+    {
+        return e_failure;
+    }
+    lsb_extract_depth(cursor->depth, image_buffer, count, data);
+    return e_success;
+}
+
+/* Embed the whole header: magic, mode, extension size, extension, nonce, payload size */
+Status steg_put_header(StegCursor *cursor, const StegHeader *header)
+{
+    uint extension_size = strlen(header->extension);
+
+    if (steg_put_magic(cursor) == e_failure ||
+        steg_put_mode(cursor, header->depth, header->flags) == e_failure ||
+        steg_put_size(cursor, extension_size) == e_failure ||
+        steg_put_data(cursor, (const uchar *)header->extension, extension_size) == e_failure ||
+        ((header->flags & STEG_EXT_CHACHA20) && steg_put_data(cursor, header->nonce, STEG_NONCE_SIZE) == e_failure) ||
+        steg_put_size(cursor, header->payload_size) == e_failure)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Extract the header fields, without checking the payload size */
+static Status get_header_fields(StegCursor *cursor, StegHeader *header)
+{
+    uint extension_size;
+
+    if (steg_check_magic(cursor) == e_failure ||
+        steg_get_mode(cursor) == e_failure ||
+        steg_get_size(cursor, &extension_size) == e_failure ||
+        extension_size > MAX_STEG_EXTN ||
+        steg_get_data(cursor, (uchar *)header->extension, extension_size) == e_failure ||
+        ((cursor->flags & STEG_EXT_CHACHA20) && steg_get_data(cursor, header->nonce, STEG_NONCE_SIZE) == e_failure) ||
+        steg_get_size(cursor, &header->payload_size) == e_failure)
+    {
+        return e_failure;
+    }
+    header->extension[extension_size] = '\0';
+    header->depth = cursor->depth;
+    header->flags = cursor->flags;
+    return e_success;
+}
+
+/* Extract the whole header, checking every field against what the image can hold */
+Status steg_get_header(StegCursor *cursor, StegHeader *header)
+{
+    if (get_header_fields(cursor, header) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // A payload the rest of the image cannot hold means this is not a valid stego image
+    if (steg_payload_channels(cursor->depth, cursor->flags, header->payload_size) > cursor->size - cursor->pos)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Channel bytes from the first payload byte to the end of the payload fields (payload and checksum) */
+unsigned long long steg_payload_channels(uint depth, uint flags, unsigned long long payload_size)
+{
+    unsigned long long channels = lsb_image_bytes(depth, payload_size) + ((flags & STEG_EXT_CRC32C) ? lsb_image_bytes(depth, 4) : 0);
+
+    // A scattered payload owns every tile it touches
+    if (flags & STEG_EXT_SCATTER)
+    {
+        channels = scatter_channels(channels);
+    }
+    return channels;
+}
+
+/* Channel bytes needed for header plus payload */
+unsigned long long steg_encoded_size(const StegHeader *header)
+{
+    uint depth = header->depth;
+
+    return lsb_image_bytes(1, strlen(MAGIC_STRING) + steg_mode_size(header->flags)) +
+           lsb_image_bytes(depth, 4) + lsb_image_bytes(depth, strlen(header->extension)) +
+           ((header->flags & STEG_EXT_CHACHA20) ? lsb_image_bytes(depth, STEG_NONCE_SIZE) : 0) + lsb_image_bytes(depth, 4) + steg_payload_channels(depth, header->flags, header->payload_size);
+}
+
+/*
+ * Header channels of the first size bytes of an image of file_size bytes
+ * The cursor only runs over channel bytes inside those size bytes, the
+ * layout covers the whole file.
+ */
+static Status open_image(const uchar *image, size_t size, unsigned long long file_size,
+                         BmpLayout *layout, StegCursor *cursor, uchar *head)
+{
+    // Step 1: The scanline layout, only taken when its own mode byte says so
+    if (bmp_parse_layout(image, size, file_size, layout) == e_success)
+    {
+        unsigned long long count = bmp_channels_before(layout, size);
+        StegCursor probe;
+
+        if (bmp_is_contiguous(layout))
+        {
+            steg_cursor_init(cursor, (uchar *)image + layout->pixel_offset, count);
+        }
+        else
+        {
+            count = (count < STEG_HEAD_MAX) ? count : STEG_HEAD_MAX;
+            bmp_gather(layout, image, 0, 0, count, head);
+            steg_cursor_init(cursor, head, count);
+        }
+        probe = *cursor;
+        if (steg_check_magic(&probe) == e_success && steg_get_mode(&probe) == e_success &&
+            (probe.flags & STEG_MODE_SCANLINE))
+        {
+            return e_success;
+        }
+    }
+
+    // Step 2: Every byte after the 54 byte header
+    if (size < BMP_HEADER_SIZE)
+    {
+        return e_failure;
+    }
+    bmp_flat_layout(layout, file_size);
+    steg_cursor_init(cursor, (uchar *)image + BMP_HEADER_SIZE,
+                     (layout->channels < size - BMP_HEADER_SIZE) ? layout->channels : size - BMP_HEADER_SIZE);
+    return e_success;
+}
+
+Status steg_open_image(const uchar *image, size_t size, BmpLayout *layout, StegCursor *cursor, uchar *head)
+{
+    return open_image(image, size, size, layout, cursor, head);
+}
+
+uint steg_layout_flags(const BmpLayout *layout)
+{
+    // Plain 24 bpp images with unpadded rows right after the 54 byte header look the same both ways
+    return (layout->pixel_offset == BMP_HEADER_SIZE && bmp_is_contiguous(layout)) ? 0 : STEG_MODE_SCANLINE;
+}
+
+/* Channel bytes of payload moved through the stack at a time for layouts that need gathering, a multiple of every depth */
+#define STEG_WINDOW 480
+
+/*
+ * Embed payload into carrier, writing the result to stego
+ * stego must hold carrier_size bytes; it may be the carrier itself to embed in place.
+ */
+Status steg_encode_buffer(const uchar *carrier, size_t carrier_size,
+                          const uchar *payload, size_t payload_size, const char *extension, uint depth,
+                          uchar *stego, size_t stego_capacity)
+{
+    StegHeader header;
+    StegCursor cursor;
+    BmpLayout layout;
+    uchar window[8 * STEG_WINDOW];
+
+    // Step 1: Validate the spans, the carrier and the header fields
+    if (stego_capacity < carrier_size || payload_size > INT32_MAX || strlen(extension) > MAX_STEG_EXTN ||
+        depth < 1 || depth > LSB_MAX_DEPTH || bmp_parse_layout(carrier, carrier_size, carrier_size, &layout) == e_failure)
+    {
+        return e_failure;
+    }
+    header.depth = depth;
+    header.flags = steg_layout_flags(&layout);
+    strcpy(header.extension, extension);
+    header.payload_size = payload_size;
+
+    // Step 2: Check capacity before touching the output
+    if (steg_encoded_size(&header) > layout.channels)
+    {
+        return e_failure;
+    }
+
+    // Step 3: Copy the carrier, then embed header and payload into the channel bytes
+    if (stego != carrier)
+    {
+        memcpy(stego, carrier, carrier_size);
+    }
+    if (bmp_is_contiguous(&layout))
+    {
+        steg_cursor_init(&cursor, stego + layout.pixel_offset, layout.channels);
+        if (steg_put_header(&cursor, &header) == e_failure)
+        {
+            return e_failure;
+        }
+        return steg_put_data(&cursor, payload, payload_size);
+    }
+
+    // Padded rows or 32 bpp: gather a window of channels, embed, scatter it back
+    size_t head = steg_encoded_size(&header) - lsb_image_bytes(depth, payload_size);
+    bmp_gather(&layout, stego, 0, 0, head, window);
+    steg_cursor_init(&cursor, window, head);
+    if (steg_put_header(&cursor, &header) == e_failure)
+    {
+        return e_failure;
+    }
+    bmp_scatter(&layout, window, 0, head, stego, 0);
+
+    for (size_t i = 0; i < payload_size; i += STEG_WINDOW)
+    {
+        size_t count = (payload_size - i < STEG_WINDOW) ? payload_size - i : STEG_WINDOW;
+        unsigned long long first = head + lsb_image_bytes(depth, i);
+        size_t length = lsb_image_bytes(depth, count);
+
+        bmp_gather(&layout, stego, 0, first, length, window);
+        lsb_embed_depth(depth, payload + i, count, window);
+        bmp_scatter(&layout, window, first, length, stego, 0);
+    }
+    return e_success;
+}
+
+/* Find and check the header, leaving the cursor at the first payload channel */
+static Status locate_payload(const uchar *stego, size_t stego_size, unsigned long long file_size,
+                             BmpLayout *layout, StegCursor *cursor, StegHeader *header)
+{
+    uchar head[STEG_HEAD_MAX];
+
+    if (open_image(stego, stego_size, file_size, layout, cursor, head) == e_failure ||
+        get_header_fields(cursor, header) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // A payload the rest of the image cannot hold means this is not a valid stego image
+    if (steg_payload_channels(cursor->depth, cursor->flags, header->payload_size) > layout->channels - cursor->pos)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* The CRC32C field right after the payload of a located header */
+static uint get_checksum(const uchar *stego, const BmpLayout *layout, const StegCursor *cursor, const StegHeader *header)
+{
+    uchar window[8 * 4];
+    uint length = lsb_image_bytes(cursor->depth, 4);
+
+    return lsb_extract_size(bmp_view(layout, stego, cursor->pos + lsb_image_bytes(cursor->depth, header->payload_size), length, window),
+                            cursor->depth);
+}
+
+/* Read only the header of a stego image */
+Status steg_read_header(const uchar *stego, size_t stego_size, StegHeader *header)
+{
+    StegCursor cursor;
+    BmpLayout layout;
+
+    return locate_payload(stego, stego_size, stego_size, &layout, &cursor, header);
+}
+
+/* Read the header from the first size bytes of an image of file_size bytes */
+Status steg_probe(const uchar *image, size_t size, unsigned long long file_size, StegHeader *header, BmpLayout *layout)
+{
+    StegCursor cursor;
+
+    return locate_payload(image, size, file_size, layout, &cursor, header);
+}
+
+/*
+ * Extract the payload into a caller buffer
+ * header is always filled in when the image carries a payload, so a caller
+ * can retry with a buffer of header->payload_size bytes if it was too small.
+ */
+Status steg_decode_buffer(const uchar *stego, size_t stego_size,
+                          uchar *payload, size_t payload_capacity, StegHeader *header)
+{
+    StegCursor cursor;
+    BmpLayout layout;
+    uchar window[8 * STEG_WINDOW];
+
+    if (locate_payload(stego, stego_size, stego_size, &layout, &cursor, header) == e_failure || header->payload_size > payload_capacity ||
+        (header->flags & STEG_EXT_SCATTER))
+    {
+        return e_failure;
+    }
+
+    // The cursor counts channel bytes whichever buffer it ran over
+    uint crc = 0;
+    for (size_t i = 0; i < header->payload_size; i += STEG_WINDOW)
+    {
+        size_t count = (header->payload_size - i < STEG_WINDOW) ? header->payload_size - i : STEG_WINDOW;
+        size_t length = lsb_image_bytes(cursor.depth, count);
+
+        lsb_extract_depth(cursor.depth, bmp_view(&layout, stego, cursor.pos + lsb_image_bytes(cursor.depth, i), length, window),
+                          count, payload + i);
+        if (header->flags & STEG_EXT_CRC32C)
+        {
+            crc = crc32c_update(crc, payload + i, count);
+        }
+    }
+    if ((header->flags & STEG_EXT_CRC32C) && crc != get_checksum(stego, &layout, &cursor, header))
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * Extract count payload bytes from payload byte offset on
+ * Every depth bytes of payload fill 8 channel bytes, so a run starting on a
+ * group boundary has a fixed channel offset; a start inside a group takes the
+ * whole group and drops the bytes in front.
+ */
+Status steg_decode_range(const uchar *stego, size_t stego_size, size_t offset,
+                         uchar *data, size_t count, StegHeader *header)
+{
+    StegCursor cursor;
+    BmpLayout layout;
+    uchar window[8 * STEG_WINDOW];
+    uchar group[LSB_MAX_DEPTH];
+
+    if (locate_payload(stego, stego_size, stego_size, &layout, &cursor, header) == e_failure ||
+        offset > header->payload_size || count > header->payload_size - offset || (header->flags & STEG_EXT_SCATTER))
+    {
+        return e_failure;
+    }
+
+    // Step 1: Rest of the group the range starts in
+    uint skip = offset % cursor.depth;
+    if (skip > 0 && count > 0)
+    {
+        size_t first = offset - skip;
+        size_t take = (cursor.depth - skip < count) ? cursor.depth - skip : count;
+        size_t group_size = (header->payload_size - first < cursor.depth) ? header->payload_size - first : cursor.depth;
+
+        lsb_extract_depth(cursor.depth, bmp_view(&layout, stego, cursor.pos + lsb_image_bytes(cursor.depth, first),
+                                                 lsb_image_bytes(cursor.depth, group_size), window),
+                          group_size, group);
+        memcpy(data, group + skip, take);
+        data += take;
+        offset += take;
+        count -= take;
+    }
+
+    // Step 2: Whole groups from here on
+    for (size_t i = 0; i < count; i += STEG_WINDOW)
+    {
+        size_t n = (count - i < STEG_WINDOW) ? count - i : STEG_WINDOW;
+
+        lsb_extract_depth(cursor.depth, bmp_view(&layout, stego, cursor.pos + lsb_image_bytes(cursor.depth, offset + i),
+                                                 lsb_image_bytes(cursor.depth, n), window),
+                          n, data + i);
+    }
+    return e_success;
+}
+
+/* Read the CRC32C recorded after the payload */
+Status steg_read_checksum(const uchar *stego, size_t stego_size, uint *checksum)
+{
+    StegHeader header;
+    StegCursor cursor;
+    BmpLayout layout;
+
+    if (locate_payload(stego, stego_size, stego_size, &layout, &cursor, &header) == e_failure ||
+        !(header.flags & STEG_EXT_CRC32C) || (header.flags & STEG_EXT_SCATTER))
+    {
+        return e_failure;
+    }
+    *checksum = get_checksum(stego, &layout, &cursor, &header);
+    return e_success;
+}
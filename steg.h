@@ -0,0 +1,147 @@
+#ifndef STEG_H
+#define STEG_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "bmp.h"
+
+/*
+ * libsteg: the stego format on plain memory
+ * Nothing in here touches files or allocates; every call works on caller
+ * owned spans. lsb.c, steg.c, bmp.c and crc32c.c build on their own (lz.c adds
+ * the LZ codec, whose stream expander is the one exception: lz_stream_init()
+ * allocates its two LZ_BLOCK_SIZE buffers and lz_stream_finish() frees them),
+ * encode.c/decode.c use them for the file based CLI paths.
+ *
+ * Layout in the channel bytes of the image (see common.h for the mode byte
+ * and bmp.h for which bytes those are):
+ *     magic string      1 bit deep
+ *     mode byte         1 bit deep
+ *     extension byte    1 bit deep, only with STEG_MODE_EXTENDED
+ *     extension size    32 bits at depth
+ *     extension         at depth
+ *     nonce             96 bits at depth, only with STEG_EXT_CHACHA20
+ *     payload size      32 bits at depth
+ *     payload           at depth
+ *     payload CRC32C    32 bits at depth, only with STEG_EXT_CRC32C
+ * With STEG_EXT_SCATTER the payload and CRC channels are spread over keyed
+ * tiles (scatter.h) and take whole tiles; the header stays in front.
+ */
+
+/* Longest secret file extension, including the dot */
+#define MAX_STEG_EXTN 15
+
+/* ChaCha20 nonce stored with an encrypted payload */
+#define STEG_NONCE_SIZE 12
+
+/* Channel bytes the header can take: magic, mode and extension byte, two sizes, the longest extension and the nonce, all at depth 1 */
+#define STEG_HEAD_MAX ((4 + 4 + MAX_STEG_EXTN + STEG_NONCE_SIZE + 4) * 8)
+
+/* Metadata stored in front of the payload */
+typedef struct _StegHeader
+{
+    uint depth;
+    uint flags;    // STEG_MODE_* flag bits of the mode byte, STEG_EXT_* ones of the extension byte
+    char extension[MAX_STEG_EXTN + 1];
+    uchar nonce[STEG_NONCE_SIZE];    // With STEG_EXT_CHACHA20
+    uint payload_size;
+} StegHeader;
+
+/*
+ * Position inside a run of image bytes
+ * Decoding goes through the same cursor over read-only memory and never
+ * writes through image.
+ */
+typedef struct _StegCursor
+{
+    uchar *image;
+    size_t size;
+    size_t pos;
+    uint depth;
+    uint flags;
+} StegCursor;
+
+/* Start a cursor over size image bytes, 1 bit deep until a mode byte says otherwise */
+void steg_cursor_init(StegCursor *cursor, uchar *image, size_t size);
+
+/* Take the next count image bytes, NULL if fewer are left */
+uchar *steg_take(StegCursor *cursor, size_t count);
+
+/* Field codecs, each consumes exactly the image bytes of its field */
+Status steg_put_magic(StegCursor *cursor);
+Status steg_check_magic(StegCursor *cursor);
+Status steg_put_mode(StegCursor *cursor, uint depth, uint flags);
+Status steg_get_mode(StegCursor *cursor);
+Status steg_put_size(StegCursor *cursor, uint size);
+Status steg_get_size(StegCursor *cursor, uint *size);
+Status steg_put_data(StegCursor *cursor, const uchar *data, size_t count);
+Status steg_get_data(StegCursor *cursor, uchar *data, size_t count);
+
+/* Whole header: magic, mode, extension size, extension, nonce, payload size */
+Status steg_put_header(StegCursor *cursor, const StegHeader *header);
+Status steg_get_header(StegCursor *cursor, StegHeader *header);
+
+/* Bytes of the mode field for these flags: the mode byte, plus the extension byte if any */
+uint steg_mode_size(uint flags);
+
+/* Channel bytes needed for header plus payload */
+unsigned long long steg_encoded_size(const StegHeader *header);
+
+/* Channel bytes from the first payload byte to the end of the payload fields (payload and checksum), whole tiles when scattered */
+unsigned long long steg_payload_channels(uint depth, uint flags, unsigned long long payload_size);
+
+/*
+ * Find the stego header of a whole image in memory
+ * Picks the scanline layout when its mode byte asks for it and the flat one
+ * otherwise, and leaves cursor at channel byte 0 of that layout. When the
+ * layout is not contiguous the header channels are gathered into head
+ * (STEG_HEAD_MAX bytes) and the cursor runs over those.
+ */
+Status steg_open_image(const uchar *image, size_t size, BmpLayout *layout, StegCursor *cursor, uchar *head);
+
+/* Mode flags an encoder sets for a carrier with this layout */
+uint steg_layout_flags(const BmpLayout *layout);
+
+/* Embed payload into carrier, writing the result to stego (may equal carrier) */
+Status steg_encode_buffer(const uchar *carrier, size_t carrier_size,
+                          const uchar *payload, size_t payload_size, const char *extension, uint depth,
+                          uchar *stego, size_t stego_capacity);
+
+/* Read only the header of a stego image */
+Status steg_read_header(const uchar *stego, size_t stego_size, StegHeader *header);
+
+/*
+ * Read the header from just the start of an image
+ * image holds the first size bytes of a file_size byte image; they have to
+ * reach past the header channels (STEG_HEAD_MAX channel bytes from the pixel
+ * data is always enough). layout gets the layout the payload was found in.
+ */
+Status steg_probe(const uchar *image, size_t size, unsigned long long file_size, StegHeader *header, BmpLayout *layout);
+
+/*
+ * Extract the payload into a caller buffer of payload_capacity bytes
+ * The payload comes back as stored: with STEG_MODE_LZ in header->flags it is
+ * an LZ stream of header->payload_size bytes, expand it with lz.h. With
+ * STEG_EXT_CRC32C the payload is checked as it comes out and a mismatch fails.
+ * With STEG_EXT_CHACHA20 it is still encrypted (the CRC covers the encrypted
+ * bytes, so it is checked without the key); chacha20_xor() from offset 0
+ * with header->nonce and the key decrypts it. A scattered payload can only
+ * be found with the key and fails here, as in the two calls below.
+ */
+Status steg_decode_buffer(const uchar *stego, size_t stego_size,
+                          uchar *payload, size_t payload_capacity, StegHeader *header);
+
+/*
+ * Extract only payload bytes [offset, offset + count) into data
+ * The bytes sit at a fixed place after the header, so nothing in front of
+ * them is read. Fails if the range runs past the payload; like
+ * steg_decode_buffer() it works on the stored bytes, an encrypted range
+ * decrypts with chacha20_xor() from offset. A range is not checked
+ * against the CRC, steg_read_checksum() gives it to callers that read it all.
+ */
+Status steg_decode_range(const uchar *stego, size_t stego_size, size_t offset,
+                         uchar *data, size_t count, StegHeader *header);
+
+/* Read the CRC32C recorded after the payload, fails without STEG_EXT_CRC32C */
+Status steg_read_checksum(const uchar *stego, size_t stego_size, uint *checksum);
+
+#endif
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "stream.h"
+#include "encode.h"
+#include "decode.h"
+#include "steg.h"
+#include "lsb.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "chacha20.h"
+#include "common.h"
+#include "types.h"
+
+/* A stego image read front to back: block holds file bytes [start, start + len) */
+typedef struct _StreamReader
+{
+    int fd;
+    uchar *block;
+    size_t len;
+    unsigned long long start;
+    unsigned long long total;    // Bytes read so far
+} StreamReader;
+
+/* Where the extracted secret goes */
+typedef struct _StreamSink
+{
+    int fd;
+    unsigned long long written;
+} StreamSink;
+
+/* Function Definitions */
+
+// Validate the command-line arguments for streaming mode
+Status read_and_validate_stream_args(char *argv[], StreamOptions *opts)
+{
+    // Step 0: stdout is kept for the data on a descriptor of its own, every message from here on goes to stderr
+    fflush(stdout);
+    opts->fd_out = dup(STDOUT_FILENO);
+    if (opts->fd_out == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+    {
+        perror("dup");
+        return e_failure;
+    }
+
+    // Defaults for the options
+    opts->depth = 1;
+    opts->checksum = 0;
+    opts->key_fname = NULL;
+    opts->secret_fd = STREAM_SECRET_FD;
+    opts->quiet = 0;
+    opts->stats_mode = e_stats_off;
+
+    // Step 1: The direction
+    if (argv[2] == NULL || (strcmp(argv[2], "-e") != 0 && strcmp(argv[2], "-d") != 0))
+    {
+        printf("Error: --stream needs -e or -d\n");
+        return e_failure;
+    }
+    opts->decode = (strcmp(argv[2], "-d") == 0);
+
+    // Step 2: The options, there are no file names
+    for (int i = 3; argv[i] != NULL; i++)
+    {
+        if (strcmp(argv[i], "-k") == 0 && !opts->decode)
+        {
+            int depth = (argv[i + 1] != NULL) ? atoi(argv[++i]) : 0;
+            if (depth < 1 || depth > LSB_MAX_DEPTH)
+            {
+                printf("Error: -k needs an embedding depth from 1 to %d\n", LSB_MAX_DEPTH);
+                return e_failure;
+            }
+            opts->depth = depth;
+        }
+        else if (strcmp(argv[i], "--crc") == 0 && !opts->decode)
+        {
+            opts->checksum = 1;
+        }
+        else if (strcmp(argv[i], "--secret-fd") == 0 && !opts->decode)
+        {
+            // stdin and stdout carry the images, stderr the messages
+            int fd = (argv[i + 1] != NULL) ? atoi(argv[++i]) : -1;
+            if (fd <= STDERR_FILENO)
+            {
+                printf("Error: --secret-fd needs a descriptor from 3 on\n");
+                return e_failure;
+            }
+            opts->secret_fd = fd;
+        }
+        else if (strcmp(argv[i], "--key") == 0)
+        {
+            if (argv[i + 1] == NULL)
+            {
+                printf("Error: --key needs a key file\n");
+                return e_failure;
+            }
+            opts->key_fname = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            opts->stats_mode = e_stats_text;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            opts->stats_mode = e_stats_json;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            opts->quiet = 1;
+        }
+        else if (strcmp(argv[i], "-z") == 0 || strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--scatter") == 0 ||
+                 strcmp(argv[i], "--in-place") == 0)
+        {
+            printf("Error: %s needs a seekable file, it does not work with --stream\n", argv[i]);
+            return e_failure;
+        }
+        else
+        {
+            printf("Error: unexpected argument %s\n", argv[i]);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Read until the block is full or the stream ends */
+static Status reader_fill(StreamReader *reader)
+{
+    while (reader->len < STREAM_BLOCK_SIZE)
+    {
+        ssize_t count = read(reader->fd, reader->block + reader->len, STREAM_BLOCK_SIZE - reader->len);
+        if (count == 0)
+        {
+            break;
+        }
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("read");
+            return e_failure;
+        }
+        reader->len += count;
+        reader->total += count;
+    }
+    return e_success;
+}
+
+/* Make file bytes [first, end) available in the block, dropping everything in front of first */
+static Status reader_need(StreamReader *reader, unsigned long long first, unsigned long long end)
+{
+    if (end <= reader->start + reader->len)
+    {
+        return e_success;
+    }
+    if (first > reader->start + reader->len || end - first > STREAM_BLOCK_SIZE)
+    {
+        return e_failure;
+    }
+    size_t drop = first - reader->start;
+    memmove(reader->block, reader->block + drop, reader->len - drop);
+    reader->len -= drop;
+    reader->start = first;
+    if (reader_fill(reader) == e_failure)
+    {
+        return e_failure;
+    }
+    return (end <= reader->start + reader->len) ? e_success : e_failure;
+}
+
+/* count channel bytes from channel first, straight out of the block or gathered into scratch */
+static const uchar *reader_view(StreamReader *reader, const BmpLayout *layout, unsigned long long first, size_t count, uchar *scratch)
+{
+    unsigned long long offset = bmp_channel_offset(layout, first);
+
+    if (reader_need(reader, offset, bmp_channel_offset(layout, first + count - 1) + 1) == e_failure)
+    {
+        return NULL;
+    }
+    if (bmp_is_contiguous(layout))
+    {
+        return reader->block + (offset - reader->start);
+    }
+    bmp_gather(layout, reader->block, reader->start, first, count, scratch);
+    return scratch;
+}
+
+/* Read the rest of the stream, so the writer in front of a pipe sees it taken */
+static Status reader_drain(StreamReader *reader)
+{
+    do
+    {
+        reader->start += reader->len;
+        reader->len = 0;
+        if (reader_fill(reader) == e_failure)
+        {
+            return e_failure;
+        }
+    } while (reader->len > 0);
+    return e_success;
+}
+
+/* Write one expanded LZ block, or one chunk of a plain payload, to the output */
+static Status sink_write(void *arg, const uchar *data, size_t count)
+{
+    StreamSink *sink = arg;
+
+    sink->written += count;
+    return write_all(sink->fd, data, count);
+}
+
+/*
+ * Extract the payload of a stego image read from fd_in and write it to fd_out
+ * The header is probed from the first block; after it the payload channels
+ * follow each other in file order, so one pass with a sliding block gets all
+ * of them. Chunks are checked against the CRC, decrypted and expanded the
+ * same way decode_secret_file_data() does it on a mapped image.
+ */
+static Status stream_decode(const StreamOptions *opts, int fd_in, int fd_out, StegStats *stats)
+{
+    StreamReader reader = { fd_in, NULL, 0, 0, 0 };
+    StreamSink sink = { fd_out, 0 };
+    StegHeader header;
+    BmpLayout layout;
+    ChaCha20 cipher;
+    LzStream expander;
+    uchar *secret = malloc(STREAM_CHUNK_SIZE);
+    uchar *channels = malloc(lsb_image_bytes(1, STREAM_CHUNK_SIZE));
+    int expand = 0;
+    Status ret = e_failure;
+
+    // Step 1: The stego header, from the first block
+    memset(&header, 0, sizeof(header));
+    reader.block = malloc(STREAM_BLOCK_SIZE);
+    if (reader.block == NULL || secret == NULL || channels == NULL || reader_fill(&reader) == e_failure)
+    {
+        fprintf(stderr, "ERROR : Unable to read the stego image\n");
+    }
+    else if (reader.len < BMP_MIN_HEADER_SIZE ||
+             steg_probe(reader.block, reader.len, reader.block[2] | (reader.block[3] << 8) | (reader.block[4] << 16) | ((uint)reader.block[5] << 24),
+                        &header, &layout) == e_failure)
+    {
+        printf("ERROR : The stream is not a stego image\n");
+    }
+    else if (header.flags & (STEG_MODE_CONTAINER | STEG_MODE_SHARD | STEG_EXT_SCATTER))
+    {
+        printf("ERROR : Containers, shards and scattered payloads need the image as a file\n");
+    }
+    else if ((header.flags & STEG_EXT_CHACHA20) && opts->key_fname == NULL)
+    {
+        printf("ERROR : The stream holds an encrypted secret, pass its key file with --key\n");
+    }
+    else
+    {
+        ret = e_success;
+    }
+    stats_stage(stats, "magic", reader.len);
+
+    // Step 2: The cipher, with the nonce from the header
+    if (ret == e_success && (header.flags & STEG_EXT_CHACHA20))
+    {
+        uchar key[CHACHA20_KEY_SIZE];
+        if (chacha20_read_key(opts->key_fname, key) == e_failure)
+        {
+            fprintf(stderr, "ERROR : %s is not a %d byte key file\n", opts->key_fname, CHACHA20_KEY_SIZE);
+            ret = e_failure;
+        }
+        else
+        {
+            chacha20_init(&cipher, key, header.nonce);
+            explicit_bzero(key, sizeof(key));
+        }
+    }
+    if (!opts->quiet && ret == e_success)
+    {
+        printf("Decoded stego header successfully (depth %u, %u bytes).\n", header.depth, header.payload_size);
+    }
+
+    // Step 3: The payload, one chunk of channels at a time, a compressed one is expanded block by block
+    if (ret == e_success && (header.flags & STEG_MODE_LZ))
+    {
+        ret = lz_stream_init(&expander, sink_write, &sink);
+        expand = (ret == e_success);
+    }
+    // The payload sits at the end of the encoded fields, only a probed header has a depth to size them with
+    uint depth = header.depth;
+    unsigned long long channel = (ret == e_success) ? steg_encoded_size(&header) - steg_payload_channels(depth, header.flags, header.payload_size) : 0;
+    uint crc = 0;
+    for (size_t done = 0; ret == e_success && done < header.payload_size; done += STREAM_CHUNK_SIZE)
+    {
+        size_t count = (header.payload_size - done < STREAM_CHUNK_SIZE) ? header.payload_size - done : STREAM_CHUNK_SIZE;
+        size_t length = lsb_image_bytes(depth, count);
+        const uchar *image_buffer = reader_view(&reader, &layout, channel, length, channels);
+        if (image_buffer == NULL)
+        {
+            printf("ERROR : The stego image ends inside the payload\n");
+            ret = e_failure;
+            break;
+        }
+        lsb_extract_depth(depth, image_buffer, count, secret);
+        channel += length;
+        if (header.flags & STEG_EXT_CRC32C)
+        {
+            crc = crc32c_update(crc, secret, count);
+        }
+        if (header.flags & STEG_EXT_CHACHA20)
+        {
+            chacha20_xor(&cipher, done, secret, count);
+        }
+        ret = expand ? lz_stream_feed(&expander, secret, count) : sink_write(&sink, secret, count);
+    }
+    if (expand && lz_stream_finish(&expander) == e_failure)
+    {
+        ret = e_failure;
+    }
+    stats_stage(stats, "payload", (ret == e_success) ? header.payload_size : 0);
+
+    // Step 4: The CRC right after the payload
+    if (ret == e_success && (header.flags & STEG_EXT_CRC32C))
+    {
+        const uchar *image_buffer = reader_view(&reader, &layout, channel, lsb_image_bytes(depth, 4), channels);
+        if (image_buffer == NULL || lsb_extract_size(image_buffer, depth) != crc)
+        {
+            printf("Payload checksum mismatch, the stream is corrupted or truncated.\n");
+            ret = e_failure;
+        }
+        else if (!opts->quiet)
+        {
+            printf("Payload checksum verified (CRC32C %08x).\n", crc);
+        }
+    }
+
+    // Step 5: Take the rest of the image off the stream
+    if (ret == e_success)
+    {
+        unsigned long long used = reader.total;
+        ret = reader_drain(&reader);
+        stats_stage(stats, "tail", reader.total - used);
+    }
+    if (!opts->quiet && ret == e_success)
+    {
+        printf("Wrote %llu secret bytes, read %llu image bytes.\n", sink.written, reader.total);
+    }
+
+    explicit_bzero(&cipher, sizeof(cipher));
+    free(reader.block);
+    free(secret);
+    free(channels);
+    return ret;
+}
+
+/* Run one stream encode or decode, the engine's messages go to stderr with the rest */
+Status do_stream(const StreamOptions *opts)
+{
+    Status ret;
+
+    if (!opts->decode)
+    {
+        EncodeInfo encInfo;
+        char secret_label[32];
+
+        // The extension recorded is the label's, decoders expect a text secret
+        snprintf(secret_label, sizeof(secret_label), "fd%d.txt", opts->secret_fd);
+        memset(&encInfo, 0, sizeof(encInfo));
+        encInfo.src_image_fname = "stdin";
+        encInfo.secret_fname = secret_label;
+        encInfo.stego_image_fname = "stdout";
+        encInfo.depth = opts->depth;
+        encInfo.threads = 1;
+        encInfo.checksum = opts->checksum;
+        encInfo.key_fname = opts->key_fname;
+        encInfo.stream = 1;
+        encInfo.stream_src_fd = STDIN_FILENO;
+        encInfo.stream_secret_fd = opts->secret_fd;
+        encInfo.stream_stego_fd = opts->fd_out;
+        encInfo.quiet = opts->quiet;
+        encInfo.stats.mode = opts->stats_mode;
+        return do_encoding(&encInfo);
+    }
+
+    StegStats stats;
+    stats.mode = opts->stats_mode;
+    stats_start(&stats);
+    ret = stream_decode(opts, STDIN_FILENO, opts->fd_out, &stats);
+    if (close(opts->fd_out) == -1)
+    {
+        ret = e_failure;
+    }
+    stats_stage(&stats, "close", 0);
+    stats_report(&stats, "decode", ret);
+    return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include "types.h" // Contains user defined types
+#include "stats.h"
+
+/*
+ * Streaming mode
+ * --stream -e reads the carrier from stdin and writes the stego image to
+ * stdout; the secret comes from another descriptor (--secret-fd, 3 by
+ * default). --stream -d reads a stego image from stdin and writes the secret
+ * to stdout. Every file is read or written front to back exactly once, so
+ * pipes, sockets and terminals work as well as files and no temporary file
+ * is ever made.
+ *
+ * Without seeking the sizes come from the data itself: the pixel array from
+ * the BMP header, the secret from its file size when the descriptor is a
+ * regular file and otherwise from a length prefix line in front of it
+ *     <secret bytes in decimal>\n<secret bytes>
+ * A decode needs the file size from the header (bfSize) for images embedded
+ * without STEG_MODE_SCANLINE, which is what every encoder writes there.
+ *
+ * Progress messages, errors and --stats go to stderr, stdout only carries
+ * the data. The options that need a seekable file (-z, which compresses the
+ * whole secret before its size is known, -t and --scatter, which write or
+ * read out of order, and --in-place) are refused.
+ */
+
+/* Carrier bytes a stream decode holds at a time, enough for a chunk's channels at any depth and layout */
+#define STREAM_BLOCK_SIZE (1024 * 1024)
+
+/* Secret bytes extracted and written per chunk, a multiple of every embedding depth (1-4) */
+#define STREAM_CHUNK_SIZE (60 * 1024)
+
+/* Descriptor the secret of a stream encode is read from by default */
+#define STREAM_SECRET_FD 3
+
+typedef struct _StreamOptions
+{
+    int decode;              // -d: stego image in, secret out; -e: carrier in, stego image out
+    uint depth;
+    int checksum;            // --crc: store a CRC32C of the payload after it
+    char *key_fname;         // --key: encrypt, or decrypt, the payload with this key file
+    int secret_fd;           // --secret-fd
+    int quiet;
+    StatsMode stats_mode;
+    int fd_out;              // Where stdout was, it carries the stego image or the secret
+} StreamOptions;
+
+/* Take stdout over for the data, then read and validate stream args: --stream -e [-k depth] [--crc] [--key key_file] [--secret-fd fd] | --stream -d [--key key_file], plus [--stats|--json] [-q] */
+Status read_and_validate_stream_args(char *argv[], StreamOptions *opts);
+
+/* Run one encode or decode from stdin to stdout */
+Status do_stream(const StreamOptions *opts);
+
+#endif
@@ -16,6 +16,18 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_batch,
+    e_bench,
+    e_inspect,
+    e_scan,
+    e_pack,
+    e_list,
+    e_extract,
+    e_shard,
+    e_join,
+    e_serve,
+    e_client,
+    e_stream,
     e_unsupported
 } OperationType;
 